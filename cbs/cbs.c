@@ -9,6 +9,7 @@
 #include <vnet/vnet.h>
 #include <vnet/plugin/plugin.h>
 #include <vnet/feature/feature.h>
+#include <vnet/interface/tx_queue_funcs.h>
 #include <cbs/cbs.h>
 
 #include <vlibapi/api.h>
@@ -36,11 +37,7 @@ cbs_main_t cbs_main;
 
 // --- Forward declarations for static functions ---
 static clib_error_t * cbs_init (vlib_main_t * vm);
-static int cbs_configure_internal (cbs_main_t * cbsm, f64 port_rate_bps, f64 idleslope_kbps,
-                                   f64 hicredit_bytes, f64 locredit_bytes,
-                                   f64 bandwidth_bps_hint, u32 packet_size);
-static cbs_wheel_t* cbs_wheel_alloc (cbs_main_t *cbsm, u32 thread_index);
-static void cbs_wheel_free(cbs_main_t *cbsm, cbs_wheel_t *wp);
+static void cbs_interface_unbind (cbs_main_t * cbsm, u32 sw_if_index, cbs_drain_mode_t drain);
 
 // CLI and API handlers (declarations needed if used before definition within #ifndef block)
 #ifndef CLIB_MARCH_VARIANT
@@ -48,29 +45,156 @@ static clib_error_t * set_cbs_command_fn (vlib_main_t * vm, unformat_input_t * i
 static clib_error_t * show_cbs_command_fn (vlib_main_t * vm, unformat_input_t * input, vlib_cli_command_t * cmd);
 static clib_error_t * cbs_cross_connect_enable_disable_command_fn (vlib_main_t * vm, unformat_input_t * input, vlib_cli_command_t * cmd);
 static clib_error_t * cbs_output_feature_enable_disable_command_fn (vlib_main_t * vm, unformat_input_t * input, vlib_cli_command_t * cmd);
-static uword unformat_cbs_rate (unformat_input_t * input, va_list * args);
 static uword unformat_cbs_slope (unformat_input_t * input, va_list * args);
-static u8 * format_cbs_rate (u8 *s, va_list *args);
 static u8 * format_cbs_slope (u8 *s, va_list *args);
 static u8 * format_cbs_config (u8 * s, va_list * args);
+static uword unformat_cbs_accounting_mode (unformat_input_t * input, va_list * args);
+static uword unformat_cbs_algo (unformat_input_t * input, va_list * args);
+static u8 * format_cbs_accounting_mode (u8 * s, va_list * args);
 static void vl_api_cbs_cross_connect_enable_disable_t_handler (vl_api_cbs_cross_connect_enable_disable_t * mp);
 static void vl_api_cbs_output_feature_enable_disable_t_handler (vl_api_cbs_output_feature_enable_disable_t * mp);
 static void vl_api_cbs_configure_t_handler (vl_api_cbs_configure_t * mp);
+static void vl_api_cbs_shaper_add_del_t_handler (vl_api_cbs_shaper_add_del_t * mp);
+static void vl_api_cbs_shaper_dump_t_handler (vl_api_cbs_shaper_dump_t * mp);
+static void vl_api_cbs_interface_dump_t_handler (vl_api_cbs_interface_dump_t * mp);
+static void vl_api_want_cbs_events_t_handler (vl_api_want_cbs_events_t * mp);
+static void vl_api_cbs_event_config_t_handler (vl_api_cbs_event_config_t * mp);
+static void vl_api_cbs_stream_add_del_t_handler (vl_api_cbs_stream_add_del_t * mp);
+static void vl_api_cbs_stream_filter_add_del_t_handler (vl_api_cbs_stream_filter_add_del_t * mp);
+static clib_error_t * set_cbs_events_command_fn (vlib_main_t * vm, unformat_input_t * input, vlib_cli_command_t * cmd);
+vlib_node_registration_t cbs_event_process_node;
 #endif // CLIB_MARCH_VARIANT
 
 
+// --- Interface Binding ---
+/**
+ * @brief Bind an interface (or sub-interface) to a shaper.
+ * Resolves the parent hardware port once so the data path needs a single
+ * sw_if_index lookup, and makes sure every thread has a busy timeline slot
+ * for the port. Vectors read by workers only grow under the barrier.
+ * @param can_steer keep a dedicated TX queue (see cbs_interface_set_tx_queue)
+ */
+static void
+cbs_interface_bind (cbs_main_t * cbsm, u32 sw_if_index, u32 shaper_index, u8 can_steer)
+{
+  vlib_main_t *vm = cbsm->vlib_main;
+  vnet_hw_interface_t *hw = vnet_get_sup_hw_interface (cbsm->vnet_main, sw_if_index);
+  cbs_interface_t invalid = { .shaper_index = ~0, .output_next_index = ~0, .hw_if_index = ~0,
+                              .tx_queue_id = CBS_TX_QUEUE_ANY };
+  vlib_node_t *tx_node = vlib_get_node (vm, hw->tx_node_index);
+  cbs_interface_t *intf;
+  cbs_per_thread_t *ptd;
+  u32 added_next;
+
+  added_next = vlib_node_add_next (vm, cbs_input_node.index, hw->output_node_index);
+  vlib_log_debug(cbsm->log_class, "Bind: sw_if %u -> shaper %u, port hw_if %u, next '%U' (%u) -> '%U' (%u), result_next_index %u",
+                 sw_if_index, shaper_index, hw->hw_if_index,
+                 format_vlib_node_name, vm, cbs_input_node.index, cbs_input_node.index,
+                 format_vlib_node_name, vm, hw->output_node_index, hw->output_node_index,
+                 added_next);
+
+  vlib_worker_thread_barrier_sync (vm);
+  vec_validate_init_empty (cbsm->interface_by_sw_if_index, sw_if_index, invalid);
+  intf = vec_elt_at_index (cbsm->interface_by_sw_if_index, sw_if_index);
+  intf->shaper_index = shaper_index;
+  intf->output_next_index = added_next;
+  intf->hw_if_index = hw->hw_if_index;
+  if (!can_steer)
+      intf->tx_queue_id = CBS_TX_QUEUE_ANY;
+  vec_foreach (ptd, cbsm->per_thread) {
+      cbs_tx_port_t *tp;
+
+      vec_validate (ptd->tx_finish_time_by_hw_if_index, hw->hw_if_index); // 0.0 = port idle
+      vec_validate (ptd->tx_port_by_hw_if_index, hw->hw_if_index);
+      tp = vec_elt_at_index (ptd->tx_port_by_hw_if_index, hw->hw_if_index);
+      tp->tx_node_index = hw->tx_node_index;
+      tp->error_heap_index = tx_node->error_heap_index;
+      tp->n_errors = tx_node->n_errors;
+      // Every port may be pending at once; the data path never grows the vector
+      vec_alloc (ptd->tx_ports_pending, vec_len (ptd->tx_port_by_hw_if_index));
+      vec_alloc (ptd->tx_sent, CBS_TX_SENT_MAX);
+  }
+  vlib_worker_thread_barrier_release (vm);
+}
+
+/**
+ * @brief Send an interface's shaped frames to one TX queue of its port
+ * (CBS_TX_QUEUE_ANY to let interface-output choose again), so unshaped
+ * traffic on the other queues cannot block them.
+ * Steered frames skip interface-output-arc-end and go to the TX node, so
+ * only interfaces shaped on the interface-output arc alone qualify: their
+ * frames have been through <if>-output (counters, checksum and GSO
+ * offload) already. Cross-connected and ip4/ip6-output frames have not.
+ */
+int
+cbs_interface_set_tx_queue (cbs_main_t * cbsm, u32 sw_if_index, u32 queue_id)
+{
+  vlib_main_t *vm = cbsm->vlib_main;
+  cbs_interface_t *intf;
+
+  if (sw_if_index >= vec_len (cbsm->interface_by_sw_if_index) ||
+      cbsm->interface_by_sw_if_index[sw_if_index].output_next_index == ~0)
+      return VNET_API_ERROR_INVALID_SW_IF_INDEX; // Not shaped
+  intf = vec_elt_at_index (cbsm->interface_by_sw_if_index, sw_if_index);
+  if (queue_id != CBS_TX_QUEUE_ANY && intf->output_arcs != (1 << CBS_OUTPUT_ARC_INTERFACE))
+      return VNET_API_ERROR_INVALID_INTERFACE;
+  if (queue_id != CBS_TX_QUEUE_ANY &&
+      vnet_hw_if_get_tx_queue_index_by_id (cbsm->vnet_main, intf->hw_if_index, queue_id) == ~0)
+      return VNET_API_ERROR_INVALID_VALUE;
+
+  vlib_worker_thread_barrier_sync (vm);
+  intf->tx_queue_id = queue_id; // Frames already in the wheels keep their queue
+  vlib_worker_thread_barrier_release (vm);
+  return 0;
+}
+
 // --- Enable/Disable Functions ---
+/**
+ * @brief Set the cross-connect ports whose RX queues a lossless
+ * cross-connect pauses (~0 for none). Threads holding a pause resume
+ * first, so no queue is left out of a poll vector by a stale pause.
+ */
+static void
+cbs_cross_connect_set_input (cbs_main_t * cbsm, u32 sw_if_index0, u32 sw_if_index1, u8 is_lossless)
+{
+  vlib_main_t *vm = cbsm->vlib_main;
+  u32 sw_if_index[2] = { sw_if_index0, sw_if_index1 };
+  cbs_per_thread_t *ptd;
+  u32 i;
+
+  vlib_worker_thread_barrier_sync (vm);
+  vec_foreach (ptd, cbsm->per_thread) {
+      cbs_wheel_t **wpp;
+      vec_foreach (wpp, ptd->wheel_by_shaper)
+          if (*wpp && (*wpp)->pausing_input)
+              cbs_wheel_resume_input (vlib_get_main_by_index (ptd - cbsm->per_thread), ptd, *wpp);
+  }
+  for (i = 0; i < 2; i++) {
+      vnet_hw_interface_t *hw;
+      cbsm->xc_input_node_index[i] = cbsm->xc_dev_instance[i] = ~0;
+      if (sw_if_index[i] == ~0)
+          continue;
+      hw = vnet_get_sup_hw_interface (cbsm->vnet_main, sw_if_index[i]);
+      cbsm->xc_input_node_index[i] = hw->input_node_index;
+      cbsm->xc_dev_instance[i] = hw->dev_instance;
+      // Room for every queue of the port, so a pause never grows the vector on a worker
+      vec_foreach (ptd, cbsm->per_thread)
+          vec_alloc (ptd->paused_rxqs[i], vec_len (hw->rx_queue_indices));
+  }
+  cbsm->xc_lossless = is_lossless && sw_if_index0 != ~0;
+  vlib_worker_thread_barrier_release (vm);
+}
+
 int
 cbs_cross_connect_enable_disable (cbs_main_t * cbsm, u32 sw_if_index0,
-				   u32 sw_if_index1, int enable_disable)
+				   u32 sw_if_index1, u32 shaper_index,
+				   int enable_disable, u8 is_lossless,
+				   cbs_drain_mode_t drain)
 {
   vnet_sw_interface_t *sw0, *sw1;
-  vnet_hw_interface_t *hw0, *hw1;
-  vlib_main_t * vm = cbsm->vlib_main;
   vnet_main_t *vnm = cbsm->vnet_main;
   vlib_log_class_t log_class = cbsm->log_class; // Get log class
   int rv = 0;
-  u32 added_next0 = (u32)~0, added_next1 = (u32)~0; // Track added indices
 
   if (PREDICT_FALSE(cbsm->is_configured == 0 && enable_disable))
     return VNET_API_ERROR_FEATURE_DISABLED;
@@ -78,47 +202,21 @@ cbs_cross_connect_enable_disable (cbs_main_t * cbsm, u32 sw_if_index0,
   if (!vnet_sw_if_index_is_api_valid(sw_if_index0)) return VNET_API_ERROR_INVALID_SW_IF_INDEX;
   if (!vnet_sw_if_index_is_api_valid(sw_if_index1)) return VNET_API_ERROR_INVALID_SW_IF_INDEX_2;
 
+  if (enable_disable && !cbs_shaper_get_if_valid (cbsm, shaper_index))
+    return VNET_API_ERROR_NO_SUCH_ENTRY;
+
   sw0 = vnet_get_sw_interface (vnm, sw_if_index0);
   sw1 = vnet_get_sw_interface (vnm, sw_if_index1);
 
-  // Only support hardware interfaces for cross-connect for simplicity now
+  // The device-input arc only runs for hardware interfaces; shape
+  // sub-interface traffic with the output feature instead.
   if (sw0->type != VNET_SW_INTERFACE_TYPE_HARDWARE) return VNET_API_ERROR_INVALID_INTERFACE;
   if (sw1->type != VNET_SW_INTERFACE_TYPE_HARDWARE) return VNET_API_ERROR_INVALID_INTERFACE;
 
-
-  hw0 = vnet_get_hw_interface (vnm, sw_if_index0);
-  hw1 = vnet_get_hw_interface (vnm, sw_if_index1);
-  // Safety check for hw pointers (Keep this basic check)
-  if (PREDICT_FALSE(!hw0 || !hw1)) {
-      vlib_log_err(log_class, "XCONN Enable: Failed to get hw interface struct for sw_if %u or %u", sw_if_index0, sw_if_index1);
-      return VNET_API_ERROR_INVALID_INTERFACE;
-  }
-
-
   if (enable_disable) {
-      u32 target_node_index0 = hw0->output_node_index;
-      u32 target_node_index1 = hw1->output_node_index;
-      added_next0 = vlib_node_add_next (vm, cbs_input_node.index, target_node_index0);
-      added_next1 = vlib_node_add_next (vm, cbs_input_node.index, target_node_index1);
-      cbsm->output_next_index0 = added_next0; // Store result
-      cbsm->output_next_index1 = added_next1; // Store result
-
-      vlib_log_debug(log_class, "Xconn Enable: Trying to add next for sw_if %u: '%U' (%u) -> '%U' (%u), result_next_index %u",
-                     sw_if_index0,
-                     format_vlib_node_name, vm, cbs_input_node.index, cbs_input_node.index,
-                     format_vlib_node_name, vm, target_node_index0, target_node_index0,
-                     added_next0);
-      vlib_log_debug(log_class, "Xconn Enable: Trying to add next for sw_if %u: '%U' (%u) -> '%U' (%u), result_next_index %u",
-                     sw_if_index1,
-                     format_vlib_node_name, vm, cbs_input_node.index, cbs_input_node.index,
-                     format_vlib_node_name, vm, target_node_index1, target_node_index1,
-                     added_next1);
-
-      // --- REMOVED vlib_node_add_next failure check (to match nsim) ---
-  } else {
-      cbsm->output_next_index0 = ~0;
-      cbsm->output_next_index1 = ~0;
-      vlib_log_debug(log_class, "Xconn Disable: Cleared next indices");
+      cbs_cross_connect_set_input (cbsm, sw_if_index0, sw_if_index1, is_lossless);
+      cbs_interface_bind (cbsm, sw_if_index0, shaper_index, 0 /* can_steer */);
+      cbs_interface_bind (cbsm, sw_if_index1, shaper_index, 0 /* can_steer */);
   }
 
   cbsm->sw_if_index0 = enable_disable ? sw_if_index0 : ~0;
@@ -135,311 +233,1276 @@ cbs_cross_connect_enable_disable (cbs_main_t * cbsm, u32 sw_if_index0,
 			                           sw_if_index1, enable_disable, 0, 0);
   // --- REMOVED feature enable failure check/rollback (to match nsim) ---
 
+  // Unbind once the features are off, so nothing new is queued meanwhile
+  if (!enable_disable) {
+      cbs_cross_connect_set_input (cbsm, ~0, ~0, 0);
+      cbs_interface_unbind (cbsm, sw_if_index0, drain);
+      cbs_interface_unbind (cbsm, sw_if_index1, drain);
+      vlib_log_debug(log_class, "Xconn Disable: Cleared next indices");
+  }
+
   return rv; // Return the result of the second call directly
 }
 
+const char *cbs_output_arc_names[CBS_N_OUTPUT_ARC] = {
+  [CBS_OUTPUT_ARC_INTERFACE] = "interface-output",
+  [CBS_OUTPUT_ARC_IP4] = "ip4-output",
+  [CBS_OUTPUT_ARC_IP6] = "ip6-output",
+};
+
+/**
+ * @brief Enable/disable the output feature on a set of arcs (bitmap of
+ * CBS_OUTPUT_ARC_*). Enabling replaces the interface's previous set, so a
+ * frame is never shaped twice; disabling removes every arc and handles the
+ * queued frames as @c drain says.
+ */
 int
 cbs_output_feature_enable_disable (cbs_main_t * cbsm, u32 sw_if_index,
-				    int enable_disable)
+				    u32 shaper_index, u8 arcs, int enable_disable,
+				    cbs_drain_mode_t drain)
 {
   vnet_sw_interface_t *sw;
-  vnet_hw_interface_t *hw;
-  vlib_main_t * vm = cbsm->vlib_main;
   vnet_main_t *vnm = cbsm->vnet_main;
   vlib_log_class_t log_class = cbsm->log_class; // Get log class
+  u8 old_arcs = 0, new_arcs = 0;
+  u32 arc;
   int rv = 0;
-  u32 added_next = (u32)~0; // Initialize added_next
 
   if (PREDICT_FALSE(cbsm->is_configured == 0 && enable_disable))
     return VNET_API_ERROR_FEATURE_DISABLED;
 
   if (!vnet_sw_if_index_is_api_valid(sw_if_index)) return VNET_API_ERROR_INVALID_SW_IF_INDEX;
 
+  if (enable_disable && !cbs_shaper_get_if_valid (cbsm, shaper_index))
+    return VNET_API_ERROR_NO_SUCH_ENTRY;
+
+  // Hardware interfaces and sub-interfaces (dot1q/dot1ad) are supported;
+  // sub-interfaces transmit through, and share the timeline of, their parent port.
   sw = vnet_get_sw_interface (vnm, sw_if_index);
-  // --- MODIFIED: Check for HARDWARE type only, like nsim ---
-  if (sw->type != VNET_SW_INTERFACE_TYPE_HARDWARE)
+  if (sw->type != VNET_SW_INTERFACE_TYPE_HARDWARE && sw->type != VNET_SW_INTERFACE_TYPE_SUB)
       return VNET_API_ERROR_INVALID_INTERFACE;
-  // --- END MODIFICATION ---
 
+  if (enable_disable && (arcs == 0 || arcs >= (1 << CBS_N_OUTPUT_ARC)))
+      return VNET_API_ERROR_INVALID_VALUE;
 
-  // --- MODIFIED: Use vnet_get_hw_interface like nsim ---
-  hw = vnet_get_hw_interface (vnm, sw_if_index);
-  // --- END MODIFICATION ---
-  // Safety check for hw pointer
-  if (PREDICT_FALSE(!hw)) {
-      vlib_log_err(log_class, "Output Enable: Failed to get hardware interface for sw_if %u", sw_if_index);
-      return VNET_API_ERROR_INVALID_INTERFACE;
+  if (sw_if_index < vec_len (cbsm->interface_by_sw_if_index))
+      old_arcs = cbsm->interface_by_sw_if_index[sw_if_index].output_arcs;
+  if (enable_disable) {
+      cbs_interface_bind (cbsm, sw_if_index, shaper_index, arcs == (1 << CBS_OUTPUT_ARC_INTERFACE));
+      new_arcs = arcs;
+  } else {
+      old_arcs |= 1 << CBS_OUTPUT_ARC_INTERFACE; // As before arcs were tracked
   }
 
-  if (enable_disable) {
-      vec_validate_init_empty (cbsm->output_next_index_by_sw_if_index, sw_if_index, ~0);
-      u32 target_node_index = hw->output_node_index;
-      added_next = vlib_node_add_next (vm, cbs_input_node.index, target_node_index);
-      cbsm->output_next_index_by_sw_if_index[sw_if_index] = added_next; // Store result
+  // Enable/Disable the feature on each arc whose state changes
+  for (arc = 0; arc < CBS_N_OUTPUT_ARC; arc++) {
+      if (!((old_arcs ^ new_arcs) & (1 << arc)))
+          continue;
+      rv = vnet_feature_enable_disable (cbs_output_arc_names[arc], "cbs-output-feature",
+                                        sw_if_index, (new_arcs >> arc) & 1, 0, 0);
+      if (rv)
+          break;
+  }
+  if (sw_if_index < vec_len (cbsm->interface_by_sw_if_index))
+      cbsm->interface_by_sw_if_index[sw_if_index].output_arcs = new_arcs;
+  if (!enable_disable) { // Arcs are off: nothing new is queued while unbinding
+      cbs_interface_unbind (cbsm, sw_if_index, drain);
+      vlib_log_debug(log_class, "Output Disable: sw_if %u unbound", sw_if_index);
+  }
+
+  // --- REMOVED feature enable failure check/rollback (to match nsim) ---
 
-      vlib_log_debug(log_class, "Output Enable DBG: Stored next_index %u for sw_if %u in output_next_index_by_sw_if_index",
-                   added_next, sw_if_index);
-      vlib_log_debug(log_class, "Output Enable: Trying to add next for sw_if %u: '%U' (%u) -> '%U' (%u), result_next_index %u",
-                   sw_if_index,
-                   format_vlib_node_name, vm, cbs_input_node.index, cbs_input_node.index,
-                   format_vlib_node_name, vm, target_node_index, target_node_index,
-                   added_next);
+  return rv; // Return result directly
+}
+
+/**
+ * @brief Give cbs-wheel a next for every next of cbs-output-feature, so a
+ * frame queued on the ip4/ip6-output arcs goes on to the feature that
+ * follows cbs-output-feature on its arc. Enabling any feature on any
+ * interface may add nexts: runs on every feature change (main thread).
+ */
+static void
+cbs_output_feature_sync_nexts (cbs_main_t * cbsm)
+{
+  vlib_main_t *vm = cbsm->vlib_main;
+  vlib_node_t *n = vlib_get_node (vm, cbs_output_feature_node.index);
+  u32 i, *wheel_next = 0;
+
+  if (vec_len (n->next_nodes) <= vec_len (cbsm->wheel_next_by_feature_next))
+      return;
+  for (i = vec_len (cbsm->wheel_next_by_feature_next); i < vec_len (n->next_nodes); i++)
+      vec_add1 (wheel_next, n->next_nodes[i] == ~0 ? ~0 :
+                vlib_node_add_next (vm, cbs_input_node.index, n->next_nodes[i]));
+  vlib_worker_thread_barrier_sync (vm);
+  vec_append (cbsm->wheel_next_by_feature_next, wheel_next);
+  vlib_worker_thread_barrier_release (vm);
+  vec_free (wheel_next);
+}
 
-       // --- REMOVED vlib_node_add_next failure check (to match nsim) ---
+static void
+cbs_feature_update (u32 sw_if_index, u8 arc_index, u8 is_enable, void *data)
+{
+  cbs_output_feature_sync_nexts (&cbs_main);
+}
 
+// --- Wheel Allocation/Deallocation ---
+/** @brief Derive a wheel's event thresholds from the global event configuration. */
+static void
+cbs_wheel_set_event_thresholds (cbs_main_t * cbsm, cbs_wheel_t * wp)
+{
+  if (cbsm->event_high_pct == 0) {
+      wp->event_high_slots = ~0; // Never reached: events off
+      wp->event_low_slots = 0;
   } else {
-      // --- MODIFIED: Remove explicit clear of next_index on disable to match nsim ---
-      vlib_log_debug(log_class, "Output Disable: No explicit clear for next index (matching nsim)");
+      wp->event_high_slots = clib_max ((u64) wp->wheel_size * cbsm->event_high_pct / 100, 1);
+      wp->event_low_slots = (u64) wp->wheel_size * cbsm->event_low_pct / 100;
   }
+  wp->event_starvation_time = cbsm->event_starvation_time;
+}
 
-  // Enable/Disable the feature on the interface-output arc
-  rv = vnet_feature_enable_disable ("interface-output", "cbs-output-feature",
-			                           sw_if_index, enable_disable, 0, 0);
+/**
+ * @brief Take a block of at least @c size bytes from a thread's arena.
+ * First fit over released blocks, then the untouched tail; a block is
+ * never split, wheels of one shaper all have the same size anyway.
+ */
+static void *
+cbs_arena_alloc (cbs_arena_t * a, uword size, uword * block_size)
+{
+  cbs_arena_free_t **fp, *f;
+
+  size = round_pow2 (size, CLIB_CACHE_LINE_BYTES);
+  for (fp = &a->free_list; (f = *fp); fp = &f->next)
+    if (f->size >= size) {
+        *fp = f->next;
+        *block_size = f->size;
+        a->n_bytes_in_use += f->size;
+        return f;
+    }
+  if (PREDICT_FALSE(!a->base || a->used + size > a->size))
+      return 0;
+  f = (cbs_arena_free_t *) (a->base + a->used);
+  a->used += size;
+  a->n_bytes_in_use += size;
+  *block_size = size;
+  return f;
+}
 
-  // --- REMOVED feature enable failure check/rollback (to match nsim) ---
+static void
+cbs_arena_free (cbs_arena_t * a, void *p, uword block_size)
+{
+  cbs_arena_free_t *f = p;
 
-  return rv; // Return result directly
+  f->size = block_size;
+  f->next = a->free_list;
+  a->free_list = f;
+  a->n_bytes_in_use -= block_size;
 }
 
-// --- Wheel Allocation/Deallocation ---
 /**
- * @brief Allocate and initialize a CBS wheel for a specific thread.
- * Uses the main thread's time for initial timestamp values.
+ * @brief Reserve a thread's arena. Only address space is taken here;
+ * pages are backed when a wheel first touches them, so threads that never
+ * see shaped traffic cost nothing. Barrier must be held.
  */
-static cbs_wheel_t *
-cbs_wheel_alloc (cbs_main_t *cbsm, u32 thread_index)
+static void
+cbs_arena_reserve (cbs_main_t * cbsm, cbs_per_thread_t * ptd)
 {
+  u32 thread_index = ptd - cbsm->per_thread;
+  void *base;
+
+  if (ptd->arena.base)
+      return;
+  base = clib_mem_vm_map (0, cbsm->arena_size, CLIB_MEM_PAGE_SZ_DEFAULT, "cbs arena %u", thread_index);
+  if (base == CLIB_MEM_VM_MAP_FAILED) {
+      vlib_log_err(cbsm->log_class, "Arena: could not reserve %lu bytes for thread %u",
+                   cbsm->arena_size, thread_index);
+      return;
+  }
+  ptd->arena.base = base;
+  ptd->arena.size = cbsm->arena_size;
+}
+
+/**
+ * @brief Create the calling thread's wheel for a shaper, on its first packet.
+ * Memory comes from the thread's arena, so the enqueue node never takes a
+ * heap lock. The first wheel of a thread turns cbs-wheel polling on for
+ * that thread only.
+ * @return the wheel, or 0 if the shaper is gone or the arena is exhausted
+ */
+cbs_wheel_t *
+cbs_wheel_create (vlib_main_t * vm, cbs_per_thread_t * ptd, u32 shaper_index)
+{
+  cbs_main_t *cbsm = &cbs_main;
+  cbs_shaper_t *shaper = cbs_shaper_get_if_valid (cbsm, shaper_index);
   cbs_wheel_t *wp;
-  uword alloc_size = sizeof (cbs_wheel_t) +
-                     cbsm->wheel_slots_per_wrk * sizeof (cbs_wheel_entry_t);
+  uword block_size;
+
+  if (PREDICT_FALSE(!shaper))
+      return 0;
+  wp = cbs_arena_alloc (&ptd->arena, sizeof (cbs_wheel_t) +
+                        shaper->wheel_slots_per_wrk * sizeof (cbs_wheel_entry_t), &block_size);
+  if (PREDICT_FALSE(!wp))
+      return 0;
+  clib_memset (wp, 0, sizeof (*wp)); // Entries are written before they are read
+
+  wp->wheel_size = shaper->wheel_slots_per_wrk;
+  wp->shaper_index = shaper_index;
+  wp->active_index = ~0; // Not scheduled until a packet is queued
+  wp->block_size = block_size;
+  wp->entries = (cbs_wheel_entry_t *) (wp + 1);
+  wp->empty_since = vlib_time_now (vm);
+  cbs_engine_init (&shaper->eng, &wp->eng, wp->empty_since); // Credits, full TBF/ATS buckets
+  cbs_wheel_set_event_thresholds (cbsm, wp);
+  // Lossless cross-connect: pause with room left for the frames already polled
+  wp->pause_high_slots = wp->wheel_size > 2 * CBS_LOSSLESS_HEADROOM ?
+      wp->wheel_size - CBS_LOSSLESS_HEADROOM : wp->wheel_size / 2;
+  wp->pause_low_slots = wp->pause_high_slots / 2;
+
+  CLIB_MEMORY_STORE_BARRIER (); // The main thread may read the wheel as soon as it is published
+  ptd->wheel_by_shaper[shaper_index] = wp;
+  if (ptd->n_wheels++ == 0)
+      vlib_node_set_state (vm, cbs_input_node.index, VLIB_NODE_STATE_POLLING);
+  return wp;
+}
 
-  wp = (cbs_wheel_t *) clib_mem_alloc_aligned (alloc_size, CLIB_CACHE_LINE_BYTES);
-  if (PREDICT_FALSE(!wp)) return 0;
-  clib_memset (wp, 0, alloc_size);
+/**
+ * @brief Free a wheel's frames sent on @c sw_if_index, or on any interface
+ * of port @c hw_if_index (~0 to match by interface only), in one
+ * compaction pass; the frames kept stay in order. Buffers are freed in
+ * batches and counted as dropped. Called by the owning thread or under
+ * the barrier.
+ * @param all free every frame (wheel release)
+ * @return number of frames freed
+ */
+static u32
+cbs_wheel_purge (vlib_main_t * vm, cbs_per_thread_t * ptd, cbs_wheel_t * wp,
+                 u32 sw_if_index, u32 hw_if_index, int all)
+{
+  cbs_main_t *cbsm = &cbs_main;
+  u32 thread_index = ptd - cbsm->per_thread;
+  u32 to_free[VLIB_FRAME_SIZE];
+  u32 rd = wp->head, wr = wp->head, n_left = wp->cursize;
+  u32 n_free = 0, n_purged = 0, n_kept = 0;
+  u64 n_bytes = 0;
+
+  while (n_left--) {
+      cbs_wheel_entry_t *ep = wp->entries + rd;
+      rd = (rd + 1) % wp->wheel_size;
+      if (ep->buffer_index == ~0)
+          continue; // Already gone, drop the slot
+      if (all || ep->tx_sw_if_index == sw_if_index || ep->hw_if_index == hw_if_index) {
+          to_free[n_free++] = ep->buffer_index;
+          n_bytes += ep->wire_length;
+          n_purged++;
+          if (n_free == VLIB_FRAME_SIZE) {
+              vlib_buffer_free (vm, to_free, n_free);
+              n_free = 0;
+          }
+          continue;
+      }
+      if (wp->entries + wr != ep)
+          wp->entries[wr] = *ep;
+      wr = (wr + 1) % wp->wheel_size;
+      n_kept++;
+  }
+  if (n_free)
+      vlib_buffer_free (vm, to_free, n_free);
+  wp->tail = wr;
+  wp->cursize = n_kept;
+
+  if (n_purged)
+      vlib_increment_combined_counter (&cbsm->counters[CBS_COUNTER_DROPPED], thread_index,
+                                       wp->shaper_index, n_purged, n_bytes);
+  if (wp->pausing_input && n_kept <= wp->pause_low_slots)
+      cbs_wheel_resume_input (vlib_get_main_by_index (thread_index), ptd, wp);
+  if (n_kept == 0 && wp->active_index != ~0) {
+      cbs_shaper_t *shaper = cbs_shaper_get_if_valid (cbsm, wp->shaper_index);
+      if (shaper)
+          cbs_engine_backlog_empty (&shaper->eng, &wp->eng);
+      cbs_active_remove (ptd, wp);
+      wp->empty_since = vlib_time_now (vm);
+  } else if (n_purged && wp->active_index != ~0) {
+      cbs_active_update (ptd, wp, vlib_time_now (vm)); // New head: look again on the next poll
+  }
+  return n_purged;
+}
 
-  wp->wheel_size = cbsm->wheel_slots_per_wrk;
-  wp->cursize = 0;
-  wp->head = 0;
-  wp->tail = 0;
-  wp->entries = (cbs_wheel_entry_t *) (wp + 1);
+/**
+ * @brief Free a wheel's packets and give its memory back to the arena, and
+ * its unsent shared grant back to the segment.
+ * Barrier must be held: the owning thread allocates from the same arena.
+ * A thread left without wheels stops polling.
+ */
+void
+cbs_wheel_release (vlib_main_t * vm, cbs_per_thread_t * ptd, cbs_wheel_t * wp)
+{
+  cbs_main_t *cbsm = &cbs_main;
+  cbs_shaper_t *shaper = cbs_shaper_get_if_valid (cbsm, wp->shaper_index);
+
+  cbs_wheel_purge (vm, ptd, wp, ~0, ~0, 1 /* all */);
+  if (shaper)
+      cbs_wheel_return_shared_grant (shaper, wp);
+  if (wp->active_index != ~0)
+      cbs_active_remove (ptd, wp);
+  ptd->wheel_by_shaper[wp->shaper_index] = 0;
+  cbs_arena_free (&ptd->arena, wp, wp->block_size);
+  if (--ptd->n_wheels == 0)
+      vlib_node_set_state (vlib_get_main_by_index (ptd - cbsm->per_thread), cbs_input_node.index,
+                           VLIB_NODE_STATE_DISABLED);
+}
 
-  wp->cbs_credits = 0.0; // Initialize credits
+/**
+ * @brief Whether frames for @c sw_if_index may be queued: it is shaped, or
+ * it is a port with a shaped sub-interface.
+ */
+static int
+cbs_interface_is_shaped (cbs_main_t * cbsm, u32 sw_if_index)
+{
+  vnet_sw_interface_t *sw = vnet_get_sw_interface_or_null (cbsm->vnet_main, sw_if_index);
+  cbs_interface_t *intf;
+
+  if (!sw)
+      return 0;
+  vec_foreach (intf, cbsm->interface_by_sw_if_index)
+      if (intf->output_next_index != ~0 &&
+          ((intf - cbsm->interface_by_sw_if_index) == sw_if_index ||
+           (sw->type == VNET_SW_INTERFACE_TYPE_HARDWARE && intf->hw_if_index == sw->hw_if_index)))
+          return 1;
+  return 0;
+}
 
-  // --- REVERTED ---
-  // Always use the main thread's time context when called from configure
-  // This is because this function is called from the main thread during configuration.
-  f64 now = vlib_time_now(cbsm->vlib_main);
-  // --- REVERTED END ---
+/**
+ * @brief Free the frames queued for an interface on every thread.
+ * Barrier must be held.
+ * @param match_port for a hardware interface, also free the frames of its
+ *        sub-interfaces (the port went down or away)
+ * @return number of frames freed
+ */
+static u32
+cbs_interface_purge (cbs_main_t * cbsm, u32 sw_if_index, int match_port)
+{
+  vlib_main_t *vm = cbsm->vlib_main;
+  vnet_sw_interface_t *sw = vnet_get_sw_interface_or_null (cbsm->vnet_main, sw_if_index);
+  u32 hw_if_index = ~0, n_purged = 0;
+  cbs_per_thread_t *ptd;
+
+  if (match_port && sw && sw->type == VNET_SW_INTERFACE_TYPE_HARDWARE)
+      hw_if_index = sw->hw_if_index;
+  vec_foreach (ptd, cbsm->per_thread) {
+      cbs_wheel_t **wpp;
+      vec_foreach (wpp, ptd->wheel_by_shaper)
+          if (*wpp && (*wpp)->cursize)
+              n_purged += cbs_wheel_purge (vm, ptd, *wpp, sw_if_index, hw_if_index, 0);
+  }
+  return n_purged;
+}
 
-  wp->cbs_last_update_time = now;
-  wp->cbs_last_tx_finish_time = now;
+/**
+ * @brief Stop shaping an interface. Frames already queued carry their own
+ * next node and port, so with CBS_DRAIN_TRANSMIT they still leave at the
+ * shaped rate; CBS_DRAIN_FLUSH frees them at once.
+ */
+static void
+cbs_interface_unbind (cbs_main_t * cbsm, u32 sw_if_index, cbs_drain_mode_t drain)
+{
+  vlib_main_t *vm = cbsm->vlib_main;
+  cbs_interface_t *intf;
+  u32 n_purged = 0;
 
-  return wp;
+  if (sw_if_index >= vec_len (cbsm->interface_by_sw_if_index))
+      return;
+
+  // Workers read the entry without a lock: never leave it half cleared
+  vlib_worker_thread_barrier_sync (vm);
+  intf = vec_elt_at_index (cbsm->interface_by_sw_if_index, sw_if_index);
+  intf->shaper_index = ~0;
+  intf->output_next_index = ~0;
+  intf->tx_queue_id = CBS_TX_QUEUE_ANY;
+  if (drain == CBS_DRAIN_FLUSH)
+      n_purged = cbs_interface_purge (cbsm, sw_if_index, 0);
+  vlib_worker_thread_barrier_release (vm);
+
+  vlib_log_debug(cbsm->log_class, "Unbind: sw_if %u, drain %U, %u frames freed",
+                 sw_if_index, format_cbs_drain_mode, drain, n_purged);
 }
 
-/** @brief Free memory allocated for a CBS wheel. */
-static void cbs_wheel_free(cbs_main_t *cbsm, cbs_wheel_t *wp)
+// --- Shaping Algorithms (control plane side) ---
+static int
+cbs_algo_cbs_validate (const cbs_config_args_t * a)
 {
-    if (wp) {
-        clib_mem_free(wp);
-    }
+  if (PREDICT_FALSE(a->idleslope_kbps < 0.0)) return VNET_API_ERROR_INVALID_VALUE_2; // Allow 0 idleslope? Standard says > 0.
+  if (PREDICT_FALSE(a->hicredit_bytes < a->locredit_bytes)) return VNET_API_ERROR_INVALID_VALUE_3;
+  return 0;
+}
+
+static void
+cbs_algo_cbs_apply (cbs_shaper_t * shaper, const cbs_config_args_t * a)
+{
+  shaper->eng.idleslope = (a->idleslope_kbps * CBS_KBPS_TO_BPS) / CBS_BITS_PER_BYTE;
+  shaper->eng.sendslope = shaper->eng.idleslope - shaper->eng.port_rate;
+  shaper->eng.hicredit = a->hicredit_bytes;
+  shaper->eng.locredit = a->locredit_bytes;
+}
+
+static u8 *
+format_cbs_algo_cbs_params (u8 * s, va_list * args)
+{
+  cbs_shaper_t *shaper = va_arg (*args, cbs_shaper_t *);
+  s = format (s, "  Idle Slope:      %U\n", format_cbs_slope, shaper->eng.idleslope);
+  // Use format_cbs_rate for sendslope, as it's also a rate in bytes/sec
+  s = format (s, "  Send Slope:      %U/sec (calculated)\n", format_cbs_rate, shaper->eng.sendslope);
+  s = format (s, "  HiCredit:        %.0f bytes\n", shaper->eng.hicredit);
+  s = format (s, "  LoCredit:        %.0f bytes\n", shaper->eng.locredit);
+  return s;
+}
+
+/** @brief Shared by TBF and ATS: both are parameterized by a rate and a burst. */
+static int
+cbs_algo_tb_validate (const cbs_config_args_t * a)
+{
+  if (PREDICT_FALSE(a->rate_bps <= 0.0)) return VNET_API_ERROR_INVALID_VALUE_2;
+  if (PREDICT_FALSE(a->burst_bytes <= 0.0)) return VNET_API_ERROR_INVALID_VALUE_3;
+  return 0;
+}
+
+static void
+cbs_algo_tb_apply (cbs_shaper_t * shaper, const cbs_config_args_t * a)
+{
+  shaper->eng.tb_rate = a->rate_bps / CBS_BITS_PER_BYTE;
+  shaper->eng.tb_burst = a->burst_bytes;
 }
 
-// --- Configuration Function ---
-/** @brief Internal function to apply CBS configuration. */
+static u8 *
+format_cbs_algo_tb_params (u8 * s, va_list * args)
+{
+  cbs_shaper_t *shaper = va_arg (*args, cbs_shaper_t *);
+  s = format (s, "  Rate:            %U\n", format_cbs_rate, shaper->eng.tb_rate);
+  s = format (s, "  Burst:           %.0f bytes\n", shaper->eng.tb_burst);
+  return s;
+}
+
+const cbs_algo_ops_t cbs_algo_ops[CBS_N_ALGO] = {
+  [CBS_ALGO_CBS] = {
+    .name = "cbs",
+    .validate = cbs_algo_cbs_validate,
+    .apply = cbs_algo_cbs_apply,
+    .format_params = format_cbs_algo_cbs_params,
+  },
+  [CBS_ALGO_TBF] = {
+    .name = "tbf",
+    .validate = cbs_algo_tb_validate,
+    .apply = cbs_algo_tb_apply,
+    .format_params = format_cbs_algo_tb_params,
+  },
+  [CBS_ALGO_ATS] = {
+    .name = "ats",
+    .validate = cbs_algo_tb_validate,
+    .apply = cbs_algo_tb_apply,
+    .format_params = format_cbs_algo_tb_params,
+  },
+};
+
+// --- Configuration Functions ---
+/** @brief Whether an interface (output feature or cross-connect) is still bound to the shaper. */
+static int
+cbs_shaper_is_bound (cbs_main_t * cbsm, u32 shaper_index)
+{
+  cbs_interface_t *intf;
+
+  vec_foreach (intf, cbsm->interface_by_sw_if_index)
+      if (intf->output_next_index != ~0 && intf->shaper_index == shaper_index)
+          return 1;
+  return 0;
+}
+
+/**
+ * @brief Validate one shaper configuration and build its state.
+ * Runs outside the barrier and computes the parameters into u->shaper;
+ * wheels are created later, by the threads the shaped traffic arrives on.
+ */
 static int
-cbs_configure_internal (cbs_main_t * cbsm, f64 port_rate_bps,
-			     f64 idleslope_kbps, f64 hicredit_bytes,
-			     f64 locredit_bytes, f64 bandwidth_bps_hint,
-			     u32 packet_size)
+cbs_shaper_prepare (cbs_main_t * cbsm, cbs_shaper_update_t * u)
 {
   u64 wheel_slots_per_wrk;
-  int i;
-  vlib_main_t *vm = cbsm->vlib_main;
   vlib_log_class_t log_class = cbsm->log_class; // Get log class
-  int n_threads = vlib_get_n_threads();
-  f64 port_rate_bytes_sec, idleslope_bytes_sec, sendslope_bytes_sec;
+  const cbs_config_args_t *a = &u->args;
+  cbs_shaper_t *shaper = &u->shaper;
+  u32 packet_size = a->packet_size;
   f64 effective_bandwidth_for_sizing;
+  int rv;
+
+  if (PREDICT_FALSE(u->shaper_index >= CBS_MAX_SHAPERS)) return VNET_API_ERROR_INVALID_VALUE_5;
+  if (!u->is_add) {
+      // Its interfaces would drop all their traffic: unbind them first
+      if (cbs_shaper_is_bound (cbsm, u->shaper_index)) {
+          vlib_log_err(cbsm->log_class, "Shaper %u: still bound to interfaces, not deleted", u->shaper_index);
+          return VNET_API_ERROR_INSTANCE_IN_USE;
+      }
+      return 0;
+  }
+  if (PREDICT_FALSE(a->algo >= CBS_N_ALGO)) {
+      vlib_log_err(cbsm->log_class, "Shaper %u: unknown algorithm %u", u->shaper_index, a->algo);
+      return VNET_API_ERROR_INVALID_ARGUMENT;
+  }
 
-  vlib_log_notice(log_class, "Configure Internal: port_rate=%.2f Gbps, idleslope=%.2f Kbps, hi=%.0f, lo=%.0f, hint=%.2f Mbps, pkt_size=%u",
-                  port_rate_bps / CBS_GBPS_TO_BPS, idleslope_kbps, hicredit_bytes, locredit_bytes, bandwidth_bps_hint / CBS_MBPS_TO_BPS, packet_size);
+  vlib_log_debug(log_class, "Prepare: shaper %u algo=%s port_rate=%.2f Gbps, idleslope=%.2f Kbps, hi=%.0f, lo=%.0f, "
+                 "rate=%.2f Mbps, burst=%.0f, hint=%.2f Mbps, pkt_size=%u",
+                 u->shaper_index, cbs_algo_ops[a->algo].name, a->port_rate_bps / CBS_GBPS_TO_BPS, a->idleslope_kbps,
+                 a->hicredit_bytes, a->locredit_bytes, a->rate_bps / CBS_MBPS_TO_BPS, a->burst_bytes,
+                 a->bandwidth_bps_hint / CBS_MBPS_TO_BPS, packet_size);
 
   // --- Validate Parameters ---
-  if (PREDICT_FALSE(port_rate_bps <= 0.0)) return VNET_API_ERROR_INVALID_VALUE;
-  if (PREDICT_FALSE(idleslope_kbps < 0.0)) return VNET_API_ERROR_INVALID_VALUE_2; // Allow 0 idleslope? Standard says > 0.
-  if (PREDICT_FALSE(hicredit_bytes < locredit_bytes)) return VNET_API_ERROR_INVALID_VALUE_3;
+  if (PREDICT_FALSE(a->port_rate_bps <= 0.0)) return VNET_API_ERROR_INVALID_VALUE;
+  if ((rv = cbs_algo_ops[a->algo].validate (a)))
+      return rv;
 
   if (packet_size == 0) packet_size = CBS_DEFAULT_PACKET_SIZE;
   if (PREDICT_FALSE(packet_size < 64 || packet_size > 9000)) return VNET_API_ERROR_INVALID_VALUE_4;
-
-  port_rate_bytes_sec = port_rate_bps / CBS_BITS_PER_BYTE;
-  idleslope_bytes_sec = (idleslope_kbps * CBS_KBPS_TO_BPS) / CBS_BITS_PER_BYTE;
-  sendslope_bytes_sec = idleslope_bytes_sec - port_rate_bytes_sec;
-
-  // --- Cleanup existing configuration ---
-  if (cbsm->is_configured) {
-      vlib_log_notice(log_class, "Configure: Re-configuring. Cleaning up previous state.");
-      vlib_worker_thread_barrier_sync (vm);
-      for (i = 0; i < vec_len (cbsm->wheel_by_thread); i++) {
-          vlib_main_t *wrk_vm = vlib_get_main_by_index(i);
-          if (wrk_vm && cbs_input_node.index != (u32)~0) { // Check node index validity
-              vlib_node_set_state (wrk_vm, cbs_input_node.index, VLIB_NODE_STATE_DISABLED);
-              vlib_log_debug(log_class, "Configure: Disabled polling for cbs-wheel on thread %d", i);
-          } else if (wrk_vm && cbs_input_node.index == (u32)~0) {
-              // Use vlib_log directly instead of vlib_log_warning macro
-              vlib_log(VLIB_LOG_LEVEL_WARNING, log_class, "Configure: cbs_input_node index invalid, cannot disable polling on thread %d", i);
-          }
-          if (cbsm->wheel_by_thread[i]) {
-            cbs_wheel_free(cbsm, cbsm->wheel_by_thread[i]);
-            cbsm->wheel_by_thread[i] = 0;
-          }
-      }
-      vec_reset_length(cbsm->wheel_by_thread);
-      vlib_worker_thread_barrier_release (vm);
-      vlib_log_notice(log_class, "Configure: Previous wheels freed and polling disabled.");
-      cbsm->is_configured = 0; // Mark as not configured until fully set up again
+  // Each setting fails with its own code so API clients can tell which one was refused
+  if (PREDICT_FALSE(a->frame_overhead < -CBS_MAX_FRAME_OVERHEAD || a->frame_overhead > CBS_MAX_FRAME_OVERHEAD)) {
+      vlib_log_err(log_class, "Shaper %u: overhead %d outside +/-%d bytes", u->shaper_index, a->frame_overhead,
+                   CBS_MAX_FRAME_OVERHEAD);
+      return VNET_API_ERROR_INVALID_ARGUMENT;
+  }
+  if (PREDICT_FALSE(a->accounting_mode > CBS_ACCOUNTING_L1)) {
+      vlib_log_err(log_class, "Shaper %u: unknown accounting mode %u", u->shaper_index, a->accounting_mode);
+      return VNET_API_ERROR_UNSUPPORTED;
+  }
+  if (PREDICT_FALSE(a->gso_mode > CBS_GSO_MODE_NONE)) {
+      vlib_log_err(log_class, "Shaper %u: unknown gso mode %u", u->shaper_index, a->gso_mode);
+      return VNET_API_ERROR_UNIMPLEMENTED;
+  }
+  if (PREDICT_FALSE(a->max_residence_us < 0 || a->max_residence_us > CBS_MAX_RESIDENCE * 1e6)) {
+      vlib_log_err(log_class, "Shaper %u: max-residence %.0f us outside 0-%.0f s", u->shaper_index,
+                   (f64) a->max_residence_us, CBS_MAX_RESIDENCE);
+      return VNET_API_ERROR_LIMIT_EXCEEDED;
   }
 
-  // --- Store new configuration ---
-  cbsm->cbs_port_rate = port_rate_bytes_sec;
-  cbsm->cbs_idleslope = idleslope_bytes_sec;
-  cbsm->cbs_sendslope = sendslope_bytes_sec;
-  cbsm->cbs_hicredit = hicredit_bytes;
-  cbsm->cbs_locredit = locredit_bytes;
-  cbsm->packet_size = packet_size;
-
-  effective_bandwidth_for_sizing = (bandwidth_bps_hint > 0) ? bandwidth_bps_hint : port_rate_bps;
-  cbsm->configured_bandwidth = effective_bandwidth_for_sizing / CBS_BITS_PER_BYTE;
+  // --- Build new shaper state ---
+  clib_memset (shaper, 0, sizeof (*shaper));
+  shaper->is_valid = 1;
+  shaper->eng.algo = a->algo;
+  shaper->eng.port_rate = a->port_rate_bps / CBS_BITS_PER_BYTE;
+  cbs_algo_ops[a->algo].apply (shaper, a);
+  shaper->packet_size = packet_size;
+  shaper->accounting_mode = a->accounting_mode;
+  shaper->gso_mode = a->gso_mode;
+  shaper->frame_overhead = a->frame_overhead;
+  shaper->frame_overhead_total = a->frame_overhead +
+      ((a->accounting_mode == CBS_ACCOUNTING_L1) ? CBS_ETH_L1_OVERHEAD_BYTES : 0);
+  shaper->max_residence = a->max_residence_us * 1e-6;
+
+  effective_bandwidth_for_sizing = (a->bandwidth_bps_hint > 0) ? a->bandwidth_bps_hint : a->port_rate_bps;
+  shaper->configured_bandwidth = effective_bandwidth_for_sizing / CBS_BITS_PER_BYTE;
 
   // --- Calculate Wheel Size ---
   // Using a fixed buffer time target might be simpler than complex bandwidth calculations
   f64 buffer_time_target = 0.010; // Target 10ms buffering
-  u64 total_buffer_bytes = (cbsm->cbs_port_rate * buffer_time_target);
+  u64 total_buffer_bytes = (shaper->eng.port_rate * buffer_time_target);
   // Ensure a minimum size based on packets
-  total_buffer_bytes = clib_max(total_buffer_bytes, (u64)cbsm->packet_size * 1024); // At least 1024 packets worth
+  total_buffer_bytes = clib_max(total_buffer_bytes, (u64)shaper->packet_size * 1024); // At least 1024 packets worth
 
   u32 num_workers = vlib_num_workers();
   u64 per_worker_buffer_bytes = (num_workers > 0) ? (total_buffer_bytes / num_workers) : total_buffer_bytes;
   // Ensure minimum size per worker
-  per_worker_buffer_bytes = clib_max(per_worker_buffer_bytes, (u64)cbsm->packet_size * 256); // At least 256 packets worth
+  per_worker_buffer_bytes = clib_max(per_worker_buffer_bytes, (u64)shaper->packet_size * 256); // At least 256 packets worth
 
-  wheel_slots_per_wrk = per_worker_buffer_bytes / cbsm->packet_size;
+  wheel_slots_per_wrk = per_worker_buffer_bytes / shaper->packet_size;
   wheel_slots_per_wrk = clib_max(wheel_slots_per_wrk, (u64)CBS_MIN_WHEEL_SLOTS); // Ensure absolute minimum slots
   wheel_slots_per_wrk++; // Add one for safety/rounding
-  cbsm->wheel_slots_per_wrk = wheel_slots_per_wrk;
-
-  vlib_log_notice(log_class, "Configure: Calculated wheel size = %lu slots/worker (target %.3f s buffer)", cbsm->wheel_slots_per_wrk, buffer_time_target);
-
-  // --- Allocate Wheels ---
-  vec_validate (cbsm->wheel_by_thread, n_threads - 1);
-  vlib_log_debug(log_class, "Configure: Allocating wheels for %d threads (0 to %d)", n_threads, n_threads - 1);
-  for (i = 0; i < n_threads; i++) {
-      cbsm->wheel_by_thread[i] = cbs_wheel_alloc (cbsm, i);
-      if (PREDICT_FALSE(!cbsm->wheel_by_thread[i])) {
-         vlib_log_err(log_class, "Configure: ERROR - Wheel allocation failed for thread %d", i);
-         // Cleanup previously allocated wheels
-         for (int j = 0; j < i; j++) {
-             if (cbsm->wheel_by_thread[j]) {
-                cbs_wheel_free(cbsm, cbsm->wheel_by_thread[j]);
-                cbsm->wheel_by_thread[j] = 0;
-             }
-         }
-         vec_reset_length(cbsm->wheel_by_thread);
-         return VNET_API_ERROR_UNSPECIFIED; // Use standard unspecified error
+  shaper->wheel_slots_per_wrk = wheel_slots_per_wrk;
+
+  vlib_log_debug(log_class, "Prepare: shaper %u wheel size = %u slots/worker (target %.3f s buffer)",
+                 u->shaper_index, shaper->wheel_slots_per_wrk, buffer_time_target);
+  return 0;
+}
+
+/**
+ * @brief Install (or delete) one prepared shaper. Barrier must be held.
+ * The shaper's previous wheels are flushed and released on every thread;
+ * other shapers are untouched.
+ */
+static void
+cbs_shaper_install (cbs_main_t * cbsm, cbs_shaper_update_t * u)
+{
+  vlib_main_t *vm = cbsm->vlib_main;
+  cbs_per_thread_t *ptd;
+  u32 c;
+  int was_valid;
+
+  vec_validate (cbsm->shapers, u->shaper_index);
+  was_valid = cbsm->shapers[u->shaper_index].is_valid;
+  vec_foreach (ptd, cbsm->per_thread) {
+      vec_validate (ptd->wheel_by_shaper, u->shaper_index);
+      vec_validate (ptd->event_by_shaper, u->shaper_index);
+      if (ptd->wheel_by_shaper[u->shaper_index])
+          cbs_wheel_release (vm, ptd, ptd->wheel_by_shaper[u->shaper_index]);
+      if (!u->is_add) // No events for a shaper that is gone
+          clib_memset (&ptd->event_by_shaper[u->shaper_index], 0, sizeof (cbs_event_slot_t));
+      // Room for every wheel in the active heap, so the data path never grows it
+      vec_alloc (ptd->active_wheels, vec_len (ptd->wheel_by_shaper) - vec_len (ptd->active_wheels));
+      cbs_arena_reserve (cbsm, ptd);
+  }
+
+  if (u->is_add)
+      cbsm->shapers[u->shaper_index] = u->shaper;
+  else
+      clib_memset (&cbsm->shapers[u->shaper_index], 0, sizeof (cbs_shaper_t));
+
+  // Counters survive a reconfiguration; a new shaper id starts from zero
+  for (c = 0; c < CBS_N_COUNTER; c++) {
+      vlib_validate_combined_counter (&cbsm->counters[c], u->shaper_index);
+      if (u->is_add && !was_valid)
+          vlib_zero_combined_counter (&cbsm->counters[c], u->shaper_index);
+  }
+  vlib_validate_simple_counter (&cbsm->queue_depth, u->shaper_index);
+  vlib_zero_simple_counter (&cbsm->queue_depth, u->shaper_index); // Wheels were just flushed
+  cbs_reservation_shaper_installed (cbsm, u->shaper_index);
+  cbs_adaptive_shaper_installed (cbsm, u->shaper_index);
+  cbs_shared_shaper_installed (cbsm, u->shaper_index);
+}
+
+/**
+ * @brief Apply a batch of shaper adds/deletes atomically.
+ * Every entry is validated before the barrier; if any entry fails
+ * nothing is applied and *failed_index names it.
+ * The whole batch is then installed under a single barrier, so workers
+ * see either the old or the new set of shapers.
+ */
+int
+cbs_shaper_add_del_bulk (cbs_main_t * cbsm, cbs_shaper_update_t * updates, u32 * failed_index)
+{
+  vlib_main_t *vm = cbsm->vlib_main;
+  int n_threads = vlib_get_n_threads();
+  cbs_shaper_update_t *u;
+  cbs_shaper_t *shaper;
+  int rv = 0;
+
+  *failed_index = ~0;
+  vec_foreach (u, updates) {
+      if ((rv = cbs_shaper_prepare (cbsm, u))) {
+          *failed_index = u - updates;
+          vlib_log_err(cbsm->log_class, "Shaper add/del: entry %u (shaper %u) rejected, rv %d",
+                       *failed_index, u->shaper_index, rv);
+          return rv;
       }
   }
-  vlib_log_debug(log_class, "Configure: Wheels allocated successfully.");
 
-  // --- Finalize and Enable Polling ---
-  cbsm->is_configured = 1; // Mark as configured *after* successful setup
-  vlib_log_notice(log_class, "Configure: Configuration complete. Enabling polling.");
+  vlib_worker_thread_barrier_sync (vm);
+  vec_validate_aligned (cbsm->per_thread, n_threads - 1, CLIB_CACHE_LINE_BYTES);
+  vec_foreach (u, updates)
+    cbs_shaper_install (cbsm, u);
+  // Configured while at least one shaper exists; the data path checks this first
+  cbsm->is_configured = 0;
+  vec_foreach (shaper, cbsm->shapers)
+    if (shaper->is_valid) { cbsm->is_configured = 1; break; }
+  // cbs-wheel starts polling on a thread when its first wheel is created
+  vlib_worker_thread_barrier_release (vm);
+
+  vlib_log_notice(cbsm->log_class, "Shaper add/del: applied %u change(s)", vec_len (updates));
+  return 0;
+}
+
+/**
+ * @brief Internal function to (re)configure one shaper.
+ * A batch of one: the shaper's wheels are replaced under the barrier while
+ * other shapers keep running untouched.
+ */
+int
+cbs_configure_internal (cbs_main_t * cbsm, u32 shaper_index, const cbs_config_args_t * a)
+{
+  cbs_shaper_update_t *updates = 0, *u;
+  u32 failed_index;
+  int rv;
+
+  vec_add2 (updates, u, 1);
+  u->shaper_index = shaper_index;
+  u->is_add = 1;
+  u->args = *a;
+  rv = cbs_shaper_add_del_bulk (cbsm, updates, &failed_index);
+  vec_free (updates);
+  return rv;
+}
+
+/**
+ * @brief Set the congestion event configuration.
+ * Thresholds are copied into every wheel under the barrier so the data
+ * path compares against wheel-local values only.
+ */
+static int
+cbs_event_config_set (cbs_main_t * cbsm, u32 high_pct, u32 low_pct,
+                      f64 starvation_time, f64 min_interval)
+{
+  vlib_main_t *vm = cbsm->vlib_main;
+  cbs_per_thread_t *ptd;
+  cbs_wheel_t **wpp;
+
+  if (high_pct > 100) return VNET_API_ERROR_INVALID_VALUE;
+  if (high_pct && low_pct >= high_pct) return VNET_API_ERROR_INVALID_VALUE_2;
+  if (starvation_time < 0 || min_interval < 0) return VNET_API_ERROR_INVALID_VALUE_3;
 
   vlib_worker_thread_barrier_sync (vm);
-  for (i = 0; i < n_threads; i++) {
-      vlib_main_t *wrk_vm = vlib_get_main_by_index(i);
-      if (wrk_vm) {
-          if (PREDICT_TRUE(cbs_input_node.index != (u32)~0)) { // Check node index validity
-             vlib_node_set_state (wrk_vm, cbs_input_node.index, VLIB_NODE_STATE_POLLING);
-             vlib_log_debug(log_class, "Configure: Enabling polling for cbs-wheel on thread %u", i);
-          } else {
-             vlib_log_err(log_class, "Configure: ERROR - cbs_input_node index invalid, cannot enable polling on thread %u", i);
-             // This indicates a potential VPP startup or plugin registration issue
-          }
-        }
-    }
+  cbsm->event_high_pct = high_pct;
+  cbsm->event_low_pct = low_pct;
+  cbsm->event_starvation_time = starvation_time;
+  cbsm->event_min_interval = min_interval;
+  vec_foreach (ptd, cbsm->per_thread)
+    vec_foreach (wpp, ptd->wheel_by_shaper)
+      if (*wpp)
+        cbs_wheel_set_event_thresholds (cbsm, *wpp);
   vlib_worker_thread_barrier_release (vm);
 
-  return 0; // Success
+  vlib_log_notice(cbsm->log_class, "Events: high %u%%, low %u%%, starvation %.6f s, interval %.3f s",
+                  high_pct, low_pct, starvation_time, min_interval);
+  return 0;
+}
+
+/** @brief Sum a shaper's stats segment counters and live wheel depth over all threads. */
+static void
+cbs_shaper_collect_counters (cbs_main_t * cbsm, u32 shaper_index, cbs_shaper_counters_t * c)
+{
+  cbs_per_thread_t *ptd;
+  vlib_counter_t v;
+
+  clib_memset (c, 0, sizeof (*c));
+  vec_foreach (ptd, cbsm->per_thread) {
+      cbs_wheel_t *wp;
+      if (shaper_index < vec_len (ptd->wheel_by_shaper) && (wp = ptd->wheel_by_shaper[shaper_index]))
+          c->queue_depth += wp->cursize;
+  }
+  if (shaper_index >= vlib_combined_counter_n_counters (&cbsm->counters[CBS_COUNTER_ENQUEUED]))
+      return;
+
+  vlib_get_combined_counter (&cbsm->counters[CBS_COUNTER_ENQUEUED], shaper_index, &v);
+  c->enqueued = v.packets;
+  c->enqueued_bytes = v.bytes;
+  vlib_get_combined_counter (&cbsm->counters[CBS_COUNTER_DROPPED], shaper_index, &v);
+  c->dropped = v.packets;
+  c->dropped_bytes = v.bytes;
+  vlib_get_combined_counter (&cbsm->counters[CBS_COUNTER_EXPIRED], shaper_index, &v);
+  c->expired = v.packets;
+  c->expired_bytes = v.bytes;
+  vlib_get_combined_counter (&cbsm->counters[CBS_COUNTER_TRANSMITTED], shaper_index, &v);
+  c->transmitted = v.packets;
+  c->transmitted_bytes = v.bytes;
+}
+
+
+/* --- Base Implementation Block (API/CLI Handlers, Init, etc.) --- */
+#ifndef CLIB_MARCH_VARIANT
+
+/* --- API Message Handlers (Defined before cbs.api.c include) --- */
+static void vl_api_cbs_cross_connect_enable_disable_t_handler
+  (vl_api_cbs_cross_connect_enable_disable_t * mp)
+{
+  vl_api_cbs_cross_connect_enable_disable_reply_t *rmp;
+  cbs_main_t *cbsm = &cbs_main;
+  int rv;
+  u32 sw_if_index0 = clib_net_to_host_u32(mp->sw_if_index0);
+  u32 sw_if_index1 = clib_net_to_host_u32(mp->sw_if_index1);
+
+  // Basic validation first
+  if (!vnet_sw_if_index_is_api_valid (sw_if_index0)) { rv = VNET_API_ERROR_INVALID_SW_IF_INDEX; goto reply; }
+  if (!vnet_sw_if_index_is_api_valid (sw_if_index1)) { rv = VNET_API_ERROR_INVALID_SW_IF_INDEX_2; goto reply; }
+
+  rv = cbs_cross_connect_enable_disable (cbsm, sw_if_index0, sw_if_index1,
+                                         clib_net_to_host_u32 (mp->shaper_id),
+                                         (int) (mp->enable_disable), 0 /* lossless */,
+                                         CBS_DRAIN_TRANSMIT);
+
+reply:
+  REPLY_MACRO (VL_API_CBS_CROSS_CONNECT_ENABLE_DISABLE_REPLY);
+}
+
+static void vl_api_cbs_output_feature_enable_disable_t_handler
+  (vl_api_cbs_output_feature_enable_disable_t * mp)
+{
+  vl_api_cbs_output_feature_enable_disable_reply_t *rmp;
+  cbs_main_t *cbsm = &cbs_main;
+  int rv;
+  u32 sw_if_index = clib_net_to_host_u32(mp->sw_if_index); // Convert once
+
+  // Use VALIDATE_SW_IF_INDEX macro for standard interface validation
+  VALIDATE_SW_IF_INDEX(mp); // Sets rv and jumps to BAD_SW_IF_INDEX_LABEL on error
+
+  // If validation passed, call the internal function
+  rv = cbs_output_feature_enable_disable (cbsm, sw_if_index,
+                                          clib_net_to_host_u32 (mp->shaper_id),
+                                          1 << CBS_OUTPUT_ARC_INTERFACE,
+                                          (int) (mp->enable_disable), CBS_DRAIN_TRANSMIT);
+
+// Macro jumps here on validation failure
+BAD_SW_IF_INDEX_LABEL;
+  REPLY_MACRO (VL_API_CBS_OUTPUT_FEATURE_ENABLE_DISABLE_REPLY);
+}
+
+static void
+vl_api_cbs_configure_t_handler (vl_api_cbs_configure_t * mp)
+{
+  vl_api_cbs_configure_reply_t *rmp;
+  cbs_main_t *cbsm = &cbs_main;
+  cbs_config_args_t a = { 0 };
+  int rv;
+
+  a.algo = (cbs_algo_t) mp->algorithm;
+  a.port_rate_bps = (f64) clib_net_to_host_u64 (mp->port_rate_bps);
+  a.idleslope_kbps = (f64) clib_net_to_host_u64 (mp->idleslope_kbps);
+  // Convert signed i32 carefully from network u32
+  a.hicredit_bytes = (f64) ((i32) clib_net_to_host_u32(mp->hicredit_bytes));
+  a.locredit_bytes = (f64) ((i32) clib_net_to_host_u32(mp->locredit_bytes));
+  a.rate_bps = (f64) clib_net_to_host_u64 (mp->rate_bps);
+  a.burst_bytes = (f64) clib_net_to_host_u32 (mp->burst_bytes);
+  a.packet_size = clib_net_to_host_u32 (mp->average_packet_size);
+  a.bandwidth_bps_hint = (f64) clib_net_to_host_u64 (mp->bandwidth_in_bits_per_second);
+  a.frame_overhead = (i32) clib_net_to_host_u32 (mp->frame_overhead_bytes);
+  a.max_residence_us = clib_net_to_host_u32 (mp->max_residence_us);
+  a.accounting_mode = (cbs_accounting_mode_t) mp->accounting_mode;
+  a.gso_mode = (cbs_gso_mode_t) mp->gso_mode;
+
+  rv = cbs_configure_internal (cbsm, clib_net_to_host_u32 (mp->shaper_id), &a);
+
+  REPLY_MACRO (VL_API_CBS_CONFIGURE_REPLY);
+}
+
+/** @brief Convert an API shaper config (network byte order) to configuration arguments */
+static void
+cbs_config_args_from_api (const vl_api_cbs_shaper_config_t * c, cbs_config_args_t * a)
+{
+  clib_memset (a, 0, sizeof (*a));
+  a->algo = (cbs_algo_t) c->algorithm;
+  a->port_rate_bps = (f64) clib_net_to_host_u64 (c->port_rate_bps);
+  a->idleslope_kbps = (f64) clib_net_to_host_u64 (c->idleslope_kbps);
+  a->hicredit_bytes = (f64) ((i32) clib_net_to_host_u32 (c->hicredit_bytes));
+  a->locredit_bytes = (f64) ((i32) clib_net_to_host_u32 (c->locredit_bytes));
+  a->rate_bps = (f64) clib_net_to_host_u64 (c->rate_bps);
+  a->burst_bytes = (f64) clib_net_to_host_u32 (c->burst_bytes);
+  a->packet_size = clib_net_to_host_u32 (c->average_packet_size);
+  a->bandwidth_bps_hint = (f64) clib_net_to_host_u64 (c->bandwidth_in_bits_per_second);
+  a->frame_overhead = (i32) clib_net_to_host_u32 (c->frame_overhead_bytes);
+  a->max_residence_us = clib_net_to_host_u32 (c->max_residence_us);
+  a->accounting_mode = (cbs_accounting_mode_t) c->accounting_mode;
+  a->gso_mode = (cbs_gso_mode_t) c->gso_mode;
+}
+
+/** @brief Convert a configured shaper back to API units (network byte order) */
+static void
+cbs_shaper_config_to_api (const cbs_shaper_t * shaper, u32 shaper_index, vl_api_cbs_shaper_config_t * c)
+{
+  c->shaper_id = clib_host_to_net_u32 (shaper_index);
+  c->algorithm = (vl_api_cbs_algorithm_t) shaper->eng.algo;
+  c->port_rate_bps = clib_host_to_net_u64 ((u64) (shaper->eng.port_rate * CBS_BITS_PER_BYTE));
+  c->idleslope_kbps = clib_host_to_net_u64 ((u64) (shaper->eng.idleslope * CBS_BITS_PER_BYTE / CBS_KBPS_TO_BPS));
+  c->hicredit_bytes = clib_host_to_net_u32 ((i32) shaper->eng.hicredit);
+  c->locredit_bytes = clib_host_to_net_u32 ((i32) shaper->eng.locredit);
+  c->rate_bps = clib_host_to_net_u64 ((u64) (shaper->eng.tb_rate * CBS_BITS_PER_BYTE));
+  c->burst_bytes = clib_host_to_net_u32 ((u32) shaper->eng.tb_burst);
+  c->average_packet_size = clib_host_to_net_u32 (shaper->packet_size);
+  c->bandwidth_in_bits_per_second = clib_host_to_net_u64 ((u64) (shaper->configured_bandwidth * CBS_BITS_PER_BYTE));
+  c->frame_overhead_bytes = clib_host_to_net_u32 (shaper->frame_overhead);
+  c->max_residence_us = clib_host_to_net_u32 ((u32) (shaper->max_residence * 1e6));
+  c->accounting_mode = (vl_api_cbs_accounting_mode_t) shaper->accounting_mode;
+  c->gso_mode = (vl_api_cbs_gso_mode_t) shaper->gso_mode;
+}
+
+static void
+vl_api_cbs_shaper_add_del_t_handler (vl_api_cbs_shaper_add_del_t * mp)
+{
+  vl_api_cbs_shaper_add_del_reply_t *rmp;
+  cbs_main_t *cbsm = &cbs_main;
+  cbs_shaper_update_t *updates = 0, *u;
+  u32 n_shapers = clib_net_to_host_u32 (mp->n_shapers);
+  u32 failed_index = ~0;
+  u32 i;
+  int rv = 0;
+
+  // The array length must match what was actually received
+  if (vl_msg_api_get_msg_length (mp) != sizeof (*mp) + (u64) n_shapers * sizeof (mp->shapers[0])) {
+      rv = VNET_API_ERROR_INVALID_VALUE;
+      goto reply;
+  }
+  if (n_shapers == 0)
+      goto reply;
+
+  vec_validate (updates, n_shapers - 1);
+  for (i = 0; i < n_shapers; i++) {
+      u = vec_elt_at_index (updates, i);
+      u->shaper_index = clib_net_to_host_u32 (mp->shapers[i].shaper_id);
+      u->is_add = mp->is_add;
+      if (u->is_add)
+          cbs_config_args_from_api (&mp->shapers[i], &u->args);
+  }
+
+  rv = cbs_shaper_add_del_bulk (cbsm, updates, &failed_index);
+  vec_free (updates);
+
+reply:
+  REPLY_MACRO2 (VL_API_CBS_SHAPER_ADD_DEL_REPLY,
+  ({
+    rmp->failed_index = clib_host_to_net_u32 (failed_index);
+  }));
+}
+
+static void
+send_cbs_shaper_details (vl_api_registration_t * reg, u32 context,
+                         cbs_main_t * cbsm, u32 shaper_index)
+{
+  vl_api_cbs_shaper_details_t *rmp;
+  cbs_shaper_counters_t c;
+
+  // Counters are read without the barrier; each one may be a poll stale
+  cbs_shaper_collect_counters (cbsm, shaper_index, &c);
+
+  rmp = vl_msg_api_alloc (sizeof (*rmp));
+  clib_memset (rmp, 0, sizeof (*rmp));
+  rmp->_vl_msg_id = clib_host_to_net_u16 (VL_API_CBS_SHAPER_DETAILS + cbsm->msg_id_base);
+  rmp->context = context;
+  cbs_shaper_config_to_api (vec_elt_at_index (cbsm->shapers, shaper_index), shaper_index, &rmp->config);
+  rmp->queue_depth = clib_host_to_net_u32 (c.queue_depth);
+  rmp->enqueued_packets = clib_host_to_net_u64 (c.enqueued);
+  rmp->dropped_packets = clib_host_to_net_u64 (c.dropped);
+  rmp->transmitted_packets = clib_host_to_net_u64 (c.transmitted);
+  rmp->transmitted_bytes = clib_host_to_net_u64 (c.transmitted_bytes);
+  rmp->expired_packets = clib_host_to_net_u64 (c.expired);
+
+  vl_api_send_msg (reg, (u8 *) rmp);
+}
+
+static void
+vl_api_cbs_shaper_dump_t_handler (vl_api_cbs_shaper_dump_t * mp)
+{
+  cbs_main_t *cbsm = &cbs_main;
+  vl_api_registration_t *reg;
+  u32 shaper_index = clib_net_to_host_u32 (mp->shaper_id);
+  u32 i;
+
+  reg = vl_api_client_index_to_registration (mp->client_index);
+  if (!reg)
+    return;
+
+  if (shaper_index != (u32) ~0) {
+      if (cbs_shaper_get_if_valid (cbsm, shaper_index))
+          send_cbs_shaper_details (reg, mp->context, cbsm, shaper_index);
+      return;
+  }
+  vec_foreach_index (i, cbsm->shapers)
+    if (cbsm->shapers[i].is_valid)
+      send_cbs_shaper_details (reg, mp->context, cbsm, i);
+}
+
+static void
+send_cbs_interface_details (vl_api_registration_t * reg, u32 context,
+                            cbs_main_t * cbsm, u32 sw_if_index)
+{
+  vl_api_cbs_interface_details_t *rmp;
+  cbs_interface_t *intf = vec_elt_at_index (cbsm->interface_by_sw_if_index, sw_if_index);
+  vnet_hw_interface_t *hw = vnet_get_hw_interface (cbsm->vnet_main, intf->hw_if_index);
+
+  rmp = vl_msg_api_alloc (sizeof (*rmp));
+  clib_memset (rmp, 0, sizeof (*rmp));
+  rmp->_vl_msg_id = clib_host_to_net_u16 (VL_API_CBS_INTERFACE_DETAILS + cbsm->msg_id_base);
+  rmp->context = context;
+  rmp->sw_if_index = clib_host_to_net_u32 (sw_if_index);
+  rmp->port_sw_if_index = clib_host_to_net_u32 (hw->sw_if_index);
+  rmp->shaper_id = clib_host_to_net_u32 (intf->shaper_index);
+  rmp->is_cross_connect = (sw_if_index == cbsm->sw_if_index0 || sw_if_index == cbsm->sw_if_index1);
+
+  vl_api_send_msg (reg, (u8 *) rmp);
+}
+
+static void
+vl_api_cbs_interface_dump_t_handler (vl_api_cbs_interface_dump_t * mp)
+{
+  cbs_main_t *cbsm = &cbs_main;
+  vl_api_registration_t *reg;
+  u32 sw_if_index = clib_net_to_host_u32 (mp->sw_if_index);
+  u32 i;
+
+  reg = vl_api_client_index_to_registration (mp->client_index);
+  if (!reg)
+    return;
+
+  vec_foreach_index (i, cbsm->interface_by_sw_if_index) {
+      if (sw_if_index != (u32) ~0 && i != sw_if_index)
+          continue;
+      if (cbsm->interface_by_sw_if_index[i].output_next_index == (u32) ~0)
+          continue;
+      // Skip entries for interfaces that have since been deleted
+      if (pool_is_free_index (cbsm->vnet_main->interface_main.sw_interfaces, i))
+          continue;
+      send_cbs_interface_details (reg, mp->context, cbsm, i);
+  }
+}
+
+
+/* --- Congestion Events --- */
+static void
+vl_api_want_cbs_events_t_handler (vl_api_want_cbs_events_t * mp)
+{
+  vl_api_want_cbs_events_reply_t *rmp;
+  cbs_main_t *cbsm = &cbs_main;
+  cbs_event_registration_t *reg;
+  uword *p;
+  int rv = 0;
+
+  p = hash_get (cbsm->event_registration_by_client_index, mp->client_index);
+  if (p) {
+      if (mp->enable_disable) {
+          rv = VNET_API_ERROR_INVALID_REGISTRATION; // Already registered
+          goto reply;
+      }
+      pool_put_index (cbsm->event_registrations, p[0]);
+      hash_unset (cbsm->event_registration_by_client_index, mp->client_index);
+      goto reply;
+  }
+  if (!mp->enable_disable) {
+      rv = VNET_API_ERROR_INVALID_REGISTRATION; // Not registered
+      goto reply;
+  }
+  pool_get (cbsm->event_registrations, reg);
+  reg->client_index = mp->client_index;
+  reg->client_pid = clib_net_to_host_u32 (mp->pid);
+  hash_set (cbsm->event_registration_by_client_index, mp->client_index,
+            reg - cbsm->event_registrations);
+  // Wake the collector; it sleeps while nobody is subscribed
+  vlib_process_signal_event (cbsm->vlib_main, cbs_event_process_node.index, 0, 0);
+
+reply:
+  REPLY_MACRO (VL_API_WANT_CBS_EVENTS_REPLY);
 }
 
+/** @brief Drop the subscription of a client that went away. */
+static clib_error_t *
+want_cbs_events_reaper (u32 client_index)
+{
+  cbs_main_t *cbsm = &cbs_main;
+  uword *p = hash_get (cbsm->event_registration_by_client_index, client_index);
 
-/* --- Base Implementation Block (API/CLI Handlers, Init, etc.) --- */
-#ifndef CLIB_MARCH_VARIANT
+  if (p) {
+      pool_put_index (cbsm->event_registrations, p[0]);
+      hash_unset (cbsm->event_registration_by_client_index, client_index);
+  }
+  return 0;
+}
 
-/* --- API Message Handlers (Defined before cbs.api.c include) --- */
-static void vl_api_cbs_cross_connect_enable_disable_t_handler
-  (vl_api_cbs_cross_connect_enable_disable_t * mp)
+VL_MSG_API_REAPER_FUNCTION (want_cbs_events_reaper);
+
+static void
+vl_api_cbs_event_config_t_handler (vl_api_cbs_event_config_t * mp)
 {
-  vl_api_cbs_cross_connect_enable_disable_reply_t *rmp;
+  vl_api_cbs_event_config_reply_t *rmp;
   cbs_main_t *cbsm = &cbs_main;
   int rv;
-  u32 sw_if_index0 = clib_net_to_host_u32(mp->sw_if_index0);
-  u32 sw_if_index1 = clib_net_to_host_u32(mp->sw_if_index1);
 
-  // Basic validation first
-  if (!vnet_sw_if_index_is_api_valid (sw_if_index0)) { rv = VNET_API_ERROR_INVALID_SW_IF_INDEX; goto reply; }
-  if (!vnet_sw_if_index_is_api_valid (sw_if_index1)) { rv = VNET_API_ERROR_INVALID_SW_IF_INDEX_2; goto reply; }
+  rv = cbs_event_config_set (cbsm, mp->high_watermark_pct, mp->low_watermark_pct,
+                             clib_net_to_host_u32 (mp->starvation_threshold_us) * 1e-6,
+                             clib_net_to_host_u32 (mp->min_interval_ms) * 1e-3);
 
-  rv = cbs_cross_connect_enable_disable (cbsm, sw_if_index0, sw_if_index1, (int) (mp->enable_disable));
+  REPLY_MACRO (VL_API_CBS_EVENT_CONFIG_REPLY);
+}
 
-reply:
-  REPLY_MACRO (VL_API_CBS_CROSS_CONNECT_ENABLE_DISABLE_REPLY);
+static void
+vl_api_cbs_stream_add_del_t_handler (vl_api_cbs_stream_add_del_t * mp)
+{
+  vl_api_cbs_stream_add_del_reply_t *rmp;
+  cbs_main_t *cbsm = &cbs_main;
+  int rv;
+
+  rv = cbs_stream_add_del (cbsm, clib_net_to_host_u32 (mp->stream_id), clib_net_to_host_u32 (mp->shaper_id),
+                           clib_net_to_host_u32 (mp->max_frame_size),
+                           clib_net_to_host_u32 (mp->frames_per_interval), mp->is_add);
+
+  REPLY_MACRO (VL_API_CBS_STREAM_ADD_DEL_REPLY);
 }
 
-static void vl_api_cbs_output_feature_enable_disable_t_handler
-  (vl_api_cbs_output_feature_enable_disable_t * mp)
+static void
+vl_api_cbs_stream_filter_add_del_t_handler (vl_api_cbs_stream_filter_add_del_t * mp)
 {
-  vl_api_cbs_output_feature_enable_disable_reply_t *rmp;
+  vl_api_cbs_stream_filter_add_del_reply_t *rmp;
   cbs_main_t *cbsm = &cbs_main;
   int rv;
-  u32 sw_if_index = clib_net_to_host_u32(mp->sw_if_index); // Convert once
 
-  // Use VALIDATE_SW_IF_INDEX macro for standard interface validation
-  VALIDATE_SW_IF_INDEX(mp); // Sets rv and jumps to BAD_SW_IF_INDEX_LABEL on error
+  rv = cbs_stream_filter_add_del (cbsm, clib_net_to_host_u32 (mp->stream_id), mp->dst_mac,
+                                  clib_net_to_host_u16 (mp->vlan_id), mp->is_add);
 
-  // If validation passed, call the internal function
-  rv = cbs_output_feature_enable_disable (cbsm, sw_if_index, (int) (mp->enable_disable));
+  REPLY_MACRO (VL_API_CBS_STREAM_FILTER_ADD_DEL_REPLY);
+}
 
-// Macro jumps here on validation failure
-BAD_SW_IF_INDEX_LABEL;
-  REPLY_MACRO (VL_API_CBS_OUTPUT_FEATURE_ENABLE_DISABLE_REPLY);
+/**
+ * @brief Send one event to every subscriber.
+ * @param wp the shaper's wheel on the thread, or 0 if it was reclaimed since
+ */
+static void
+cbs_send_event (cbs_main_t * cbsm, u32 thread_index, u32 shaper_index, cbs_wheel_t * wp,
+                cbs_event_t event)
+{
+  cbs_event_registration_t *reg;
+
+  pool_foreach (reg, cbsm->event_registrations)
+    {
+      vl_api_registration_t *vl_reg = vl_api_client_index_to_registration (reg->client_index);
+      vl_api_cbs_event_t *mp;
+
+      if (!vl_reg || !vl_api_can_send_msg (vl_reg))
+        continue; // Slow subscriber: drop rather than block the main thread
+
+      mp = vl_msg_api_alloc (sizeof (*mp));
+      clib_memset (mp, 0, sizeof (*mp));
+      mp->_vl_msg_id = clib_host_to_net_u16 (VL_API_CBS_EVENT + cbsm->msg_id_base);
+      mp->client_index = reg->client_index;
+      mp->pid = clib_host_to_net_u32 (reg->client_pid);
+      mp->shaper_id = clib_host_to_net_u32 (shaper_index);
+      mp->thread_index = clib_host_to_net_u32 (thread_index);
+      mp->event = clib_host_to_net_u32 (event);
+      if (wp) {
+          mp->queue_depth = clib_host_to_net_u32 (wp->cursize);
+          mp->wheel_size = clib_host_to_net_u32 (wp->wheel_size);
+          mp->credits_bytes = clib_host_to_net_u32 ((i32) wp->eng.credits);
+      }
+      vl_api_send_msg (vl_reg, (u8 *) mp);
+    }
 }
 
+/**
+ * @brief Collect events posted by the workers and send them.
+ * Only threads whose flag is set (or that hold rate-limited events) are
+ * scanned. The event slots and wheel_by_shaper only change size under the
+ * barrier, and wheels are only freed under it, so neither can go away
+ * underneath this walk; a wheel the owning thread creates meanwhile is
+ * published fully initialized.
+ */
 static void
-vl_api_cbs_configure_t_handler (vl_api_cbs_configure_t * mp)
+cbs_event_collect (cbs_main_t * cbsm, f64 now)
+{
+  int have_subscribers = pool_elts (cbsm->event_registrations) > 0;
+  cbs_per_thread_t *ptd;
+  cbs_event_slot_t *es;
+  u32 pending;
+
+  vec_foreach (ptd, cbsm->per_thread)
+    {
+      u32 thread_index = ptd - cbsm->per_thread;
+
+      if (!clib_atomic_swap_acq_n (&ptd->events_pending, 0) && !ptd->events_deferred)
+        continue;
+      ptd->events_deferred = 0;
+
+      vec_foreach (es, ptd->event_by_shaper)
+        {
+          u32 shaper_index = es - ptd->event_by_shaper;
+          cbs_wheel_t *wp;
+
+          pending = clib_atomic_swap_acq_n (&es->pending_events, 0);
+          // A newer state of a pair replaces the deferred one
+          es->deferred_events = (es->deferred_events & ~cbs_event_opposite (pending)) | pending;
+          if (!es->deferred_events)
+            continue;
+          if (!have_subscribers) {
+              es->deferred_events = 0;
+              continue;
+          }
+          if (now - es->event_last_sent < cbsm->event_min_interval) {
+              ptd->events_deferred = 1; // Retry on a later tick
+              continue;
+          }
+          wp = shaper_index < vec_len (ptd->wheel_by_shaper) ? ptd->wheel_by_shaper[shaper_index] : 0;
+          // One state per pair is left, so sending in enum order loses no transition
+#define _(sym, bit, str)                                                        \
+          if (es->deferred_events & CBS_EVENT_##sym)                            \
+            cbs_send_event (cbsm, thread_index, shaper_index, wp, CBS_EVENT_##sym);
+          foreach_cbs_event
+#undef _
+          es->deferred_events = 0;
+          es->event_last_sent = now;
+        }
+    }
+}
+
+static uword
+cbs_event_process (vlib_main_t * vm, vlib_node_runtime_t * rt, vlib_frame_t * f)
 {
-  vl_api_cbs_configure_reply_t *rmp;
   cbs_main_t *cbsm = &cbs_main;
-  f64 port_rate_bps, idleslope_kbps, bandwidth_bps_hint;
-  f64 hicredit_bytes, locredit_bytes;
-  u32 packet_size;
-  int rv;
+  uword *event_data = 0;
+
+  while (1)
+    {
+      // Sleep until someone subscribes, then collect every poll interval
+      if (pool_elts (cbsm->event_registrations) == 0)
+        vlib_process_wait_for_event (vm);
+      else
+        vlib_process_wait_for_event_or_clock (vm, CBS_EVENT_POLL_INTERVAL);
+      vlib_process_get_events (vm, &event_data);
+      vec_reset_length (event_data);
+
+      cbs_event_collect (cbsm, vlib_time_now (vm));
+    }
+  return 0;
+}
 
-  port_rate_bps = (f64) clib_net_to_host_u64 (mp->port_rate_bps);
-  idleslope_kbps = (f64) clib_net_to_host_u64 (mp->idleslope_kbps);
-  // Convert signed i32 carefully from network u32
-  hicredit_bytes = (f64) ((i32) clib_net_to_host_u32(mp->hicredit_bytes));
-  locredit_bytes = (f64) ((i32) clib_net_to_host_u32(mp->locredit_bytes));
-  packet_size = clib_net_to_host_u32 (mp->average_packet_size);
-  bandwidth_bps_hint = (f64) clib_net_to_host_u64 (mp->bandwidth_in_bits_per_second);
+VLIB_REGISTER_NODE (cbs_event_process_node) = {
+  .function = cbs_event_process,
+  .type = VLIB_NODE_TYPE_PROCESS,
+  .name = "cbs-event-process",
+};
+
+static_always_inline int
+cbs_wheel_is_idle (cbs_main_t * cbsm, cbs_wheel_t * wp, f64 now)
+{
+  return wp && wp->cursize == 0 && !wp->is_pinned && now - wp->empty_since > cbsm->wheel_idle_timeout;
+}
+
+/**
+ * @brief Give wheels that stayed empty past the idle timeout back to their
+ * thread's arena; the next packet for the shaper creates a fresh one.
+ * Candidates are spotted without stopping the workers and checked again
+ * under the barrier, which is only taken when there is one.
+ * @return number of wheels reclaimed
+ */
+static u32
+cbs_wheel_reclaim_idle (cbs_main_t * cbsm, f64 now)
+{
+  vlib_main_t *vm = cbsm->vlib_main;
+  cbs_per_thread_t *ptd;
+  cbs_wheel_t **wpp;
+  u32 n_reclaimed = 0;
+  int found = 0;
 
-  rv = cbs_configure_internal (cbsm, port_rate_bps, idleslope_kbps,
-				    hicredit_bytes, locredit_bytes,
-				    bandwidth_bps_hint, packet_size);
+  vec_foreach (ptd, cbsm->per_thread)
+    vec_foreach (wpp, ptd->wheel_by_shaper)
+      found |= cbs_wheel_is_idle (cbsm, *wpp, now);
+  if (!found)
+    return 0;
 
-  REPLY_MACRO (VL_API_CBS_CONFIGURE_REPLY);
+  vlib_worker_thread_barrier_sync (vm);
+  vec_foreach (ptd, cbsm->per_thread)
+    vec_foreach (wpp, ptd->wheel_by_shaper)
+      if (cbs_wheel_is_idle (cbsm, *wpp, now)) {
+          cbs_wheel_release (vm, ptd, *wpp);
+          n_reclaimed++;
+      }
+  vlib_worker_thread_barrier_release (vm);
+
+  vlib_log_debug (cbsm->log_class, "Reclaim: %u idle wheels freed", n_reclaimed);
+  return n_reclaimed;
+}
+
+static uword
+cbs_reclaim_process (vlib_main_t * vm, vlib_node_runtime_t * rt, vlib_frame_t * f)
+{
+  cbs_main_t *cbsm = &cbs_main;
+
+  while (1)
+    {
+      vlib_process_suspend (vm, CBS_WHEEL_RECLAIM_INTERVAL);
+      if (cbsm->is_configured)
+        cbs_wheel_reclaim_idle (cbsm, vlib_time_now (vm));
+    }
+  return 0;
 }
 
+VLIB_REGISTER_NODE (cbs_reclaim_process_node) = {
+  .function = cbs_reclaim_process,
+  .type = VLIB_NODE_TYPE_PROCESS,
+  .name = "cbs-reclaim-process",
+};
 
 /* --- Plugin Initialization --- */
 static clib_error_t *
@@ -457,11 +1520,46 @@ cbs_init (vlib_main_t * vm)
   // Initialize main struct fields to safe defaults
   cbsm->sw_if_index0 = ~0;
   cbsm->sw_if_index1 = ~0;
-  cbsm->output_next_index0 = ~0;
-  cbsm->output_next_index1 = ~0;
+  cbsm->xc_lossless = 0;
+  cbsm->xc_input_node_index[0] = cbsm->xc_input_node_index[1] = ~0;
+  cbsm->xc_dev_instance[0] = cbsm->xc_dev_instance[1] = ~0;
   cbsm->is_configured = 0;
-  cbsm->output_next_index_by_sw_if_index = 0; // Initialize vector pointer to NULL
-  cbsm->wheel_by_thread = 0;                  // Initialize vector pointer to NULL
+  cbsm->shapers = 0;                          // Initialize vector pointer to NULL
+  cbsm->per_thread = 0;                       // Initialize vector pointer to NULL
+  cbsm->interface_by_sw_if_index = 0;         // Initialize vector pointer to NULL
+  cbsm->event_high_pct = CBS_EVENT_DEFAULT_HIGH_PCT;
+  cbsm->event_low_pct = CBS_EVENT_DEFAULT_LOW_PCT;
+  cbsm->event_starvation_time = CBS_EVENT_DEFAULT_STARVATION;
+  cbsm->event_min_interval = CBS_EVENT_DEFAULT_MIN_INTERVAL;
+  cbsm->event_registrations = 0;
+  cbsm->horizon_max = 0;
+  cbsm->arena_size = CBS_ARENA_DEFAULT_SIZE;
+  cbsm->wheel_idle_timeout = CBS_WHEEL_IDLE_TIMEOUT;
+  cbsm->tx_backoff = CBS_TX_BACKOFF_DEFAULT;
+  cbsm->elog_enabled = 0;
+  cbsm->streams = 0;
+  cbsm->stream_index_by_id = hash_create (0, sizeof (uword));
+  cbsm->reservation_by_shaper = 0;
+  cbsm->shared_by_shaper = 0;
+  cbsm->n_shared_attached = 0;
+  cbsm->adaptive_by_shaper = 0;
+  cbsm->n_adaptive = 0;
+  cbsm->adaptive_interval = CBS_ADAPTIVE_DEFAULT_INTERVAL;
+  cbsm->event_registration_by_client_index = hash_create (0, sizeof (uword));
+#define _(sym, n, path)                                                 \
+  cbsm->counters[CBS_COUNTER_##sym].name = #n;                          \
+  cbsm->counters[CBS_COUNTER_##sym].stat_segment_name = path;
+  foreach_cbs_counter
+#undef _
+  cbsm->queue_depth.name = "queue-depth";
+  cbsm->queue_depth.stat_segment_name = "/cbs/queue-depth";
+  cbsm->stream_drops.name = "stream-drops";
+  cbsm->stream_drops.stat_segment_name = "/cbs/stream-drops";
+  cbsm->idleslope_gauge.name = "idleslope";
+  cbsm->idleslope_gauge.stat_segment_name = "/cbs/idleslope";
+  cbsm->idleslope_adjustments.name = "idleslope-adjustments";
+  cbsm->idleslope_adjustments.stat_segment_name = "/cbs/idleslope-adjustments";
+  cbsm->n_stream_filters = 0;
   cbsm->msg_id_base = 0;                      // Initialize msg_id_base
   cbsm->arc_index = (u16)~0;                  // Initialize arc_index
 
@@ -479,6 +1577,7 @@ cbs_init (vlib_main_t * vm)
         error = clib_error_return (0, "Failed to get feature arc index for 'interface-output'");
         goto done;
   }
+  vnet_feature_register (cbs_feature_update, 0);
 
   vlib_log_debug(cbsm->log_class, "CBS plugin initialization complete");
 
@@ -503,6 +1602,86 @@ VNET_FEATURE_INIT (cbs_output_feature_feat, static) = {
   .runs_before = VNET_FEATURES ("interface-output-arc-end"),
 };
 
+// Routed traffic can be shaped before interface-output ("arc ip4|ip6|ip");
+// cbs-wheel then resumes the arc at the feature after cbs-output-feature,
+// so later output features (IPsec, NAT, ACLs) still see every frame
+VNET_FEATURE_INIT (cbs_output_feature_ip4_feat, static) = {
+  .arc_name = "ip4-output",
+  .node_name = "cbs-output-feature",
+  .runs_before = VNET_FEATURES ("interface-output"),
+};
+
+VNET_FEATURE_INIT (cbs_output_feature_ip6_feat, static) = {
+  .arc_name = "ip6-output",
+  .node_name = "cbs-output-feature",
+  .runs_before = VNET_FEATURES ("interface-output"),
+};
+
+/* --- Interface Lifecycle --- */
+/**
+ * @brief An interface going away takes its queued frames with it (the
+ * port's output node may not be there to take them later) and stops being
+ * shaped. A broken cross-connect is disabled on the surviving peer.
+ */
+static clib_error_t *
+cbs_sw_interface_add_del (vnet_main_t * vnm, u32 sw_if_index, u32 is_add)
+{
+  cbs_main_t *cbsm = &cbs_main;
+  vlib_main_t *vm = cbsm->vlib_main;
+  u32 peer = ~0, n_purged = 0;
+
+  if (is_add || !cbs_interface_is_shaped (cbsm, sw_if_index))
+      return 0;
+
+  if (sw_if_index == cbsm->sw_if_index0) peer = cbsm->sw_if_index1;
+  else if (sw_if_index == cbsm->sw_if_index1) peer = cbsm->sw_if_index0;
+  if (peer != ~0) {
+      vnet_feature_enable_disable ("device-input", "cbs-cross-connect", peer, 0, 0, 0);
+      cbs_cross_connect_set_input (cbsm, ~0, ~0, 0);
+      cbs_interface_unbind (cbsm, peer, CBS_DRAIN_FLUSH);
+      cbsm->sw_if_index0 = cbsm->sw_if_index1 = ~0;
+  }
+
+  vlib_worker_thread_barrier_sync (vm);
+  n_purged = cbs_interface_purge (cbsm, sw_if_index, 1);
+  vlib_worker_thread_barrier_release (vm);
+  cbs_interface_unbind (cbsm, sw_if_index, CBS_DRAIN_TRANSMIT); // Nothing left to drain
+  if (sw_if_index < vec_len (cbsm->interface_by_sw_if_index))
+      cbsm->interface_by_sw_if_index[sw_if_index].output_arcs = 0; // vnet drops the features
+
+  vlib_log_notice(cbsm->log_class, "Interface %U deleted: %u queued frames freed",
+                  format_vnet_sw_if_index_name, vnm, sw_if_index, n_purged);
+  return 0;
+}
+
+VNET_SW_INTERFACE_ADD_DEL_FUNCTION (cbs_sw_interface_add_del);
+
+/**
+ * @brief Taking an interface down frees the frames queued for it (for a
+ * port, also those of its sub-interfaces) instead of transmitting them
+ * into a down link; it stays shaped for when it comes back up.
+ */
+static clib_error_t *
+cbs_sw_interface_admin_up_down (vnet_main_t * vnm, u32 sw_if_index, u32 flags)
+{
+  cbs_main_t *cbsm = &cbs_main;
+  vlib_main_t *vm = cbsm->vlib_main;
+  u32 n_purged;
+
+  if ((flags & VNET_SW_INTERFACE_FLAG_ADMIN_UP) || !cbs_interface_is_shaped (cbsm, sw_if_index))
+      return 0;
+
+  vlib_worker_thread_barrier_sync (vm);
+  n_purged = cbs_interface_purge (cbsm, sw_if_index, 1);
+  vlib_worker_thread_barrier_release (vm);
+  if (n_purged)
+      vlib_log_notice(cbsm->log_class, "Interface %U down: %u queued frames freed",
+                      format_vnet_sw_if_index_name, vnm, sw_if_index, n_purged);
+  return 0;
+}
+
+VNET_SW_INTERFACE_ADMIN_UP_DOWN_FUNCTION (cbs_sw_interface_admin_up_down);
+
 /* --- Plugin Registration --- */
 VLIB_PLUGIN_REGISTER () =
 {
@@ -512,7 +1691,60 @@ VLIB_PLUGIN_REGISTER () =
 };
 
 /* --- CLI Formatters/Unformatters --- */
-static uword
+/** @brief Shaper parameters as "set cbs" takes them, before any is parsed */
+void
+cbs_config_args_init (cbs_config_args_t * a)
+{
+  clib_memset (a, 0, sizeof (*a));
+  a->algo = CBS_ALGO_CBS;
+  a->accounting_mode = CBS_ACCOUNTING_L2;
+  a->gso_mode = CBS_GSO_MODE_SEGMENTS;
+}
+
+/**
+ * @brief Parse one shaper parameter ("set cbs" syntax) into a cbs_config_args_t.
+ * args: cbs_config_args_t *, u32 *params_set (CBS_PARAM_* of mandatory parameters seen)
+ */
+uword
+unformat_cbs_shaper_param (unformat_input_t * input, va_list * args)
+{
+  cbs_config_args_t *a = va_arg (*args, cbs_config_args_t *);
+  u32 *params_set = va_arg (*args, u32 *);
+
+  if (unformat (input, "port_rate %U", unformat_cbs_rate, &a->port_rate_bps)) *params_set |= CBS_PARAM_PORT_RATE;
+  else if (unformat (input, "algorithm %U", unformat_cbs_algo, &a->algo));
+  else if (unformat (input, "idleslope %U", unformat_cbs_slope, &a->idleslope_kbps)) *params_set |= CBS_PARAM_IDLESLOPE;
+  else if (unformat (input, "hicredit %f", &a->hicredit_bytes)) *params_set |= CBS_PARAM_HICREDIT;
+  else if (unformat (input, "locredit %f", &a->locredit_bytes)) *params_set |= CBS_PARAM_LOCREDIT;
+  else if (unformat (input, "rate %U", unformat_cbs_rate, &a->rate_bps)) *params_set |= CBS_PARAM_RATE;
+  else if (unformat (input, "burst %f", &a->burst_bytes)) *params_set |= CBS_PARAM_BURST;
+  else if (unformat (input, "bandwidth %U", unformat_cbs_rate, &a->bandwidth_bps_hint)); // Optional
+  else if (unformat (input, "packet-size %u", &a->packet_size)); // Optional
+  else if (unformat (input, "overhead %d", &a->frame_overhead)); // Optional
+  else if (unformat (input, "max-residence %f", &a->max_residence_us)); // Optional
+  else if (unformat (input, "accounting %U", unformat_cbs_accounting_mode, &a->accounting_mode)); // Optional
+  else if (unformat (input, "gso-segments")) a->gso_mode = CBS_GSO_MODE_SEGMENTS;
+  else if (unformat (input, "no-gso-segments")) a->gso_mode = CBS_GSO_MODE_NONE;
+  else return 0;
+  return 1;
+}
+
+/** @brief Check that the mandatory parameters of the chosen algorithm were given. */
+clib_error_t *
+cbs_config_args_check (const cbs_config_args_t * a, u32 params_set)
+{
+  u32 cbs_params = CBS_PARAM_PORT_RATE | CBS_PARAM_IDLESLOPE | CBS_PARAM_HICREDIT | CBS_PARAM_LOCREDIT;
+  u32 tb_params = CBS_PARAM_PORT_RATE | CBS_PARAM_RATE | CBS_PARAM_BURST;
+
+  if (a->algo == CBS_ALGO_CBS && (params_set & cbs_params) != cbs_params)
+    return clib_error_return (0, "Mandatory parameters missing. Required: port_rate, idleslope, hicredit, locredit");
+  if (a->algo != CBS_ALGO_CBS && (params_set & tb_params) != tb_params)
+    return clib_error_return (0, "Mandatory parameters missing. Required for %s: port_rate, rate, burst",
+                              cbs_algo_ops[a->algo].name);
+  return 0;
+}
+
+uword
 unformat_cbs_rate (unformat_input_t * input, va_list * args)
 {
   f64 *result = va_arg (*args, f64 *); f64 tmp;
@@ -531,7 +1763,7 @@ unformat_cbs_slope (unformat_input_t * input, va_list * args)
   else return 0; return 1;
 }
 
-static u8 *
+u8 *
 format_cbs_rate (u8 *s, va_list *args)
 {
   f64 rate_bytes_sec = va_arg (*args, f64);
@@ -551,58 +1783,180 @@ format_cbs_slope (u8 *s, va_list *args)
   return s;
 }
 
+static uword
+unformat_cbs_accounting_mode (unformat_input_t * input, va_list * args)
+{
+  cbs_accounting_mode_t *result = va_arg (*args, cbs_accounting_mode_t *);
+  if (unformat (input, "l1")) *result = CBS_ACCOUNTING_L1;
+  else if (unformat (input, "l2")) *result = CBS_ACCOUNTING_L2;
+  else return 0; return 1;
+}
+
+static uword
+unformat_cbs_algo (unformat_input_t * input, va_list * args)
+{
+  cbs_algo_t *result = va_arg (*args, cbs_algo_t *);
+  if (unformat (input, "cbs")) *result = CBS_ALGO_CBS;
+  else if (unformat (input, "tbf")) *result = CBS_ALGO_TBF;
+  else if (unformat (input, "ats")) *result = CBS_ALGO_ATS;
+  else return 0; return 1;
+}
+
+/** @brief "interface" | "ip4" | "ip6" | "ip" (both), into a bitmap of CBS_OUTPUT_ARC_* */
+uword
+unformat_cbs_output_arcs (unformat_input_t * input, va_list * args)
+{
+  u8 *result = va_arg (*args, u8 *);
+  if (unformat (input, "interface")) *result = 1 << CBS_OUTPUT_ARC_INTERFACE;
+  else if (unformat (input, "ip4")) *result = 1 << CBS_OUTPUT_ARC_IP4;
+  else if (unformat (input, "ip6")) *result = 1 << CBS_OUTPUT_ARC_IP6;
+  else if (unformat (input, "ip")) *result = (1 << CBS_OUTPUT_ARC_IP4) | (1 << CBS_OUTPUT_ARC_IP6);
+  else return 0; return 1;
+}
+
+u8 *
+format_cbs_output_arcs (u8 * s, va_list * args)
+{
+  u32 arcs = va_arg (*args, u32);
+  u32 arc, n = 0;
+
+  for (arc = 0; arc < CBS_N_OUTPUT_ARC; arc++)
+    if (arcs & (1 << arc))
+      s = format (s, "%s%s", n++ ? "," : "", cbs_output_arc_names[arc]);
+  return s;
+}
+
+/** @brief "transmit" | "flush" */
+uword
+unformat_cbs_drain_mode (unformat_input_t * input, va_list * args)
+{
+  cbs_drain_mode_t *result = va_arg (*args, cbs_drain_mode_t *);
+  if (unformat (input, "transmit")) *result = CBS_DRAIN_TRANSMIT;
+  else if (unformat (input, "flush")) *result = CBS_DRAIN_FLUSH;
+  else return 0; return 1;
+}
+
+u8 *
+format_cbs_drain_mode (u8 * s, va_list * args)
+{
+  cbs_drain_mode_t mode = va_arg (*args, int);
+  return format (s, "%s", mode == CBS_DRAIN_FLUSH ? "flush" : "transmit");
+}
+
+static u8 *
+format_cbs_accounting_mode (u8 * s, va_list * args)
+{
+  cbs_accounting_mode_t mode = va_arg (*args, int);
+  return format (s, "%s", (mode == CBS_ACCOUNTING_L1) ? "L1 (preamble+SFD+IFG+FCS, padded)" : "L2 (buffer length)");
+}
+
 static u8 *
 format_cbs_config (u8 * s, va_list * args)
 {
    cbs_main_t *cbsm = &cbs_main;
    int verbose __attribute__((unused)) = va_arg (*args, int); // Keep verbose argument for potential future use
+   int output_feature_enabled = 0;
+   cbs_shaper_counters_t c;
+   u32 shaper_index, i;
 
    s = format (s, "CBS Configuration:\n");
    if (!cbsm->is_configured) {
         s = format(s, "  Not configured.\n");
         return s;
    }
-   s = format (s, "  Port Rate:       %U\n", format_cbs_rate, cbsm->cbs_port_rate);
-   s = format (s, "  Idle Slope:      %U\n", format_cbs_slope, cbsm->cbs_idleslope);
-   // Use format_cbs_rate for sendslope, as it's also a rate in bytes/sec
-   s = format (s, "  Send Slope:      %U/sec (calculated)\n", format_cbs_rate, cbsm->cbs_sendslope);
-   s = format (s, "  HiCredit:        %.0f bytes\n", cbsm->cbs_hicredit);
-   s = format (s, "  LoCredit:        %.0f bytes\n", cbsm->cbs_locredit);
-
-   s = format (s, "Internal Sizing:\n");
-   s = format (s, "  Avg Packet Size: %u bytes\n", cbsm->packet_size);
-   s = format (s, "  Bandwidth Hint:  %U (for wheel sizing)\n", format_cbs_rate, cbsm->configured_bandwidth);
-   s = format (s, "  Wheel Size:      %u slots/worker\n", cbsm->wheel_slots_per_wrk);
+   vec_foreach_index (shaper_index, cbsm->shapers) {
+       cbs_shaper_t *shaper = vec_elt_at_index (cbsm->shapers, shaper_index);
+       if (!shaper->is_valid)
+           continue;
+       s = format (s, "Shaper %u:\n", shaper_index);
+       s = format (s, "  Algorithm:       %s\n", cbs_algo_ops[shaper->eng.algo].name);
+       s = format (s, "  Port Rate:       %U\n", format_cbs_rate, shaper->eng.port_rate);
+       s = format (s, "%U", cbs_algo_ops[shaper->eng.algo].format_params, shaper);
+       s = format (s, "%U", format_cbs_reservation, shaper_index);
+       s = format (s, "%U", format_cbs_adaptive, shaper_index);
+       s = format (s, "%U", format_cbs_shared, shaper_index);
+       s = format (s, "  Accounting:      %U, overhead %d bytes/frame\n",
+                   format_cbs_accounting_mode, shaper->accounting_mode, shaper->frame_overhead);
+       s = format (s, "  GSO:             %s\n",
+                   (shaper->gso_mode == CBS_GSO_MODE_SEGMENTS) ? "charge per segment" : "charge as one frame");
+       if (shaper->max_residence > 0)
+           s = format (s, "  Max Residence:   %.0f us (older frames freed unsent)\n", shaper->max_residence * 1e6);
+       s = format (s, "  Avg Packet Size: %u bytes\n", shaper->packet_size);
+       s = format (s, "  Bandwidth Hint:  %U (for wheel sizing)\n", format_cbs_rate, shaper->configured_bandwidth);
+       s = format (s, "  Wheel Size:      %u slots/worker\n", shaper->wheel_slots_per_wrk);
+       cbs_shaper_collect_counters (cbsm, shaper_index, &c);
+       s = format (s, "  Queue Depth:     %u packets\n", c.queue_depth);
+       s = format (s, "  Counters:        enqueued %lu (%lu bytes), dropped %lu (%lu bytes), expired %lu (%lu bytes), "
+                   "transmitted %lu (%lu bytes)\n", c.enqueued, c.enqueued_bytes, c.dropped, c.dropped_bytes,
+                   c.expired, c.expired_bytes, c.transmitted, c.transmitted_bytes);
+   }
+
+   if (cbsm->event_high_pct)
+       s = format (s, "Events: high %u%%, low %u%%, starvation %.0f us, interval %.0f ms, %u subscriber(s)\n",
+                   cbsm->event_high_pct, cbsm->event_low_pct, cbsm->event_starvation_time * 1e6,
+                   cbsm->event_min_interval * 1e3, pool_elts (cbsm->event_registrations));
+   else
+       s = format (s, "Events: disabled\n");
+   if (cbsm->horizon_max > 0) {
+       s = format (s, "Horizon: up to %.1f us, current per thread (us):", cbsm->horizon_max * 1e6);
+       vec_foreach_index (i, cbsm->per_thread)
+           s = format (s, " %.1f", cbsm->per_thread[i].horizon * 1e6);
+       s = format (s, "\n");
+   }
+   else
+       s = format (s, "Horizon: off (only frames eligible at the poll are sent)\n");
+   if (cbsm->tx_backoff > 0)
+       s = format (s, "Backpressure: hold ports with TX errors from %.0f us up to %.0f us\n",
+                   cbsm->tx_backoff * 1e6, CBS_TX_BACKOFF_MAX * 1e6);
+   else
+       s = format (s, "Backpressure: off\n");
+   s = format (s, "Event logger: %s\n", cbsm->elog_enabled ? "enabled" : "disabled");
+   s = format (s, "Wheels per thread (backlogged/allocated, arena KB in use):");
+   vec_foreach_index (i, cbsm->per_thread)
+       s = format (s, " %u/%u %lu", vec_len (cbsm->per_thread[i].active_wheels),
+                   cbsm->per_thread[i].n_wheels, cbsm->per_thread[i].arena.n_bytes_in_use >> 10);
+   s = format (s, "\n");
 
    s = format (s, "\nEnabled Interfaces:\n");
-    if (cbsm->sw_if_index0 != (u32)~0) { // Check explicitly against ~0
-         s = format (s, "  Cross-connect: %U <--> %U\n",
-                     format_vnet_sw_if_index_name, cbsm->vnet_main, cbsm->sw_if_index0,
-                     format_vnet_sw_if_index_name, cbsm->vnet_main, cbsm->sw_if_index1);
-    } else {
-        int output_feature_enabled = 0;
-        u32 i;
-        // Use pool_foreach for potentially sparse vectors if they become pools later
-        // For vec, simple loop is fine. Check length before iterating.
-        if (cbsm->output_next_index_by_sw_if_index) {
-            for (i = 0; i < vec_len (cbsm->output_next_index_by_sw_if_index); i++) {
-              // Check if the index i is valid AND if the next index is set
-              if (cbsm->output_next_index_by_sw_if_index[i] != (u32)~0) {
-                // Double check if the sw_if_index is still valid in VPP
-                 if (!pool_is_free_index(cbsm->vnet_main->interface_main.sw_interfaces, i)) {
-                     if (!output_feature_enabled) {
-                       s = format (s, "  Output Feature on:\n");
-                       output_feature_enabled = 1;
-                     }
-                     s = format (s, "    %U\n", format_vnet_sw_if_index_name, cbsm->vnet_main, i);
-                 }
-              }
+   if (cbsm->sw_if_index0 != (u32)~0) { // Check explicitly against ~0
+        s = format (s, "  Cross-connect: %U <--> %U%s\n",
+                    format_vnet_sw_if_index_name, cbsm->vnet_main, cbsm->sw_if_index0,
+                    format_vnet_sw_if_index_name, cbsm->vnet_main, cbsm->sw_if_index1,
+                    cbsm->xc_lossless ? " (lossless)" : "");
+        if (cbsm->xc_lossless) {
+            s = format (s, "    RX paused on threads:");
+            vec_foreach_index (i, cbsm->per_thread) {
+                cbs_per_thread_t *ptd = vec_elt_at_index (cbsm->per_thread, i);
+                u8 rx0 = ptd->n_wheels_pausing_input[0] > 0, rx1 = ptd->n_wheels_pausing_input[1] > 0;
+                if (rx0 || rx1)
+                    s = format (s, " %u (%s)", i, rx0 && rx1 ? "both ports" : rx0 ? "first port" : "second port");
             }
+            s = format (s, "\n");
         }
-        if (!output_feature_enabled) {
-            s = format(s, "  None\n");
-        }
-    }
+   }
+   vec_foreach_index (i, cbsm->interface_by_sw_if_index) {
+       cbs_interface_t *intf = vec_elt_at_index (cbsm->interface_by_sw_if_index, i);
+       if (intf->output_next_index == (u32)~0 || i == cbsm->sw_if_index0 || i == cbsm->sw_if_index1)
+           continue;
+       // Double check if the sw_if_index is still valid in VPP
+       if (pool_is_free_index(cbsm->vnet_main->interface_main.sw_interfaces, i))
+           continue;
+       if (!output_feature_enabled) {
+           s = format (s, "  Output Feature on:\n");
+           output_feature_enabled = 1;
+       }
+       s = format (s, "    %U -> shaper %u, port %U",
+                   format_vnet_sw_if_index_name, cbsm->vnet_main, i, intf->shaper_index,
+                   format_vnet_hw_if_index_name, cbsm->vnet_main, intf->hw_if_index);
+       if (intf->tx_queue_id != CBS_TX_QUEUE_ANY)
+           s = format (s, " tx-queue %u", intf->tx_queue_id);
+       if (intf->output_arcs & ~(1 << CBS_OUTPUT_ARC_INTERFACE))
+           s = format (s, " on %U", format_cbs_output_arcs, (u32) intf->output_arcs);
+       s = format (s, "\n");
+   }
+   if (!output_feature_enabled && cbsm->sw_if_index0 == (u32)~0) {
+       s = format(s, "  None\n");
+   }
 
    return s;
 }
@@ -618,7 +1972,10 @@ cbs_cross_connect_enable_disable_command_fn (vlib_main_t * vm,
    unformat_input_t _line_input, *line_input = &_line_input;
    u32 sw_if_index0 = ~0;
    u32 sw_if_index1 = ~0;
+   u32 shaper_index = CBS_DEFAULT_SHAPER;
    int enable_disable = 1;
+   cbs_drain_mode_t drain = CBS_DRAIN_TRANSMIT;
+   u8 is_lossless = 0;
    u32 tmp;
    int rv;
    clib_error_t * error = 0;
@@ -630,6 +1987,9 @@ cbs_cross_connect_enable_disable_command_fn (vlib_main_t * vm,
 
    while (unformat_check_input (line_input) != UNFORMAT_END_OF_INPUT) {
        if (unformat (line_input, "disable")) enable_disable = 0;
+       else if (unformat (line_input, "drain %U", unformat_cbs_drain_mode, &drain));
+       else if (unformat (line_input, "lossless")) is_lossless = 1;
+       else if (unformat (line_input, "shaper %u", &shaper_index));
        else if (unformat (line_input, "%U", unformat_vnet_sw_interface, cbsm->vnet_main, &tmp)) {
            if (sw_if_index0 == ~0) sw_if_index0 = tmp;
            else if (sw_if_index1 == ~0) sw_if_index1 = tmp;
@@ -650,14 +2010,16 @@ cbs_cross_connect_enable_disable_command_fn (vlib_main_t * vm,
                    format_vnet_sw_if_index_name, cbsm->vnet_main, sw_if_index0,
                    format_vnet_sw_if_index_name, cbsm->vnet_main, sw_if_index1);
 
-   rv = cbs_cross_connect_enable_disable (cbsm, sw_if_index0, sw_if_index1, enable_disable);
+   rv = cbs_cross_connect_enable_disable (cbsm, sw_if_index0, sw_if_index1, shaper_index, enable_disable,
+                                          is_lossless, drain);
 
    switch (rv) {
      case 0: break; // Success
      case VNET_API_ERROR_FEATURE_DISABLED: error = clib_error_return (0, "CBS not configured, please 'set cbs ...' first"); break;
      case VNET_API_ERROR_INVALID_SW_IF_INDEX:
      case VNET_API_ERROR_INVALID_SW_IF_INDEX_2: error = clib_error_return(0, "Invalid software interface index"); break;
-     case VNET_API_ERROR_INVALID_INTERFACE: error = clib_error_return (0, "Invalid interface type (must be hardware)"); break;
+     case VNET_API_ERROR_INVALID_INTERFACE: error = clib_error_return (0, "Invalid interface type (must be hardware, use output-feature for sub-interfaces)"); break;
+     case VNET_API_ERROR_NO_SUCH_ENTRY: error = clib_error_return (0, "Shaper %u not configured", shaper_index); break;
      case VNET_API_ERROR_UNSPECIFIED: // Handle the generic error code
           error = clib_error_return (0, "CBS cross-connect setup failed (unspecified internal error)");
           break;
@@ -680,7 +2042,10 @@ cbs_output_feature_enable_disable_command_fn (vlib_main_t * vm,
     vlib_log_class_t log_class = cbsm->log_class; // Get log class
     unformat_input_t _line_input, *line_input = &_line_input;
     u32 sw_if_index = ~0;
+    u32 shaper_index = CBS_DEFAULT_SHAPER;
+    u8 arcs = 1 << CBS_OUTPUT_ARC_INTERFACE;
     int enable_disable = 1;
+    cbs_drain_mode_t drain = CBS_DRAIN_TRANSMIT;
     int rv;
     clib_error_t * error = 0;
 
@@ -690,6 +2055,9 @@ cbs_output_feature_enable_disable_command_fn (vlib_main_t * vm,
 
     while (unformat_check_input (line_input) != UNFORMAT_END_OF_INPUT) {
         if (unformat (line_input, "disable")) enable_disable = 0;
+        else if (unformat (line_input, "drain %U", unformat_cbs_drain_mode, &drain));
+        else if (unformat (line_input, "shaper %u", &shaper_index));
+        else if (unformat (line_input, "arc %U", unformat_cbs_output_arcs, &arcs));
         else if (unformat (line_input, "%U", unformat_vnet_sw_interface, cbsm->vnet_main, &sw_if_index)) ;
         else if (unformat (line_input, "sw_if_index %u", &sw_if_index));
         else { error = clib_error_return (0, "unknown input `%U'", format_unformat_error, line_input); goto done; }
@@ -701,13 +2069,15 @@ cbs_output_feature_enable_disable_command_fn (vlib_main_t * vm,
                     enable_disable ? "enable" : "disable",
                     format_vnet_sw_if_index_name, cbsm->vnet_main, sw_if_index);
 
-    rv = cbs_output_feature_enable_disable (cbsm, sw_if_index, enable_disable);
+    rv = cbs_output_feature_enable_disable (cbsm, sw_if_index, shaper_index, arcs, enable_disable, drain);
 
     switch (rv) {
       case 0: break; // Success
       case VNET_API_ERROR_FEATURE_DISABLED: error = clib_error_return (0, "CBS not configured, please 'set cbs ...' first"); break;
       case VNET_API_ERROR_INVALID_SW_IF_INDEX: error = clib_error_return(0, "Invalid software interface index"); break;
-      case VNET_API_ERROR_INVALID_INTERFACE: error = clib_error_return(0, "Invalid interface type (must be hardware)"); break; // Adjusted error message due to code change
+      case VNET_API_ERROR_INVALID_INTERFACE: error = clib_error_return(0, "Invalid interface type (must be hardware or sub-interface)"); break;
+      case VNET_API_ERROR_NO_SUCH_ENTRY: error = clib_error_return (0, "Shaper %u not configured", shaper_index); break;
+      case VNET_API_ERROR_INVALID_VALUE: error = clib_error_return (0, "Invalid arc"); break;
       case VNET_API_ERROR_UNSPECIFIED: // Handle the generic error code
           error = clib_error_return (0, "CBS output feature setup failed (unspecified internal error)");
           break;
@@ -726,44 +2096,69 @@ set_cbs_command_fn (vlib_main_t * vm, unformat_input_t * input, vlib_cli_command
 {
     cbs_main_t *cbsm = &cbs_main;
     vlib_log_class_t log_class = cbsm->log_class; // Get log class
-    f64 port_rate_bps = 0.0, idleslope_kbps = 0.0, bandwidth_bps_hint = 0.0;
-    f64 hicredit_bytes = 0.0, locredit_bytes = 0.0;
-    u32 packet_size = 0; // Use 0 to signify default
+    cbs_config_args_t a;
+    u32 shaper_index = CBS_DEFAULT_SHAPER;
+    u32 params_set = 0; // Track mandatory parameters
+    int is_delete = 0;
     int rv;
     clib_error_t * error = 0;
-    // Track mandatory parameters
-    int port_rate_set = 0, idleslope_set = 0, hicredit_set = 0, locredit_set = 0;
 
+    cbs_config_args_init (&a);
     while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT) {
-        if (unformat (input, "port_rate %U", unformat_cbs_rate, &port_rate_bps)) port_rate_set = 1;
-        else if (unformat (input, "idleslope %U", unformat_cbs_slope, &idleslope_kbps)) idleslope_set = 1;
-        else if (unformat (input, "hicredit %f", &hicredit_bytes)) hicredit_set = 1;
-        else if (unformat (input, "locredit %f", &locredit_bytes)) locredit_set = 1;
-        else if (unformat (input, "bandwidth %U", unformat_cbs_rate, &bandwidth_bps_hint)); // Optional
-        else if (unformat (input, "packet-size %u", &packet_size)); // Optional
+        if (unformat (input, "shaper %u", &shaper_index));
+        else if (unformat (input, "delete")) is_delete = 1;
+        else if (unformat_user (input, unformat_cbs_shaper_param, &a, &params_set));
         else { error = clib_error_return (0, "unknown input '%U'", format_unformat_error, input); goto done; }
       }
 
-    // Check if all mandatory parameters were provided
-    if (!port_rate_set || !idleslope_set || !hicredit_set || !locredit_set) {
-        error = clib_error_return (0, "Mandatory parameters missing. Required: port_rate, idleslope, hicredit, locredit");
+    if (is_delete) {
+        cbs_shaper_update_t *updates = 0, *u;
+        u32 failed_index;
+
+        if (!cbs_shaper_get_if_valid (cbsm, shaper_index)) {
+            error = clib_error_return (0, "Shaper %u not configured", shaper_index);
+            goto done;
+        }
+        vec_add2 (updates, u, 1);
+        u->shaper_index = shaper_index;
+        u->is_add = 0;
+        rv = cbs_shaper_add_del_bulk (cbsm, updates, &failed_index);
+        vec_free (updates);
+        if (rv == VNET_API_ERROR_INSTANCE_IN_USE)
+            error = clib_error_return (0, "Shaper %u is still bound to interfaces; disable the output "
+                                       "feature or cross-connect first", shaper_index);
+        else if (rv)
+            error = clib_error_return (0, "Shaper %u delete failed: rv %d", shaper_index, rv);
         goto done;
     }
 
-    vlib_log_notice(log_class, "Set CBS config: port_rate %.2fG, idle %.2fK, hi %.0f, lo %.0f, bw_hint %.2fM, pkt_size %u",
-                    port_rate_bps / CBS_GBPS_TO_BPS, idleslope_kbps, hicredit_bytes, locredit_bytes,
-                    bandwidth_bps_hint / CBS_MBPS_TO_BPS, packet_size);
+    if ((error = cbs_config_args_check (&a, params_set)))
+        goto done;
+
+    vlib_log_notice(log_class, "Set CBS config: shaper %u algo %s port_rate %.2fG, idle %.2fK, hi %.0f, lo %.0f, rate %.2fM, burst %.0f, bw_hint %.2fM, pkt_size %u",
+                    shaper_index, cbs_algo_ops[a.algo].name, a.port_rate_bps / CBS_GBPS_TO_BPS, a.idleslope_kbps,
+                    a.hicredit_bytes, a.locredit_bytes, a.rate_bps / CBS_MBPS_TO_BPS, a.burst_bytes,
+                    a.bandwidth_bps_hint / CBS_MBPS_TO_BPS, a.packet_size);
 
-    rv = cbs_configure_internal (cbsm, port_rate_bps, idleslope_kbps, hicredit_bytes, locredit_bytes, bandwidth_bps_hint, packet_size);
+    rv = cbs_configure_internal (cbsm, shaper_index, &a);
 
     switch (rv) {
       case 0: // Success
           vlib_cli_output (vm, "%U", format_cbs_config, 0 /* verbose=0 */);
           break;
       case VNET_API_ERROR_INVALID_VALUE: error = clib_error_return (0, "Invalid port_rate (must be > 0)"); break;
-      case VNET_API_ERROR_INVALID_VALUE_2: error = clib_error_return (0, "Invalid idleslope (must be >= 0)"); break;
-      case VNET_API_ERROR_INVALID_VALUE_3: error = clib_error_return (0, "Invalid credits (hicredit must be >= locredit)"); break;
+      case VNET_API_ERROR_INVALID_VALUE_2:
+          error = clib_error_return (0, (a.algo == CBS_ALGO_CBS) ? "Invalid idleslope (must be >= 0)" : "Invalid rate (must be > 0)"); break;
+      case VNET_API_ERROR_INVALID_VALUE_3:
+          error = clib_error_return (0, (a.algo == CBS_ALGO_CBS) ? "Invalid credits (hicredit must be >= locredit)" : "Invalid burst (must be > 0)"); break;
       case VNET_API_ERROR_INVALID_VALUE_4: error = clib_error_return (0, "Invalid packet size (must be 64-9000, or 0 for default)"); break;
+      case VNET_API_ERROR_INVALID_VALUE_5: error = clib_error_return (0, "Invalid shaper id (must be < %u)", CBS_MAX_SHAPERS); break;
+      case VNET_API_ERROR_INVALID_ARGUMENT:
+          error = clib_error_return (0, "Invalid overhead (must be within +/-%d bytes)", CBS_MAX_FRAME_OVERHEAD); break;
+      case VNET_API_ERROR_UNSUPPORTED: error = clib_error_return (0, "Invalid accounting mode"); break;
+      case VNET_API_ERROR_UNIMPLEMENTED: error = clib_error_return (0, "Invalid gso mode"); break;
+      case VNET_API_ERROR_LIMIT_EXCEEDED:
+          error = clib_error_return (0, "Invalid max-residence (must be 0-%.0f s)", CBS_MAX_RESIDENCE); break;
       case VNET_API_ERROR_UNSPECIFIED: error = clib_error_return(0, "Configuration failed (unspecified internal error)"); break;
       default:
           error = clib_error_return (0, "cbs_configure_internal failed: rv %d", rv);
@@ -774,6 +2169,169 @@ set_cbs_command_fn (vlib_main_t * vm, unformat_input_t * input, vlib_cli_command
     return error;
 }
 
+static clib_error_t *
+set_cbs_events_command_fn (vlib_main_t * vm, unformat_input_t * input, vlib_cli_command_t * cmd)
+{
+    cbs_main_t *cbsm = &cbs_main;
+    u32 high_pct = cbsm->event_high_pct ? cbsm->event_high_pct : CBS_EVENT_DEFAULT_HIGH_PCT;
+    u32 low_pct = cbsm->event_low_pct;
+    f64 starvation_us = cbsm->event_starvation_time * 1e6;
+    f64 interval_ms = cbsm->event_min_interval * 1e3;
+    clib_error_t * error = 0;
+    int rv;
+
+    while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT) {
+        if (unformat (input, "disable")) high_pct = 0;
+        else if (unformat (input, "high %u", &high_pct));
+        else if (unformat (input, "low %u", &low_pct));
+        else if (unformat (input, "starvation %f", &starvation_us));
+        else if (unformat (input, "interval %f", &interval_ms));
+        else { error = clib_error_return (0, "unknown input '%U'", format_unformat_error, input); goto done; }
+      }
+
+    rv = cbs_event_config_set (cbsm, high_pct, low_pct, starvation_us * 1e-6, interval_ms * 1e-3);
+
+    switch (rv) {
+      case 0: break;
+      case VNET_API_ERROR_INVALID_VALUE: error = clib_error_return (0, "Invalid high watermark (0-100 percent)"); break;
+      case VNET_API_ERROR_INVALID_VALUE_2: error = clib_error_return (0, "Low watermark must be below the high watermark"); break;
+      case VNET_API_ERROR_INVALID_VALUE_3: error = clib_error_return (0, "Invalid starvation threshold or interval (must be >= 0)"); break;
+      default:
+          error = clib_error_return (0, "cbs_event_config_set failed: rv %d", rv);
+          break;
+    }
+
+  done:
+    return error;
+}
+
+static clib_error_t *
+set_cbs_horizon_command_fn (vlib_main_t * vm, unformat_input_t * input, vlib_cli_command_t * cmd)
+{
+    cbs_main_t *cbsm = &cbs_main;
+    cbs_per_thread_t *ptd;
+    f64 max_us = -1;
+
+    while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT) {
+        if (unformat (input, "max %f", &max_us));
+        else if (unformat (input, "off")) max_us = 0;
+        else return clib_error_return (0, "unknown input '%U'", format_unformat_error, input);
+      }
+    if (max_us < 0)
+        return clib_error_return (0, "Please specify max <us> or off");
+    if (max_us * 1e-6 > CBS_MAX_HORIZON)
+        return clib_error_return (0, "Invalid max (must be <= %.0f us)", CBS_MAX_HORIZON * 1e6);
+
+    vlib_worker_thread_barrier_sync (vm);
+    cbsm->horizon_max = max_us * 1e-6;
+    vec_foreach (ptd, cbsm->per_thread)
+        ptd->horizon = 0; // Measured again from the next poll
+    vlib_worker_thread_barrier_release (vm);
+
+    vlib_log_notice(cbsm->log_class, "Horizon: max %.1f us", max_us);
+    return 0;
+}
+
+static clib_error_t *
+set_cbs_backpressure_command_fn (vlib_main_t * vm, unformat_input_t * input, vlib_cli_command_t * cmd)
+{
+    cbs_main_t *cbsm = &cbs_main;
+    cbs_per_thread_t *ptd;
+    cbs_tx_port_t *tp;
+    f64 backoff_us = -1;
+
+    while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT) {
+        if (unformat (input, "backoff %f", &backoff_us));
+        else if (unformat (input, "off")) backoff_us = 0;
+        else return clib_error_return (0, "unknown input '%U'", format_unformat_error, input);
+      }
+    if (backoff_us < 0)
+        return clib_error_return (0, "Please specify backoff <us> or off");
+    if (backoff_us * 1e-6 > CBS_TX_BACKOFF_MAX)
+        return clib_error_return (0, "Invalid backoff (must be <= %.0f us)", CBS_TX_BACKOFF_MAX * 1e6);
+
+    vlib_worker_thread_barrier_sync (vm);
+    cbsm->tx_backoff = backoff_us * 1e-6;
+    vec_foreach (ptd, cbsm->per_thread) {
+        vec_foreach (tp, ptd->tx_port_by_hw_if_index) {
+            tp->is_pending = 0;
+            tp->n_sent = 0;
+            tp->backoff = 0;
+        }
+        vec_reset_length (ptd->tx_ports_pending);
+        vec_reset_length (ptd->tx_sent);
+    }
+    vlib_worker_thread_barrier_release (vm);
+
+    vlib_log_notice(cbsm->log_class, "Backpressure: backoff %.1f us", backoff_us);
+    return 0;
+}
+
+static clib_error_t *
+set_cbs_tx_queue_command_fn (vlib_main_t * vm, unformat_input_t * input, vlib_cli_command_t * cmd)
+{
+    cbs_main_t *cbsm = &cbs_main;
+    unformat_input_t _line_input, *line_input = &_line_input;
+    u32 sw_if_index = ~0, queue_id = ~0;
+    clib_error_t * error = 0;
+    int rv;
+
+    if (!unformat_user (input, unformat_line_input, line_input))
+        return clib_error_return (0, "Please specify an interface");
+
+    while (unformat_check_input (line_input) != UNFORMAT_END_OF_INPUT) {
+        if (unformat (line_input, "queue %u", &queue_id));
+        else if (unformat (line_input, "any")) queue_id = CBS_TX_QUEUE_ANY;
+        else if (unformat (line_input, "%U", unformat_vnet_sw_interface, cbsm->vnet_main, &sw_if_index));
+        else { error = clib_error_return (0, "unknown input `%U'", format_unformat_error, line_input); goto done; }
+      }
+    if (sw_if_index == ~0) { error = clib_error_return (0, "Please specify an interface"); goto done; }
+    if (queue_id == ~0) { error = clib_error_return (0, "Please specify queue <n> or any"); goto done; }
+    if (queue_id > CBS_TX_QUEUE_ANY) { error = clib_error_return (0, "Invalid queue %u", queue_id); goto done; }
+
+    rv = cbs_interface_set_tx_queue (cbsm, sw_if_index, queue_id);
+    switch (rv) {
+      case 0: break;
+      case VNET_API_ERROR_INVALID_SW_IF_INDEX: error = clib_error_return (0, "Interface is not shaped by CBS"); break;
+      case VNET_API_ERROR_INVALID_VALUE: error = clib_error_return (0, "No TX queue %u on the port", queue_id); break;
+      case VNET_API_ERROR_INVALID_INTERFACE:
+          error = clib_error_return (0, "Only interfaces shaped on the interface-output arc alone can use a TX queue"); break;
+      default: error = clib_error_return (0, "cbs_interface_set_tx_queue failed: rv %d", rv); break;
+      }
+
+  done:
+    unformat_free (line_input);
+    return error;
+}
+
+static clib_error_t *
+set_cbs_elog_command_fn (vlib_main_t * vm, unformat_input_t * input, vlib_cli_command_t * cmd)
+{
+    cbs_main_t *cbsm = &cbs_main;
+    int enable = -1;
+
+    while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT) {
+        if (unformat (input, "enable")) enable = 1;
+        else if (unformat (input, "disable")) enable = 0;
+        else return clib_error_return (0, "unknown input '%U'", format_unformat_error, input);
+      }
+    if (enable < 0)
+        return clib_error_return (0, "Please specify enable or disable");
+
+    // Stall tracking restarts from scratch on the next enable
+    if (enable && !cbsm->elog_enabled) {
+        cbs_per_thread_t *ptd;
+        cbs_wheel_t **wpp;
+        vec_foreach (ptd, cbsm->per_thread)
+          vec_foreach (wpp, ptd->wheel_by_shaper)
+            if (*wpp)
+                (*wpp)->elog_stall_reason = 0;
+    }
+    cbsm->elog_enabled = enable;
+    vlib_log_notice(cbsm->log_class, "Event logger %s", enable ? "enabled" : "disabled");
+    return 0;
+}
+
 static clib_error_t *
 show_cbs_command_fn (vlib_main_t * vm, unformat_input_t * input, vlib_cli_command_t * cmd)
 {
@@ -800,10 +2358,47 @@ show_cbs_command_fn (vlib_main_t * vm, unformat_input_t * input, vlib_cli_comman
 VLIB_CLI_COMMAND (set_cbs_command, static) =
 {
   .path = "set cbs",
-  .short_help = "set cbs port_rate <rate> idleslope <kbps> hicredit <bytes> locredit <bytes> [bandwidth <rate>] [packet-size <n>]",
+  .short_help = "set cbs [shaper <id>] {delete | port_rate <rate> {idleslope <kbps> hicredit <bytes> locredit <bytes> | "
+                "algorithm tbf|ats rate <rate> burst <bytes>} [bandwidth <rate>] [packet-size <n>] "
+                "[overhead <bytes>] [max-residence <us>] [accounting l1|l2] [gso-segments|no-gso-segments]}",
   .function = set_cbs_command_fn,
 };
 
+VLIB_CLI_COMMAND (set_cbs_events_command, static) =
+{
+  .path = "set cbs events",
+  .short_help = "set cbs events [high <pct>] [low <pct>] [starvation <us>] [interval <ms>] | disable",
+  .function = set_cbs_events_command_fn,
+};
+
+VLIB_CLI_COMMAND (set_cbs_horizon_command, static) =
+{
+  .path = "set cbs horizon",
+  .short_help = "set cbs horizon max <us> | off",
+  .function = set_cbs_horizon_command_fn,
+};
+
+VLIB_CLI_COMMAND (set_cbs_backpressure_command, static) =
+{
+  .path = "set cbs backpressure",
+  .short_help = "set cbs backpressure backoff <us> | off",
+  .function = set_cbs_backpressure_command_fn,
+};
+
+VLIB_CLI_COMMAND (set_cbs_tx_queue_command, static) =
+{
+  .path = "set cbs tx-queue",
+  .short_help = "set cbs tx-queue <interface> {queue <n> | any}",
+  .function = set_cbs_tx_queue_command_fn,
+};
+
+VLIB_CLI_COMMAND (set_cbs_elog_command, static) =
+{
+  .path = "set cbs elog",
+  .short_help = "set cbs elog enable|disable",
+  .function = set_cbs_elog_command_fn,
+};
+
 VLIB_CLI_COMMAND (show_cbs_command, static) =
 {
   .path = "show cbs",
@@ -814,14 +2409,16 @@ VLIB_CLI_COMMAND (show_cbs_command, static) =
 VLIB_CLI_COMMAND (cbs_enable_disable_command, static) =
 {
   .path = "cbs cross-connect enable-disable",
-  .short_help = "cbs cross-connect enable-disable <intfc1> <intfc2> [disable]",
+  .short_help = "cbs cross-connect enable-disable <intfc1> <intfc2> [shaper <id>] [lossless] "
+                "[disable [drain transmit|flush]]",
   .function = cbs_cross_connect_enable_disable_command_fn,
 };
 
 VLIB_CLI_COMMAND (cbs_output_feature_enable_disable_command, static) =
 {
   .path = "cbs output-feature enable-disable",
-  .short_help = "cbs output-feature enable-disable <interface> [disable]",
+  .short_help = "cbs output-feature enable-disable <interface|sub-interface> [shaper <id>] "
+                "[arc interface|ip4|ip6|ip] [disable [drain transmit|flush]]",
   .function = cbs_output_feature_enable_disable_command_fn,
 };
 
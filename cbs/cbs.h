@@ -12,22 +12,123 @@
 #include <vnet/vnet.h>
 #include <vnet/ip/ip.h>
 #include <vnet/ethernet/ethernet.h>
+#include <vnet/ethernet/mac_address.h>
 #include <vnet/feature/feature.h>
 
 #include <vppinfra/hash.h>
 #include <vppinfra/error.h>
 #include <vppinfra/time.h>
 #include <vppinfra/clib.h> // For cache line alignment macro
+#include <vppinfra/bihash_8_8.h> // Stream filter table
 #include <vlib/log.h>      // Include for vlib_log_class_t
 
+#include <cbs/cbs_engine.h> // Shaping arithmetic (VPP independent)
+#include <cbs/cbs_capture.h> // Timeline capture file format (VPP independent)
+#include <cbs/cbs_shared.h> // Aggregate shaping segment shared by VPP instances (VPP independent)
+
 // Constants
 #define CBS_MAX_TX_BURST 8         /**< Max packets to dequeue in one go from wheel (Reduced from 32) */
+#define CBS_MAX_EXPIRE_PER_VISIT VLIB_FRAME_SIZE /**< Stale frames freed per wheel visit; the rest on the next poll */
 #define CBS_DEFAULT_PACKET_SIZE 1500 /**< Default average packet size if not specified */
 #define CBS_BITS_PER_BYTE 8.0
 #define CBS_KBPS_TO_BPS 1000.0
 #define CBS_MBPS_TO_BPS 1000000.0
 #define CBS_GBPS_TO_BPS 1000000000.0
 #define CBS_MIN_WHEEL_SLOTS 2048    /**< Minimum guaranteed slots in the wheel */
+#define CBS_MAX_SHAPERS 65536       /**< Upper bound for shaper ids */
+#define CBS_ACTIVE_MIN_DELAY 1e-9   /**< Re-key delay of a wheel still due after its poll (next poll) */
+#define CBS_MAX_HORIZON 0.010        /**< Upper bound for "set cbs horizon" (seconds) */
+#define CBS_ARENA_DEFAULT_SIZE (256ULL << 20) /**< Address space reserved per thread for wheels (backed on use) */
+#define CBS_WHEEL_IDLE_TIMEOUT 10.0  /**< Seconds a wheel may stay empty before its memory is reclaimed */
+#define CBS_WHEEL_RECLAIM_INTERVAL 1.0 /**< How often cbs-reclaim-process looks for idle wheels (seconds) */
+#define CBS_TX_QUEUE_ANY ((u16) ~0)  /**< No dedicated TX queue: interface-output picks one */
+#define CBS_TX_BACKOFF_DEFAULT 20e-6 /**< First hold of a port whose TX node reported errors (seconds) */
+#define CBS_TX_BACKOFF_MAX 0.001     /**< Hold doubles while errors continue, up to this */
+#define CBS_LOSSLESS_HEADROOM (2 * VLIB_FRAME_SIZE) /**< Slots free when a lossless cross-connect pauses RX: one poll of each port */
+#define CBS_STREAM_FILTER_BUCKETS 4096 /**< Stream filter table buckets (thousands of streams) */
+#define CBS_STREAM_FILTER_MEMORY (4 << 20) /**< Stream filter table heap */
+#define CBS_SHARED_DEFAULT_BATCH 16384 /**< Bytes taken from a shared segment per reservation */
+#define CBS_SHARED_DEFAULT_LEASE 1.0  /**< Seconds a shared segment member stays alive without renewing */
+#define CBS_ADAPTIVE_DEFAULT_INTERVAL 0.1 /**< Seconds between demand samples of the idleslope controller */
+#define CBS_ADAPTIVE_DEFAULT_HYSTERESIS 0.1 /**< Relative change of the target needed before idleslope moves */
+#define CBS_ADAPTIVE_DEFAULT_HEADROOM 0.1 /**< Idleslope above the measured demand */
+#define CBS_DEFAULT_SHAPER 0        /**< Shaper configured by plain "set cbs" and used when none is given */
+
+// Ethernet wire overhead not present in vlib buffers (used for L1 accounting)
+#define CBS_ETH_PREAMBLE_SFD_BYTES 8 /**< Preamble (7) + start frame delimiter (1) */
+#define CBS_ETH_IFG_BYTES 12         /**< Minimum inter-frame gap */
+#define CBS_ETH_FCS_BYTES 4          /**< Frame check sequence, stripped from buffers */
+#define CBS_ETH_MIN_FRAME_BYTES 60   /**< Minimum frame length without FCS (padding applies below it) */
+#define CBS_ETH_L1_OVERHEAD_BYTES \
+  (CBS_ETH_PREAMBLE_SFD_BYTES + CBS_ETH_IFG_BYTES + CBS_ETH_FCS_BYTES)
+#define CBS_MAX_FRAME_OVERHEAD 256   /**< Upper bound for the configurable per-frame overhead */
+#define CBS_MAX_RESIDENCE 10.0       /**< Upper bound for the per-class max residence time (seconds) */
+
+// Stream reservation defaults (see "set cbs reservation")
+#define CBS_RESERVATION_DEFAULT_INTERVAL 125e-6   /**< 802.1Q class measurement interval of SR class A */
+#define CBS_RESERVATION_DEFAULT_SHARE_PCT 75      /**< Reservable share of the port rate (802.1Q deltaBandwidth) */
+#define CBS_RESERVATION_DEFAULT_INTERFERENCE 1518 /**< Largest lower priority frame: 1500 MTU + tagged header */
+
+/** \brief How frame lengths are charged against credits and the port timeline */
+typedef enum {
+    CBS_ACCOUNTING_L2 = 0,  /**< Buffer length (L2 frame without FCS) + configured overhead */
+    CBS_ACCOUNTING_L1,      /**< Padded frame + FCS + preamble/SFD + IFG + configured overhead */
+} cbs_accounting_mode_t;
+
+/** \brief How GSO super-packets are charged */
+typedef enum {
+    CBS_GSO_MODE_SEGMENTS = 0, /**< Charge for the segments the super-packet will be cut into */
+    CBS_GSO_MODE_NONE,         /**< Charge the super-packet as a single frame (legacy behaviour) */
+} cbs_gso_mode_t;
+
+// Congestion event defaults (see "set cbs events")
+#define CBS_EVENT_DEFAULT_HIGH_PCT 80        /**< Occupancy raising high-watermark */
+#define CBS_EVENT_DEFAULT_LOW_PCT 20         /**< Occupancy raising low-watermark after a high crossing */
+#define CBS_EVENT_DEFAULT_STARVATION 0.010   /**< Seconds of negative CBS credit before credit-starved */
+#define CBS_EVENT_DEFAULT_MIN_INTERVAL 0.100 /**< Minimum seconds between events of one wheel */
+#define CBS_EVENT_POLL_INTERVAL 0.010        /**< How often the main thread collects posted events */
+
+/**
+ * Per-shaper counters exported to the stats segment (packets and charged
+ * bytes), indexed by shaper id; sym, field name, stats segment path.
+ */
+#define foreach_cbs_counter                       \
+_(ENQUEUED, enqueued, "/cbs/enqueued")            \
+_(DROPPED, dropped, "/cbs/dropped")               \
+_(EXPIRED, expired, "/cbs/expired")               \
+_(TRANSMITTED, transmitted, "/cbs/transmitted")
+
+typedef enum {
+#define _(sym, name, path) CBS_COUNTER_##sym,
+  foreach_cbs_counter
+#undef _
+  CBS_N_COUNTER,
+} cbs_counter_t;
+
+/** \brief Congestion events; values are bits, matching vl_api_cbs_event_type_t */
+#define foreach_cbs_event                         \
+_(HIGH_WATERMARK, 0, "high-watermark")            \
+_(LOW_WATERMARK, 1, "low-watermark")              \
+_(DROPS_STARTED, 2, "drops-started")              \
+_(DROPS_STOPPED, 3, "drops-stopped")              \
+_(CREDIT_STARVED, 4, "credit-starved")            \
+_(CREDIT_RECOVERED, 5, "credit-recovered")
+
+typedef enum {
+#define _(sym, bit, str) CBS_EVENT_##sym = (1 << bit),
+    foreach_cbs_event
+#undef _
+} cbs_event_t;
+
+/** Events come in pairs: an even bit enters a state, the next bit leaves it */
+#define CBS_EVENT_ENTER_MASK (CBS_EVENT_HIGH_WATERMARK | CBS_EVENT_DROPS_STARTED | CBS_EVENT_CREDIT_STARVED)
+
+/** @brief The events of the opposite state of each pair in @c events */
+always_inline u32
+cbs_event_opposite (u32 events)
+{
+  return ((events & CBS_EVENT_ENTER_MASK) << 1) | ((events >> 1) & CBS_EVENT_ENTER_MASK);
+}
 
 /** \brief CBS Wheel Entry (stores packet info in the queue) */
 typedef struct
@@ -36,30 +137,284 @@ typedef struct
   u32 rx_sw_if_index;     /**< Original RX software interface index */
   u32 tx_sw_if_index;     /**< Target TX software interface index (after potential cross-connect change) */
   u32 output_next_index;  /**< Next node index *after* the cbs-wheel node */
-  u16 pad[2];             /**< Padding for alignment */
+  u32 wire_length;        /**< Bytes charged on dequeue (computed at enqueue, see cbs_buffer_wire_length) */
+  u32 hw_if_index;        /**< Parent hardware port, selects the shared transmission timeline */
+  u16 tx_queue_id;        /**< Dedicated TX queue, or CBS_TX_QUEUE_ANY (see "set cbs tx-queue") */
+  f64 eligible_time;      /**< ATS: earliest transmission time assigned at enqueue */
+  f64 enqueue_time;       /**< When the packet was buffered (frame arrival time) */
 } cbs_wheel_entry_t;
 
-/** \brief CBS Wheel Structure (per thread) */
+/** \brief CBS Wheel Structure (per shaper, per thread) */
 typedef struct
 {
   u32 wheel_size;         /**< Total number of slots in this wheel */
   u32 cursize;            /**< Current number of packets in the wheel */
   u32 head;               /**< Index to dequeue from */
   u32 tail;               /**< Index to enqueue to */
-  f64 cbs_credits;        /**< Current credit balance for this thread/queue */
-  f64 cbs_last_update_time; /**< Time when credits were last updated */
-  f64 cbs_last_tx_finish_time; /**< Time when the last packet transmission from this wheel finished */
+  u32 shaper_index;       /**< Shaper owning this wheel */
+  u32 active_index;       /**< Position in the thread's active heap (~0 while empty) */
+  uword block_size;       /**< Bytes taken from the thread's arena */
+  f64 empty_since;        /**< When the wheel last ran empty (idle reclaim) */
+  u8 is_pinned;           /**< Preallocated by the startup config, never reclaimed when idle */
+  u8 pausing_input;       /**< Lossless cross-connect: bitmap of the ports (0, 1) whose RX this wheel paused */
+  u32 pause_high_slots;   /**< Occupancy stopping the cross-connect's RX polling (lossless mode) */
+  u32 pause_low_slots;    /**< Occupancy resuming it */
+  f64 next_check_time;    /**< Earliest time the head may be sendable (active heap key) */
+  f64 shared_grant;       /**< Bytes reserved from the shaper's shared segment, not yet sent (< 0: borrowed) */
+  cbs_engine_state_t eng; /**< Credits/tokens and ATS state of this thread's queue */
   // f64 cbs_last_poll_time; // Optional: For reducing log spam when wheel is empty
   cbs_wheel_entry_t *entries; /**< Pointer to the array of wheel entries */
+
+  /* Congestion events, detected by the owning thread (see cbs_wheel_post_event) */
+  u32 event_high_slots;   /**< Occupancy raising HIGH_WATERMARK (~0 = events off) */
+  u32 event_low_slots;    /**< Occupancy raising LOW_WATERMARK after a high crossing */
+  f64 event_starvation_time; /**< Seconds of negative credit raising CREDIT_STARVED */
+  u8 is_above_high;       /**< Between a high and the following low crossing */
+  u8 is_dropping;         /**< Between DROPS_STARTED and DROPS_STOPPED */
+  u8 is_starved;          /**< Between CREDIT_STARVED and CREDIT_RECOVERED */
+  f64 starved_since;      /**< When credits went negative (0 = not negative) */
+
+  /* Event logger stall tracking (only while "set cbs elog" is on) */
+  u8 elog_stall_reason;   /**< cbs_engine_verdict_t of the current stall (0 = not stalled) */
+  f64 elog_stall_start;   /**< When the current stall started */
     CLIB_CACHE_LINE_ALIGN_MARK (pad); /**< Ensure structure ends on a cache line boundary */
 } cbs_wheel_t;
 
+/** \brief Shaper instance (one traffic class); parameters in bytes/sec */
+typedef struct
+{
+  u8 is_valid;          /**< Set once the shaper has been configured */
+
+  /* Algorithm, port rate and algorithm parameters (bytes/sec, bytes) */
+  cbs_engine_params_t eng;
+  u32 eng_version;      /**< Odd while eng is rewritten outside the barrier (cbs_shaper_params_publish) */
+
+  /* Frame accounting */
+  cbs_accounting_mode_t accounting_mode; /**< L1 or L2 length accounting */
+  cbs_gso_mode_t gso_mode;  /**< GSO super-packet charging mode */
+  i32 frame_overhead;       /**< Configured extra bytes per frame (may be negative) */
+  i32 frame_overhead_total; /**< frame_overhead + fixed L1 overhead if in L1 mode (precomputed) */
+
+  /* Wheel Sizing Parameters */
+  u32 packet_size;      /**< Average packet size hint (bytes) */
+  f64 configured_bandwidth; /**< Bandwidth hint used for wheel sizing (bytes/sec) */
+  u32 wheel_slots_per_wrk; /**< Number of slots per worker thread wheel */
+
+  /* Deadline */
+  f64 max_residence;    /**< Seconds a frame may wait before dequeue frees it unsent (0 = no limit) */
+
+  /* Aggregate shaping across VPP instances (cbs_shared.c), set while attached */
+  cbs_shared_segment_t *shared; /**< Segment every sent byte is also reserved from (0 = local only) */
+  cbs_shared_member_t *shared_member; /**< This instance's member slot (byte count) */
+  u32 shared_batch;     /**< Bytes reserved at a time by each thread */
+} cbs_shaper_t;
+
+/**
+ * \brief Feature arcs the output feature can shape on.
+ * All of them see frames after the rewrite, so the charged length is the
+ * final L2 length. ip4-output/ip6-output run before interface-output and
+ * drop on a full wheel earlier, but only shape routed traffic.
+ */
+typedef enum {
+    CBS_OUTPUT_ARC_INTERFACE = 0, /**< "interface-output": every frame, including L2 bridged */
+    CBS_OUTPUT_ARC_IP4,           /**< "ip4-output" */
+    CBS_OUTPUT_ARC_IP6,           /**< "ip6-output" */
+    CBS_N_OUTPUT_ARC,
+} cbs_output_arc_t;
+
+/**
+ * \brief What happens to an interface's queued frames when it stops being
+ * shaped (feature disabled, interface deleted or taken down).
+ */
+typedef enum {
+    CBS_DRAIN_TRANSMIT = 0, /**< Frames still leave at the shaped rate (default) */
+    CBS_DRAIN_FLUSH,        /**< Frames are freed at once and counted as dropped */
+} cbs_drain_mode_t;
+
+/** \brief Per sw_if_index shaping state, resolved with one lookup on the fast path */
+typedef struct
+{
+  u32 shaper_index;       /**< Shaper serving traffic transmitted on this interface (~0 if none) */
+  u32 output_next_index;  /**< cbs-wheel next index towards the parent port's output node */
+  u32 hw_if_index;        /**< Parent hardware port (sub-interfaces share its timeline) */
+  u16 tx_queue_id;        /**< Dedicated TX queue for shaped frames (CBS_TX_QUEUE_ANY = none) */
+  u8 output_arcs;         /**< Bitmap of CBS_OUTPUT_ARC_* the output feature is enabled on */
+} cbs_interface_t;
+
+/**
+ * \brief Per-thread TX state of a port.
+ * There is no generic way to ask a device for TX ring space, so cbs-wheel
+ * watches the error counters of the port's TX node on its own thread: a
+ * frame the driver could not place (ring full) shows up there by the next
+ * poll. The port is then held so the backlog stays in the wheel, and the
+ * credit of the dropped frames is given back. The counters also count
+ * unshaped traffic, so at most the frames cbs-wheel handed over are
+ * taken as dropped.
+ */
+typedef struct
+{
+  u32 tx_node_index;      /**< Device TX node (hw->tx_node_index) */
+  u32 error_heap_index;   /**< First error counter of the TX node */
+  u32 n_errors;           /**< Number of TX node error counters */
+  u8 is_pending;          /**< Sent to in the last poll, errors checked in the next */
+  u64 tx_errors;          /**< Sum of the TX node's errors when first sent to in the last poll */
+  u32 n_sent;             /**< Frames handed over in the last poll */
+  u32 n_dropped;          /**< Of those, frames still to refund while checking */
+  f64 backoff;            /**< Current hold after errors (0 = not backpressured) */
+} cbs_tx_port_t;
+
+#define CBS_TX_SENT_MAX VLIB_FRAME_SIZE /**< Frames per poll whose charge can be refunded */
+
+/** \brief A frame handed to a port in the last poll, in hand-over order */
+typedef struct
+{
+  u32 shaper_index;       /**< Shaper charged for it */
+  u32 hw_if_index;        /**< Port it went to */
+  u32 wire_length;        /**< Bytes charged */
+} cbs_tx_sent_t;
+
+/** \brief Released arena block; the link lives in the block itself */
+typedef struct cbs_arena_free
+{
+  uword size;
+  struct cbs_arena_free *next;
+} cbs_arena_free_t;
+
+/**
+ * \brief Per-thread wheel memory.
+ * Address space is reserved when the first shaper is installed; pages are
+ * backed on first touch, so threads without shaped traffic cost nothing.
+ * The owning thread allocates; wheels are freed only by the main thread
+ * under the barrier (reconfiguration, idle reclaim), so the control plane
+ * can read any wheel it finds in wheel_by_shaper.
+ */
+typedef struct
+{
+  u8 *base;                   /**< Reservation start (0 = not reserved) */
+  uword size;                 /**< Bytes reserved */
+  uword used;                 /**< Bytes handed out from the untouched tail */
+  uword n_bytes_in_use;       /**< Bytes in live wheels */
+  cbs_arena_free_t *free_list; /**< Released blocks, reused first fit */
+} cbs_arena_t;
+
+/**
+ * \brief Congestion events of one shaper on one thread, on their way to
+ * the API subscribers. Kept apart from the wheel: the main thread reads
+ * the slot while the owning thread may be creating the wheel, and the
+ * slot only moves when the vector grows under the barrier.
+ */
+typedef struct
+{
+  u32 pending_events;     /**< CBS_EVENT_* bits posted by the owning thread, taken atomically */
+  /* Main thread only */
+  u32 deferred_events;    /**< Collected events held back by the rate limit, latest state per pair */
+  f64 event_last_sent;    /**< Time the last event of this slot was sent */
+} cbs_event_slot_t;
+
+/** \brief Per-thread data path state */
+typedef struct
+{
+  CLIB_CACHE_LINE_ALIGN_MARK (cacheline0);
+  cbs_wheel_t **wheel_by_shaper;         /**< This thread's wheels, indexed by shaper index */
+  cbs_wheel_t **active_wheels;           /**< Backlogged wheels, min-heap on next_check_time */
+  u32 n_wheels;                          /**< Wheels this thread owns; cbs-wheel polls while non-zero */
+  cbs_event_slot_t *event_by_shaper;     /**< Congestion events, indexed by shaper index */
+  cbs_arena_t arena;                     /**< Memory of this thread's wheels */
+  f64 *tx_finish_time_by_hw_if_index;    /**< Port busy timeline shared by all shapers of a port */
+  cbs_tx_port_t *tx_port_by_hw_if_index; /**< TX backpressure state per port */
+  u32 *tx_ports_pending;                 /**< Ports sent to in the last poll (hw_if_index) */
+  cbs_tx_sent_t *tx_sent;                /**< Frames handed over in the last poll (CBS_TX_SENT_MAX allocated) */
+  f64 last_poll_time;                    /**< Previous cbs-wheel run, to measure the poll interval */
+  f64 horizon;                           /**< Look-ahead of the current poll: min (last interval, horizon_max) */
+  volatile u32 events_pending;           /**< Set when any shaper of this thread posted an event */
+  u8 events_deferred;                    /**< Main thread only: a slot still holds rate-limited events */
+  u32 n_wheels_pausing_input[2];         /**< Wheels holding each cross-connect port's RX paused on this thread */
+  vnet_hw_if_rxq_poll_vector_t *paused_rxqs[2]; /**< RX queues of each port taken out of this thread's poll vector */
+  vnet_hw_if_rxq_poll_vector_t *paused_poll_vector[2]; /**< Poll vector they were taken from (replaced = stale) */
+
+  /* Timeline capture ring ("set cbs capture"): this thread produces, cbs-capture-process consumes */
+  cbs_capture_record_t *capture_ring;    /**< Power-of-2 sized, 0 while capture is off */
+  u32 capture_mask;                      /**< Ring size - 1 */
+  volatile u32 capture_head;             /**< Next record to write */
+  u64 capture_lost;                      /**< Records dropped on a full ring */
+  CLIB_CACHE_LINE_ALIGN_MARK (capture_consumer);
+  volatile u32 capture_tail;             /**< Next record to read, written by the main thread */
+} cbs_per_thread_t;
+
+
+/** \brief Configuration arguments as supplied by CLI/API (user units) */
+typedef struct
+{
+  cbs_algo_t algo;            /**< Eligibility algorithm */
+  f64 port_rate_bps;          /**< Port rate in bits/sec (all algorithms) */
+  f64 idleslope_kbps;         /**< CBS idleslope in kbps */
+  f64 hicredit_bytes;         /**< CBS hicredit */
+  f64 locredit_bytes;         /**< CBS locredit */
+  f64 rate_bps;               /**< TBF rate / ATS committed information rate in bits/sec */
+  f64 burst_bytes;            /**< TBF bucket depth / ATS committed burst size */
+  f64 bandwidth_bps_hint;     /**< Wheel sizing hint (0 = port rate) */
+  u32 packet_size;            /**< Average packet size hint (0 = default) */
+  i32 frame_overhead;         /**< Per-frame overhead in bytes */
+  f64 max_residence_us;       /**< Max residence time in microseconds (0 = no limit) */
+  cbs_accounting_mode_t accounting_mode;
+  cbs_gso_mode_t gso_mode;
+} cbs_config_args_t;
+
+// Mandatory shaper parameters seen by unformat_cbs_shaper_param
+#define CBS_PARAM_PORT_RATE (1 << 0)
+#define CBS_PARAM_IDLESLOPE (1 << 1)
+#define CBS_PARAM_HICREDIT  (1 << 2)
+#define CBS_PARAM_LOCREDIT  (1 << 3)
+#define CBS_PARAM_RATE      (1 << 4)
+#define CBS_PARAM_BURST     (1 << 5)
+
+/** \brief One entry of a bulk shaper change (see cbs_shaper_add_del) */
+typedef struct
+{
+  u32 shaper_index;           /**< Shaper id to create, reconfigure or delete */
+  u8 is_add;                  /**< 0 = delete */
+  cbs_config_args_t args;     /**< Requested configuration (add only) */
+  /* Filled in while preparing, before the barrier */
+  cbs_shaper_t shaper;        /**< Validated parameters */
+} cbs_shaper_update_t;
+
+/** \brief Live counters of one shaper, summed over all threads */
+typedef struct
+{
+  u32 queue_depth;            /**< Packets currently buffered */
+  u64 enqueued;
+  u64 enqueued_bytes;
+  u64 dropped;
+  u64 dropped_bytes;
+  u64 expired;
+  u64 expired_bytes;
+  u64 transmitted;
+  u64 transmitted_bytes;
+} cbs_shaper_counters_t;
+
+/**
+ * \brief Per-algorithm control-plane operations.
+ * Only used on the main thread; the data path specializes on the
+ * algorithm at compile time instead of calling through this table.
+ */
+typedef struct
+{
+  char *name;
+  /** Validate algorithm-specific arguments, returns 0 or VNET_API_ERROR_* */
+  int (*validate) (const cbs_config_args_t * a);
+  /** Store algorithm-specific parameters (converted to bytes/sec) */
+  void (*apply) (cbs_shaper_t * shaper, const cbs_config_args_t * a);
+  /** Format algorithm-specific parameters for "show cbs" */
+  format_function_t *format_params;
+} cbs_algo_ops_t;
 
 /** \brief Trace actions for enqueue node (node.c) */
 typedef enum {
     CBS_TRACE_ACTION_BUFFER,            /**< Packet buffered into the wheel */
     CBS_TRACE_ACTION_DROP_WHEEL_FULL,   /**< Packet dropped because the wheel was full */
     CBS_TRACE_ACTION_DROP_LOOKUP_FAIL,  /**< Packet dropped due to lookup failure */
+    CBS_TRACE_ACTION_DROP_STREAM_SDU,   /**< Packet dropped: larger than its stream's max frame size */
+    CBS_TRACE_ACTION_DROP_STREAM_METER, /**< Packet dropped: its stream exceeded its reservation */
 } cbs_trace_action_t;
 
 
@@ -68,10 +423,102 @@ typedef struct cbs_node_ctx
 {
   u32 *drop;          /**< Pointer to array for dropped buffer indices */
   u32 n_buffered;     /**< Number of packets buffered to the wheel in this frame */
-  // u32 n_lookup_drop;  /**< Number of packets dropped due to lookup failure (removed) */
+  u32 n_lookup_drop;  /**< Number of packets dropped for lack of interface/shaper/wheel */
+  u32 n_sdu_drop;     /**< Number of packets dropped by a stream filter's max SDU check */
+  u32 n_meter_drop;   /**< Number of packets dropped by a stream filter's meter */
+  f64 now;            /**< Frame arrival time (ATS eligibility assignment) */
+  cbs_per_thread_t *ptd; /**< This thread's data path state */
+  u32 thread_index;   /**< For the stats segment counters */
 } cbs_node_ctx_t;
 
 
+/** \brief A want_cbs_events subscriber */
+typedef struct
+{
+  u32 client_index;       /**< API client to send cbs_event to */
+  u32 client_pid;         /**< Echoed in every event */
+} cbs_event_registration_t;
+
+/** \brief One registered stream (see cbs_reservation.c) */
+typedef struct
+{
+  u32 stream_id;            /**< Id chosen by the talker's control plane */
+  u32 shaper_index;         /**< Traffic class the bandwidth is reserved in */
+  u32 max_frame_size;       /**< Largest frame (L2 without FCS, charged like the shaper charges buffers) */
+  u32 frames_per_interval;  /**< Most frames sent in one class measurement interval */
+  u8 has_filter;            /**< Frames matching filter_key are policed to the reservation */
+  u64 filter_key;           /**< cbs_stream_filter_key of the stream's DMAC and VID */
+} cbs_stream_t;
+
+/**
+ * \brief 802.1Qci flow meter of a filtered stream, indexed by stream pool
+ * index. One meter for all threads: RSS may spread a stream over several
+ * workers, and a meter per thread would let it through once per thread.
+ * The bucket is a virtual time (GCRA) taken with one compare-and-swap, as
+ * in cbs_shared.h; a cache line per stream keeps streams from contending.
+ * The main thread writes the parameters, the enqueue path the bucket.
+ */
+typedef struct
+{
+  CLIB_CACHE_LINE_ALIGN_MARK (cacheline0);
+  volatile u64 tat;         /**< Time the bucket was last empty (ns of vlib time, 0 = full) */
+  f64 ns_per_byte;          /**< Inverse of the reserved rate, charged like the shaper charges */
+  u64 burst_ns;             /**< Bucket depth as time at rate: one interval's worth of frames */
+  u32 shaper_index;         /**< Class the stream is reserved in; frames to other classes pass */
+  u16 max_sdu;              /**< Largest frame accepted (L2 without FCS) */
+  u16 pad;
+} cbs_stream_meter_t;
+
+STATIC_ASSERT_SIZEOF (cbs_stream_meter_t, CLIB_CACHE_LINE_BYTES);
+
+/** \brief Reservation parameters and derived slopes of one CBS traffic class */
+typedef struct
+{
+  f64 interval;             /**< Class measurement interval in seconds */
+  u32 share_pct;            /**< Reservable share of the port rate */
+  u32 max_interference;     /**< Largest lower priority frame that may delay the class (L2 bytes) */
+  u32 n_streams;            /**< Streams admitted; the class slopes are derived while non-zero */
+  cbs_engine_params_t configured; /**< Operator slopes restored when the last stream is withdrawn */
+} cbs_reservation_t;
+
+/** \brief A shaper's attachment to a shared segment (main thread only, see cbs_shared.c) */
+typedef struct
+{
+  u8 *name;                       /**< Segment name (without the leading '/'), 0 while detached */
+  cbs_shared_segment_t *seg;      /**< Mapping of the segment */
+  u32 member_index;               /**< Member slot held by this instance */
+  u64 lease_expiry;               /**< Expiry last written to the slot (reclaimed by another instance if it changed) */
+  u64 lease_ns;                   /**< Lease granted on each renewal */
+  u32 batch;                      /**< Bytes reserved at a time */
+} cbs_shared_attach_t;
+
+/** \brief Demand-driven idleslope controller of one CBS class (main thread only, see cbs_adaptive.c) */
+typedef struct
+{
+  u8 is_enabled;
+  f64 min_idleslope;        /**< Administrative bounds, bytes/sec */
+  f64 max_idleslope;
+  f64 hysteresis;           /**< Fraction of the current idleslope the target must move by */
+  f64 headroom;             /**< Fraction granted above the measured demand */
+  cbs_engine_params_t base; /**< Operator slopes: credit bounds scale from these, restored on disable */
+  f64 demand;               /**< Smoothed arrival rate, bytes/sec (0 = not sampled yet) */
+  u64 last_bytes;           /**< Enqueued + dropped bytes at the previous sample */
+  u64 last_packets;         /**< Enqueued + dropped packets at the previous sample */
+  f64 last_sample;          /**< Time of the previous sample */
+  u64 n_adjustments;        /**< Idleslope changes published */
+} cbs_adaptive_t;
+
+/** \brief Timeline capture session (main thread only, see cbs_capture.c) */
+typedef struct
+{
+  u8 *file_name;                  /**< Capture file, 0 while no capture is running */
+  int fd;
+  cbs_capture_header_t *header;   /**< Start of the shared file mapping */
+  cbs_capture_record_t *records;  /**< Record array following the header */
+  u64 map_size;                   /**< Bytes mapped */
+  cbs_capture_record_t **rings;   /**< Per-thread rings, still drained after the data path lets go */
+} cbs_capture_t;
+
 /** \brief Main CBS Plugin State */
 typedef struct
 {
@@ -83,41 +530,525 @@ typedef struct
 
   /* Feature arcs */
   u16 arc_index;      /**< Index for the "interface-output" feature arc */
+  u32 *wheel_next_by_feature_next; /**< cbs-output-feature next -> cbs-wheel next (ip4/ip6-output arcs resume there) */
 
   /* Configuration State */
-  int is_configured;    /**< Flag indicating if CBS parameters are set */
-
-  /* CBS Parameters (converted to bytes/sec where applicable) */
-  f64 cbs_port_rate;    /**< Port rate in bytes/sec */
-  f64 cbs_idleslope;    /**< Idle slope in bytes/sec */
-  f64 cbs_sendslope;    /**< Send slope in bytes/sec (idleslope - port_rate) */
-  f64 cbs_hicredit;     /**< High credit limit in bytes */
-  f64 cbs_locredit;     /**< Low credit limit in bytes */
+  int is_configured;    /**< Flag indicating if at least one shaper is configured */
 
-  /* Wheel Sizing Parameters */
-  u32 packet_size;      /**< Average packet size hint (bytes) */
-  f64 configured_bandwidth; /**< Bandwidth hint used for wheel sizing (bytes/sec) */
-  u32 wheel_slots_per_wrk; /**< Number of slots per worker thread wheel */
+  /* Shapers, indexed by shaper id (sparse, see cbs_shaper_t.is_valid) */
+  cbs_shaper_t *shapers;
 
   /* Per-thread data */
-  cbs_wheel_t **wheel_by_thread; /**< Vector of pointers to per-thread wheels */
+  cbs_per_thread_t *per_thread; /**< Vector of per-thread data path state */
 
   /* Cross Connect specific state */
   u32 sw_if_index0;     /**< First sw_if_index for cross-connect mode (~0 if not used) */
   u32 sw_if_index1;     /**< Second sw_if_index for cross-connect mode (~0 if not used) */
-  u32 output_next_index0; /**< Next node index after wheel for sw_if_index0 output */
-  u32 output_next_index1; /**< Next node index after wheel for sw_if_index1 output */
+  u8 xc_lossless;       /**< Pause RX polling on a filling wheel instead of dropping */
+  u32 xc_input_node_index[2]; /**< Device input nodes of the two ports (~0 if not used) */
+  u32 xc_dev_instance[2];     /**< Driver instances of the two ports, as in the input nodes' poll vectors */
+
+  /* Interface state (output feature and cross-connect peers) */
+  cbs_interface_t *interface_by_sw_if_index; /**< Vector mapping sw_if_index to shaper/next/port */
+
+  /* Congestion events */
+  u32 event_high_pct;     /**< High watermark, percent of wheel size (0 = events off) */
+  u32 event_low_pct;      /**< Low watermark, percent of wheel size */
+  f64 event_starvation_time; /**< Seconds of negative credit before CREDIT_STARVED */
+  f64 event_min_interval; /**< Rate limit: minimum seconds between events of one wheel */
+  cbs_event_registration_t *event_registrations; /**< Pool of want_cbs_events subscribers */
+  uword *event_registration_by_client_index; /**< client_index -> pool index */
+
+  /* Stats segment counters, indexed by shaper id */
+  vlib_combined_counter_main_t counters[CBS_N_COUNTER]; /**< See foreach_cbs_counter */
+  vlib_simple_counter_main_t queue_depth; /**< "/cbs/queue-depth": per-thread wheel occupancy, sampled each poll */
 
-  /* Output Feature specific state */
-  u32 *output_next_index_by_sw_if_index; /**< Vector mapping sw_if_index to next node index after wheel */
+  /* Transmission horizon ("set cbs horizon") */
+  f64 horizon_max;        /**< Upper bound on the look-ahead in seconds (0 = send only what is eligible now) */
+
+  /* Lazy per-thread wheels */
+  uword arena_size;       /**< Address space reserved per thread */
+  f64 wheel_idle_timeout; /**< Seconds an empty wheel is kept before its memory is reclaimed */
+
+  /* TX backpressure ("set cbs backpressure") */
+  f64 tx_backoff;         /**< First hold of a port after TX errors in seconds (0 = off) */
+
+  /* Stream reservations (cbs_reservation.c) */
+  cbs_stream_t *streams;                  /**< Pool of admitted streams */
+  uword *stream_index_by_id;              /**< stream_id -> pool index */
+  cbs_reservation_t *reservation_by_shaper; /**< Per-class reservation parameters, indexed by shaper id */
+  clib_bihash_8_8_t stream_filter_table;  /**< cbs_stream_filter_key -> stream pool index */
+  u32 n_stream_filters;                   /**< Filters installed; the enqueue path skips the lookup while 0 */
+  cbs_stream_meter_t *stream_meters;      /**< Stream filter meters, indexed by stream pool index */
+  vlib_simple_counter_main_t stream_drops; /**< "/cbs/stream-drops": frames dropped by a stream filter, per stream index */
+
+  /* Event logger */
+  u8 elog_enabled;        /**< Log shaping decisions to the event logger ("set cbs elog") */
+
+  /* Timeline capture (cbs_capture.c) */
+  cbs_capture_t capture;
+
+  /* Aggregate shaping across VPP instances (cbs_shared.c) */
+  cbs_shared_attach_t *shared_by_shaper; /**< Indexed by shaper id */
+  u32 n_shared_attached;  /**< Attachments whose leases cbs-shared-lease renews */
+
+  /* Adaptive idleslope (cbs_adaptive.c) */
+  cbs_adaptive_t *adaptive_by_shaper;     /**< Indexed by shaper id */
+  u32 n_adaptive;                         /**< Controllers enabled; cbs-adaptive-process sleeps while 0 */
+  f64 adaptive_interval;                  /**< Seconds between samples */
+  vlib_simple_counter_main_t idleslope_gauge; /**< "/cbs/idleslope": bits/sec in effect, per adaptive shaper */
+  vlib_simple_counter_main_t idleslope_adjustments; /**< "/cbs/idleslope-adjustments": changes published, per shaper */
 
 } cbs_main_t;
 
 extern cbs_main_t cbs_main;
+extern const cbs_algo_ops_t cbs_algo_ops[CBS_N_ALGO];
+
+/** @brief Look up a configured shaper, 0 if the index is unused */
+always_inline cbs_shaper_t *
+cbs_shaper_get_if_valid (cbs_main_t * cbsm, u32 shaper_index)
+{
+  if (shaper_index >= vec_len (cbsm->shapers) || !cbsm->shapers[shaper_index].is_valid)
+    return 0;
+  return vec_elt_at_index (cbsm->shapers, shaper_index);
+}
+
+/**
+ * @brief Replace a shaper's engine parameters while workers keep running.
+ * Main thread only. The version is odd while the copy is in flight, so a
+ * worker reading through cbs_shaper_params_read never acts on a mix of old
+ * and new slopes; it simply reads again.
+ */
+always_inline void
+cbs_shaper_params_publish (cbs_shaper_t * shaper, const cbs_engine_params_t * p)
+{
+  clib_atomic_store_relax_n (&shaper->eng_version, shaper->eng_version + 1);
+  __atomic_thread_fence (__ATOMIC_RELEASE);
+  shaper->eng = *p;
+  clib_atomic_store_rel_n (&shaper->eng_version, shaper->eng_version + 1);
+}
+
+/** @brief Consistent copy of a shaper's engine parameters (see cbs_shaper_params_publish). */
+always_inline void
+cbs_shaper_params_read (const cbs_shaper_t * shaper, cbs_engine_params_t * p)
+{
+  u32 version;
+
+  do
+    {
+      version = clib_atomic_load_acq_n (&shaper->eng_version);
+      *p = shaper->eng;
+      __atomic_thread_fence (__ATOMIC_ACQUIRE);
+    }
+  while (PREDICT_FALSE ((version & 1) || clib_atomic_load_relax_n (&shaper->eng_version) != version));
+}
+
+/**
+ * @brief Give the bytes a wheel took from its shaper's shared segment and
+ * did not send back to the segment, so the other instances can use them
+ * now rather than after the lease runs out. Barrier must be held.
+ */
+always_inline void
+cbs_wheel_return_shared_grant (cbs_shaper_t * shaper, cbs_wheel_t * wp)
+{
+  u32 n_bytes = wp->shared_grant > 0 ? (u32) wp->shared_grant : 0;
+
+  if (shaper->shared && n_bytes)
+    {
+      cbs_shared_return (shaper->shared, cbs_shared_now (), n_bytes);
+      if (shaper->shared_member)
+        clib_atomic_fetch_sub_relax (&shaper->shared_member->n_bytes, n_bytes);
+    }
+  wp->shared_grant = 0;
+}
+
+/**
+ * @brief Stop polling the RX queues of cross-connect port @c side on this
+ * thread: take them out of the input node's poll vector and keep them
+ * aside. Other ports of the same driver, and the port's queues on other
+ * threads, are still polled. Queues in interrupt mode are not paused.
+ * No allocation: paused_rxqs is sized for the port's queues under the
+ * barrier (cbs_cross_connect_set_input), and the poll vector keeps the
+ * room the queues leave for cbs_xc_rx_resume.
+ */
+always_inline void
+cbs_xc_rx_pause (vlib_main_t * vm, cbs_per_thread_t * ptd, u32 side)
+{
+  cbs_main_t *cbsm = &cbs_main;
+  vnet_hw_if_rx_node_runtime_t *rt;
+  u32 i = 0;
+
+  if (cbsm->xc_input_node_index[side] == ~0)
+    return;
+  rt = vlib_node_get_runtime_data (vm, cbsm->xc_input_node_index[side]);
+  while (i < vec_len (rt->rxq_vector_poll))
+    {
+      if (rt->rxq_vector_poll[i].dev_instance != cbsm->xc_dev_instance[side])
+        {
+          i++;
+          continue;
+        }
+      vec_add1 (ptd->paused_rxqs[side], rt->rxq_vector_poll[i]);
+      vec_del1 (rt->rxq_vector_poll, i);
+    }
+  ptd->paused_poll_vector[side] = rt->rxq_vector_poll;
+}
+
+/**
+ * @brief Give the queues taken by cbs_xc_rx_pause back to the poll vector.
+ * If the main thread rebuilt the vector meanwhile (RX placement changed),
+ * it already holds this thread's queues and the kept ones are stale.
+ */
+always_inline void
+cbs_xc_rx_resume (vlib_main_t * vm, cbs_per_thread_t * ptd, u32 side)
+{
+  cbs_main_t *cbsm = &cbs_main;
+  vnet_hw_if_rx_node_runtime_t *rt;
+  vnet_hw_if_rxq_poll_vector_t *paused, *pv;
+
+  if (cbsm->xc_input_node_index[side] == ~0)
+    goto done;
+  rt = vlib_node_get_runtime_data (vm, cbsm->xc_input_node_index[side]);
+  if (rt->rxq_vector_poll != ptd->paused_poll_vector[side])
+    goto done;
+  vec_foreach (paused, ptd->paused_rxqs[side])
+    {
+      vec_foreach (pv, rt->rxq_vector_poll)
+        if (pv->dev_instance == paused->dev_instance && pv->queue_id == paused->queue_id)
+          break;
+      if (pv == vec_end (rt->rxq_vector_poll))
+        vec_add1 (rt->rxq_vector_poll, *paused);
+    }
+done:
+  vec_reset_length (ptd->paused_rxqs[side]);
+  ptd->paused_poll_vector[side] = 0;
+}
+
+/**
+ * @brief Lossless cross-connect: the wheel crossed its pause threshold, so
+ * stop polling, on this thread, the RX queues of the port the frame came
+ * from and let the NIC ring hold the burst. The reverse direction keeps
+ * flowing until its own frames cross the threshold. Owning thread, or
+ * main under the barrier.
+ */
+always_inline void
+cbs_wheel_pause_input (vlib_main_t * vm, cbs_per_thread_t * ptd, cbs_wheel_t * wp,
+                       u32 rx_sw_if_index)
+{
+  u32 side = rx_sw_if_index == cbs_main.sw_if_index0 ? 0 : 1;
+
+  if (wp->pausing_input & (1 << side))
+    return;
+  wp->pausing_input |= 1 << side;
+  if (ptd->n_wheels_pausing_input[side]++ == 0)
+    cbs_xc_rx_pause (vm, ptd, side);
+}
+
+/** @brief Undo cbs_wheel_pause_input once the wheel drained to its low threshold. */
+always_inline void
+cbs_wheel_resume_input (vlib_main_t * vm, cbs_per_thread_t * ptd, cbs_wheel_t * wp)
+{
+  u32 side;
+
+  for (side = 0; side < 2; side++)
+    if ((wp->pausing_input & (1 << side)) && --ptd->n_wheels_pausing_input[side] == 0)
+      cbs_xc_rx_resume (vm, ptd, side); // No other wheel still needs the pause
+  wp->pausing_input = 0;
+}
+
+/**
+ * @brief Post a congestion event from the owning thread.
+ * Only called on state transitions, so the atomics are off the per-packet
+ * path; the main thread takes the bits in cbs-event-process. An event
+ * replaces a still pending one of the opposite state, so at most one bit
+ * of each pair is pending and it is the latest state.
+ */
+always_inline void
+cbs_wheel_post_event (cbs_per_thread_t * ptd, cbs_wheel_t * wp, cbs_event_t event)
+{
+  cbs_event_slot_t *es = vec_elt_at_index (ptd->event_by_shaper, wp->shaper_index);
+
+  clib_atomic_fetch_and (&es->pending_events, ~cbs_event_opposite (event));
+  clib_atomic_fetch_or (&es->pending_events, event);
+  ptd->events_pending = 1;
+
+  if (PREDICT_FALSE (cbs_main.elog_enabled))
+    {
+      ELOG_TYPE_DECLARE (e) = {
+        .format = "cbs-event: shaper %d %s, depth %d",
+        .format_args = "i4t4i4",
+        .n_enum_strings = 6,
+        .enum_strings = {
+#define _(sym, bit, str) str,
+          foreach_cbs_event
+#undef _
+        },
+      };
+      struct { u32 shaper; u32 event; u32 depth; } *ed;
+      ed = ELOG_TRACK_DATA (vlib_get_elog_main (), e,
+                            vlib_worker_threads[vlib_get_thread_index ()].elog_track);
+      ed->shaper = wp->shaper_index;
+      ed->event = count_trailing_zeros (event);
+      ed->depth = wp->cursize;
+    }
+}
+
+/**
+ * @brief Append one dequeue decision to this thread's capture ring.
+ * Single producer: the record is written before the head is published,
+ * and a full ring loses the record rather than stalling the wheel.
+ */
+always_inline void
+cbs_capture_add (cbs_per_thread_t * ptd, cbs_wheel_t * wp, cbs_wheel_entry_t * ep,
+                 u32 thread_index, cbs_algo_t algo, f64 now, f64 credits_before)
+{
+  u32 head = ptd->capture_head;
+  cbs_capture_record_t *r;
+
+  if (PREDICT_FALSE (head - clib_atomic_load_acq_n (&ptd->capture_tail) > ptd->capture_mask))
+    {
+      ptd->capture_lost++;
+      return;
+    }
+  r = ptd->capture_ring + (head & ptd->capture_mask);
+  r->time = now;
+  r->wait = now - ep->enqueue_time;
+  r->credits_before = credits_before;
+  r->credits_after = wp->eng.credits;
+  r->length = ep->wire_length;
+  r->next_index = ep->output_next_index;
+  r->shaper_index = wp->shaper_index;
+  r->thread_index = thread_index;
+  r->algo = algo;
+  r->reserved = 0;
+  clib_atomic_store_rel_n (&ptd->capture_head, head + 1);
+}
+
+/*
+ * Active wheel scheduling: each thread keeps its backlogged wheels in a
+ * binary min-heap keyed by the earliest time their head may be sent, so
+ * cbs-wheel only touches wheels that are due and its idle cost does not
+ * grow with the number of shapers. Keys are lower bounds (see
+ * cbs_engine_next_check_time); a wheel polled early just stalls and is
+ * re-keyed. The heap has room for every wheel (cbs_shaper_install), so
+ * the data path never allocates.
+ */
+always_inline void
+cbs_active_set (cbs_per_thread_t * ptd, u32 i, cbs_wheel_t * wp)
+{
+  ptd->active_wheels[i] = wp;
+  wp->active_index = i;
+}
+
+always_inline void
+cbs_active_sift_up (cbs_per_thread_t * ptd, u32 i)
+{
+  cbs_wheel_t *wp = ptd->active_wheels[i];
+
+  while (i > 0)
+    {
+      u32 parent = (i - 1) / 2;
+      if (ptd->active_wheels[parent]->next_check_time <= wp->next_check_time)
+        break;
+      cbs_active_set (ptd, i, ptd->active_wheels[parent]);
+      i = parent;
+    }
+  cbs_active_set (ptd, i, wp);
+}
+
+always_inline void
+cbs_active_sift_down (cbs_per_thread_t * ptd, u32 i)
+{
+  cbs_wheel_t *wp = ptd->active_wheels[i];
+  u32 n = vec_len (ptd->active_wheels), child;
+
+  while ((child = 2 * i + 1) < n)
+    {
+      if (child + 1 < n &&
+          ptd->active_wheels[child + 1]->next_check_time < ptd->active_wheels[child]->next_check_time)
+        child++;
+      if (wp->next_check_time <= ptd->active_wheels[child]->next_check_time)
+        break;
+      cbs_active_set (ptd, i, ptd->active_wheels[child]);
+      i = child;
+    }
+  cbs_active_set (ptd, i, wp);
+}
+
+/** @brief Schedule a wheel that just became backlogged. */
+always_inline void
+cbs_active_insert (cbs_per_thread_t * ptd, cbs_wheel_t * wp, f64 time)
+{
+  wp->next_check_time = time;
+  vec_add1 (ptd->active_wheels, wp);
+  cbs_active_sift_up (ptd, vec_len (ptd->active_wheels) - 1);
+}
+
+/** @brief Move a scheduled wheel to a new check time. */
+always_inline void
+cbs_active_update (cbs_per_thread_t * ptd, cbs_wheel_t * wp, f64 time)
+{
+  f64 old = wp->next_check_time;
+
+  wp->next_check_time = time;
+  if (time < old)
+    cbs_active_sift_up (ptd, wp->active_index);
+  else
+    cbs_active_sift_down (ptd, wp->active_index);
+}
+
+/** @brief Unschedule a wheel (ran empty, or is being freed). */
+always_inline void
+cbs_active_remove (cbs_per_thread_t * ptd, cbs_wheel_t * wp)
+{
+  u32 i = wp->active_index;
+  cbs_wheel_t *last = vec_pop (ptd->active_wheels);
+
+  wp->active_index = ~0;
+  if (last == wp)
+    return;
+  cbs_active_set (ptd, i, last);
+  cbs_active_sift_down (ptd, i);
+  cbs_active_sift_up (ptd, last->active_index);
+}
+
+/** @brief Sum of the port's TX node error counters on this thread. */
+always_inline u64
+cbs_tx_port_errors (vlib_main_t * vm, cbs_tx_port_t * tp)
+{
+  u64 *c = vm->error_main.counters + tp->error_heap_index, sum = 0;
+  u32 i;
+
+  for (i = 0; i < tp->n_errors; i++)
+    sum += c[i];
+  return sum;
+}
+
+/**
+ * @brief Track how long a backlogged CBS class stays ineligible.
+ * Called whenever cbs-wheel visits the wheel, before and after sending.
+ * Credits are clamped at locredit, so "starved" means negative credit for
+ * longer than the threshold rather than credit below locredit.
+ */
+always_inline void
+cbs_wheel_track_starvation (cbs_per_thread_t * ptd, cbs_wheel_t * wp, f64 now)
+{
+  if (wp->eng.credits < 0.0)
+    {
+      if (wp->starved_since == 0)
+        wp->starved_since = now;
+      else if (PREDICT_FALSE (!wp->is_starved && wp->event_high_slots != ~0 &&
+                              now - wp->starved_since >= wp->event_starvation_time))
+        {
+          wp->is_starved = 1;
+          cbs_wheel_post_event (ptd, wp, CBS_EVENT_CREDIT_STARVED);
+        }
+    }
+  else if (wp->starved_since != 0)
+    {
+      wp->starved_since = 0;
+      if (PREDICT_FALSE (wp->is_starved))
+        {
+          wp->is_starved = 0;
+          cbs_wheel_post_event (ptd, wp, CBS_EVENT_CREDIT_RECOVERED);
+        }
+    }
+}
+
+/**
+ * @brief Bytes charged for a single frame of @c len bytes (as seen in the buffer).
+ * In L1 mode short frames are padded to the Ethernet minimum before the
+ * fixed overhead is added.
+ */
+always_inline u32
+cbs_frame_wire_length (cbs_shaper_t * shaper, u32 len)
+{
+  return cbs_engine_wire_length (len, shaper->accounting_mode == CBS_ACCOUNTING_L1 ? CBS_ETH_MIN_FRAME_BYTES : 0,
+                                 shaper->frame_overhead_total);
+}
+
+/**
+ * @brief Bytes charged for a buffer (chain), accounting for GSO.
+ * A GSO super-packet is charged as the sequence of segments it will be
+ * split into: each segment repeats the L2-L4 headers and pays the per-frame
+ * overhead. The port timeline then advances by the real wire time, which
+ * paces whatever follows the super-packet.
+ */
+always_inline u32
+cbs_buffer_wire_length (vlib_main_t * vm, cbs_shaper_t * shaper, vlib_buffer_t * b)
+{
+  u32 len = vlib_buffer_length_in_chain (vm, b);
+
+  if (PREDICT_FALSE ((b->flags & VNET_BUFFER_F_GSO) &&
+                     shaper->gso_mode == CBS_GSO_MODE_SEGMENTS))
+    {
+      u32 gso_size = vnet_buffer2 (b)->gso_size;
+      i32 hdr_len = vnet_buffer (b)->l4_hdr_offset +
+                    vnet_buffer2 (b)->gso_l4_hdr_sz - b->current_data;
+
+      if (PREDICT_TRUE (gso_size > 0 && hdr_len > 0 && len > (u32) hdr_len))
+        {
+          u32 payload = len - hdr_len;
+          u32 n_segs = (payload + gso_size - 1) / gso_size;
+          u32 last_seg = payload - (n_segs - 1) * gso_size;
+
+          return (n_segs - 1) * cbs_frame_wire_length (shaper, hdr_len + gso_size) +
+                 cbs_frame_wire_length (shaper, hdr_len + last_seg);
+        }
+    }
+
+  return cbs_frame_wire_length (shaper, len);
+}
+
+/** @brief Stream filter key: destination MAC and VLAN id (0 = untagged or priority tagged) */
+always_inline u64
+cbs_stream_filter_key (const u8 * dmac, u16 vid)
+{
+  return (ethernet_mac_address_u64 (dmac) << 16) | vid;
+}
+
+// Control plane entry points shared with the debug CLIs (cbs.c)
+int cbs_shaper_add_del_bulk (cbs_main_t * cbsm, cbs_shaper_update_t * updates, u32 * failed_index);
+cbs_wheel_t *cbs_wheel_create (vlib_main_t * vm, cbs_per_thread_t * ptd, u32 shaper_index);
+void cbs_wheel_release (vlib_main_t * vm, cbs_per_thread_t * ptd, cbs_wheel_t * wp);
+int cbs_configure_internal (cbs_main_t * cbsm, u32 shaper_index, const cbs_config_args_t * a);
+int cbs_cross_connect_enable_disable (cbs_main_t * cbsm, u32 sw_if_index0, u32 sw_if_index1,
+                                      u32 shaper_index, int enable_disable, u8 is_lossless,
+                                      cbs_drain_mode_t drain);
+int cbs_output_feature_enable_disable (cbs_main_t * cbsm, u32 sw_if_index, u32 shaper_index,
+                                       u8 arcs, int enable_disable, cbs_drain_mode_t drain);
+extern const char *cbs_output_arc_names[CBS_N_OUTPUT_ARC];
+unformat_function_t unformat_cbs_output_arcs;
+format_function_t format_cbs_output_arcs;
+unformat_function_t unformat_cbs_drain_mode;
+format_function_t format_cbs_drain_mode;
+int cbs_interface_set_tx_queue (cbs_main_t * cbsm, u32 sw_if_index, u32 queue_id);
+
+// Shaper parameter parsing shared by "set cbs" and the startup config (cbs.c)
+void cbs_config_args_init (cbs_config_args_t * a);
+unformat_function_t unformat_cbs_shaper_param;
+unformat_function_t unformat_cbs_rate;
+format_function_t format_cbs_rate;
+clib_error_t *cbs_config_args_check (const cbs_config_args_t * a, u32 params_set);
+
+// Stream reservations (cbs_reservation.c)
+int cbs_stream_add_del (cbs_main_t * cbsm, u32 stream_id, u32 shaper_index, u32 max_frame_size,
+                        u32 frames_per_interval, int is_add);
+void cbs_reservation_shaper_installed (cbs_main_t * cbsm, u32 shaper_index);
+int cbs_stream_filter_add_del (cbs_main_t * cbsm, u32 stream_id, const u8 * dmac, u16 vid, int is_add);
+format_function_t format_cbs_reservation;
+
+// Adaptive idleslope (cbs_adaptive.c)
+void cbs_adaptive_shaper_installed (cbs_main_t * cbsm, u32 shaper_index);
+format_function_t format_cbs_adaptive;
+
+// Aggregate shaping across VPP instances (cbs_shared.c)
+void cbs_shared_shaper_installed (cbs_main_t * cbsm, u32 shaper_index);
+format_function_t format_cbs_shared;
 
 // Node registrations (defined in respective .c files)
 extern vlib_node_registration_t cbs_cross_connect_node;
 extern vlib_node_registration_t cbs_output_feature_node;
 extern vlib_node_registration_t cbs_input_node; // The dequeue node ("cbs-wheel")
 
-#endif /* __included_cbs_h__ */
\ No newline at end of file
+#endif /* __included_cbs_h__ */
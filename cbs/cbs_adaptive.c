@@ -0,0 +1,329 @@
+/*
+ * cbs_adaptive.c - VPP CBS plugin demand-driven idleslope
+ * cbs-adaptive-process samples each enabled class's arrivals (enqueued and
+ * dropped bytes) and backlog (queue depth) every interval, and moves its
+ * idleslope towards the demand within the operator's bounds. Slopes reach
+ * the workers through cbs_shaper_params_publish; wheels are never rebuilt.
+ *
+ * Copyright (c) 2024 Your Org <your.email@example.com> // Placeholder
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ */
+
+#include <vlib/vlib.h>
+#include <vnet/vnet.h>
+#include <vppinfra/error.h>
+#include <vppinfra/format.h>
+#include <cbs/cbs.h>
+
+#define CBS_ADAPTIVE_EWMA 0.25          /**< Weight of the newest arrival rate sample */
+#define CBS_ADAPTIVE_DRAIN_INTERVALS 4  /**< Backlog is budgeted to drain over this many intervals */
+
+vlib_node_registration_t cbs_adaptive_process_node;
+
+static cbs_adaptive_t *
+cbs_adaptive_get (cbs_main_t * cbsm, u32 shaper_index)
+{
+  vec_validate (cbsm->adaptive_by_shaper, shaper_index);
+  return vec_elt_at_index (cbsm->adaptive_by_shaper, shaper_index);
+}
+
+/**
+ * @brief The operator's slopes with idleslope moved to @c idleslope.
+ * The credit bounds follow 802.1Q: hicredit scales with idleslope, locredit
+ * with sendslope, so the interference and frame sizes they encode stay put.
+ */
+/**
+ * @brief Whether slopes can be an adaptive base: the credit bounds are
+ * scaled by idleslope and sendslope, so neither may be 0.
+ */
+static int
+cbs_adaptive_base_is_valid (const cbs_engine_params_t * base)
+{
+  return base->algo == CBS_ALGO_CBS && base->idleslope > 0 && base->idleslope < base->port_rate;
+}
+
+static void
+cbs_adaptive_params (cbs_shaper_t * shaper, cbs_adaptive_t * ad, f64 idleslope, cbs_engine_params_t * p)
+{
+  *p = shaper->eng;
+  p->idleslope = idleslope;
+  p->sendslope = idleslope - p->port_rate;
+  p->hicredit = ad->base.hicredit * idleslope / ad->base.idleslope;
+  p->locredit = ad->base.locredit * p->sendslope / ad->base.sendslope;
+}
+
+static void
+cbs_adaptive_gauge (cbs_main_t * cbsm, u32 shaper_index, f64 idleslope)
+{
+  vlib_validate_simple_counter (&cbsm->idleslope_gauge, shaper_index);
+  vlib_set_simple_counter (&cbsm->idleslope_gauge, 0, shaper_index, (u64) (idleslope * CBS_BITS_PER_BYTE));
+}
+
+/** @brief Arrivals (enqueued and dropped) of a shaper so far, summed over threads */
+static void
+cbs_adaptive_arrivals (cbs_main_t * cbsm, u32 shaper_index, u64 * packets, u64 * bytes)
+{
+  vlib_counter_t enq, drop;
+
+  vlib_get_combined_counter (&cbsm->counters[CBS_COUNTER_ENQUEUED], shaper_index, &enq);
+  vlib_get_combined_counter (&cbsm->counters[CBS_COUNTER_DROPPED], shaper_index, &drop);
+  *packets = enq.packets + drop.packets;
+  *bytes = enq.bytes + drop.bytes;
+}
+
+/** @brief Take one sample of a class and publish a new idleslope if it moved far enough. */
+static void
+cbs_adaptive_sample (cbs_main_t * cbsm, u32 shaper_index, f64 now)
+{
+  cbs_shaper_t *shaper = vec_elt_at_index (cbsm->shapers, shaper_index);
+  cbs_adaptive_t *ad = vec_elt_at_index (cbsm->adaptive_by_shaper, shaper_index);
+  u64 packets, bytes, n_packets, n_bytes;
+  f64 dt = now - ad->last_sample, rate, avg_len, backlog, target, current;
+  cbs_engine_params_t p;
+
+  if (dt <= 0)
+    return;
+  cbs_adaptive_arrivals (cbsm, shaper_index, &packets, &bytes);
+  n_packets = packets - ad->last_packets;
+  n_bytes = bytes - ad->last_bytes;
+  ad->last_packets = packets;
+  ad->last_bytes = bytes;
+  ad->last_sample = now;
+
+  // Registered streams own the slopes while there are any
+  if (shaper_index < vec_len (cbsm->reservation_by_shaper) && cbsm->reservation_by_shaper[shaper_index].n_streams)
+    return;
+
+  rate = n_bytes / dt;
+  ad->demand = ad->demand == 0 ? rate : ad->demand + CBS_ADAPTIVE_EWMA * (rate - ad->demand);
+  // Queue depth is kept in packets; size them like this interval's arrivals
+  avg_len = n_packets ? (f64) n_bytes / n_packets : shaper->packet_size;
+  backlog = vlib_get_simple_counter (&cbsm->queue_depth, shaper_index) * avg_len;
+
+  target = (ad->demand + backlog / (CBS_ADAPTIVE_DRAIN_INTERVALS * cbsm->adaptive_interval)) * (1 + ad->headroom);
+  target = clib_max (clib_min (target, ad->max_idleslope), ad->min_idleslope);
+  current = shaper->eng.idleslope;
+  if ((target > current ? target - current : current - target) <= ad->hysteresis * current)
+    return;
+
+  cbs_adaptive_params (shaper, ad, target, &p);
+  cbs_shaper_params_publish (shaper, &p);
+  ad->n_adjustments++;
+  cbs_adaptive_gauge (cbsm, shaper_index, target);
+  vlib_increment_simple_counter (&cbsm->idleslope_adjustments, 0, shaper_index, 1);
+  vlib_log_notice (cbsm->log_class, "Adaptive: shaper %u idleslope %U -> %U (demand %U, backlog %.0f bytes)",
+                   shaper_index, format_cbs_rate, current, format_cbs_rate, target,
+                   format_cbs_rate, ad->demand, backlog);
+}
+
+static uword
+cbs_adaptive_process (vlib_main_t * vm, vlib_node_runtime_t * rt, vlib_frame_t * f)
+{
+  cbs_main_t *cbsm = &cbs_main;
+  uword *event_data = 0;
+  cbs_adaptive_t *ad;
+
+  while (1)
+    {
+      // Sleep until a controller is enabled, then sample every interval
+      if (cbsm->n_adaptive == 0)
+        vlib_process_wait_for_event (vm);
+      else
+        vlib_process_wait_for_event_or_clock (vm, cbsm->adaptive_interval);
+      vlib_process_get_events (vm, &event_data);
+      vec_reset_length (event_data);
+
+      vec_foreach (ad, cbsm->adaptive_by_shaper)
+        if (ad->is_enabled)
+          cbs_adaptive_sample (cbsm, ad - cbsm->adaptive_by_shaper, vlib_time_now (vm));
+    }
+  return 0;
+}
+
+VLIB_REGISTER_NODE (cbs_adaptive_process_node) = {
+  .function = cbs_adaptive_process,
+  .type = VLIB_NODE_TYPE_PROCESS,
+  .name = "cbs-adaptive-process",
+};
+
+/**
+ * @brief Let a CBS class's idleslope follow its demand between @c min and
+ * @c max (bytes/sec), or hand the operator's slopes back.
+ * @return 0 or VNET_API_ERROR_*: NO_SUCH_ENTRY (shaper not configured, or
+ *         not adaptive on disable), INVALID_VALUE (not CBS),
+ *         INVALID_VALUE_2 (bounds), INVALID_VALUE_3 (hysteresis or headroom),
+ *         INVALID_VALUE_4 (the class has registered streams),
+ *         INVALID_VALUE_5 (configured idleslope not between 0 and port_rate)
+ */
+static int
+cbs_adaptive_enable_disable (cbs_main_t * cbsm, u32 shaper_index, f64 min, f64 max, f64 hysteresis,
+                             f64 headroom, int enable)
+{
+  vlib_main_t *vm = cbsm->vlib_main;
+  cbs_shaper_t *shaper = cbs_shaper_get_if_valid (cbsm, shaper_index);
+  cbs_adaptive_t *ad;
+  u64 packets, bytes;
+
+  if (!shaper)
+    return VNET_API_ERROR_NO_SUCH_ENTRY;
+  ad = cbs_adaptive_get (cbsm, shaper_index);
+
+  if (!enable)
+    {
+      if (!ad->is_enabled)
+        return VNET_API_ERROR_NO_SUCH_ENTRY;
+      // Streams registered since own the slopes, and restore the operator's when withdrawn
+      if (shaper_index >= vec_len (cbsm->reservation_by_shaper) || !cbsm->reservation_by_shaper[shaper_index].n_streams)
+        cbs_shaper_params_publish (shaper, &ad->base);
+      cbs_adaptive_gauge (cbsm, shaper_index, 0);
+      clib_memset (ad, 0, sizeof (*ad));
+      cbsm->n_adaptive--;
+      vlib_log_notice (cbsm->log_class, "Adaptive: shaper %u back to idleslope %U", shaper_index,
+                       format_cbs_rate, shaper->eng.idleslope);
+      return 0;
+    }
+
+  if (shaper->eng.algo != CBS_ALGO_CBS)
+    return VNET_API_ERROR_INVALID_VALUE;
+  if (min <= 0 || max < min || max >= shaper->eng.port_rate)
+    return VNET_API_ERROR_INVALID_VALUE_2;
+  if (hysteresis < 0 || hysteresis >= 1 || headroom < 0)
+    return VNET_API_ERROR_INVALID_VALUE_3;
+  if (shaper_index < vec_len (cbsm->reservation_by_shaper) && cbsm->reservation_by_shaper[shaper_index].n_streams)
+    return VNET_API_ERROR_INVALID_VALUE_4;
+  if (!ad->is_enabled && !cbs_adaptive_base_is_valid (&shaper->eng))
+    return VNET_API_ERROR_INVALID_VALUE_5;
+
+  if (!ad->is_enabled)
+    {
+      ad->base = shaper->eng;
+      ad->demand = 0;
+      cbs_adaptive_arrivals (cbsm, shaper_index, &packets, &bytes);
+      ad->last_packets = packets;
+      ad->last_bytes = bytes;
+      ad->last_sample = vlib_time_now (vm);
+      ad->is_enabled = 1;
+      cbsm->n_adaptive++;
+    }
+  ad->min_idleslope = min;
+  ad->max_idleslope = max;
+  ad->hysteresis = hysteresis;
+  ad->headroom = headroom;
+  vlib_validate_simple_counter (&cbsm->idleslope_adjustments, shaper_index);
+  cbs_adaptive_gauge (cbsm, shaper_index, shaper->eng.idleslope);
+
+  vlib_process_signal_event (vm, cbs_adaptive_process_node.index, 0, 0);
+  vlib_log_notice (cbsm->log_class, "Adaptive: shaper %u idleslope %U-%U, hysteresis %.0f%%, headroom %.0f%%",
+                   shaper_index, format_cbs_rate, min, format_cbs_rate, max, hysteresis * 100, headroom * 100);
+  return 0;
+}
+
+/**
+ * @brief Called by cbs_shaper_install with the barrier held. A reconfigured
+ * class starts again from its new operator slopes; a deleted one, or one no
+ * longer running CBS, loses its controller.
+ */
+void
+cbs_adaptive_shaper_installed (cbs_main_t * cbsm, u32 shaper_index)
+{
+  cbs_shaper_t *shaper = cbs_shaper_get_if_valid (cbsm, shaper_index);
+  cbs_adaptive_t *ad;
+
+  if (shaper_index >= vec_len (cbsm->adaptive_by_shaper) || !cbsm->adaptive_by_shaper[shaper_index].is_enabled)
+    return;
+  ad = vec_elt_at_index (cbsm->adaptive_by_shaper, shaper_index);
+  if (shaper && cbs_adaptive_base_is_valid (&shaper->eng) && shaper->eng.port_rate > ad->max_idleslope)
+    {
+      ad->base = shaper->eng;
+      cbs_adaptive_gauge (cbsm, shaper_index, shaper->eng.idleslope);
+      return;
+    }
+  clib_memset (ad, 0, sizeof (*ad));
+  cbsm->n_adaptive--;
+  cbs_adaptive_gauge (cbsm, shaper_index, 0);
+  vlib_log_notice (cbsm->log_class, "Adaptive: shaper %u controller removed with its configuration", shaper_index);
+}
+
+/** @brief "show cbs" line of an adaptive class */
+u8 *
+format_cbs_adaptive (u8 * s, va_list * args)
+{
+  u32 shaper_index = va_arg (*args, u32);
+  cbs_main_t *cbsm = &cbs_main;
+  cbs_adaptive_t *ad;
+
+  if (shaper_index >= vec_len (cbsm->adaptive_by_shaper) || !cbsm->adaptive_by_shaper[shaper_index].is_enabled)
+    return s;
+  ad = vec_elt_at_index (cbsm->adaptive_by_shaper, shaper_index);
+  return format (s, "  Adaptive:        %U-%U (configured %U), demand %U, %lu adjustments\n",
+                 format_cbs_rate, ad->min_idleslope, format_cbs_rate, ad->max_idleslope,
+                 format_cbs_rate, ad->base.idleslope, format_cbs_rate, ad->demand, ad->n_adjustments);
+}
+
+static clib_error_t *
+set_cbs_adaptive_command_fn (vlib_main_t * vm, unformat_input_t * input, vlib_cli_command_t * cmd)
+{
+    cbs_main_t *cbsm = &cbs_main;
+    u32 shaper_index = CBS_DEFAULT_SHAPER;
+    f64 min_bps = 0, max_bps = 0, interval_ms = 0;
+    f64 hysteresis_pct = CBS_ADAPTIVE_DEFAULT_HYSTERESIS * 100, headroom_pct = CBS_ADAPTIVE_DEFAULT_HEADROOM * 100;
+    int enable = 1;
+    int rv;
+
+    while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT) {
+        if (unformat (input, "shaper %u", &shaper_index));
+        else if (unformat (input, "min %U", unformat_cbs_rate, &min_bps));
+        else if (unformat (input, "max %U", unformat_cbs_rate, &max_bps));
+        else if (unformat (input, "hysteresis %f", &hysteresis_pct));
+        else if (unformat (input, "headroom %f", &headroom_pct));
+        else if (unformat (input, "interval %f", &interval_ms));
+        else if (unformat (input, "disable")) enable = 0;
+        else return clib_error_return (0, "unknown input '%U'", format_unformat_error, input);
+      }
+
+    // The sampling interval is shared by every class
+    if (interval_ms != 0) {
+        if (interval_ms < 1)
+            return clib_error_return (0, "Invalid interval (must be >= 1 ms)");
+        cbsm->adaptive_interval = interval_ms * 1e-3;
+        if (enable && min_bps == 0 && max_bps == 0)
+            return 0;
+    }
+    if (enable && (min_bps == 0 || max_bps == 0))
+        return clib_error_return (0, "Please specify min <rate> and max <rate>, or disable");
+
+    rv = cbs_adaptive_enable_disable (cbsm, shaper_index, min_bps / CBS_BITS_PER_BYTE, max_bps / CBS_BITS_PER_BYTE,
+                                      hysteresis_pct / 100, headroom_pct / 100, enable);
+    switch (rv) {
+      case 0: return 0;
+      case VNET_API_ERROR_NO_SUCH_ENTRY:
+          return enable ? clib_error_return (0, "Shaper %u is not configured", shaper_index) :
+                          clib_error_return (0, "Shaper %u is not adaptive", shaper_index);
+      case VNET_API_ERROR_INVALID_VALUE: return clib_error_return (0, "Shaper %u does not run cbs", shaper_index);
+      case VNET_API_ERROR_INVALID_VALUE_2:
+          return clib_error_return (0, "Invalid bounds (0 < min <= max < port_rate)");
+      case VNET_API_ERROR_INVALID_VALUE_3:
+          return clib_error_return (0, "Invalid hysteresis (0-99 percent) or headroom (>= 0 percent)");
+      case VNET_API_ERROR_INVALID_VALUE_4:
+          return clib_error_return (0, "Shaper %u has registered streams, its slopes follow them", shaper_index);
+      case VNET_API_ERROR_INVALID_VALUE_5:
+          return clib_error_return (0, "Shaper %u idleslope must be above 0 and below port_rate to adapt",
+                                    shaper_index);
+      default: return clib_error_return (0, "cbs_adaptive_enable_disable failed: rv %d", rv);
+      }
+}
+
+VLIB_CLI_COMMAND (set_cbs_adaptive_command, static) =
+{
+  .path = "set cbs adaptive",
+  .short_help = "set cbs adaptive [shaper <id>] {min <rate> max <rate> [hysteresis <pct>] [headroom <pct>] "
+                "| disable} [interval <ms>]",
+  .function = set_cbs_adaptive_command_fn,
+};
+
+/*
+ * fd.io coding-style-patch-verification: ON
+ * Local Variables:
+ * eval: (c-set-style "gnu")
+ * End:
+ */
@@ -0,0 +1,267 @@
+/*
+ * cbs_capture.c - VPP CBS plugin shaping timeline capture
+ * Every dequeue decision of cbs-wheel goes to a per-thread lock-free ring
+ * (cbs_capture_add); cbs-capture-process streams the rings into a
+ * memory-mapped file for offline analysis (cbs_capture_analyze).
+ *
+ * Copyright (c) 2024 Your Org <your.email@example.com> // Placeholder
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ */
+
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <vlib/vlib.h>
+#include <vnet/vnet.h>
+#include <vppinfra/error.h>
+#include <vppinfra/format.h>
+#include <vppinfra/time.h>
+#include <cbs/cbs.h>
+
+#define CBS_CAPTURE_POLL_INTERVAL 0.001        /**< How often the rings are drained into the file */
+#define CBS_CAPTURE_DEFAULT_RECORDS (1 << 20)  /**< File capacity (48 bytes per record) */
+#define CBS_CAPTURE_DEFAULT_RING (1 << 16)     /**< Records per thread ring */
+
+vlib_node_registration_t cbs_capture_process_node;
+
+/**
+ * @brief Move whatever the threads produced into the file.
+ * @return 1 once the file is full
+ */
+static int
+cbs_capture_drain (cbs_main_t * cbsm)
+{
+  cbs_capture_t *cm = &cbsm->capture;
+  cbs_capture_header_t *h = cm->header;
+  u64 n_lost = 0;
+  u32 i;
+
+  vec_foreach_index (i, cm->rings)
+    {
+      cbs_per_thread_t *ptd = vec_elt_at_index (cbsm->per_thread, i);
+      cbs_capture_record_t *ring = cm->rings[i];
+      u32 tail = ptd->capture_tail;
+      u32 n = clib_atomic_load_acq_n (&ptd->capture_head) - tail;
+
+      n = clib_min (n, h->capacity - h->n_records);
+      while (n > 0)
+        {
+          u32 slot = tail & ptd->capture_mask;
+          u32 n_copy = clib_min (n, ptd->capture_mask + 1 - slot); // Up to the ring's end
+          clib_memcpy_fast (cm->records + h->n_records, ring + slot, n_copy * sizeof (*ring));
+          h->n_records += n_copy;
+          tail += n_copy;
+          n -= n_copy;
+        }
+      clib_atomic_store_rel_n (&ptd->capture_tail, tail);
+      n_lost += ptd->capture_lost;
+    }
+  h->n_lost = n_lost;
+  return h->n_records >= h->capacity;
+}
+
+static clib_error_t *
+cbs_capture_start (cbs_main_t * cbsm, u8 * file_name, u64 n_records, u32 ring_size)
+{
+  cbs_capture_t *cm = &cbsm->capture;
+  vlib_main_t *vm = cbsm->vlib_main;
+  u32 n_threads = vlib_get_n_threads (), i;
+  u64 map_size = sizeof (cbs_capture_header_t) + n_records * sizeof (cbs_capture_record_t);
+  cbs_capture_header_t *h;
+  cbs_per_thread_t *ptd;
+  int fd;
+
+  if (cm->file_name)
+    return clib_error_return (0, "Capture to %s already running", cm->file_name);
+  if (vec_len (cbsm->per_thread) < n_threads)
+    return clib_error_return (0, "No shaper configured");
+
+  fd = open ((char *) file_name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0)
+    return clib_error_return_unix (0, "open '%s'", file_name);
+  if (ftruncate (fd, map_size) < 0)
+    {
+      close (fd);
+      return clib_error_return_unix (0, "ftruncate '%s'", file_name);
+    }
+  h = mmap (0, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (h == MAP_FAILED)
+    {
+      close (fd);
+      return clib_error_return_unix (0, "mmap '%s'", file_name);
+    }
+
+  clib_memset (h, 0, sizeof (*h));
+  clib_memcpy (h->magic, CBS_CAPTURE_MAGIC, sizeof (h->magic));
+  h->version = CBS_CAPTURE_VERSION;
+  h->record_size = sizeof (cbs_capture_record_t);
+  h->capacity = n_records;
+  h->time_offset = unix_time_now () - vlib_time_now (vm);
+  h->n_threads = n_threads;
+
+  cm->fd = fd;
+  cm->header = h;
+  cm->records = (cbs_capture_record_t *) (h + 1);
+  cm->map_size = map_size;
+  cm->file_name = vec_dup (file_name);
+  vec_validate (cm->rings, n_threads - 1);
+  for (i = 0; i < n_threads; i++)
+    cm->rings[i] = clib_mem_alloc_aligned (ring_size * sizeof (cbs_capture_record_t), CLIB_CACHE_LINE_BYTES);
+
+  vlib_worker_thread_barrier_sync (vm);
+  vec_foreach_index (i, cbsm->per_thread)
+    {
+      ptd = vec_elt_at_index (cbsm->per_thread, i);
+      ptd->capture_head = ptd->capture_tail = 0;
+      ptd->capture_lost = 0;
+      ptd->capture_mask = ring_size - 1;
+      ptd->capture_ring = cm->rings[i];
+    }
+  vlib_worker_thread_barrier_release (vm);
+
+  vlib_process_signal_event (vm, cbs_capture_process_node.index, 0, 0);
+  vlib_log_notice (cbsm->log_class, "Capture: started to %s (%lu records, %u per thread ring)",
+                   file_name, n_records, ring_size);
+  return 0;
+}
+
+/** @brief Detach the rings from the data path, flush them and close the file. */
+static void
+cbs_capture_stop (cbs_main_t * cbsm)
+{
+  cbs_capture_t *cm = &cbsm->capture;
+  vlib_main_t *vm = cbsm->vlib_main;
+  cbs_per_thread_t *ptd;
+  cbs_capture_record_t **ring;
+  u64 n_records, n_lost;
+
+  vlib_worker_thread_barrier_sync (vm);
+  vec_foreach (ptd, cbsm->per_thread)
+    ptd->capture_ring = 0;
+  vlib_worker_thread_barrier_release (vm);
+
+  cbs_capture_drain (cbsm); // Workers are done with the rings now
+  n_records = cm->header->n_records;
+  n_lost = cm->header->n_lost;
+  msync (cm->header, cm->map_size, MS_SYNC);
+  munmap (cm->header, cm->map_size);
+  if (ftruncate (cm->fd, sizeof (cbs_capture_header_t) + n_records * sizeof (cbs_capture_record_t)) < 0)
+    vlib_log_warn (cbsm->log_class, "Capture: could not trim %s", cm->file_name);
+  close (cm->fd);
+
+  vlib_log_notice (cbsm->log_class, "Capture: %s closed, %lu records, %lu lost",
+                   cm->file_name, n_records, n_lost);
+  vec_foreach (ring, cm->rings)
+    clib_mem_free (*ring);
+  vec_free (cm->rings);
+  vec_free (cm->file_name);
+  cm->header = 0;
+  cm->records = 0;
+  cm->fd = -1;
+}
+
+static uword
+cbs_capture_process (vlib_main_t * vm, vlib_node_runtime_t * rt, vlib_frame_t * f)
+{
+  cbs_main_t *cbsm = &cbs_main;
+  uword *event_data = 0;
+
+  while (1)
+    {
+      // Sleep until a capture starts, then drain every poll interval
+      if (!cbsm->capture.file_name)
+        vlib_process_wait_for_event (vm);
+      else
+        vlib_process_wait_for_event_or_clock (vm, CBS_CAPTURE_POLL_INTERVAL);
+      vlib_process_get_events (vm, &event_data);
+      vec_reset_length (event_data);
+
+      if (cbsm->capture.file_name && cbs_capture_drain (cbsm))
+        {
+          vlib_log_notice (cbsm->log_class, "Capture: %s is full", cbsm->capture.file_name);
+          cbs_capture_stop (cbsm);
+        }
+    }
+  return 0;
+}
+
+VLIB_REGISTER_NODE (cbs_capture_process_node) = {
+  .function = cbs_capture_process,
+  .type = VLIB_NODE_TYPE_PROCESS,
+  .name = "cbs-capture-process",
+};
+
+static clib_error_t *
+set_cbs_capture_command_fn (vlib_main_t * vm, unformat_input_t * input, vlib_cli_command_t * cmd)
+{
+    cbs_main_t *cbsm = &cbs_main;
+    u64 n_records = CBS_CAPTURE_DEFAULT_RECORDS;
+    u32 ring_size = CBS_CAPTURE_DEFAULT_RING;
+    u8 *file_name = 0;
+    int stop = 0;
+    clib_error_t * error = 0;
+
+    while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT) {
+        if (unformat (input, "file %s", &file_name));
+        else if (unformat (input, "records %lu", &n_records));
+        else if (unformat (input, "ring %u", &ring_size));
+        else if (unformat (input, "stop")) stop = 1;
+        else { error = clib_error_return (0, "unknown input '%U'", format_unformat_error, input); goto done; }
+      }
+
+    if (stop) {
+        if (!cbsm->capture.file_name)
+            error = clib_error_return (0, "No capture running");
+        else
+            cbs_capture_stop (cbsm);
+        goto done;
+    }
+
+    if (!file_name) { error = clib_error_return (0, "Please specify file <path> or stop"); goto done; }
+    if (n_records == 0) { error = clib_error_return (0, "Invalid records (must be > 0)"); goto done; }
+    if (ring_size < 2 || ring_size > (1 << 24)) { error = clib_error_return (0, "Invalid ring (must be 2-%u)", 1 << 24); goto done; }
+
+    vec_add1 (file_name, 0);
+    error = cbs_capture_start (cbsm, file_name, n_records, max_pow2 (ring_size));
+
+  done:
+    vec_free (file_name);
+    return error;
+}
+
+static clib_error_t *
+show_cbs_capture_command_fn (vlib_main_t * vm, unformat_input_t * input, vlib_cli_command_t * cmd)
+{
+    cbs_main_t *cbsm = &cbs_main;
+    cbs_capture_t *cm = &cbsm->capture;
+
+    if (!cm->file_name) {
+        vlib_cli_output (vm, "Capture: not running");
+        return 0;
+    }
+    vlib_cli_output (vm, "Capture: %s, %lu of %lu records, %lu lost on full rings",
+                     cm->file_name, cm->header->n_records, cm->header->capacity, cm->header->n_lost);
+    return 0;
+}
+
+VLIB_CLI_COMMAND (set_cbs_capture_command, static) =
+{
+  .path = "set cbs capture",
+  .short_help = "set cbs capture {file <path> [records <n>] [ring <n>] | stop}",
+  .function = set_cbs_capture_command_fn,
+};
+
+VLIB_CLI_COMMAND (show_cbs_capture_command, static) =
+{
+  .path = "show cbs capture",
+  .short_help = "show cbs capture",
+  .function = show_cbs_capture_command_fn,
+};
+
+/*
+ * fd.io coding-style-patch-verification: ON
+ * Local Variables:
+ * eval: (c-set-style "gnu")
+ * End:
+ */
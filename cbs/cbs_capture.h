@@ -0,0 +1,56 @@
+/*
+ * cbs_capture.h - CBS plugin shaping timeline capture file format
+ *
+ * One record per dequeue decision of cbs-wheel, written by "set cbs
+ * capture" and read by cbs_capture_analyze. VPP independent so the
+ * offline tool can include it.
+ *
+ * Copyright (c) 2024 Your Org <your.email@example.com> // Placeholder
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ */
+#ifndef __included_cbs_capture_h__
+#define __included_cbs_capture_h__
+
+#include <stdint.h>
+
+#define CBS_CAPTURE_MAGIC "CBSCAPT"   /**< 8 bytes including the terminating NUL */
+#define CBS_CAPTURE_VERSION 1
+
+/** \brief One dequeued frame */
+typedef struct
+{
+  double time;            /**< Dequeue time, seconds (VPP main clock) */
+  double wait;            /**< Seconds the frame spent in the wheel */
+  double credits_before;  /**< CBS credits / TBF tokens before the frame was charged */
+  double credits_after;   /**< ... and after */
+  uint32_t length;        /**< Charged (wire) bytes */
+  uint32_t next_index;    /**< cbs-wheel next node the frame was sent to */
+  uint32_t shaper_index;
+  uint16_t thread_index;
+  uint8_t algo;           /**< cbs_algo_t */
+  uint8_t reserved;
+} cbs_capture_record_t;
+
+/** \brief File header; records follow immediately */
+typedef struct
+{
+  char magic[8];          /**< CBS_CAPTURE_MAGIC */
+  uint32_t version;       /**< CBS_CAPTURE_VERSION */
+  uint32_t record_size;   /**< sizeof (cbs_capture_record_t) */
+  uint64_t capacity;      /**< Records the file was sized for */
+  uint64_t n_records;     /**< Records written so far (updated while capturing) */
+  uint64_t n_lost;        /**< Records lost because a thread's ring was full */
+  double time_offset;     /**< Add to record times for Unix time */
+  uint32_t n_threads;
+  uint32_t reserved[3];
+} cbs_capture_header_t;
+
+#endif /* __included_cbs_capture_h__ */
+
+/*
+ * fd.io coding-style-patch-verification: ON
+ *
+ * Local Variables:
+ * eval: (c-set-style "gnu")
+ * End:
+ */
@@ -0,0 +1,371 @@
+/*
+ * cbs_debug.c - VPP CBS plugin debug CLIs
+ * Engine conformance checks and microbenchmarks on a virtual clock (the
+ * VPP-independent cbs_engine_test.h, also built as cbs_engine_test), and
+ * an in-process benchmark of the enqueue and wheel nodes, so shaper
+ * changes can be verified and timed without NICs or a traffic setup.
+ *
+ * Copyright (c) 2024 Your Org <your.email@example.com> // Placeholder
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ */
+
+#include <vlib/vlib.h>
+#include <vnet/vnet.h>
+#include <vppinfra/error.h>
+#include <vppinfra/format.h>
+#include <vppinfra/time.h>
+#include <cbs/cbs.h>
+#include <cbs/cbs_engine_test.h> // Checks shared with the standalone cbs_engine_test
+
+STATIC_ASSERT (CBS_TEST_MAX_BURST == CBS_MAX_TX_BURST, "engine checks poll like cbs-wheel");
+
+/** @brief cbs_engine_test.h output to the CLI */
+static void
+cbs_engine_test_cli_output (void *ctx, const char *line)
+{
+  vlib_cli_output ((vlib_main_t *) ctx, "%s", line);
+}
+
+static clib_error_t *
+test_cbs_engine_command_fn (vlib_main_t * vm, unformat_input_t * input, vlib_cli_command_t * cmd)
+{
+    u32 n_packets = 1 << 20, frame_len = 1500;
+    int conformance = 0, bench = 0;
+    clib_error_t * error = 0;
+    int n_fail;
+
+    while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT) {
+        if (unformat (input, "conformance")) conformance = 1;
+        else if (unformat (input, "bench")) bench = 1;
+        else if (unformat (input, "packets %u", &n_packets));
+        else if (unformat (input, "len %u", &frame_len));
+        else { error = clib_error_return (0, "unknown input '%U'", format_unformat_error, input); goto done; }
+      }
+
+    if (!conformance && !bench) { error = clib_error_return (0, "Please specify conformance and/or bench"); goto done; }
+    if (frame_len < 64 || frame_len > 9000) { error = clib_error_return (0, "Invalid len (must be 64-9000)"); goto done; }
+
+    if (conformance) {
+        vlib_cli_output (vm, "CBS engine conformance (virtual clock):");
+        n_fail = cbs_engine_conformance (cbs_engine_test_cli_output, vm);
+        if (n_fail)
+            error = clib_error_return (0, "%d check(s) failed", n_fail);
+    }
+    if (bench) {
+        vlib_cli_output (vm, "CBS engine microbenchmark (%u packets of %u bytes per case):", n_packets, frame_len);
+        if (cbs_engine_bench (cbs_engine_test_cli_output, vm, n_packets, frame_len))
+            error = clib_error_return (0, "Out of memory");
+    }
+
+  done:
+    return error;
+}
+
+VLIB_CLI_COMMAND (test_cbs_engine_command, static) =
+{
+  .path = "test cbs engine",
+  .short_help = "test cbs engine [conformance] [bench [packets <n>] [len <bytes>]]",
+  .function = test_cbs_engine_command_fn,
+};
+
+/* --- Node benchmark ("test cbs perf") --- */
+
+#define CBS_PERF_MAX_PORTS 64
+#define CBS_PERF_MAX_POLLS_PER_PACKET 1000 /**< Give up if the wheel stops draining */
+
+/** \brief Scratch shaper and fake ports driven by "test cbs perf" */
+typedef struct
+{
+  u32 shaper_index;          /**< First free shaper id, deleted afterwards */
+  u32 *sw_if_indices;        /**< Fake interfaces bound to the shaper, one per port */
+  u32 packet_size;
+  u32 next_port;             /**< Round robin over sw_if_indices */
+  vlib_node_runtime_t *enq_rt; /**< cbs-output-feature on this thread */
+  vlib_node_runtime_t *deq_rt; /**< cbs-wheel on this thread */
+  vlib_frame_t *frame;       /**< Reused frame to cbs-output-feature */
+  cbs_wheel_t *wp;           /**< This thread's wheel of the scratch shaper */
+} cbs_perf_ctx_t;
+
+/** Frees everything cbs-wheel sends to the fake ports. */
+static uword
+cbs_perf_sink_fn (vlib_main_t * vm, vlib_node_runtime_t * node, vlib_frame_t * frame)
+{
+  vlib_buffer_free (vm, vlib_frame_vector_args (frame), frame->n_vectors);
+  return frame->n_vectors;
+}
+
+VLIB_REGISTER_NODE (cbs_perf_sink_node, static) =
+{
+  .function = cbs_perf_sink_fn,
+  .name = "cbs-perf-sink",
+  .vector_size = sizeof (u32),
+  .type = VLIB_NODE_TYPE_INTERNAL,
+};
+
+/**
+ * @brief Allocate @c n synthetic frames addressed round robin to the fake ports.
+ * Dequeued buffers only come back once cbs-perf-sink runs, so the CLI
+ * process yields to the main loop when the pool runs dry.
+ */
+static int
+cbs_perf_alloc (vlib_main_t * vm, cbs_perf_ctx_t * pc, u32 * bis, u32 n)
+{
+  u32 n_alloc = 0, i, n_tries = 0;
+
+  while (n_alloc < n)
+    {
+      n_alloc += vlib_buffer_alloc (vm, bis + n_alloc, n - n_alloc);
+      if (n_alloc < n)
+        {
+          if (++n_tries > 100)
+            {
+              vlib_buffer_free (vm, bis, n_alloc);
+              return -1;
+            }
+          vlib_process_suspend (vm, 1e-3);
+        }
+    }
+
+  for (i = 0; i < n; i++)
+    {
+      vlib_buffer_t *b = vlib_get_buffer (vm, bis[i]);
+      b->current_data = 0;
+      b->current_length = pc->packet_size;
+      vnet_buffer (b)->sw_if_index[VLIB_RX] = 0;
+      vnet_buffer (b)->sw_if_index[VLIB_TX] = pc->sw_if_indices[pc->next_port++ % vec_len (pc->sw_if_indices)];
+      vnet_buffer (b)->feature_arc_index = cbs_main.arc_index; // As on interface-output: no arc to resume
+    }
+  return 0;
+}
+
+/** @brief Push @c n buffers through cbs-output-feature; @return clocks spent in the node */
+static u64
+cbs_perf_enqueue (vlib_main_t * vm, cbs_perf_ctx_t * pc, u32 * bis, u32 n)
+{
+  u64 t0;
+
+  clib_memcpy_fast (vlib_frame_vector_args (pc->frame), bis, n * sizeof (u32));
+  pc->frame->n_vectors = n;
+  t0 = clib_cpu_time_now ();
+  pc->enq_rt->function (vm, pc->enq_rt, pc->frame);
+  return clib_cpu_time_now () - t0;
+}
+
+/** @brief Poll cbs-wheel until the scratch wheel holds @c target packets; @return clocks, or ~0 if stuck */
+static u64
+cbs_perf_dequeue (vlib_main_t * vm, cbs_perf_ctx_t * pc, u32 target, u64 * n_polls)
+{
+  u64 clocks = 0, t0, max_polls = (u64) (pc->wp->cursize - clib_min (target, pc->wp->cursize) + 1) *
+                                  CBS_PERF_MAX_POLLS_PER_PACKET;
+  u64 n = 0;
+
+  while (pc->wp->cursize > target)
+    {
+      if (++n > max_polls)
+        return ~0ULL;
+      t0 = clib_cpu_time_now ();
+      pc->deq_rt->function (vm, pc->deq_rt, 0);
+      clocks += clib_cpu_time_now () - t0;
+    }
+  *n_polls += n;
+  return clocks;
+}
+
+/**
+ * @brief Create the scratch shaper and its fake ports.
+ * The shaper runs CBS with idleslope equal to the port rate, so credit
+ * never runs out and only the port timeline paces the wheel: with the
+ * horizon off each poll sends at most one frame per port, i.e. @c n_ports
+ * frames per poll up to CBS_MAX_TX_BURST.
+ */
+static clib_error_t *
+cbs_perf_setup (vlib_main_t * vm, cbs_perf_ctx_t * pc, u32 n_ports)
+{
+  cbs_main_t *cbsm = &cbs_main;
+  vnet_interface_main_t *im = &cbsm->vnet_main->interface_main;
+  cbs_interface_t invalid = { .shaper_index = ~0, .output_next_index = ~0, .hw_if_index = ~0,
+                              .tx_queue_id = CBS_TX_QUEUE_ANY };
+  cbs_config_args_t a = {
+    .algo = CBS_ALGO_CBS,
+    .port_rate_bps = 100 * CBS_GBPS_TO_BPS,
+    .idleslope_kbps = 100 * CBS_GBPS_TO_BPS / CBS_KBPS_TO_BPS,
+    .packet_size = 9000, // Wheel sizing only; keeps the scratch wheel small
+  };
+  u32 first_sw_if_index, first_hw_if_index, next_index, i;
+  cbs_per_thread_t *ptd;
+  int rv;
+
+  for (pc->shaper_index = 0; cbs_shaper_get_if_valid (cbsm, pc->shaper_index); pc->shaper_index++)
+    ;
+  if ((rv = cbs_configure_internal (cbsm, pc->shaper_index, &a)))
+    return clib_error_return (0, "scratch shaper %u: configure failed, rv %d", pc->shaper_index, rv);
+  // The test drives both nodes on this thread, so the wheel is created here
+  pc->wp = cbs_wheel_create (vm, &cbsm->per_thread[vm->thread_index], pc->shaper_index);
+  if (!pc->wp)
+    return clib_error_return (0, "scratch shaper %u: no wheel memory", pc->shaper_index);
+
+  // Ports beyond every real interface; the CLI holds the barrier throughout
+  first_sw_if_index = clib_max (vec_len (cbsm->interface_by_sw_if_index), pool_len (im->sw_interfaces));
+  first_hw_if_index = pool_len (im->hw_interfaces);
+  next_index = vlib_node_add_next (vm, cbs_input_node.index, cbs_perf_sink_node.index);
+  for (i = 0; i < n_ports; i++)
+    {
+      cbs_interface_t *intf;
+
+      vec_validate_init_empty (cbsm->interface_by_sw_if_index, first_sw_if_index + i, invalid);
+      intf = vec_elt_at_index (cbsm->interface_by_sw_if_index, first_sw_if_index + i);
+      intf->shaper_index = pc->shaper_index;
+      intf->output_next_index = next_index;
+      intf->hw_if_index = first_hw_if_index + i;
+      vec_foreach (ptd, cbsm->per_thread)
+        {
+          vec_validate (ptd->tx_finish_time_by_hw_if_index, first_hw_if_index + i);
+          vec_validate (ptd->tx_port_by_hw_if_index, first_hw_if_index + i); // No TX node errors to watch
+          vec_alloc (ptd->tx_ports_pending, vec_len (ptd->tx_port_by_hw_if_index));
+          vec_alloc (ptd->tx_sent, CBS_TX_SENT_MAX);
+        }
+      vec_add1 (pc->sw_if_indices, first_sw_if_index + i);
+    }
+
+  pc->enq_rt = vlib_node_get_runtime (vm, cbs_output_feature_node.index);
+  pc->deq_rt = vlib_node_get_runtime (vm, cbs_input_node.index);
+  pc->frame = vlib_get_frame_to_node (vm, cbs_output_feature_node.index);
+  return 0;
+}
+
+static void
+cbs_perf_teardown (vlib_main_t * vm, cbs_perf_ctx_t * pc)
+{
+  cbs_main_t *cbsm = &cbs_main;
+  cbs_shaper_update_t *updates = 0, *u;
+  u32 failed_index, *sw_if_index;
+
+  vec_foreach (sw_if_index, pc->sw_if_indices)
+    {
+      cbs_interface_t *intf = vec_elt_at_index (cbsm->interface_by_sw_if_index, *sw_if_index);
+      intf->shaper_index = intf->output_next_index = intf->hw_if_index = ~0;
+    }
+  vec_free (pc->sw_if_indices);
+
+  vec_add2 (updates, u, 1); // Frees whatever is still queued
+  u->shaper_index = pc->shaper_index;
+  u->is_add = 0;
+  cbs_shaper_add_del_bulk (cbsm, updates, &failed_index);
+  vec_free (updates);
+
+  if (pc->frame)
+    vlib_frame_free (vm, pc->frame);
+}
+
+/**
+ * @brief Time one occupancy / burst case.
+ * The wheel is prefilled to @c occupancy; each round then pushes a frame of
+ * @c burst packets through the enqueue node and polls cbs-wheel until the
+ * wheel is back at @c occupancy, so both nodes see a steady backlog.
+ */
+static clib_error_t *
+cbs_perf_run_case (vlib_main_t * vm, cbs_perf_ctx_t * pc, u32 n_packets,
+                   u32 occupancy, u32 burst)
+{
+  u32 bis[VLIB_FRAME_SIZE];
+  u64 enq_clocks = 0, deq_clocks = 0, clocks, n_polls = 0, n_moved = 0;
+  u32 n, n_rounds = clib_max (n_packets / burst, 1), i;
+
+  for (n = 0; n < occupancy; n += i) // Prefill, untimed
+    {
+      i = clib_min (occupancy - n, VLIB_FRAME_SIZE);
+      if (cbs_perf_alloc (vm, pc, bis, i))
+        return clib_error_return (0, "out of buffers");
+      cbs_perf_enqueue (vm, pc, bis, i);
+    }
+
+  for (i = 0; i < n_rounds; i++)
+    {
+      if (cbs_perf_alloc (vm, pc, bis, burst))
+        return clib_error_return (0, "out of buffers");
+      enq_clocks += cbs_perf_enqueue (vm, pc, bis, burst);
+      if ((clocks = cbs_perf_dequeue (vm, pc, occupancy, &n_polls)) == ~0ULL)
+        return clib_error_return (0, "wheel stopped draining (occupancy %u, burst %u)", occupancy, burst);
+      deq_clocks += clocks;
+      n_moved += burst;
+    }
+
+  if (cbs_perf_dequeue (vm, pc, 0, &n_polls) == ~0ULL) // Drain, untimed
+    return clib_error_return (0, "wheel stopped draining");
+
+  vlib_cli_output (vm, "%10u %6u %14.2f %14.2f %10.2f", occupancy, burst,
+                   (f64) enq_clocks / n_moved, (f64) deq_clocks / n_moved,
+                   n_polls ? (f64) (n_moved + occupancy) / n_polls : 0.0);
+  return 0;
+}
+
+/**
+ * @brief "test cbs perf": CPU clocks per packet of the enqueue and wheel
+ * nodes, run in-process on synthetic frames (no NICs). The node function
+ * variants are the ones selected for this CPU (see "show node").
+ */
+static clib_error_t *
+test_cbs_perf_command_fn (vlib_main_t * vm, unformat_input_t * input, vlib_cli_command_t * cmd)
+{
+    static const u32 occupancies[] = { 0, 256, 1024 };
+    static const u32 bursts[] = { 1, 8, 32, VLIB_FRAME_SIZE };
+    u32 n_packets = 1 << 16, packet_size = 64, n_ports = 1;
+    cbs_perf_ctx_t pc = { 0 };
+    vlib_node_state_t wheel_state;
+    clib_error_t * error = 0;
+    u32 oi, bi;
+
+    while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT) {
+        if (unformat (input, "packets %u", &n_packets));
+        else if (unformat (input, "size %u", &packet_size));
+        else if (unformat (input, "ports %u", &n_ports));
+        else return clib_error_return (0, "unknown input '%U'", format_unformat_error, input);
+      }
+
+    if (packet_size < 60 || packet_size > vlib_buffer_get_default_data_size (vm))
+        return clib_error_return (0, "Invalid size (must be 60-%u)", vlib_buffer_get_default_data_size (vm));
+    if (n_ports == 0 || n_ports > CBS_PERF_MAX_PORTS)
+        return clib_error_return (0, "Invalid ports (must be 1-%u)", CBS_PERF_MAX_PORTS);
+    if (n_packets == 0)
+        return clib_error_return (0, "Invalid packets (must be > 0)");
+
+    // Keep the main loop's own cbs-wheel poll off the scratch wheel while we yield for buffers
+    wheel_state = vlib_node_get_state (vm, cbs_input_node.index);
+    vlib_node_set_state (vm, cbs_input_node.index, VLIB_NODE_STATE_DISABLED);
+
+    pc.packet_size = packet_size;
+    if ((error = cbs_perf_setup (vm, &pc, n_ports)))
+        goto done;
+
+    vlib_cli_output (vm, "cbs-output-feature -> cbs-wheel, %u byte frames, %u port(s), %u packets per case, "
+                     "scratch shaper %u (wheel %u slots):", packet_size, n_ports, n_packets,
+                     pc.shaper_index, pc.wp->wheel_size);
+    vlib_cli_output (vm, "%10s %6s %14s %14s %10s", "occupancy", "burst", "enq clk/pkt", "deq clk/pkt", "pkts/poll");
+    for (oi = 0; oi < ARRAY_LEN (occupancies); oi++)
+        for (bi = 0; bi < ARRAY_LEN (bursts); bi++) {
+            if (occupancies[oi] + bursts[bi] >= pc.wp->wheel_size)
+                continue; // Would measure wheel-full drops instead
+            if ((error = cbs_perf_run_case (vm, &pc, n_packets, occupancies[oi], bursts[bi])))
+                goto done;
+          }
+
+  done:
+    if (pc.wp)
+        cbs_perf_teardown (vm, &pc);
+    vlib_node_set_state (vm, cbs_input_node.index, wheel_state);
+    return error;
+}
+
+VLIB_CLI_COMMAND (test_cbs_perf_command, static) =
+{
+  .path = "test cbs perf",
+  .short_help = "test cbs perf [packets <n>] [size <bytes>] [ports <n>]",
+  .function = test_cbs_perf_command_fn,
+};
+
+/*
+ * fd.io coding-style-patch-verification: ON
+ * Local Variables:
+ * eval: (c-set-style "gnu")
+ * End:
+ */
@@ -0,0 +1,401 @@
+/*
+ * cbs_engine.h - VPP-independent shaping engine for the CBS plugin
+ *
+ * The credit, token and eligibility arithmetic of the three shaping
+ * algorithms plus the shared port-busy timeline, with no dependency on
+ * vlib: time is whatever the caller passes in (vlib_time_now in the
+ * nodes, a virtual clock in "test cbs engine" and offline tools).
+ *
+ * Copyright (c) 2024 Your Org <your.email@example.com> // Placeholder
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ */
+#ifndef __included_cbs_engine_h__
+#define __included_cbs_engine_h__
+
+#include <stdint.h>
+
+#define CBS_ENGINE_INLINE static inline __attribute__ ((always_inline))
+
+#define CBS_ATS_N_FLOWS 64           /**< ATS per-flow token buckets per wheel (power of 2, <= 64) */
+
+/** \brief Shaping algorithm deciding wheel head eligibility */
+typedef enum {
+    CBS_ALGO_CBS = 0,   /**< IEEE 802.1Qav credit based shaper */
+    CBS_ALGO_TBF,       /**< Classic token bucket filter */
+    CBS_ALGO_ATS,       /**< IEEE 802.1Qcr asynchronous traffic shaping */
+    CBS_N_ALGO,
+} cbs_algo_t;
+
+/** \brief Shaper parameters; rates in bytes/sec, sizes in bytes */
+typedef struct
+{
+  cbs_algo_t algo;      /**< Eligibility algorithm */
+  double port_rate;     /**< Port rate, paces the port timeline */
+  double idleslope;     /**< CBS: credit gain while waiting */
+  double sendslope;     /**< CBS: credit change while sending (idleslope - port_rate) */
+  double hicredit;      /**< CBS: upper credit bound */
+  double locredit;      /**< CBS: lower credit bound */
+  double tb_rate;       /**< TBF token rate / ATS committed information rate */
+  double tb_burst;      /**< TBF bucket depth / ATS committed burst size */
+} cbs_engine_params_t;
+
+/** \brief Per-queue shaping state */
+typedef struct
+{
+  double credits;       /**< CBS credits / TBF tokens */
+  double last_update_time; /**< Time credits were last advanced */
+  int idle;             /**< Queue ran empty since the last advance */
+  double ats_group_eligibility_time; /**< ATS: eligibility time of the last frame assigned */
+  double ats_bucket_empty_time[CBS_ATS_N_FLOWS]; /**< ATS: per-flow bucket empty times */
+  uint32_t ats_flow_key[CBS_ATS_N_FLOWS]; /**< ATS: full flow key owning each bucket */
+  uint64_t ats_flow_used;  /**< ATS: buckets ever claimed, one bit each */
+} cbs_engine_state_t;
+
+_Static_assert (CBS_ATS_N_FLOWS <= 64, "ats_flow_used holds one bit per bucket");
+
+/** \brief Why the head of a queue may or may not be sent now */
+typedef enum {
+    CBS_ENGINE_SEND = 0,
+    CBS_ENGINE_STALL_PORT_BUSY,    /**< Port still transmitting an earlier frame */
+    CBS_ENGINE_STALL_CREDITS,      /**< CBS credits negative */
+    CBS_ENGINE_STALL_TOKENS,       /**< TBF bucket short of the frame */
+    CBS_ENGINE_STALL_NOT_ELIGIBLE, /**< ATS eligibility time not reached */
+} cbs_engine_verdict_t;
+
+/**
+ * @brief Bytes charged for a frame of @c len bytes (L2, without FCS).
+ * @param min_frame pad shorter frames to this length first (0: no padding)
+ * @param overhead fixed per-frame bytes added after padding (may be negative)
+ */
+CBS_ENGINE_INLINE uint32_t
+cbs_engine_wire_length (uint32_t len, uint32_t min_frame, int32_t overhead)
+{
+  int32_t wire_len = (int32_t) (len > min_frame ? len : min_frame) + overhead;
+  return wire_len > 0 ? (uint32_t) wire_len : 1;
+}
+
+/** @brief Reset a queue's state at time @c now. */
+CBS_ENGINE_INLINE void
+cbs_engine_init (const cbs_engine_params_t * p, cbs_engine_state_t * s, double now)
+{
+  int i;
+
+  s->credits = 0.0;
+  s->last_update_time = now;
+  s->idle = 1;
+  s->ats_group_eligibility_time = now;
+  s->ats_flow_used = 0;
+  for (i = 0; i < CBS_ATS_N_FLOWS; i++)
+    s->ats_bucket_empty_time[i] = now;
+
+  if (p->algo == CBS_ALGO_TBF)
+    s->credits = p->tb_burst; // Start with a full bucket
+  else if (p->algo == CBS_ALGO_ATS)
+    // Buckets start full: they became empty one empty-to-full duration ago
+    for (i = 0; i < CBS_ATS_N_FLOWS; i++)
+      s->ats_bucket_empty_time[i] = now - p->tb_burst / p->tb_rate;
+}
+
+/**
+ * @brief Advance credits/tokens to @c now.
+ * CBS follows 802.1Q 8.6.8.2: while frames wait, credits grow at
+ * idleslope up to hicredit; while the queue is empty, positive credit is
+ * lost and negative credit only recovers towards zero.
+ */
+CBS_ENGINE_INLINE void
+cbs_engine_advance (const cbs_engine_params_t * p, cbs_engine_state_t * s, double now)
+{
+  double delta_t = now - s->last_update_time;
+
+  if (p->algo == CBS_ALGO_ATS || delta_t <= 1e-9) // ATS carries no credit state
+    return;
+
+  if (p->algo == CBS_ALGO_CBS)
+    {
+      double credits = s->credits + delta_t * p->idleslope;
+      double bound = s->idle ? 0.0 : p->hicredit;
+      s->credits = credits < bound ? credits : bound;
+    }
+  else // TBF: credits are the bucket's tokens
+    {
+      double tokens = s->credits + delta_t * p->tb_rate;
+      s->credits = tokens < p->tb_burst ? tokens : p->tb_burst;
+    }
+  s->last_update_time = now;
+  s->idle = 0;
+}
+
+/** @brief Note that the queue ran empty (call after a dequeue leaves it empty). */
+CBS_ENGINE_INLINE void
+cbs_engine_backlog_empty (const cbs_engine_params_t * p, cbs_engine_state_t * s)
+{
+  s->idle = 1;
+  if (p->algo == CBS_ALGO_CBS && s->credits > 0.0)
+    s->credits = 0.0;
+}
+
+/**
+ * @brief Bucket of ATS flow @c flow_key, keyed on the whole key.
+ * Open addressing with linear probing; buckets are never emptied, only
+ * handed over, so probe chains stay intact. A new flow takes a free
+ * bucket or one that has refilled (a full bucket carries no state), and
+ * starts full. With every bucket busy the flow shares its home bucket,
+ * which can only delay frames, never let a flow exceed its burst.
+ */
+CBS_ENGINE_INLINE double *
+cbs_engine_ats_bucket (const cbs_engine_params_t * p, cbs_engine_state_t * s,
+                       uint32_t flow_key, double arrival)
+{
+  uint32_t home = (flow_key * 2654435761u) >> (32 - __builtin_ctz (CBS_ATS_N_FLOWS));
+  double empty_to_full = p->tb_burst / p->tb_rate;
+  int i, slot, reuse = -1;
+
+  for (i = 0; i < CBS_ATS_N_FLOWS; i++)
+    {
+      slot = (home + i) & (CBS_ATS_N_FLOWS - 1);
+      if (!(s->ats_flow_used & (1ULL << slot)))
+        {
+          if (reuse < 0)
+            reuse = slot;
+          break;
+        }
+      if (s->ats_flow_key[slot] == flow_key)
+        return &s->ats_bucket_empty_time[slot];
+      if (reuse < 0 && s->ats_bucket_empty_time[slot] + empty_to_full <= arrival)
+        reuse = slot;
+    }
+
+  if (reuse < 0)
+    return &s->ats_bucket_empty_time[home];
+  s->ats_flow_used |= 1ULL << reuse;
+  s->ats_flow_key[reuse] = flow_key;
+  s->ats_bucket_empty_time[reuse] = arrival - empty_to_full;
+  return &s->ats_bucket_empty_time[reuse];
+}
+
+/**
+ * @brief ATS (802.1Qcr 8.6.11) eligibility time assignment for one frame.
+ * All flows of a queue form one scheduler group so frames keep FIFO order.
+ */
+CBS_ENGINE_INLINE double
+cbs_engine_ats_eligibility (const cbs_engine_params_t * p, cbs_engine_state_t * s,
+                            uint32_t flow_key, uint32_t len, double arrival)
+{
+  double *bucket_empty_time = cbs_engine_ats_bucket (p, s, flow_key, arrival);
+  double length_recovery = (double) len / p->tb_rate;
+  double empty_to_full = p->tb_burst / p->tb_rate;
+  double scheduler_eligibility_time = *bucket_empty_time + length_recovery;
+  double bucket_full_time = *bucket_empty_time + empty_to_full;
+  double eligibility_time;
+
+  eligibility_time = arrival > s->ats_group_eligibility_time ? arrival : s->ats_group_eligibility_time;
+  if (scheduler_eligibility_time > eligibility_time)
+    eligibility_time = scheduler_eligibility_time;
+
+  s->ats_group_eligibility_time = eligibility_time;
+  if (eligibility_time < bucket_full_time)
+    *bucket_empty_time = scheduler_eligibility_time;
+  else
+    *bucket_empty_time = scheduler_eligibility_time + eligibility_time - bucket_full_time;
+
+  return eligibility_time;
+}
+
+/**
+ * @brief May a head frame of @c len bytes be sent at @c now?
+ * @param port_free_time when the port finishes its current frame
+ * @param eligible_time ATS eligibility time of the frame (ignored otherwise)
+ */
+CBS_ENGINE_INLINE cbs_engine_verdict_t
+cbs_engine_check (const cbs_engine_params_t * p, const cbs_engine_state_t * s,
+                  double port_free_time, uint32_t len, double eligible_time, double now)
+{
+  if (now < port_free_time)
+    return CBS_ENGINE_STALL_PORT_BUSY;
+
+  if (p->algo == CBS_ALGO_CBS)
+    {
+      if (s->credits < 0.0) // 802.1Q: transmission allowed while credit >= 0
+        return CBS_ENGINE_STALL_CREDITS;
+    }
+  else if (p->algo == CBS_ALGO_TBF)
+    {
+      // Frames above the bucket depth only need a full bucket
+      double need = (double) len < p->tb_burst ? (double) len : p->tb_burst;
+      if (s->credits < need)
+        return CBS_ENGINE_STALL_TOKENS;
+    }
+  else if (now < eligible_time) // ATS: FIFO order holds the rest
+    return CBS_ENGINE_STALL_NOT_ELIGIBLE;
+
+  return CBS_ENGINE_SEND;
+}
+
+/**
+ * @brief Earliest time at or after @c now the head frame could pass cbs_engine_check.
+ * Call with the state advanced to @c now. The result is a lower bound:
+ * the port timeline only moves later and nothing but time adds credit.
+ */
+CBS_ENGINE_INLINE double
+cbs_engine_next_check_time (const cbs_engine_params_t * p, const cbs_engine_state_t * s,
+                            double port_free_time, uint32_t len, double eligible_time, double now)
+{
+  double t = now > port_free_time ? now : port_free_time;
+  double ready = t;
+
+  if (p->algo == CBS_ALGO_CBS)
+    {
+      if (s->credits < 0.0) // Recovery starts once a transmission in progress ends
+        ready = s->last_update_time + -s->credits / p->idleslope;
+    }
+  else if (p->algo == CBS_ALGO_TBF)
+    {
+      double need = (double) len < p->tb_burst ? (double) len : p->tb_burst;
+      if (s->credits < need)
+        ready = s->last_update_time + (need - s->credits) / p->tb_rate;
+    }
+  else
+    ready = eligible_time;
+
+  return ready > t ? ready : t;
+}
+
+/**
+ * @brief Charge a frame that is being sent at @c now.
+ * Moves the port timeline (starting from the later of now and the end of
+ * the previous frame) and takes the frame's credits/tokens. CBS credit
+ * is frozen for the transmission, which is charged at sendslope up front.
+ * @return transmission duration in seconds
+ */
+CBS_ENGINE_INLINE double
+cbs_engine_charge (const cbs_engine_params_t * p, cbs_engine_state_t * s,
+                   double * port_free_time, uint32_t len, double now)
+{
+  double tx_duration = (double) len / p->port_rate;
+  double start = now > *port_free_time ? now : *port_free_time;
+
+  if (p->algo == CBS_ALGO_CBS)
+    {
+      s->credits += tx_duration * p->sendslope; // Sendslope = idle - port
+      if (s->credits < p->locredit)
+        s->credits = p->locredit;
+      // The transmission is fully accounted for: no idleslope gain until it ends
+      s->last_update_time = start + tx_duration;
+    }
+  else if (p->algo == CBS_ALGO_TBF)
+    s->credits -= len;
+
+  *port_free_time = start + tx_duration;
+  return tx_duration;
+}
+
+/**
+ * @brief Give back the credit or tokens charged for a frame of @c len bytes
+ * that never reached the wire. The port timeline is left alone: a port
+ * that dropped frames is held anyway.
+ */
+CBS_ENGINE_INLINE void
+cbs_engine_refund (const cbs_engine_params_t * p, cbs_engine_state_t * s, uint32_t len)
+{
+  if (p->algo == CBS_ALGO_CBS)
+    {
+      s->credits -= (double) len / p->port_rate * p->sendslope;
+      if (s->credits > p->hicredit)
+        s->credits = p->hicredit;
+    }
+  else if (p->algo == CBS_ALGO_TBF)
+    {
+      s->credits += len;
+      if (s->credits > p->tb_burst)
+        s->credits = p->tb_burst;
+    }
+}
+
+/*
+ * Standalone FIFO, for users of the engine outside the VPP graph (the
+ * virtual-clock checks and offline tools). The nodes keep their own wheel
+ * entries and call the primitives above directly.
+ */
+
+/** \brief A queued frame */
+typedef struct
+{
+  uint32_t len;           /**< Charged length in bytes */
+  uint32_t flow;          /**< ATS flow key */
+  double arrival_time;
+  double eligible_time;   /**< ATS: assigned at enqueue */
+  uint64_t opaque;        /**< Caller data */
+} cbs_engine_pkt_t;
+
+/** \brief Ring of frames; the caller provides @c size entries of storage */
+typedef struct
+{
+  cbs_engine_pkt_t *ring;
+  uint32_t size;
+  uint32_t head;
+  uint32_t tail;
+  uint32_t count;
+} cbs_engine_queue_t;
+
+/** @brief Enqueue a frame arriving at @c now. @return 0, or -1 if the queue is full */
+CBS_ENGINE_INLINE int
+cbs_engine_enqueue (const cbs_engine_params_t * p, cbs_engine_state_t * s,
+                    cbs_engine_queue_t * q, const cbs_engine_pkt_t * pkt, double now)
+{
+  cbs_engine_pkt_t *e;
+
+  if (q->count >= q->size)
+    return -1;
+  e = &q->ring[q->tail];
+  *e = *pkt;
+  e->arrival_time = now;
+  if (p->algo == CBS_ALGO_ATS)
+    e->eligible_time = cbs_engine_ats_eligibility (p, s, pkt->flow, pkt->len, now);
+  q->tail = (q->tail + 1) % q->size;
+  q->count++;
+  return 0;
+}
+
+/**
+ * @brief Advance to @c now and dequeue up to @c max eligible frames into @c out.
+ * @param why_stopped if not null, receives the verdict that ended the burst
+ *        (CBS_ENGINE_SEND if the burst or the queue ran out)
+ * @return number of frames dequeued
+ */
+CBS_ENGINE_INLINE uint32_t
+cbs_engine_dequeue_eligible (const cbs_engine_params_t * p, cbs_engine_state_t * s,
+                             cbs_engine_queue_t * q, double * port_free_time, double now,
+                             cbs_engine_pkt_t * out, uint32_t max,
+                             cbs_engine_verdict_t * why_stopped)
+{
+  cbs_engine_verdict_t v = CBS_ENGINE_SEND;
+  uint32_t n = 0;
+
+  cbs_engine_advance (p, s, now);
+  while (n < max && q->count > 0)
+    {
+      cbs_engine_pkt_t *e = &q->ring[q->head];
+      v = cbs_engine_check (p, s, *port_free_time, e->len, e->eligible_time, now);
+      if (v != CBS_ENGINE_SEND)
+        break;
+      cbs_engine_charge (p, s, port_free_time, e->len, now);
+      out[n++] = *e;
+      q->head = (q->head + 1) % q->size;
+      q->count--;
+    }
+  if (q->count == 0)
+    cbs_engine_backlog_empty (p, s);
+  if (why_stopped)
+    *why_stopped = v;
+  return n;
+}
+
+#endif /* __included_cbs_engine_h__ */
+
+/*
+ * fd.io coding-style-patch-verification: ON
+ *
+ * Local Variables:
+ * eval: (c-set-style "gnu")
+ * End:
+ */
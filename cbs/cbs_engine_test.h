@@ -0,0 +1,297 @@
+/*
+ * cbs_engine_test.h - conformance checks and microbenchmarks of the CBS
+ * plugin's shaping engine on a virtual clock
+ *
+ * VPP independent, like cbs_engine.h: the same checks run standalone in
+ * cbs_engine_test (no VPP process needed) and behind "test cbs engine".
+ * Every result line goes to a caller-supplied output function.
+ *
+ * Copyright (c) 2024 Your Org <your.email@example.com> // Placeholder
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ */
+#ifndef __included_cbs_engine_test_h__
+#define __included_cbs_engine_test_h__
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <cbs/cbs_engine.h>
+
+#define CBS_TEST_MAX_FRAME 1522     /**< maxInterferenceSize / maxFrameSize used by the checks */
+#define CBS_TEST_RATE_TOLERANCE 0.005 /**< Long-run rate must be within 0.5% */
+#define CBS_TEST_CREDIT_EPSILON 1e-6
+#define CBS_TEST_MAX_BURST 8        /**< Frames per poll, as CBS_MAX_TX_BURST in cbs-wheel */
+#define CBS_TEST_RING_SIZE 1024     /**< Backlog of the conformance runs */
+
+/** \brief Receives one line of results (no trailing newline) */
+typedef void (cbs_engine_test_output_t) (void *ctx, const char *line);
+
+/** \brief One virtual-clock run of a permanently backlogged queue */
+typedef struct
+{
+  double duration;          /**< Virtual seconds to run */
+  double poll_interval;     /**< Virtual seconds between dequeue polls */
+  uint32_t frame_len;       /**< Length of every queued frame */
+  uint32_t max_burst;       /**< Frames per poll (at most CBS_TEST_MAX_BURST) */
+  double interferer_period; /**< A lower class grabs the free port this often (0 = never) */
+  uint32_t interferer_len;  /**< Length of the interfering frame */
+  double reference_rate;    /**< Rate for the arrival curve excess (0 = not tracked) */
+} cbs_engine_run_args_t;
+
+typedef struct
+{
+  uint64_t bytes_sent;
+  uint64_t frames_sent;
+  double max_excess;        /**< Max of bytes sent by t minus reference_rate * t */
+  double max_credit;        /**< Highest credit seen before a dequeue */
+  double min_credit;        /**< Lowest credit seen after a dequeue */
+} cbs_engine_run_result_t;
+
+static const char *const cbs_engine_test_algo_names[CBS_N_ALGO] = { "cbs", "tbf", "ats" };
+
+static inline void
+cbs_engine_test_printf (cbs_engine_test_output_t * out, void *ctx, const char *fmt, ...)
+{
+  char line[256];
+  va_list va;
+
+  va_start (va, fmt);
+  vsnprintf (line, sizeof (line), fmt, va);
+  va_end (va);
+  out (ctx, line);
+}
+
+static inline uint64_t
+cbs_engine_test_now_ns (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline void
+cbs_engine_run (const cbs_engine_params_t * p, const cbs_engine_run_args_t * a,
+                cbs_engine_run_result_t * r)
+{
+  cbs_engine_pkt_t pkt = { .len = a->frame_len }, out[CBS_TEST_MAX_BURST], ring[CBS_TEST_RING_SIZE];
+  cbs_engine_queue_t q = { .ring = ring, .size = CBS_TEST_RING_SIZE };
+  cbs_engine_state_t s;
+  double now = 0, port_free_time = 0, next_interferer = a->interferer_period;
+  uint32_t n, burst = a->max_burst < CBS_TEST_MAX_BURST ? a->max_burst : CBS_TEST_MAX_BURST;
+
+  cbs_engine_init (p, &s, now);
+  memset (r, 0, sizeof (*r));
+  r->max_credit = r->min_credit = s.credits;
+
+  while (now < a->duration)
+    {
+      while (q.count < q.size) // Permanently backlogged
+        cbs_engine_enqueue (p, &s, &q, &pkt, now);
+
+      if (a->interferer_period > 0 && now >= next_interferer && now >= port_free_time)
+        {
+          port_free_time = now + (double) a->interferer_len / p->port_rate;
+          next_interferer += a->interferer_period;
+        }
+
+      cbs_engine_advance (p, &s, now);
+      if (s.credits > r->max_credit)
+        r->max_credit = s.credits;
+      n = cbs_engine_dequeue_eligible (p, &s, &q, &port_free_time, now, out, burst, 0);
+      if (s.credits < r->min_credit)
+        r->min_credit = s.credits;
+      r->frames_sent += n;
+      r->bytes_sent += (uint64_t) n * a->frame_len;
+      if (a->reference_rate > 0 && r->bytes_sent - a->reference_rate * now > r->max_excess)
+        r->max_excess = r->bytes_sent - a->reference_rate * now;
+      now += a->poll_interval;
+    }
+}
+
+/** @brief Report one check; returns 1 on failure. */
+static inline int
+cbs_check (cbs_engine_test_output_t * out, void *ctx, const char *name, int ok, const char *fmt, ...)
+{
+  char detail[192];
+  va_list va;
+
+  va_start (va, fmt);
+  vsnprintf (detail, sizeof (detail), fmt, va);
+  va_end (va);
+  cbs_engine_test_printf (out, ctx, "  %-28s %s  %s", name, ok ? "PASS" : "FAIL", detail);
+  return !ok;
+}
+
+static inline int
+cbs_check_rate (cbs_engine_test_output_t * out, void *ctx, const char *name, double achieved, double expected)
+{
+  double err = (achieved - expected) / expected;
+  return cbs_check (out, ctx, name, err <= CBS_TEST_RATE_TOLERANCE && err >= -CBS_TEST_RATE_TOLERANCE,
+                    "achieved %.3f Mbps, expected %.3f Mbps (%+.3f%%)",
+                    achieved * 8 / 1e6, expected * 8 / 1e6, err * 100);
+}
+
+/**
+ * @brief Conformance checks against the 802.1Q CBS and token bucket formulas.
+ * CBS credits use hiCredit = maxInterferenceSize * idleSlope / portRate and
+ * loCredit = maxFrameSize * sendSlope / portRate (802.1Q annex L).
+ * @return number of failed checks
+ */
+static inline int
+cbs_engine_conformance (cbs_engine_test_output_t * out, void *ctx)
+{
+  cbs_engine_params_t p = { 0 };
+  cbs_engine_run_args_t a = {
+    .duration = 1.0,
+    .poll_interval = 1e-6,
+    .frame_len = 1500,
+    .max_burst = CBS_TEST_MAX_BURST,
+  };
+  cbs_engine_run_result_t r;
+  cbs_engine_state_t s;
+  double e1, e2;
+  int n_fail = 0;
+
+  /* CBS: 1G port, 300M class */
+  p.algo = CBS_ALGO_CBS;
+  p.port_rate = 1e9 / 8;
+  p.idleslope = 300e6 / 8;
+  p.sendslope = p.idleslope - p.port_rate;
+  p.hicredit = CBS_TEST_MAX_FRAME * p.idleslope / p.port_rate;
+  p.locredit = CBS_TEST_MAX_FRAME * p.sendslope / p.port_rate;
+
+  cbs_engine_run (&p, &a, &r);
+  n_fail += cbs_check_rate (out, ctx, "cbs long-run rate", r.bytes_sent / a.duration, p.idleslope);
+  n_fail += cbs_check (out, ctx, "cbs locredit bound", r.min_credit >= p.locredit - CBS_TEST_CREDIT_EPSILON,
+                       "min credit %.3f, locredit %.3f", r.min_credit, p.locredit);
+
+  // A lower class keeps grabbing the port: credit builds while waiting, up to hicredit
+  a.interferer_period = 50e-6;
+  a.interferer_len = CBS_TEST_MAX_FRAME;
+  cbs_engine_run (&p, &a, &r);
+  n_fail += cbs_check_rate (out, ctx, "cbs rate with interference", r.bytes_sent / a.duration, p.idleslope);
+  n_fail += cbs_check (out, ctx, "cbs hicredit bound", r.max_credit <= p.hicredit + CBS_TEST_CREDIT_EPSILON,
+                       "max credit %.3f, hicredit %.3f", r.max_credit, p.hicredit);
+  a.interferer_period = 0;
+
+  // Positive credit is lost when the queue empties, negative credit only recovers to zero
+  cbs_engine_init (&p, &s, 0);
+  s.credits = p.hicredit;
+  cbs_engine_backlog_empty (&p, &s);
+  cbs_engine_advance (&p, &s, 1.0);
+  n_fail += cbs_check (out, ctx, "cbs idle credit reset", s.credits == 0.0,
+                       "credit after 1s idle %.3f", s.credits);
+
+  /* TBF: 100M, 15000 byte bucket */
+  memset (&p, 0, sizeof (p));
+  p.algo = CBS_ALGO_TBF;
+  p.port_rate = 1e9 / 8;
+  p.tb_rate = 100e6 / 8;
+  p.tb_burst = 15000;
+  a.reference_rate = p.tb_rate;
+  cbs_engine_run (&p, &a, &r);
+  n_fail += cbs_check_rate (out, ctx, "tbf long-run rate", (r.bytes_sent - p.tb_burst) / a.duration, p.tb_rate);
+  n_fail += cbs_check (out, ctx, "tbf arrival curve", r.max_excess <= p.tb_burst + CBS_TEST_CREDIT_EPSILON,
+                       "max excess over rate %.1f bytes, bucket %.0f", r.max_excess, p.tb_burst);
+
+  /* ATS: 100M committed rate, 3000 byte committed burst */
+  p.algo = CBS_ALGO_ATS;
+  p.tb_burst = 3000;
+  cbs_engine_run (&p, &a, &r);
+  n_fail += cbs_check_rate (out, ctx, "ats long-run rate", (r.bytes_sent - p.tb_burst) / a.duration, p.tb_rate);
+  n_fail += cbs_check (out, ctx, "ats arrival curve", r.max_excess <= p.tb_burst + CBS_TEST_CREDIT_EPSILON,
+                       "max excess over rate %.1f bytes, committed burst %.0f", r.max_excess, p.tb_burst);
+
+  // Flows whose keys differ only above the bucket count keep separate buckets
+  cbs_engine_init (&p, &s, 0);
+  e1 = cbs_engine_ats_eligibility (&p, &s, 1, p.tb_burst, 0);
+  e2 = cbs_engine_ats_eligibility (&p, &s, 1 + CBS_ATS_N_FLOWS, p.tb_burst, 0);
+  n_fail += cbs_check (out, ctx, "ats flow isolation", e1 == 0.0 && e2 == 0.0,
+                       "eligibility of two full-burst flows %.3f us, %.3f us", e1 * 1e6, e2 * 1e6);
+
+  return n_fail;
+}
+
+/**
+ * @brief Time enqueue and dequeue of the engine FIFO, per packet.
+ * Rates equal the port rate and the virtual clock moves by one burst of
+ * wire time per round, so every round moves a full burst and the backlog
+ * stays constant. Like the wheel node, frames leave one at a time; the
+ * port timeline is reset per frame so pacing does not end the burst.
+ * @return 0, or -1 if the ring could not be allocated
+ */
+static inline int
+cbs_engine_bench (cbs_engine_test_output_t * out, void *ctx, uint32_t n_packets, uint32_t frame_len)
+{
+  static const uint32_t bursts[] = { 1, 8, 32, 256 };
+  static const uint32_t backlogs[] = { 64, 4096, 65536 };
+  cbs_engine_pkt_t pkt = { .len = frame_len }, one[1];
+  uint32_t algo, bi, qi, i, j;
+
+  cbs_engine_test_printf (out, ctx, "%-6s %6s %8s %12s %12s", "algo", "burst", "backlog", "enq ns/pkt", "deq ns/pkt");
+  for (algo = 0; algo < CBS_N_ALGO; algo++)
+    for (bi = 0; bi < sizeof (bursts) / sizeof (bursts[0]); bi++)
+      for (qi = 0; qi < sizeof (backlogs) / sizeof (backlogs[0]); qi++)
+        {
+          uint32_t burst = bursts[bi], backlog = backlogs[qi];
+          uint32_t n_rounds = n_packets / burst ? n_packets / burst : 1;
+          cbs_engine_params_t p = {
+            .algo = (cbs_algo_t) algo,
+            .port_rate = 10e9 / 8,
+            .idleslope = 10e9 / 8,
+            .hicredit = 1e9,
+            .locredit = -1e9,
+            .tb_rate = 10e9 / 8,
+            .tb_burst = (double) frame_len * burst * 2,
+          };
+          cbs_engine_queue_t q = { 0 };
+          cbs_engine_state_t s;
+          double now = 0, port_free_time = 0, step;
+          uint64_t enq_ns = 0, deq_ns = 0, t0;
+          uint64_t n_enq = 0, n_deq = 0;
+
+          q.size = backlog + burst;
+          if (!(q.ring = calloc (q.size, sizeof (q.ring[0]))))
+            return -1;
+          cbs_engine_init (&p, &s, now);
+          for (i = 0; i < backlog; i++)
+            cbs_engine_enqueue (&p, &s, &q, &pkt, now);
+          step = (double) frame_len * burst / p.port_rate * 1.0001;
+
+          for (j = 0; j < n_rounds; j++)
+            {
+              now += step;
+              t0 = cbs_engine_test_now_ns ();
+              for (i = 0; i < burst; i++)
+                n_enq += cbs_engine_enqueue (&p, &s, &q, &pkt, now) == 0;
+              enq_ns += cbs_engine_test_now_ns () - t0;
+
+              t0 = cbs_engine_test_now_ns ();
+              for (i = 0; i < burst; i++)
+                {
+                  port_free_time = 0;
+                  n_deq += cbs_engine_dequeue_eligible (&p, &s, &q, &port_free_time, now, one, 1, 0);
+                }
+              deq_ns += cbs_engine_test_now_ns () - t0;
+            }
+
+          cbs_engine_test_printf (out, ctx, "%-6s %6u %8u %12.2f %12.2f", cbs_engine_test_algo_names[algo],
+                                  burst, backlog, n_enq ? (double) enq_ns / n_enq : 0.0,
+                                  n_deq ? (double) deq_ns / n_deq : 0.0);
+          free (q.ring);
+        }
+  return 0;
+}
+
+#endif /* __included_cbs_engine_test_h__ */
+
+/*
+ * fd.io coding-style-patch-verification: ON
+ *
+ * Local Variables:
+ * eval: (c-set-style "gnu")
+ * End:
+ */
@@ -22,8 +22,14 @@
 _(TRANSMITTED, "Packets transmitted by CBS")    \
 _(STALLED_CREDITS, "CBS stalled (insufficient credits)") \
 _(STALLED_PORT_BUSY, "CBS stalled (port busy)") \
+_(STALLED_TOKENS, "TBF stalled (insufficient tokens)") \
+_(STALLED_NOT_ELIGIBLE, "ATS stalled (head not yet eligible)") \
+_(STALLED_SHARED, "Stalled (shared segment out of bytes)") \
+_(EXPIRED, "Freed unsent (waited longer than max-residence)") \
 _(NO_PKTS_IN_WHEEL, "CBS wheel empty when polled")       \
 _(NO_WHEEL_FOR_THREAD, "No CBS wheel configured for thread")\
+_(TX_BACKPRESSURE, "Port held after TX node errors (ring full)") \
+_(TX_REFUNDED, "Frames dropped by the TX node, charge given back") \
 _(INVALID_BUFFER, "Invalid buffer index found in wheel")
 
 typedef enum
@@ -34,6 +40,14 @@ typedef enum
     CBS_TX_N_ERROR,
 } cbs_tx_error_t;
 
+/** \brief Node counter for each engine stall reason */
+static const u8 cbs_tx_error_by_verdict[] = {
+  [CBS_ENGINE_STALL_PORT_BUSY] = CBS_TX_ERROR_STALLED_PORT_BUSY,
+  [CBS_ENGINE_STALL_CREDITS] = CBS_TX_ERROR_STALLED_CREDITS,
+  [CBS_ENGINE_STALL_TOKENS] = CBS_TX_ERROR_STALLED_TOKENS,
+  [CBS_ENGINE_STALL_NOT_ELIGIBLE] = CBS_TX_ERROR_STALLED_NOT_ELIGIBLE,
+};
+
 
 /** \brief Trace structure for CBS dequeue node */
 typedef struct
@@ -43,10 +57,29 @@ typedef struct
   f64 tx_time;
   f64 cbs_credits_before;
   f64 cbs_credits_after;
-  u32 packet_len;
+  u32 packet_len;   /**< Charged (wire) length */
 } cbs_tx_trace_t;
 
 
+/**
+ * \brief Frames released in one poll, from every wheel visited. They are
+ * handed over once at the end of the poll (cbs_input_flush), so shapers
+ * sharing a port's output node share one frame to it instead of sending
+ * one small frame each. Wheels are visited in next_check_time order, so
+ * the frames keep eligibility order.
+ */
+typedef struct
+{
+  u32 n_bufs;                            /**< Frames for interface-output (or the port output node) */
+  u32 n_steered;                         /**< Frames for a dedicated TX queue ("set cbs tx-queue") */
+  u32 bufs[VLIB_FRAME_SIZE];
+  u16 nexts[VLIB_FRAME_SIZE];
+  u32 steered_bufs[VLIB_FRAME_SIZE];
+  u32 steered_tx_nodes[VLIB_FRAME_SIZE];
+  u16 steered_queues[VLIB_FRAME_SIZE];
+} cbs_tx_batch_t;
+
+
 /* --- Static Function Declarations/Definitions --- */
 
 // Forward declaration for trace function
@@ -56,60 +89,300 @@ cbs_input_add_trace (vlib_main_t * vm, vlib_node_runtime_t * node,
                    f64 credits_before, f64 credits_after, u32 len);
 
 
+/* --- Event Logger ("set cbs elog", see "show event-logger") --- */
+/** @brief Log CBS credit crossing zero or reaching hicredit/locredit. */
+static_always_inline void
+cbs_elog_credit (u32 thread_index, cbs_wheel_t * wp, const cbs_engine_params_t * p,
+                 f64 before, f64 after)
+{
+  ELOG_TYPE_DECLARE (e) = {
+    .format = "cbs-credit: shaper %d %s, credit %d",
+    .format_args = "i4t4i4",
+    .n_enum_strings = 4,
+    .enum_strings = { "below zero", "back to zero", "at hicredit", "at locredit" },
+  };
+  struct { u32 shaper; u32 what; i32 credit; } *ed;
+  u32 what[3], n = 0, i;
+
+  if ((before < 0.0) != (after < 0.0))
+    what[n++] = after < 0.0 ? 0 : 1;
+  if (after >= p->hicredit && before < p->hicredit)
+    what[n++] = 2;
+  if (after <= p->locredit && before > p->locredit)
+    what[n++] = 3;
+
+  for (i = 0; i < n; i++)
+    {
+      ed = ELOG_TRACK_DATA (vlib_get_elog_main (), e, vlib_worker_threads[thread_index].elog_track);
+      ed->shaper = wp->shaper_index;
+      ed->what = what[i];
+      ed->credit = (i32) after;
+    }
+}
+
+/**
+ * @brief Log the start or end of a stall of the wheel head.
+ * Port-busy waits are the normal pacing between frames and are not logged.
+ */
+static_always_inline void
+cbs_elog_stall (u32 thread_index, cbs_wheel_t * wp, cbs_engine_verdict_t verdict, f64 now)
+{
+  ELOG_TYPE_DECLARE (e_start) = {
+    .format = "cbs-stall: shaper %d start, %s, depth %d",
+    .format_args = "i4t4i4",
+    .n_enum_strings = 5,
+    .enum_strings = { "none", "port busy", "credits", "tokens", "not eligible" },
+  };
+  ELOG_TYPE_DECLARE (e_end) = {
+    .format = "cbs-stall: shaper %d end, %s, %.3f us",
+    .format_args = "i4t4f8",
+    .n_enum_strings = 5,
+    .enum_strings = { "none", "port busy", "credits", "tokens", "not eligible" },
+  };
+
+  if (verdict == CBS_ENGINE_SEND)
+    {
+      struct { u32 shaper; u32 reason; f64 us; } *ed;
+      ed = ELOG_TRACK_DATA (vlib_get_elog_main (), e_end, vlib_worker_threads[thread_index].elog_track);
+      ed->shaper = wp->shaper_index;
+      ed->reason = wp->elog_stall_reason;
+      ed->us = (now - wp->elog_stall_start) * 1e6;
+      wp->elog_stall_reason = 0;
+    }
+  else
+    {
+      struct { u32 shaper; u32 reason; u32 depth; } *ed;
+      ed = ELOG_TRACK_DATA (vlib_get_elog_main (), e_start, vlib_worker_threads[thread_index].elog_track);
+      ed->shaper = wp->shaper_index;
+      ed->reason = verdict;
+      ed->depth = wp->cursize;
+      wp->elog_stall_reason = verdict;
+      wp->elog_stall_start = now;
+    }
+}
+
+/** @brief Log the frames and bytes one poll sent from a wheel. */
+static_always_inline void
+cbs_elog_burst (u32 thread_index, cbs_wheel_t * wp, u32 n_packets, u64 n_bytes)
+{
+  ELOG_TYPE_DECLARE (e) = {
+    .format = "cbs-poll: shaper %d sent %d frames, %d bytes, depth %d",
+    .format_args = "i4i4i4i4",
+  };
+  struct { u32 shaper; u32 n_packets; u32 n_bytes; u32 depth; } *ed;
+
+  ed = ELOG_TRACK_DATA (vlib_get_elog_main (), e, vlib_worker_threads[thread_index].elog_track);
+  ed->shaper = wp->shaper_index;
+  ed->n_packets = n_packets;
+  ed->n_bytes = n_bytes;
+  ed->depth = wp->cursize;
+}
+
+
+/* --- TX Backpressure and Queue Steering --- */
+/**
+ * @brief Give back what the last poll charged for frames its ports' TX
+ * nodes dropped. Drivers drop the tail of what they could not place, so
+ * the last frames handed to a port are the ones refunded.
+ */
+static_always_inline void
+cbs_input_refund_tx_drops (vlib_main_t * vm, vlib_node_runtime_t * node, cbs_main_t * cbsm,
+                           cbs_per_thread_t * ptd)
+{
+  cbs_tx_sent_t *ts;
+  u32 n_refunded = 0;
+
+  vec_foreach_backwards (ts, ptd->tx_sent)
+    {
+      cbs_tx_port_t *tp = ptd->tx_port_by_hw_if_index + ts->hw_if_index;
+      cbs_wheel_t *wp;
+      cbs_engine_params_t p;
+
+      if (tp->n_dropped == 0)
+        continue;
+      tp->n_dropped--;
+      // The wheel may have been reclaimed since: the credit went with it
+      if (ts->shaper_index >= vec_len (ptd->wheel_by_shaper) || !(wp = ptd->wheel_by_shaper[ts->shaper_index]))
+        continue;
+      cbs_shaper_params_read (vec_elt_at_index (cbsm->shapers, ts->shaper_index), &p);
+      cbs_engine_refund (&p, &wp->eng, ts->wire_length);
+      n_refunded++;
+    }
+  if (n_refunded)
+    vlib_node_increment_counter (vm, node->node_index, CBS_TX_ERROR_TX_REFUNDED, n_refunded);
+}
+
+/**
+ * @brief Hold ports whose TX node counted errors since this thread last
+ * sent to them, and refund the frames it dropped. The hold uses the port
+ * timeline, so frames stay in the wheels uncharged until it ends; it
+ * doubles while errors continue. No new frame reaches a held port, so
+ * only the frames of the poll that filled the ring are lost.
+ */
+static_always_inline void
+cbs_input_check_tx_ports (vlib_main_t * vm, vlib_node_runtime_t * node, cbs_main_t * cbsm,
+                          cbs_per_thread_t * ptd, f64 now)
+{
+  u32 *hw_if_index;
+  int any_dropped = 0;
+
+  vec_foreach (hw_if_index, ptd->tx_ports_pending)
+    {
+      cbs_tx_port_t *tp = ptd->tx_port_by_hw_if_index + *hw_if_index;
+      f64 *tx_finish_time = ptd->tx_finish_time_by_hw_if_index + *hw_if_index;
+      u64 n_errors = cbs_tx_port_errors (vm, tp) - tp->tx_errors;
+
+      if (n_errors)
+        {
+          tp->backoff = tp->backoff ? clib_min (2 * tp->backoff, CBS_TX_BACKOFF_MAX) : cbsm->tx_backoff;
+          *tx_finish_time = clib_max (*tx_finish_time, now + tp->backoff);
+          vlib_node_increment_counter (vm, node->node_index, CBS_TX_ERROR_TX_BACKPRESSURE, 1);
+          // Unshaped traffic counts there too: never more than this thread's frames
+          tp->n_dropped = clib_min (n_errors, tp->n_sent);
+          any_dropped = 1;
+        }
+      else
+        tp->backoff = 0;
+    }
+  if (any_dropped)
+    cbs_input_refund_tx_drops (vm, node, cbsm, ptd);
+
+  vec_foreach (hw_if_index, ptd->tx_ports_pending)
+    {
+      cbs_tx_port_t *tp = ptd->tx_port_by_hw_if_index + *hw_if_index;
+      tp->is_pending = 0;
+      tp->n_sent = tp->n_dropped = 0;
+    }
+  vec_reset_length (ptd->tx_ports_pending);
+  vec_reset_length (ptd->tx_sent);
+}
+
+/** @brief Note that a frame went to a port, so its TX errors get checked next poll. */
+static_always_inline void
+cbs_input_tx_port_sent (vlib_main_t * vm, cbs_per_thread_t * ptd, cbs_wheel_t * wp, u32 hw_if_index, u32 len)
+{
+  cbs_tx_port_t *tp = ptd->tx_port_by_hw_if_index + hw_if_index;
+
+  if (vec_len (ptd->tx_sent) < CBS_TX_SENT_MAX)
+    {
+      cbs_tx_sent_t *ts;
+      vec_add2 (ptd->tx_sent, ts, 1); // Allocated at bind, never grows here
+      ts->shaper_index = wp->shaper_index;
+      ts->hw_if_index = hw_if_index;
+      ts->wire_length = len;
+      tp->n_sent++;
+    }
+  if (tp->is_pending)
+    return;
+  tp->is_pending = 1;
+  tp->tx_errors = cbs_tx_port_errors (vm, tp); // Before the TX node sees this poll's frames
+  vec_add1 (ptd->tx_ports_pending, hw_if_index);
+}
+
+/**
+ * @brief Hand frames straight to their port's TX node on a fixed queue.
+ * Does what interface-output-arc-end does, minus the queue choice. Frames
+ * for the same node and queue go in one frame, in order, even when other
+ * ports' frames came in between.
+ */
+static_always_inline void
+cbs_input_enqueue_to_tx_queue (vlib_main_t * vm, u32 * bufs, u32 * tx_nodes, u16 * queues, u32 n)
+{
+  u8 is_sent[VLIB_FRAME_SIZE] = { 0 };
+  u32 i, j;
+
+  for (i = 0; i < n; i++)
+    {
+      if (is_sent[i])
+        continue;
+
+      vlib_frame_t *f = vlib_get_frame_to_node (vm, tx_nodes[i]);
+      vnet_hw_if_tx_frame_t *tf = vlib_frame_scalar_args (f);
+      u32 *to = vlib_frame_vector_args (f);
+      tf->queue_id = queues[i];
+      tf->shared_queue = 1; // Other threads may have the queue too
+      for (j = i; j < n; j++)
+        if (!is_sent[j] && tx_nodes[j] == tx_nodes[i] && queues[j] == queues[i])
+          {
+            to[f->n_vectors++] = bufs[j];
+            is_sent[j] = 1;
+          }
+      vlib_put_frame_to_node (vm, tx_nodes[i], f);
+    }
+}
+
+/** @brief Hand over everything a poll released: one frame per next node / TX queue. */
+static_always_inline void
+cbs_input_flush (vlib_main_t * vm, vlib_node_runtime_t * node, cbs_tx_batch_t * tb)
+{
+  if (tb->n_bufs)
+    vlib_buffer_enqueue_to_next (vm, node, tb->bufs, tb->nexts, tb->n_bufs);
+  if (PREDICT_FALSE (tb->n_steered))
+    cbs_input_enqueue_to_tx_queue (vm, tb->steered_bufs, tb->steered_tx_nodes, tb->steered_queues, tb->n_steered);
+  tb->n_bufs = tb->n_steered = 0;
+}
+
+
+/**
+ * @brief Free head-of-line frames that outlived their class's max
+ * residence. They are not charged, so fresh frames behind them are not
+ * delayed by credit they would have burnt.
+ */
+static_always_inline void
+cbs_input_expire (vlib_main_t * vm, vlib_node_runtime_t * node, cbs_wheel_t * wp,
+                  u32 * bufs, u32 n_bufs, u64 n_bytes)
+{
+  cbs_main_t *cbsm = &cbs_main;
+
+  vlib_buffer_free (vm, bufs, n_bufs);
+  vlib_node_increment_counter (vm, node->node_index, CBS_TX_ERROR_EXPIRED, n_bufs);
+  vlib_increment_combined_counter (&cbsm->counters[CBS_COUNTER_EXPIRED], vm->thread_index,
+                                   wp->shaper_index, n_bufs, n_bytes);
+}
+
+
 /* --- Input Node Function (Inline) --- */
+/**
+ * @brief Dequeue eligible packets from one shaper's wheel on this thread
+ * into the poll's batch (at most CBS_MAX_TX_BURST, which must fit).
+ * @param algo compile-time constant; each algorithm gets its own fully
+ *        inlined variant (see the node function below).
+ */
 static_always_inline uword
 cbs_input_inline (vlib_main_t * vm, vlib_node_runtime_t * node,
-                  vlib_frame_t * frame)
+                  cbs_per_thread_t * ptd, cbs_shaper_t * shaper,
+                  cbs_wheel_t * wp, f64 now, cbs_tx_batch_t * tb, cbs_algo_t algo)
 {
    cbs_main_t *cbsm = &cbs_main;
    u32 thread_index = vm->thread_index;
-   cbs_wheel_t *wp = NULL;
-   f64 now;
    u32 n_tx_packets = 0;
-   u32 to_next_bufs[CBS_MAX_TX_BURST];
-   u16 to_next_nodes[CBS_MAX_TX_BURST];
-
-   // --- Initial checks ---
-   if (PREDICT_FALSE(!cbsm->is_configured)) return 0;
-
-   if (PREDICT_FALSE (thread_index >= vec_len(cbsm->wheel_by_thread) || !(wp = cbsm->wheel_by_thread[thread_index]))) {
-       vlib_node_increment_counter (vm, node->node_index, CBS_TX_ERROR_NO_WHEEL_FOR_THREAD, 1);
-       // clib_warning("T%u: No wheel found!", thread_index); // Optional debug
-       return 0;
-   }
-
-   if (PREDICT_TRUE (wp->cursize == 0)) {
-       // Increment counter only if needed for debugging empty polls
-       // vlib_node_increment_counter(vm, node->node_index, CBS_TX_ERROR_NO_PKTS_IN_WHEEL, 1);
-       return 0;
-   }
+   u64 n_tx_bytes = 0;
+   f64 shared_retry = 0; // When the shared segment may grant again (0 = it did not refuse)
+   u32 expired[CBS_MAX_EXPIRE_PER_VISIT], n_expired = 0;
+   u64 n_expired_bytes = 0;
+
+   // Local copy with the algorithm pinned to the compile-time constant, so
+   // every algorithm test in the engine folds away in this variant. Stream
+   // reservations republish the slopes without a barrier (see cbs_reservation.c).
+   cbs_engine_params_t p;
+   cbs_shaper_params_read(shaper, &p);
+   p.algo = algo;
+   u8 elog = cbsm->elog_enabled;
+   f64 credits_polled = wp->eng.credits;
+   f64 horizon_end = now + ptd->horizon; // Frames starting before the next poll go now
+   // Frames enqueued before this are stale; with no limit nothing is, at the cost of one compare
+   f64 expire_before = shaper->max_residence > 0 ? now - shaper->max_residence : -1.0;
 
    // --- Update Credits ---
-   now = vlib_time_now (vm); // Get current time once for this poll cycle
-
-   f64 delta_t = now - wp->cbs_last_update_time;
-   if (PREDICT_TRUE(delta_t > 1e-9)) { // Avoid division by zero or negative time
-       f64 gained_credits = delta_t * cbsm->cbs_idleslope;
-       wp->cbs_credits += gained_credits;
-       wp->cbs_credits = clib_min(wp->cbs_credits, cbsm->cbs_hicredit); // Cap at hicredit
-       wp->cbs_last_update_time = now;
-   }
+   cbs_engine_advance(&p, &wp->eng, now);
+   if (algo == CBS_ALGO_CBS && PREDICT_FALSE (elog))
+       cbs_elog_credit(thread_index, wp, &p, credits_polled, wp->eng.credits);
+   if (algo == CBS_ALGO_CBS)
+       cbs_wheel_track_starvation(ptd, wp, now);
 
    // --- Transmission Loop (Modified Logic) ---
-   f64 current_tx_allowed_time = wp->cbs_last_tx_finish_time; // Initialize current allowed time for this burst
-
    while (n_tx_packets < CBS_MAX_TX_BURST && wp->cursize > 0) {
 
-       // *** Port Busy Check (Using current_tx_allowed_time) ***
-       if (now < current_tx_allowed_time) {
-           // Log only if this is the *first* check in the loop that fails
-           if (n_tx_packets == 0) {
-                // clib_warning("CBS_DBG T%u: STALLED (port busy loop: now %.9f < allowed %.9f)", thread_index, now, current_tx_allowed_time); // Optional debug
-                vlib_node_increment_counter (vm, node->node_index, CBS_TX_ERROR_STALLED_PORT_BUSY, 1);
-           }
-           break; // Stop sending for this poll cycle
-       }
-
        cbs_wheel_entry_t *ep = wp->entries + wp->head;
        u32 bi = ep->buffer_index;
 
@@ -119,6 +392,17 @@ cbs_input_inline (vlib_main_t * vm, vlib_node_runtime_t * node,
            wp->cursize--;
            continue;
        }
+       if (PREDICT_FALSE (ep->enqueue_time < expire_before)) {
+           // A long stale backlog is freed over several polls, not in one
+           if (n_expired == CBS_MAX_EXPIRE_PER_VISIT)
+               break;
+           expired[n_expired++] = bi;
+           n_expired_bytes += ep->wire_length;
+           ep->buffer_index = ~0;
+           wp->head = (wp->head + 1) % wp->wheel_size;
+           wp->cursize--;
+           continue;
+       }
        vlib_buffer_t *b = vlib_get_buffer(vm, bi);
        if (PREDICT_FALSE(!b)) {
            clib_warning("T%u: Invalid buffer index %u found in wheel", thread_index, bi); // Keep this warning
@@ -128,58 +412,141 @@ cbs_input_inline (vlib_main_t * vm, vlib_node_runtime_t * node,
            wp->cursize--;
            continue;
        }
-       u32 len = vlib_buffer_length_in_chain(vm, b);
-       f64 credits_before = wp->cbs_credits; // For trace
+       u32 len = ep->wire_length; // Wire-accurate length computed at enqueue
+       f64 credits_before = wp->eng.credits; // For trace
        u32 next_node_index_for_buffer = ep->output_next_index;
 
-       // --- Credit Check ---
-       // Sendslope check removed as per simplified CBS definition (sendslope < 0 check)
-       // if (wp->cbs_credits < 0 && cbsm->cbs_sendslope < 0) { // Original check
-       if (wp->cbs_credits < cbsm->cbs_locredit && cbsm->cbs_sendslope <= 0) { // More standard check: below locredit and not gaining credits faster than sending
-            // Log only if this is the *first* check in the loop that fails
-            if (n_tx_packets == 0) {
-                // clib_warning("CBS_DBG T%u: STALLED (credits %.4f < locredit %.4f && sendslope %.4f <= 0)",
-                //             thread_index, wp->cbs_credits, cbsm->cbs_locredit, cbsm->cbs_sendslope); // Optional debug
-                vlib_node_increment_counter (vm, node->node_index, CBS_TX_ERROR_STALLED_CREDITS, 1);
-            }
-            break; // Stop sending due to insufficient credits
-        }
+       // The timeline belongs to the parent port and is shared by every
+       // shaper (and sub-interface) transmitting on it from this thread.
+       ASSERT (ep->hw_if_index < vec_len (ptd->tx_finish_time_by_hw_if_index));
+       f64 *current_tx_allowed_time = ptd->tx_finish_time_by_hw_if_index + ep->hw_if_index;
+
+       // --- Port Busy / Credit / Token / Eligibility Check ---
+       f64 tx_time = now;
+       cbs_engine_verdict_t verdict = cbs_engine_check(&p, &wp->eng, *current_tx_allowed_time,
+                                                       len, ep->eligible_time, now);
+       if (verdict != CBS_ENGINE_SEND && horizon_end > now) {
+           // Project the frame's start through the port timeline and the credit
+           // curve; if that is before the next poll, release it now.
+           f64 t = cbs_engine_next_check_time(&p, &wp->eng, *current_tx_allowed_time,
+                                              len, ep->eligible_time, now);
+           if (t <= horizon_end) {
+               cbs_engine_advance(&p, &wp->eng, t);
+               verdict = cbs_engine_check(&p, &wp->eng, *current_tx_allowed_time, len, ep->eligible_time, t);
+               tx_time = t;
+           }
+       }
+       if (verdict != CBS_ENGINE_SEND) {
+           // Count only if this is the *first* check in the loop that fails
+           if (n_tx_packets == 0)
+               vlib_node_increment_counter (vm, node->node_index, cbs_tx_error_by_verdict[verdict], 1);
+           if (PREDICT_FALSE (elog) && verdict != CBS_ENGINE_STALL_PORT_BUSY && verdict != wp->elog_stall_reason)
+               cbs_elog_stall(thread_index, wp, verdict, now);
+           break; // Stop sending for this poll cycle
+       }
+       if (PREDICT_FALSE (shaper->shared != 0) && wp->shared_grant < len) {
+           // Other instances shape onto the same uplink: take bytes from the
+           // common bucket, a batch at a time so the segment is rarely touched.
+           // Never more than the bucket holds: a frame larger than that (GSO)
+           // borrows the rest, and the debt is taken with the next batch.
+           f64 n_owed = len - wp->shared_grant;
+           u32 n_bytes = clib_min (clib_max (n_owed, shaper->shared_batch),
+                                   cbs_shared_burst_bytes (shaper->shared));
+           u64 wait = cbs_shared_reserve (shaper->shared, cbs_shared_now (), n_bytes);
+           if (wait) {
+               if (n_tx_packets == 0)
+                   vlib_node_increment_counter (vm, node->node_index, CBS_TX_ERROR_STALLED_SHARED, 1);
+               shared_retry = now + wait * 1e-9;
+               break;
+           }
+           clib_atomic_fetch_add_relax (&shaper->shared_member->n_bytes, n_bytes);
+           wp->shared_grant += n_bytes;
+       }
+       if (PREDICT_FALSE (elog && wp->elog_stall_reason))
+           cbs_elog_stall(thread_index, wp, CBS_ENGINE_SEND, now);
 
        // --- Prepare for Enqueue ---
-       to_next_bufs[n_tx_packets] = bi;
-       to_next_nodes[n_tx_packets] = (u16) next_node_index_for_buffer;
-
-       // --- Calculate Transmission Duration & Update Credits ---
-       f64 tx_duration = (f64)len / cbsm->cbs_port_rate;
-       f64 credit_change = tx_duration * cbsm->cbs_sendslope; // Sendslope = idle - port
-       wp->cbs_credits += credit_change;
-       // Note: Credit is allowed to go below locredit during transmission
-
-       // ★★★ Update the next allowed transmission time for *this burst* ★★★
-       // Use the later of 'now' or the previous 'allowed' time as the start point
-       current_tx_allowed_time = clib_max(now, current_tx_allowed_time) + tx_duration;
+       if (PREDICT_FALSE (ep->tx_queue_id != CBS_TX_QUEUE_ANY)) {
+           tb->steered_bufs[tb->n_steered] = bi;
+           tb->steered_tx_nodes[tb->n_steered] = ptd->tx_port_by_hw_if_index[ep->hw_if_index].tx_node_index;
+           tb->steered_queues[tb->n_steered++] = ep->tx_queue_id;
+       } else {
+           tb->bufs[tb->n_bufs] = bi;
+           tb->nexts[tb->n_bufs++] = (u16) next_node_index_for_buffer;
+       }
+       if (cbsm->tx_backoff > 0)
+           cbs_input_tx_port_sent(vm, ptd, wp, ep->hw_if_index, len);
+
+       // --- Update Credits & the next allowed transmission time on the port ---
+       cbs_engine_charge(&p, &wp->eng, current_tx_allowed_time, len, tx_time);
+       if (PREDICT_FALSE (shaper->shared != 0))
+           wp->shared_grant -= len;
+       if (algo == CBS_ALGO_CBS && PREDICT_FALSE (elog))
+           cbs_elog_credit(thread_index, wp, &p, credits_before, wp->eng.credits);
+       if (PREDICT_FALSE (ptd->capture_ring != 0))
+           cbs_capture_add(ptd, wp, ep, thread_index, algo, tx_time, credits_before);
 
        // --- Add Trace & Update Wheel State ---
-       cbs_input_add_trace(vm, node, bi, now, next_node_index_for_buffer, credits_before, wp->cbs_credits, len);
+       cbs_input_add_trace(vm, node, bi, tx_time, next_node_index_for_buffer, credits_before, wp->eng.credits, len);
        ep->buffer_index = ~0; // Mark buffer as dequeued in the wheel entry
        wp->head = (wp->head + 1) % wp->wheel_size;
        wp->cursize--;
+       n_tx_bytes += len;
        n_tx_packets++;
 
      } // end while loop
 
    // --- Final Enqueue & State Update ---
    if (n_tx_packets > 0) {
-       // ★★★ Record the final calculated allowed time for the next poll cycle ★★★
-       wp->cbs_last_tx_finish_time = current_tx_allowed_time;
-
-       vlib_buffer_enqueue_to_next(vm, node, to_next_bufs, to_next_nodes, n_tx_packets);
+       // The frames themselves go out with the rest of the poll (cbs_input_flush)
        vlib_node_increment_counter(vm, node->node_index, CBS_TX_ERROR_TRANSMITTED, n_tx_packets);
+       vlib_increment_combined_counter (&cbsm->counters[CBS_COUNTER_TRANSMITTED], thread_index,
+                                        wp->shaper_index, n_tx_packets, n_tx_bytes);
+       if (PREDICT_FALSE (elog))
+           cbs_elog_burst(thread_index, wp, n_tx_packets, n_tx_bytes);
+     }
+   if (PREDICT_FALSE (n_expired > 0))
+       cbs_input_expire(vm, node, wp, expired, n_expired, n_expired_bytes);
+   if (n_tx_packets > 0 || n_expired > 0) {
+       if (PREDICT_FALSE(wp->is_above_high && wp->cursize <= wp->event_low_slots)) {
+           wp->is_above_high = 0;
+           cbs_wheel_post_event(ptd, wp, CBS_EVENT_LOW_WATERMARK);
+       }
+       if (PREDICT_FALSE(wp->pausing_input && wp->cursize <= wp->pause_low_slots))
+           cbs_wheel_resume_input(vm, ptd, wp); // Lossless cross-connect: RX polls again
      }
    // else {
    //    // Optional: Log or count cases where the loop exited without sending (e.g., only stalls occurred)
    // }
 
+   if (wp->cursize == 0) {
+       cbs_engine_backlog_empty(&p, &wp->eng); // 802.1Q: no credit kept while idle
+       cbs_active_remove(ptd, wp);
+       wp->empty_since = now;
+   } else {
+       // Re-key on when the new head may go; until then this wheel is not touched
+       cbs_wheel_entry_t *ep = wp->entries + wp->head;
+       f64 next = cbs_engine_next_check_time(&p, &wp->eng, ptd->tx_finish_time_by_hw_if_index[ep->hw_if_index],
+                                             ep->wire_length, ep->eligible_time, now);
+       if (algo == CBS_ALGO_CBS) {
+           cbs_wheel_track_starvation(ptd, wp, now);
+           // Come back when a credit-starved event would be due, even if credits recover later
+           if (wp->starved_since != 0 && !wp->is_starved && wp->event_high_slots != ~0)
+               next = clib_min (next, wp->starved_since + wp->event_starvation_time);
+       }
+       next = clib_max (next, shared_retry);
+       // Come back when the head goes stale, even if it cannot be sent by then; a head
+       // left stale by the expiry bound is due at once, so the next poll frees more
+       if (shaper->max_residence > 0)
+           next = clib_min (next, ep->enqueue_time + shaper->max_residence);
+       if (next <= horizon_end)
+           next = horizon_end + CBS_ACTIVE_MIN_DELAY; // Still due (burst limit): not again in this poll
+       cbs_active_update(ptd, wp, next);
+   }
+
+   // Occupancy gauge; empty wheels are skipped by the poll, so this lands on 0 when drained
+   vlib_set_simple_counter (&cbsm->queue_depth, thread_index, wp->shaper_index, wp->cursize);
+
    return n_tx_packets;
 }
 
@@ -209,8 +576,56 @@ cbs_input_add_trace (vlib_main_t * vm, vlib_node_runtime_t * node,
 /* --- Node Function Wrapper --- */
 VLIB_NODE_FN (cbs_input_node) (vlib_main_t * vm, vlib_node_runtime_t * node, vlib_frame_t * frame)
 {
-    // Directly call the inline function
-    return cbs_input_inline (vm, node, frame);
+    cbs_main_t *cbsm = &cbs_main;
+    u32 thread_index = vm->thread_index;
+    cbs_per_thread_t *ptd;
+    cbs_wheel_t *wp;
+    cbs_tx_batch_t tb;
+    uword n_tx = 0;
+    f64 now;
+
+    // --- Initial checks ---
+    if (PREDICT_FALSE(!cbsm->is_configured)) return 0;
+
+    if (PREDICT_FALSE (thread_index >= vec_len(cbsm->per_thread))) {
+        vlib_node_increment_counter (vm, node->node_index, CBS_TX_ERROR_NO_WHEEL_FOR_THREAD, 1);
+        return 0;
+    }
+    ptd = vec_elt_at_index (cbsm->per_thread, thread_index);
+    now = vlib_time_now (vm); // Get current time once for this poll cycle
+    if (cbsm->horizon_max > 0 && ptd->last_poll_time > 0)
+        ptd->horizon = clib_min (now - ptd->last_poll_time, cbsm->horizon_max);
+    ptd->last_poll_time = now;
+    if (vec_len (ptd->tx_ports_pending))
+        cbs_input_check_tx_ports (vm, node, cbsm, ptd, now);
+
+    // Only wheels whose head may be sendable by now; each visit re-keys or removes the wheel
+    tb.n_bufs = tb.n_steered = 0;
+    while (vec_len (ptd->active_wheels) > 0) {
+        wp = ptd->active_wheels[0];
+        if (wp->next_check_time > now + ptd->horizon)
+            break;
+        cbs_shaper_t *shaper = vec_elt_at_index (cbsm->shapers, wp->shaper_index);
+        if (PREDICT_FALSE (tb.n_bufs + tb.n_steered + CBS_MAX_TX_BURST > VLIB_FRAME_SIZE))
+            cbs_input_flush (vm, node, &tb); // Many shapers due at once: a frame is full
+
+        // Resolve the algorithm once per wheel; each case is a direct call into
+        // a specialized variant, so the per-packet path has no indirect calls.
+        switch (shaper->eng.algo) {
+          case CBS_ALGO_TBF:
+            n_tx += cbs_input_inline (vm, node, ptd, shaper, wp, now, &tb, CBS_ALGO_TBF);
+            break;
+          case CBS_ALGO_ATS:
+            n_tx += cbs_input_inline (vm, node, ptd, shaper, wp, now, &tb, CBS_ALGO_ATS);
+            break;
+          default:
+            n_tx += cbs_input_inline (vm, node, ptd, shaper, wp, now, &tb, CBS_ALGO_CBS);
+            break;
+        }
+    }
+    cbs_input_flush (vm, node, &tb);
+
+    return n_tx;
 }
 
 /* --- Non-Variant Specific Code (Error Strings, Trace Formatting, Registration) --- */
@@ -231,7 +646,7 @@ format_cbs_tx_trace (u8 * s, va_list * args)
   cbs_tx_trace_t *t = va_arg (*args, cbs_tx_trace_t *);
 
   // Format the trace output
-  s = format (s, "CBS_DEQ (bi %u len %u): tx @ %.9f, next %u, credit %.4f -> %.4f", // Increased precision for time/credit
+  s = format (s, "CBS_DEQ (bi %u wire_len %u): tx @ %.9f, next %u, credit %.4f -> %.4f", // Increased precision for time/credit
               t->buffer_index, t->packet_len, t->tx_time, t->next_index,
               t->cbs_credits_before, t->cbs_credits_after);
   return s;
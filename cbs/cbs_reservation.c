@@ -0,0 +1,627 @@
+/*
+ * cbs_reservation.c - VPP CBS plugin stream reservation table
+ * Talkers register streams (class, max frame size, frames per class
+ * measurement interval); the CBS slopes and credit bounds of each class are
+ * derived from its streams with the 802.1Q-2018 Annex L formulas and
+ * published to the workers without a barrier (cbs_shaper_params_publish).
+ * A stream may also carry an 802.1Qci filter (DMAC + VID): the enqueue path
+ * then drops its frames over the declared max frame size or over the
+ * reserved rate before they take a slot in the class wheel.
+ *
+ * Copyright (c) 2024 Your Org <your.email@example.com> // Placeholder
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ */
+
+#include <vlib/vlib.h>
+#include <vnet/vnet.h>
+#include <vnet/api_errno.h>
+#include <vppinfra/error.h>
+#include <vppinfra/format.h>
+#include <vppinfra/hash.h>
+#include <cbs/cbs.h>
+
+#include <vppinfra/bihash_8_8.h>
+#include <vppinfra/bihash_template.c>
+
+#define CBS_STREAM_MAX_FRAME 9000 /**< Largest max frame size a stream may declare */
+
+/** @brief Reservation state of a class, created with the defaults on first use */
+static cbs_reservation_t *
+cbs_reservation_get (cbs_main_t * cbsm, u32 shaper_index)
+{
+  cbs_reservation_t *r;
+
+  vec_validate (cbsm->reservation_by_shaper, shaper_index);
+  r = vec_elt_at_index (cbsm->reservation_by_shaper, shaper_index);
+  if (r->interval == 0)
+    {
+      r->interval = CBS_RESERVATION_DEFAULT_INTERVAL;
+      r->share_pct = CBS_RESERVATION_DEFAULT_SHARE_PCT;
+      r->max_interference = CBS_RESERVATION_DEFAULT_INTERFERENCE;
+    }
+  return r;
+}
+
+/**
+ * @brief Whether a class with @c idleslope fits next to the other CBS
+ * classes on every port it transmits on: the idleslopes of all classes
+ * bound to interfaces of a port (sub-interfaces count for their parent)
+ * may not exceed @c limit together. Classes on other ports do not count.
+ */
+static int
+cbs_reservation_port_fits (cbs_main_t * cbsm, u32 shaper_index, f64 idleslope, f64 limit)
+{
+  cbs_interface_t *intf, *other;
+  uword *on_port = 0;
+  int fits = 1;
+  u32 i;
+
+  vec_foreach (intf, cbsm->interface_by_sw_if_index)
+    {
+      f64 sum = idleslope;
+
+      if (intf->output_next_index == ~0 || intf->shaper_index != shaper_index)
+        continue;
+      clib_bitmap_zero (on_port);
+      vec_foreach (other, cbsm->interface_by_sw_if_index)
+        if (other->output_next_index != ~0 && other->hw_if_index == intf->hw_if_index &&
+            other->shaper_index != shaper_index)
+          on_port = clib_bitmap_set (on_port, other->shaper_index, 1);
+      clib_bitmap_foreach (i, on_port)
+        {
+          cbs_shaper_t *shaper = cbs_shaper_get_if_valid (cbsm, i);
+          if (shaper && shaper->eng.algo == CBS_ALGO_CBS)
+            sum += shaper->eng.idleslope;
+        }
+      if (sum > limit)
+        {
+          fits = 0;
+          break;
+        }
+    }
+  clib_bitmap_free (on_port);
+  return fits;
+}
+
+/**
+ * @brief Derive a class's CBS parameters from its streams (802.1Q-2018 L.3).
+ *   idleSlope = sum (maxFrameSize * maxIntervalFrames) / classMeasurementInterval
+ *   hiCredit  = maxInterferenceSize * idleSlope / portTransmitRate
+ *   loCredit  = maxFrameSize * sendSlope / portTransmitRate
+ * Frame sizes are charged the way the shaper charges buffers (L1/L2, overhead).
+ * A class without streams gets the operator's slopes back.
+ * @return 0, or VNET_API_ERROR_INVALID_VALUE_4 if the streams need more than
+ *         the reservable share, alone or with the other CBS classes of a
+ *         port the class is bound to (p is filled in either way)
+ */
+static int
+cbs_reservation_compute (cbs_main_t * cbsm, u32 shaper_index, cbs_engine_params_t * p)
+{
+  cbs_shaper_t *shaper = vec_elt_at_index (cbsm->shapers, shaper_index);
+  cbs_reservation_t *r = cbs_reservation_get (cbsm, shaper_index);
+  f64 port_rate = shaper->eng.port_rate;
+  f64 idleslope = 0, limit;
+  u32 max_frame = 0, n_streams = 0;
+  cbs_stream_t *st;
+
+  pool_foreach (st, cbsm->streams)
+    {
+      u32 frame;
+      if (st->shaper_index != shaper_index)
+        continue;
+      frame = cbs_frame_wire_length (shaper, st->max_frame_size);
+      idleslope += (f64) frame * st->frames_per_interval / r->interval;
+      max_frame = clib_max (max_frame, frame);
+      n_streams++;
+    }
+
+  if (n_streams == 0)
+    {
+      *p = r->configured;
+      return 0;
+    }
+
+  *p = shaper->eng;
+  p->idleslope = idleslope;
+  p->sendslope = idleslope - port_rate;
+  p->hicredit = cbs_frame_wire_length (shaper, r->max_interference) * idleslope / port_rate;
+  p->locredit = max_frame * p->sendslope / port_rate;
+  limit = port_rate * r->share_pct / 100.0;
+  if (idleslope > limit || !cbs_reservation_port_fits (cbsm, shaper_index, idleslope, limit))
+    return VNET_API_ERROR_INVALID_VALUE_4;
+  return 0;
+}
+
+/** @brief Recompute a class and hand the result to the workers. */
+static void
+cbs_reservation_publish (cbs_main_t * cbsm, u32 shaper_index)
+{
+  cbs_engine_params_t p;
+
+  if (cbs_reservation_compute (cbsm, shaper_index, &p))
+    vlib_log_warn (cbsm->log_class, "Reservation: shaper %u streams exceed the reservable share", shaper_index);
+  cbs_shaper_params_publish (vec_elt_at_index (cbsm->shapers, shaper_index), &p);
+}
+
+/**
+ * @brief Write a filtered stream's meter parameters from its reservation.
+ * Plain stores: a worker may police one more frame with the previous values.
+ */
+static void
+cbs_stream_meter_refresh (cbs_main_t * cbsm, cbs_stream_t * st)
+{
+  cbs_shaper_t *shaper = vec_elt_at_index (cbsm->shapers, st->shaper_index);
+  cbs_reservation_t *r = cbs_reservation_get (cbsm, st->shaper_index);
+  f64 burst = (f64) cbs_frame_wire_length (shaper, st->max_frame_size) * st->frames_per_interval;
+  cbs_stream_meter_t *m;
+
+  if (!st->has_filter)
+    return;
+  m = vec_elt_at_index (cbsm->stream_meters, st - cbsm->streams);
+  m->ns_per_byte = burst > 0 ? r->interval * 1e9 / burst : 1e12; // No frames: nothing conforms
+  m->burst_ns = r->interval * 1e9;
+  m->shaper_index = st->shaper_index;
+  m->max_sdu = st->max_frame_size;
+}
+
+/** @brief Refresh the meters of a class's filtered streams after its parameters changed. */
+static void
+cbs_reservation_refresh_meters (cbs_main_t * cbsm, u32 shaper_index)
+{
+  cbs_stream_t *st;
+
+  if (cbsm->n_stream_filters == 0)
+    return;
+  pool_foreach (st, cbsm->streams)
+    if (st->shaper_index == shaper_index)
+      cbs_stream_meter_refresh (cbsm, st);
+}
+
+/** @brief Take a stream's filter out of the lookup table; its frames pass unpoliced. */
+static void
+cbs_stream_filter_remove (cbs_main_t * cbsm, cbs_stream_t * st)
+{
+  clib_bihash_kv_8_8_t kv = { .key = st->filter_key };
+
+  if (!st->has_filter)
+    return;
+  clib_bihash_add_del_8_8 (&cbsm->stream_filter_table, &kv, 0 /* is_add */);
+  st->has_filter = 0;
+  cbsm->n_stream_filters--;
+}
+
+/**
+ * @brief Register, update or withdraw a stream.
+ * Registering a known stream id replaces its reservation, and only if the
+ * new one fits; a rejected admission leaves every class as it was.
+ * @return 0 or VNET_API_ERROR_*: NO_SUCH_ENTRY (shaper or stream unknown),
+ *         INVALID_VALUE (not a CBS shaper), INVALID_VALUE_2 (frame size),
+ *         INVALID_VALUE_3 (frames), INVALID_VALUE_4 (over the reservable share)
+ */
+int
+cbs_stream_add_del (cbs_main_t * cbsm, u32 stream_id, u32 shaper_index, u32 max_frame_size,
+                    u32 frames_per_interval, int is_add)
+{
+  uword *q = hash_get (cbsm->stream_index_by_id, stream_id);
+  cbs_reservation_t *r;
+  cbs_shaper_t *shaper;
+  cbs_stream_t *st, saved = { 0 };
+  cbs_engine_params_t p;
+  u32 old_shaper_index = ~0;
+  int rv;
+
+  if (!is_add)
+    {
+      if (!q)
+        return VNET_API_ERROR_NO_SUCH_ENTRY;
+      st = pool_elt_at_index (cbsm->streams, q[0]);
+      shaper_index = st->shaper_index;
+      cbs_stream_filter_remove (cbsm, st);
+      hash_unset (cbsm->stream_index_by_id, stream_id);
+      pool_put (cbsm->streams, st);
+      cbsm->reservation_by_shaper[shaper_index].n_streams--;
+      cbs_reservation_publish (cbsm, shaper_index);
+      vlib_log_notice (cbsm->log_class, "Reservation: stream %u withdrawn from shaper %u", stream_id, shaper_index);
+      return 0;
+    }
+
+  if (!(shaper = cbs_shaper_get_if_valid (cbsm, shaper_index)))
+    return VNET_API_ERROR_NO_SUCH_ENTRY;
+  if (shaper->eng.algo != CBS_ALGO_CBS)
+    return VNET_API_ERROR_INVALID_VALUE;
+  if (max_frame_size == 0 || max_frame_size > CBS_STREAM_MAX_FRAME)
+    return VNET_API_ERROR_INVALID_VALUE_2;
+  if (frames_per_interval == 0)
+    return VNET_API_ERROR_INVALID_VALUE_3;
+
+  r = cbs_reservation_get (cbsm, shaper_index);
+  if (r->n_streams == 0)
+    r->configured = shaper->eng; // The operator's slopes, restored once the class has no streams
+
+  if (q)
+    {
+      st = pool_elt_at_index (cbsm->streams, q[0]);
+      saved = *st;
+      old_shaper_index = st->shaper_index;
+    }
+  else
+    {
+      pool_get_zero (cbsm->streams, st);
+      hash_set (cbsm->stream_index_by_id, stream_id, st - cbsm->streams);
+    }
+  st->stream_id = stream_id;
+  st->shaper_index = shaper_index;
+  st->max_frame_size = max_frame_size;
+  st->frames_per_interval = frames_per_interval;
+
+  if ((rv = cbs_reservation_compute (cbsm, shaper_index, &p)))
+    {
+      if (q)
+        *st = saved;
+      else
+        {
+          hash_unset (cbsm->stream_index_by_id, stream_id);
+          pool_put (cbsm->streams, st);
+        }
+      vlib_log_notice (cbsm->log_class, "Reservation: stream %u rejected, shaper %u or its ports would exceed %u%%",
+                       stream_id, shaper_index, r->share_pct);
+      return rv;
+    }
+  cbs_shaper_params_publish (shaper, &p);
+  cbs_stream_meter_refresh (cbsm, st);
+
+  if (old_shaper_index != shaper_index)
+    {
+      r->n_streams++;
+      if (old_shaper_index != ~0)
+        {
+          cbsm->reservation_by_shaper[old_shaper_index].n_streams--;
+          cbs_reservation_publish (cbsm, old_shaper_index);
+        }
+    }
+  vlib_log_notice (cbsm->log_class, "Reservation: stream %u in shaper %u, %u x %u bytes per %.0f us, idleslope %.0f kbps",
+                   stream_id, shaper_index, frames_per_interval, max_frame_size, r->interval * 1e6,
+                   p.idleslope * CBS_BITS_PER_BYTE / CBS_KBPS_TO_BPS);
+  return 0;
+}
+
+/**
+ * @brief Keep a class's reservations across a reconfiguration of its shaper.
+ * Called by cbs_shaper_install with the barrier held. The new configuration
+ * becomes the operator's slopes; streams of a deleted shaper, or of one that
+ * no longer runs CBS, are dropped.
+ */
+void
+cbs_reservation_shaper_installed (cbs_main_t * cbsm, u32 shaper_index)
+{
+  cbs_shaper_t *shaper = cbs_shaper_get_if_valid (cbsm, shaper_index);
+  cbs_reservation_t *r;
+  cbs_stream_t *st;
+  u32 *dropped = 0, *id;
+
+  if (shaper_index >= vec_len (cbsm->reservation_by_shaper))
+    return;
+  r = vec_elt_at_index (cbsm->reservation_by_shaper, shaper_index);
+  if (r->n_streams == 0)
+    return;
+
+  if (shaper && shaper->eng.algo == CBS_ALGO_CBS)
+    {
+      r->configured = shaper->eng;
+      if (cbs_reservation_compute (cbsm, shaper_index, &shaper->eng))
+        vlib_log_warn (cbsm->log_class, "Reservation: shaper %u streams exceed the reservable share", shaper_index);
+      cbs_reservation_refresh_meters (cbsm, shaper_index); // Accounting may have changed
+      return;
+    }
+
+  pool_foreach (st, cbsm->streams)
+    if (st->shaper_index == shaper_index)
+      vec_add1 (dropped, st->stream_id);
+  vec_foreach (id, dropped)
+    {
+      uword *q = hash_get (cbsm->stream_index_by_id, *id);
+      cbs_stream_filter_remove (cbsm, pool_elt_at_index (cbsm->streams, q[0]));
+      pool_put_index (cbsm->streams, q[0]);
+      hash_unset (cbsm->stream_index_by_id, *id);
+    }
+  vlib_log_notice (cbsm->log_class, "Reservation: %u stream(s) of shaper %u dropped", vec_len (dropped), shaper_index);
+  vec_free (dropped);
+  r->n_streams = 0;
+}
+
+/**
+ * @brief Set a class's measurement interval, reservable share and
+ * interference size, re-deriving its slopes. Refused if the streams already
+ * admitted would no longer fit.
+ */
+static int
+cbs_reservation_config_set (cbs_main_t * cbsm, u32 shaper_index, f64 interval, u32 share_pct,
+                            u32 max_interference)
+{
+  cbs_reservation_t *r, saved;
+  cbs_engine_params_t p;
+  int rv;
+
+  if (shaper_index >= CBS_MAX_SHAPERS) return VNET_API_ERROR_INVALID_VALUE_5;
+  if (interval <= 0) return VNET_API_ERROR_INVALID_VALUE;
+  if (share_pct == 0 || share_pct > 100) return VNET_API_ERROR_INVALID_VALUE_2;
+  if (max_interference == 0 || max_interference > CBS_STREAM_MAX_FRAME) return VNET_API_ERROR_INVALID_VALUE_3;
+
+  r = cbs_reservation_get (cbsm, shaper_index);
+  saved = *r;
+  r->interval = interval;
+  r->share_pct = share_pct;
+  r->max_interference = max_interference;
+  if (r->n_streams)
+    {
+      if ((rv = cbs_reservation_compute (cbsm, shaper_index, &p)))
+        {
+          *r = saved;
+          return rv;
+        }
+      cbs_shaper_params_publish (vec_elt_at_index (cbsm->shapers, shaper_index), &p);
+      cbs_reservation_refresh_meters (cbsm, shaper_index);
+    }
+
+  vlib_log_notice (cbsm->log_class, "Reservation: shaper %u interval %.0f us, share %u%%, interference %u bytes",
+                   shaper_index, interval * 1e6, share_pct, max_interference);
+  return 0;
+}
+
+/**
+ * @brief Attach or detach a stream's 802.1Qci filter. Frames to the
+ * stream's class whose destination MAC and VLAN id match are checked
+ * against its max frame size and metered at its reserved rate, with a
+ * bucket of one interval's frames, before they take a wheel slot.
+ * @return 0 or VNET_API_ERROR_*: NO_SUCH_ENTRY (stream unknown, or no
+ *         filter to remove), INVALID_VALUE (VLAN id), VALUE_EXIST (the key
+ *         already filters another stream)
+ */
+int
+cbs_stream_filter_add_del (cbs_main_t * cbsm, u32 stream_id, const u8 * dmac, u16 vid, int is_add)
+{
+  vlib_main_t *vm = cbsm->vlib_main;
+  uword *q = hash_get (cbsm->stream_index_by_id, stream_id);
+  clib_bihash_kv_8_8_t kv;
+  cbs_stream_t *st;
+  u32 stream_index;
+
+  if (!q)
+    return VNET_API_ERROR_NO_SUCH_ENTRY;
+  stream_index = q[0];
+  st = pool_elt_at_index (cbsm->streams, stream_index);
+
+  if (!is_add)
+    {
+      if (!st->has_filter)
+        return VNET_API_ERROR_NO_SUCH_ENTRY;
+      cbs_stream_filter_remove (cbsm, st);
+      vlib_log_notice (cbsm->log_class, "Stream filter: stream %u no longer policed", stream_id);
+      return 0;
+    }
+
+  if (vid > 4095)
+    return VNET_API_ERROR_INVALID_VALUE;
+  if (!cbsm->stream_filter_table.buckets)
+    clib_bihash_init_8_8 (&cbsm->stream_filter_table, "cbs stream filters",
+                          CBS_STREAM_FILTER_BUCKETS, CBS_STREAM_FILTER_MEMORY);
+  kv.key = cbs_stream_filter_key (dmac, vid);
+  if (!clib_bihash_search_8_8 (&cbsm->stream_filter_table, &kv, &kv) && kv.value != stream_index)
+    return VNET_API_ERROR_VALUE_EXIST;
+
+  // Meters are indexed by stream: grow them (and the drop counter) once, under the barrier
+  vlib_worker_thread_barrier_sync (vm);
+  vec_validate_aligned (cbsm->stream_meters, stream_index, CLIB_CACHE_LINE_BYTES);
+  clib_memset (vec_elt_at_index (cbsm->stream_meters, stream_index), 0, sizeof (cbs_stream_meter_t));
+  vlib_validate_simple_counter (&cbsm->stream_drops, stream_index);
+  vlib_zero_simple_counter (&cbsm->stream_drops, stream_index);
+  vlib_worker_thread_barrier_release (vm);
+
+  cbs_stream_filter_remove (cbsm, st); // A new key replaces the old one
+  st->filter_key = kv.key = cbs_stream_filter_key (dmac, vid);
+  st->has_filter = 1;
+  cbs_stream_meter_refresh (cbsm, st);
+  kv.value = stream_index;
+  clib_bihash_add_del_8_8 (&cbsm->stream_filter_table, &kv, 1 /* is_add */);
+  cbsm->n_stream_filters++;
+
+  vlib_log_notice (cbsm->log_class, "Stream filter: stream %u policed on %U vlan %u, max frame %u bytes",
+                   stream_id, format_ethernet_address, dmac, vid, st->max_frame_size);
+  return 0;
+}
+
+/** @brief "show cbs" line of a class with streams; args: shaper index */
+u8 *
+format_cbs_reservation (u8 * s, va_list * args)
+{
+  cbs_main_t *cbsm = &cbs_main;
+  u32 shaper_index = va_arg (*args, u32);
+  cbs_shaper_t *shaper = vec_elt_at_index (cbsm->shapers, shaper_index);
+  cbs_reservation_t *r;
+
+  if (shaper_index >= vec_len (cbsm->reservation_by_shaper))
+    return s;
+  r = vec_elt_at_index (cbsm->reservation_by_shaper, shaper_index);
+  if (r->n_streams == 0)
+    return s;
+  return format (s, "  Reservations:    %u stream(s), %.1f%% of port (max %u%%), interval %.0f us, "
+                 "interference %u bytes\n", r->n_streams, 100.0 * shaper->eng.idleslope / shaper->eng.port_rate,
+                 r->share_pct, r->interval * 1e6, r->max_interference);
+}
+
+static clib_error_t *
+set_cbs_stream_command_fn (vlib_main_t * vm, unformat_input_t * input, vlib_cli_command_t * cmd)
+{
+    cbs_main_t *cbsm = &cbs_main;
+    u32 stream_id = ~0, shaper_index = CBS_DEFAULT_SHAPER;
+    u32 max_frame_size = 0, frames = 0;
+    int is_add = -1;
+    int rv;
+
+    while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT) {
+        if (unformat (input, "add %u", &stream_id)) is_add = 1;
+        else if (unformat (input, "del %u", &stream_id)) is_add = 0;
+        else if (unformat (input, "shaper %u", &shaper_index));
+        else if (unformat (input, "frame-size %u", &max_frame_size));
+        else if (unformat (input, "frames %u", &frames));
+        else return clib_error_return (0, "unknown input '%U'", format_unformat_error, input);
+      }
+    if (is_add < 0)
+        return clib_error_return (0, "Please specify add <stream-id> or del <stream-id>");
+
+    rv = cbs_stream_add_del (cbsm, stream_id, shaper_index, max_frame_size, frames, is_add);
+    switch (rv) {
+      case 0: return 0;
+      case VNET_API_ERROR_NO_SUCH_ENTRY:
+          return is_add ? clib_error_return (0, "Shaper %u is not configured", shaper_index) :
+                          clib_error_return (0, "No stream %u", stream_id);
+      case VNET_API_ERROR_INVALID_VALUE: return clib_error_return (0, "Shaper %u does not run cbs", shaper_index);
+      case VNET_API_ERROR_INVALID_VALUE_2:
+          return clib_error_return (0, "Invalid frame-size (must be 1-%u)", CBS_STREAM_MAX_FRAME);
+      case VNET_API_ERROR_INVALID_VALUE_3: return clib_error_return (0, "Invalid frames (must be > 0)");
+      case VNET_API_ERROR_INVALID_VALUE_4:
+          return clib_error_return (0, "Admission refused: shaper %u would exceed its reservable share", shaper_index);
+      default: return clib_error_return (0, "cbs_stream_add_del failed: rv %d", rv);
+      }
+}
+
+static clib_error_t *
+set_cbs_stream_filter_command_fn (vlib_main_t * vm, unformat_input_t * input, vlib_cli_command_t * cmd)
+{
+    cbs_main_t *cbsm = &cbs_main;
+    u32 stream_id = ~0, vid = 0;
+    u8 dmac[6] = { 0 };
+    int is_add = 1, has_dmac = 0;
+    int rv;
+
+    while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT) {
+        if (unformat (input, "del")) is_add = 0;
+        else if (unformat (input, "dmac %U", unformat_ethernet_address, dmac)) has_dmac = 1;
+        else if (unformat (input, "vlan %u", &vid));
+        else if (unformat (input, "%u", &stream_id));
+        else return clib_error_return (0, "unknown input '%U'", format_unformat_error, input);
+      }
+    if (stream_id == ~0)
+        return clib_error_return (0, "Please specify a stream id");
+    if (is_add && !has_dmac)
+        return clib_error_return (0, "Please specify dmac <mac>");
+
+    rv = cbs_stream_filter_add_del (cbsm, stream_id, dmac, vid, is_add);
+    switch (rv) {
+      case 0: return 0;
+      case VNET_API_ERROR_NO_SUCH_ENTRY:
+          return is_add ? clib_error_return (0, "No stream %u", stream_id) :
+                          clib_error_return (0, "Stream %u has no filter", stream_id);
+      case VNET_API_ERROR_INVALID_VALUE: return clib_error_return (0, "Invalid vlan (must be 0-4095)");
+      case VNET_API_ERROR_VALUE_EXIST:
+          return clib_error_return (0, "%U vlan %u already filters another stream", format_ethernet_address, dmac, vid);
+      default: return clib_error_return (0, "cbs_stream_filter_add_del failed: rv %d", rv);
+      }
+}
+
+static clib_error_t *
+set_cbs_reservation_command_fn (vlib_main_t * vm, unformat_input_t * input, vlib_cli_command_t * cmd)
+{
+    cbs_main_t *cbsm = &cbs_main;
+    u32 shaper_index = CBS_DEFAULT_SHAPER;
+    cbs_reservation_t *r;
+    f64 interval_us;
+    u32 share_pct, interference;
+    int rv;
+
+    // Parameters not given keep their current values
+    if (unformat (input, "shaper %u", &shaper_index) && shaper_index >= CBS_MAX_SHAPERS)
+        return clib_error_return (0, "Invalid shaper id (must be < %u)", CBS_MAX_SHAPERS);
+    r = cbs_reservation_get (cbsm, shaper_index);
+    interval_us = r->interval * 1e6;
+    share_pct = r->share_pct;
+    interference = r->max_interference;
+
+    while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT) {
+        if (unformat (input, "interval %f", &interval_us));
+        else if (unformat (input, "share %u", &share_pct));
+        else if (unformat (input, "interference %u", &interference));
+        else return clib_error_return (0, "unknown input '%U'", format_unformat_error, input);
+      }
+
+    rv = cbs_reservation_config_set (cbsm, shaper_index, interval_us * 1e-6, share_pct, interference);
+    switch (rv) {
+      case 0: return 0;
+      case VNET_API_ERROR_INVALID_VALUE: return clib_error_return (0, "Invalid interval (must be > 0)");
+      case VNET_API_ERROR_INVALID_VALUE_2: return clib_error_return (0, "Invalid share (1-100 percent)");
+      case VNET_API_ERROR_INVALID_VALUE_3:
+          return clib_error_return (0, "Invalid interference (must be 1-%u bytes)", CBS_STREAM_MAX_FRAME);
+      case VNET_API_ERROR_INVALID_VALUE_4:
+          return clib_error_return (0, "Refused: the streams of shaper %u would no longer fit", shaper_index);
+      default: return clib_error_return (0, "cbs_reservation_config_set failed: rv %d", rv);
+      }
+}
+
+static clib_error_t *
+show_cbs_streams_command_fn (vlib_main_t * vm, unformat_input_t * input, vlib_cli_command_t * cmd)
+{
+    cbs_main_t *cbsm = &cbs_main;
+    cbs_stream_t *st;
+
+    if (pool_elts (cbsm->streams) == 0) {
+        vlib_cli_output (vm, "No streams registered");
+        return 0;
+    }
+    vlib_cli_output (vm, "%10s %7s %11s %16s %14s  %s", "stream", "shaper", "frame-size", "frames/interval",
+                     "reserved kbps", "filter (policed drops)");
+    pool_foreach (st, cbsm->streams)
+      {
+        cbs_shaper_t *shaper = vec_elt_at_index (cbsm->shapers, st->shaper_index);
+        cbs_reservation_t *r = vec_elt_at_index (cbsm->reservation_by_shaper, st->shaper_index);
+        f64 rate = (f64) cbs_frame_wire_length (shaper, st->max_frame_size) * st->frames_per_interval / r->interval;
+        u8 *filter;
+        if (st->has_filter)
+          {
+            u8 dmac[6];
+            ethernet_mac_address_from_u64 (st->filter_key >> 16, dmac);
+            filter = format (0, "%U vlan %u (%lu)", format_ethernet_address, dmac, (u32) (st->filter_key & 0xfff),
+                             vlib_get_simple_counter (&cbsm->stream_drops, st - cbsm->streams));
+          }
+        else
+          filter = format (0, "-");
+        vlib_cli_output (vm, "%10u %7u %11u %16u %14.0f  %v", st->stream_id, st->shaper_index, st->max_frame_size,
+                         st->frames_per_interval, rate * CBS_BITS_PER_BYTE / CBS_KBPS_TO_BPS, filter);
+        vec_free (filter);
+      }
+    return 0;
+}
+
+VLIB_CLI_COMMAND (set_cbs_stream_command, static) =
+{
+  .path = "set cbs stream",
+  .short_help = "set cbs stream {add <id> [shaper <id>] frame-size <bytes> frames <n> | del <id>}",
+  .function = set_cbs_stream_command_fn,
+};
+
+VLIB_CLI_COMMAND (set_cbs_stream_filter_command, static) =
+{
+  .path = "set cbs stream filter",
+  .short_help = "set cbs stream filter <stream-id> dmac <mac> [vlan <vid>] | <stream-id> del",
+  .function = set_cbs_stream_filter_command_fn,
+};
+
+VLIB_CLI_COMMAND (set_cbs_reservation_command, static) =
+{
+  .path = "set cbs reservation",
+  .short_help = "set cbs reservation [shaper <id>] [interval <us>] [share <pct>] [interference <bytes>]",
+  .function = set_cbs_reservation_command_fn,
+};
+
+VLIB_CLI_COMMAND (show_cbs_streams_command, static) =
+{
+  .path = "show cbs streams",
+  .short_help = "show cbs streams",
+  .function = show_cbs_streams_command_fn,
+};
+
+/*
+ * fd.io coding-style-patch-verification: ON
+ * Local Variables:
+ * eval: (c-set-style "gnu")
+ * End:
+ */
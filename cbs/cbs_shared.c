@@ -0,0 +1,481 @@
+/*
+ * cbs_shared.c - VPP CBS plugin aggregate shaping across VPP instances
+ * A shaper attached to a named POSIX shared memory segment also reserves
+ * every byte it sends from the segment's bucket (cbs_shared_reserve, in
+ * cbs-wheel), so instances sharing an uplink stay within one rate between
+ * them. cbs-shared-lease renews this instance's member leases; slots of
+ * instances that crashed are reused once their lease runs out.
+ *
+ * Copyright (c) 2024 Your Org <your.email@example.com> // Placeholder
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <vlib/vlib.h>
+#include <vnet/vnet.h>
+#include <vppinfra/error.h>
+#include <vppinfra/format.h>
+#include <cbs/cbs.h>
+
+#define CBS_SHARED_OPEN_TIMEOUT 100  /**< Milliseconds to wait for another instance to initialize a segment */
+#define CBS_SHARED_MIN_LEASE 0.01    /**< Shortest lease (seconds); renewed three times per lease */
+
+vlib_node_registration_t cbs_shared_lease_node;
+
+static cbs_shared_attach_t *
+cbs_shared_get (cbs_main_t * cbsm, u32 shaper_index)
+{
+  vec_validate (cbsm->shared_by_shaper, shaper_index);
+  return vec_elt_at_index (cbsm->shared_by_shaper, shaper_index);
+}
+
+/**
+ * @brief Open the segment, creating and initializing it if no instance has.
+ * The creator sets the rate and burst; whoever opens it later shapes at
+ * the segment's, whatever it asked for.
+ * @return the mapping, or 0 with *error set
+ */
+static cbs_shared_segment_t *
+cbs_shared_map (char *path, f64 rate, u64 burst_ns, clib_error_t ** error)
+{
+  cbs_shared_segment_t *seg;
+  struct stat st;
+  int fd, is_creator, i;
+
+  fd = shm_open (path, O_RDWR | O_CREAT | O_EXCL, 0600);
+  is_creator = fd >= 0;
+  if (!is_creator && errno == EEXIST)
+    fd = shm_open (path, O_RDWR, 0);
+  if (fd < 0)
+    {
+      *error = clib_error_return_unix (0, "shm_open '%s'", path);
+      return 0;
+    }
+  if (is_creator && ftruncate (fd, sizeof (*seg)) < 0)
+    {
+      *error = clib_error_return_unix (0, "ftruncate '%s'", path);
+      goto fail;
+    }
+  // Mapping past the end of a segment still being sized would fault on access
+  for (i = 0; ; i++)
+    {
+      if (fstat (fd, &st) < 0)
+        {
+          *error = clib_error_return_unix (0, "fstat '%s'", path);
+          goto fail;
+        }
+      if (st.st_size >= (off_t) sizeof (*seg))
+        break;
+      if (i >= CBS_SHARED_OPEN_TIMEOUT)
+        {
+          *error = clib_error_return (0, "'%s' is not a cbs segment", path);
+          goto fail;
+        }
+      usleep (1000);
+    }
+  seg = mmap (0, sizeof (*seg), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (seg == MAP_FAILED)
+    {
+      *error = clib_error_return_unix (0, "mmap '%s'", path);
+      goto fail;
+    }
+  close (fd);
+
+  if (is_creator)
+    {
+      seg->version = CBS_SHARED_VERSION;
+      seg->rate = rate;
+      seg->burst_ns = burst_ns;
+      seg->tat = cbs_shared_now () - burst_ns; // Starts full
+      __atomic_store_n (&seg->magic, CBS_SHARED_MAGIC, __ATOMIC_RELEASE);
+      return seg;
+    }
+  for (i = 0; __atomic_load_n (&seg->magic, __ATOMIC_ACQUIRE) != CBS_SHARED_MAGIC; i++)
+    {
+      if (i >= CBS_SHARED_OPEN_TIMEOUT)
+        {
+          *error = clib_error_return (0, "'%s' was never initialized (creator died?), remove /dev/shm%s", path, path);
+          munmap (seg, sizeof (*seg));
+          return 0;
+        }
+      usleep (1000);
+    }
+  if (seg->version != CBS_SHARED_VERSION)
+    {
+      *error = clib_error_return (0, "'%s' has version %u, expected %u", path, seg->version, CBS_SHARED_VERSION);
+      munmap (seg, sizeof (*seg));
+      return 0;
+    }
+  return seg;
+
+fail:
+  close (fd);
+  if (is_creator)
+    shm_unlink (path);
+  return 0;
+}
+
+/** @brief Take a free or expired member slot. @return its index, or ~0 if all are held */
+static u32
+cbs_shared_member_claim (cbs_shared_segment_t * seg, u64 now, u64 lease_ns)
+{
+  u32 i;
+
+  for (i = 0; i < CBS_SHARED_MAX_MEMBERS; i++)
+    {
+      cbs_shared_member_t *m = seg->members + i;
+      u64 expiry = m->lease_expiry;
+      if (expiry != 0 && (i64) (expiry - now) > 0)
+        continue;
+      // Another instance may be reclaiming the same slot; one of us wins
+      if (!__atomic_compare_exchange_n (&m->lease_expiry, &expiry, now + lease_ns, 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+        continue;
+      m->pid = getpid ();
+      m->n_bytes = 0;
+      return i;
+    }
+  return ~0;
+}
+
+/** @brief Point the shaper's fast path at the segment (0 to stop). Barrier must be held. */
+static void
+cbs_shared_bind (cbs_main_t * cbsm, u32 shaper_index, cbs_shared_attach_t * a)
+{
+  cbs_shaper_t *shaper = vec_elt_at_index (cbsm->shapers, shaper_index);
+  cbs_per_thread_t *ptd;
+
+  // Bytes granted under an earlier attachment go back to its segment
+  vec_foreach (ptd, cbsm->per_thread)
+    if (shaper_index < vec_len (ptd->wheel_by_shaper) && ptd->wheel_by_shaper[shaper_index])
+      cbs_wheel_return_shared_grant (shaper, ptd->wheel_by_shaper[shaper_index]);
+  shaper->shared = a ? a->seg : 0;
+  shaper->shared_member = a ? a->seg->members + a->member_index : 0;
+  shaper->shared_batch = a ? a->batch : 0;
+}
+
+/**
+ * @brief Give up the member slot and the mapping. The data path must no
+ * longer use the segment. The last live member removes the segment's name.
+ */
+static void
+cbs_shared_unmap (cbs_main_t * cbsm, cbs_shared_attach_t * a)
+{
+  cbs_shared_segment_t *seg = a->seg;
+  u64 now = cbs_shared_now (), expiry = a->lease_expiry;
+  u8 *path = format (0, "/%v%c", a->name, 0);
+  u32 i, n_live = 0;
+
+  __atomic_compare_exchange_n (&seg->members[a->member_index].lease_expiry, &expiry, 0, 0,
+                               __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+  for (i = 0; i < CBS_SHARED_MAX_MEMBERS; i++)
+    if (seg->members[i].lease_expiry != 0 && (i64) (seg->members[i].lease_expiry - now) > 0)
+      n_live++;
+  if (n_live == 0)
+    shm_unlink ((char *) path);
+  munmap (seg, sizeof (*seg));
+
+  vlib_log_notice (cbsm->log_class, "Shared: detached from %v%s", a->name, n_live ? "" : " (removed)");
+  vec_free (path);
+  vec_free (a->name);
+  clib_memset (a, 0, sizeof (*a));
+  cbsm->n_shared_attached--;
+}
+
+/**
+ * @brief Attach a shaper to a named segment, creating it if needed.
+ * @param rate bytes/sec, used only if this instance creates the segment
+ * @param burst bytes, likewise
+ */
+static clib_error_t *
+cbs_shared_attach (cbs_main_t * cbsm, u32 shaper_index, u8 * name, f64 rate, u32 burst, u32 batch, f64 lease)
+{
+  vlib_main_t *vm = cbsm->vlib_main;
+  cbs_shared_attach_t *a;
+  cbs_shared_segment_t *seg;
+  clib_error_t *error = 0;
+  u64 now, lease_ns = lease * 1e9;
+  u8 *path;
+  u32 member;
+
+  if (!cbs_shaper_get_if_valid (cbsm, shaper_index))
+    return clib_error_return (0, "Shaper %u is not configured", shaper_index);
+  a = cbs_shared_get (cbsm, shaper_index);
+  if (a->name)
+    return clib_error_return (0, "Shaper %u is already attached to %v", shaper_index, a->name);
+
+  path = format (0, "/%v%c", name, 0);
+  seg = cbs_shared_map ((char *) path, rate, (u64) (burst * 1e9 / rate), &error);
+  vec_free (path);
+  if (!seg)
+    return error;
+  if (seg->rate != rate)
+    vlib_log_warn (cbsm->log_class, "Shared: %v shapes at %U, not the %U asked for", name,
+                   format_cbs_rate, seg->rate, format_cbs_rate, rate);
+  // The segment's creator chose the burst: a larger batch could never be granted
+  if (batch > cbs_shared_burst_bytes (seg))
+    {
+      error = clib_error_return (0, "Batch %u bytes is larger than the burst of %v (%.0f bytes)", batch, name,
+                                 cbs_shared_burst_bytes (seg));
+      munmap (seg, sizeof (*seg));
+      return error;
+    }
+
+  now = cbs_shared_now ();
+  member = cbs_shared_member_claim (seg, now, lease_ns);
+  if (member == ~0)
+    {
+      munmap (seg, sizeof (*seg));
+      return clib_error_return (0, "%v already has %u live members", name, CBS_SHARED_MAX_MEMBERS);
+    }
+
+  a->name = vec_dup (name);
+  a->seg = seg;
+  a->member_index = member;
+  a->lease_expiry = now + lease_ns;
+  a->lease_ns = lease_ns;
+  a->batch = batch;
+  cbsm->n_shared_attached++;
+
+  vlib_worker_thread_barrier_sync (vm);
+  cbs_shared_bind (cbsm, shaper_index, a);
+  vlib_worker_thread_barrier_release (vm);
+
+  vlib_process_signal_event (vm, cbs_shared_lease_node.index, 0, 0);
+  vlib_log_notice (cbsm->log_class, "Shared: shaper %u attached to %v as member %u (%U, batch %u bytes, lease %.0f ms)",
+                   shaper_index, name, member, format_cbs_rate, seg->rate, batch, lease * 1e3);
+  return 0;
+}
+
+static clib_error_t *
+cbs_shared_detach (cbs_main_t * cbsm, u32 shaper_index)
+{
+  vlib_main_t *vm = cbsm->vlib_main;
+  cbs_shared_attach_t *a;
+
+  if (shaper_index >= vec_len (cbsm->shared_by_shaper) || !cbsm->shared_by_shaper[shaper_index].name)
+    return clib_error_return (0, "Shaper %u is not attached", shaper_index);
+  a = vec_elt_at_index (cbsm->shared_by_shaper, shaper_index);
+
+  vlib_worker_thread_barrier_sync (vm);
+  cbs_shared_bind (cbsm, shaper_index, 0);
+  vlib_worker_thread_barrier_release (vm);
+  cbs_shared_unmap (cbsm, a);
+  return 0;
+}
+
+/**
+ * @brief Called by cbs_shaper_install with the barrier held. A reconfigured
+ * shaper keeps its attachment (the install rewrote the fast path fields);
+ * a deleted one gives it up.
+ */
+void
+cbs_shared_shaper_installed (cbs_main_t * cbsm, u32 shaper_index)
+{
+  cbs_shared_attach_t *a;
+
+  if (shaper_index >= vec_len (cbsm->shared_by_shaper) || !cbsm->shared_by_shaper[shaper_index].name)
+    return;
+  a = vec_elt_at_index (cbsm->shared_by_shaper, shaper_index);
+  if (cbs_shaper_get_if_valid (cbsm, shaper_index))
+    cbs_shared_bind (cbsm, shaper_index, a);
+  else
+    cbs_shared_unmap (cbsm, a);
+}
+
+/** @brief Move every lease forward. @return seconds until the next renewal is due */
+static f64
+cbs_shared_renew (cbs_main_t * cbsm)
+{
+  u64 now = cbs_shared_now ();
+  cbs_shared_attach_t *a;
+  f64 next = CBS_SHARED_DEFAULT_LEASE;
+
+  vec_foreach (a, cbsm->shared_by_shaper)
+    {
+      u64 expiry = a->lease_expiry;
+      if (!a->name)
+        continue;
+      // Fails only if the slot expired (this process stalled) and was taken
+      if (!__atomic_compare_exchange_n (&a->seg->members[a->member_index].lease_expiry, &expiry,
+                                        now + a->lease_ns, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+        {
+          u32 member = cbs_shared_member_claim (a->seg, now, a->lease_ns);
+          vlib_log_warn (cbsm->log_class, "Shared: lease on %v member %u lost, %s", a->name, a->member_index,
+                         member == ~0 ? "no slot free, shaping on without one" : "claimed another");
+          if (member == ~0)
+            continue;
+          vlib_worker_thread_barrier_sync (cbsm->vlib_main);
+          // The lost slot's byte count belongs to its new owner
+          vec_elt_at_index (cbsm->shapers, a - cbsm->shared_by_shaper)->shared_member = 0;
+          a->member_index = member;
+          cbs_shared_bind (cbsm, a - cbsm->shared_by_shaper, a);
+          vlib_worker_thread_barrier_release (cbsm->vlib_main);
+        }
+      a->lease_expiry = now + a->lease_ns;
+      next = clib_min (next, a->lease_ns * 1e-9 / 3);
+    }
+  return next;
+}
+
+static uword
+cbs_shared_lease_process (vlib_main_t * vm, vlib_node_runtime_t * rt, vlib_frame_t * f)
+{
+  cbs_main_t *cbsm = &cbs_main;
+  uword *event_data = 0;
+  f64 interval = CBS_SHARED_DEFAULT_LEASE / 3;
+
+  while (1)
+    {
+      // Sleep until a shaper attaches, then renew three times per lease
+      if (cbsm->n_shared_attached == 0)
+        vlib_process_wait_for_event (vm);
+      else
+        vlib_process_wait_for_event_or_clock (vm, interval);
+      vlib_process_get_events (vm, &event_data);
+      vec_reset_length (event_data);
+
+      if (cbsm->n_shared_attached)
+        interval = cbs_shared_renew (cbsm);
+    }
+  return 0;
+}
+
+VLIB_REGISTER_NODE (cbs_shared_lease_node) = {
+  .function = cbs_shared_lease_process,
+  .type = VLIB_NODE_TYPE_PROCESS,
+  .name = "cbs-shared-lease",
+};
+
+/** @brief "show cbs" lines of an attached shaper */
+u8 *
+format_cbs_shared (u8 * s, va_list * args)
+{
+  u32 shaper_index = va_arg (*args, u32);
+  cbs_main_t *cbsm = &cbs_main;
+  cbs_shared_attach_t *a;
+  cbs_shared_segment_t *seg;
+  u64 now = cbs_shared_now ();
+  u32 i, n_live = 0;
+
+  if (shaper_index >= vec_len (cbsm->shared_by_shaper) || !cbsm->shared_by_shaper[shaper_index].name)
+    return s;
+  a = vec_elt_at_index (cbsm->shared_by_shaper, shaper_index);
+  seg = a->seg;
+  for (i = 0; i < CBS_SHARED_MAX_MEMBERS; i++)
+    if (seg->members[i].lease_expiry != 0 && (i64) (seg->members[i].lease_expiry - now) > 0)
+      n_live++;
+  return format (s, "  Shared:          %v at %U, burst %.0f bytes, member %u of %u live, %lu bytes reserved\n",
+                 a->name, format_cbs_rate, seg->rate, seg->burst_ns * 1e-9 * seg->rate, a->member_index, n_live,
+                 seg->members[a->member_index].n_bytes);
+}
+
+static clib_error_t *
+set_cbs_shared_command_fn (vlib_main_t * vm, unformat_input_t * input, vlib_cli_command_t * cmd)
+{
+    cbs_main_t *cbsm = &cbs_main;
+    u32 shaper_index = CBS_DEFAULT_SHAPER, burst = 0, batch = CBS_SHARED_DEFAULT_BATCH;
+    f64 rate_bps = 0, lease_ms = CBS_SHARED_DEFAULT_LEASE * 1e3, rate;
+    cbs_shaper_t *shaper;
+    u8 *name = 0;
+    int disable = 0;
+    clib_error_t * error = 0;
+
+    while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT) {
+        if (unformat (input, "shaper %u", &shaper_index));
+        else if (unformat (input, "name %s", &name));
+        else if (unformat (input, "rate %U", unformat_cbs_rate, &rate_bps));
+        else if (unformat (input, "burst %u", &burst));
+        else if (unformat (input, "batch %u", &batch));
+        else if (unformat (input, "lease %f", &lease_ms));
+        else if (unformat (input, "disable")) disable = 1;
+        else { error = clib_error_return (0, "unknown input '%U'", format_unformat_error, input); goto done; }
+      }
+
+    if (disable) {
+        error = cbs_shared_detach (cbsm, shaper_index);
+        goto done;
+    }
+
+    if (!name) { error = clib_error_return (0, "Please specify name <segment> or disable"); goto done; }
+    if (vec_search (name, '/') != ~0) { error = clib_error_return (0, "Invalid name (no '/')"); goto done; }
+    if (!(shaper = cbs_shaper_get_if_valid (cbsm, shaper_index))) {
+        error = clib_error_return (0, "Shaper %u is not configured", shaper_index);
+        goto done;
+    }
+    // By default the instances share what one shaper would have sent
+    rate = rate_bps > 0 ? rate_bps / CBS_BITS_PER_BYTE :
+           shaper->eng.algo == CBS_ALGO_CBS ? shaper->eng.idleslope : shaper->eng.tb_rate;
+    if (rate <= 0) { error = clib_error_return (0, "Invalid rate (must be > 0)"); goto done; }
+    if (batch == 0) { error = clib_error_return (0, "Invalid batch (must be > 0)"); goto done; }
+    if (burst == 0)
+        burst = 2 * batch;
+    if (burst < batch) { error = clib_error_return (0, "Invalid burst (must be at least the batch, %u)", batch); goto done; }
+    if (lease_ms < CBS_SHARED_MIN_LEASE * 1e3) {
+        error = clib_error_return (0, "Invalid lease (must be >= %.0f ms)", CBS_SHARED_MIN_LEASE * 1e3);
+        goto done;
+    }
+
+    error = cbs_shared_attach (cbsm, shaper_index, name, rate, burst, batch, lease_ms * 1e-3);
+
+  done:
+    vec_free (name);
+    return error;
+}
+
+static clib_error_t *
+show_cbs_shared_command_fn (vlib_main_t * vm, unformat_input_t * input, vlib_cli_command_t * cmd)
+{
+    cbs_main_t *cbsm = &cbs_main;
+    cbs_shared_attach_t *a;
+    u64 now = cbs_shared_now ();
+    u32 i;
+
+    if (cbsm->n_shared_attached == 0) {
+        vlib_cli_output (vm, "No shaper attached to a shared segment");
+        return 0;
+    }
+    vec_foreach (a, cbsm->shared_by_shaper) {
+        if (!a->name)
+            continue;
+        vlib_cli_output (vm, "Shaper %u: %v, %U, burst %.0f bytes, batch %u bytes, lease %.0f ms",
+                         a - cbsm->shared_by_shaper, a->name, format_cbs_rate, a->seg->rate,
+                         a->seg->burst_ns * 1e-9 * a->seg->rate, a->batch, a->lease_ns * 1e-6);
+        vlib_cli_output (vm, "  %6s %8s %10s %16s", "member", "pid", "state", "bytes");
+        for (i = 0; i < CBS_SHARED_MAX_MEMBERS; i++) {
+            cbs_shared_member_t *m = a->seg->members + i;
+            if (m->lease_expiry == 0)
+                continue;
+            vlib_cli_output (vm, "  %6u %8d %10s %16lu%s", i, m->pid,
+                             (i64) (m->lease_expiry - now) > 0 ? "alive" : "expired", m->n_bytes,
+                             i == a->member_index ? "  (this instance)" : "");
+        }
+    }
+    return 0;
+}
+
+VLIB_CLI_COMMAND (set_cbs_shared_command, static) =
+{
+  .path = "set cbs shared",
+  .short_help = "set cbs shared [shaper <id>] {name <segment> [rate <rate>] [burst <bytes>] [batch <bytes>] "
+                "[lease <ms>] | disable}",
+  .function = set_cbs_shared_command_fn,
+};
+
+VLIB_CLI_COMMAND (show_cbs_shared_command, static) =
+{
+  .path = "show cbs shared",
+  .short_help = "show cbs shared",
+  .function = show_cbs_shared_command_fn,
+};
+
+/*
+ * fd.io coding-style-patch-verification: ON
+ * Local Variables:
+ * eval: (c-set-style "gnu")
+ * End:
+ */
@@ -0,0 +1,123 @@
+/*
+ * cbs_shared.h - CBS plugin aggregate shaping segment shared by VPP instances
+ *
+ * Several VPP processes on one host that transmit through the same uplink
+ * (SR-IOV VFs, memif peers) attach a shaper to one named POSIX shared
+ * memory segment. The segment holds a single token bucket for all of them,
+ * kept as a virtual time (GCRA) in one 64-bit word, so every reservation
+ * is one compare-and-swap and no lock can be left held by a crashed
+ * process. Instances take bytes in batches and hold a lease on a member
+ * slot that they renew; slots of instances that stopped renewing are
+ * reused. VPP independent, all times are CLOCK_MONOTONIC nanoseconds.
+ *
+ * Copyright (c) 2024 Your Org <your.email@example.com> // Placeholder
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ */
+#ifndef __included_cbs_shared_h__
+#define __included_cbs_shared_h__
+
+#include <stdint.h>
+#include <time.h>
+
+#define CBS_SHARED_MAGIC 0x53534243 /**< "CBSS", written last by the creator */
+#define CBS_SHARED_VERSION 1
+#define CBS_SHARED_MAX_MEMBERS 32   /**< VPP instances attached to one segment */
+
+/**
+ * \brief An attached instance; 64 bytes so members never share a line.
+ * A slot is owned by whoever last moved lease_expiry forward with a
+ * compare-and-swap; pids repeat across containers, so they are only shown.
+ */
+typedef struct
+{
+  volatile uint64_t lease_expiry;   /**< Owner presumed dead after this time (0 = free) */
+  volatile uint64_t n_bytes;        /**< Bytes reserved by the owner since it attached */
+  int32_t pid;                      /**< Owner process, in its own pid namespace */
+  uint32_t reserved;
+  uint64_t pad[5];
+} cbs_shared_member_t;
+
+/** \brief Segment layout */
+typedef struct
+{
+  uint32_t magic;                   /**< CBS_SHARED_MAGIC once initialized */
+  uint32_t version;                 /**< CBS_SHARED_VERSION */
+  double rate;                      /**< Aggregate rate, bytes/sec (set by the creator) */
+  uint64_t burst_ns;                /**< Bucket depth, as time at rate */
+  uint64_t pad0[5];
+  volatile uint64_t tat;            /**< Time the bucket was last empty (own cache line) */
+  uint64_t pad1[7];
+  cbs_shared_member_t members[CBS_SHARED_MAX_MEMBERS];
+} cbs_shared_segment_t;
+
+static inline uint64_t
+cbs_shared_now (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/** @brief Most bytes the bucket holds, so the most one reservation can take. */
+static inline double
+cbs_shared_burst_bytes (cbs_shared_segment_t * seg)
+{
+  return seg->burst_ns * 1e-9 * seg->rate;
+}
+
+/**
+ * @brief Take @c n_bytes from the aggregate bucket, all or nothing.
+ * More than cbs_shared_burst_bytes is never granted.
+ * The bucket holds min (burst, (now - tat) * rate) bytes; taking moves tat
+ * forward by the bytes' time at rate.
+ * @return 0 if taken, else nanoseconds until they would be available
+ */
+static inline uint64_t
+cbs_shared_reserve (cbs_shared_segment_t * seg, uint64_t now, uint32_t n_bytes)
+{
+  uint64_t cost = (uint64_t) (n_bytes * 1e9 / seg->rate);
+  uint64_t tat = __atomic_load_n (&seg->tat, __ATOMIC_RELAXED), base, new_tat;
+
+  do
+    {
+      // A bucket idle for longer than the burst is full, not fuller
+      base = (int64_t) (now - tat) > (int64_t) seg->burst_ns ? now - seg->burst_ns : tat;
+      new_tat = base + cost;
+      if ((int64_t) (new_tat - now) > 0)
+        return new_tat - now;
+    }
+  while (!__atomic_compare_exchange_n (&seg->tat, &tat, new_tat, 1 /* weak */,
+                                       __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+  return 0;
+}
+
+/**
+ * @brief Give back @c n_bytes taken with cbs_shared_reserve and not sent:
+ * tat moves back by their time at rate, but the bucket never gets fuller
+ * than its burst.
+ */
+static inline void
+cbs_shared_return (cbs_shared_segment_t * seg, uint64_t now, uint32_t n_bytes)
+{
+  uint64_t cost = (uint64_t) (n_bytes * 1e9 / seg->rate);
+  uint64_t tat = __atomic_load_n (&seg->tat, __ATOMIC_RELAXED), full = now - seg->burst_ns, new_tat;
+
+  do
+    {
+      new_tat = (int64_t) (tat - cost - full) < 0 ? full : tat - cost;
+      if ((int64_t) (new_tat - tat) >= 0)
+        return; // Already full
+    }
+  while (!__atomic_compare_exchange_n (&seg->tat, &tat, new_tat, 1 /* weak */,
+                                       __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+#endif /* __included_cbs_shared_h__ */
+
+/*
+ * fd.io coding-style-patch-verification: ON
+ *
+ * Local Variables:
+ * eval: (c-set-style "gnu")
+ * End:
+ */
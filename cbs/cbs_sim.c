@@ -0,0 +1,545 @@
+/*
+ * cbs_sim.c - offline trace-driven simulator for the CBS plugin shapers
+ *
+ * Replays the packet arrivals of a pcap through the plugin's own shaping
+ * engine (cbs_engine.h, the code cbs-wheel and the enqueue nodes run) and
+ * reports, per parameter set, drops at wheel capacity, the wheel latency
+ * distribution, credit excursions and the achieved rate. Parameter sweeps
+ * run in parallel, each worker streaming the pcap on its own, so traces
+ * of any size are handled in constant memory.
+ *
+ *   cbs_sim -r trace.pcap -p 1G [-j <threads>] [-g <poll-us>] [-l1] [-o <bytes>] [-c]
+ *           -s 'cbs,idleslope=100M:500M:100M,wheel=2048'
+ *           -s 'tbf,rate=300M,burst=15000:60000:15000'
+ *
+ * A spec is an algorithm (cbs, tbf, ats) followed by key=value pairs;
+ * any value may be a range lo:hi:step, and every combination is run.
+ * Rates take k/M/G suffixes (bits/sec), sizes are bytes. CBS hicredit and
+ * locredit default to the 802.1Q values for a 1522 byte interfering frame.
+ *
+ * Copyright (c) 2024 Your Org <your.email@example.com> // Placeholder
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include <cbs/cbs_engine.h>
+
+#define SIM_MAX_FRAME 1522                /**< maxInterferenceSize for default credits */
+#define SIM_DEFAULT_WHEEL 2048            /**< CBS_MIN_WHEEL_SLOTS */
+#define SIM_L1_OVERHEAD (8 + 12 + 4)      /**< Preamble/SFD, IFG, FCS (CBS_ETH_L1_OVERHEAD_BYTES) */
+#define SIM_ETH_MIN_FRAME 60
+#define SIM_HIST_SUB_BITS 4               /**< Latency histogram: 16 linear steps per power of 2 */
+#define SIM_HIST_N_BUCKETS (64 << SIM_HIST_SUB_BITS)
+#define SIM_MAX_RANGE_STEPS 100000
+
+/** \brief One parameter set to simulate */
+typedef struct
+{
+  cbs_engine_params_t p;
+  uint32_t wheel_slots;
+
+  /* Results */
+  uint64_t n_packets;
+  uint64_t n_dropped;
+  uint64_t n_sent_bytes;
+  uint32_t max_depth;
+  double first_arrival;
+  double last_tx_end;
+  double min_credits;
+  double max_credits;
+  double latency_sum;
+  double latency_max;
+  uint64_t *latency_hist;   /**< Wait in ns, log-linear buckets */
+  int error;
+} sim_run_t;
+
+typedef struct
+{
+  const char *pcap_file;
+  double port_rate;         /**< bytes/sec */
+  double poll_interval;     /**< 0 = the wheel reacts instantly */
+  int l1_accounting;
+  int frame_overhead;
+  sim_run_t *runs;
+  uint32_t n_runs;
+  uint32_t next_run;        /**< Work queue, taken atomically */
+} sim_main_t;
+
+static sim_main_t sim_main;
+
+/* --- pcap streaming --- */
+
+typedef struct
+{
+  FILE *f;
+  int swapped;
+  double ts_scale;          /**< Sub-second unit: 1e-6 or 1e-9 */
+  double t0;
+  int have_t0;
+} sim_pcap_t;
+
+static uint32_t
+sim_pcap_u32 (sim_pcap_t * pc, uint32_t v)
+{
+  return pc->swapped ? __builtin_bswap32 (v) : v;
+}
+
+static int
+sim_pcap_open (sim_pcap_t * pc, const char *file)
+{
+  uint32_t hdr[6];
+
+  memset (pc, 0, sizeof (*pc));
+  if (!(pc->f = fopen (file, "rb")))
+    return -1;
+  setvbuf (pc->f, 0, _IOFBF, 1 << 20);
+  if (fread (hdr, sizeof (hdr), 1, pc->f) != 1)
+    goto bad;
+
+  switch (hdr[0])
+    {
+    case 0xa1b2c3d4: pc->ts_scale = 1e-6; break;
+    case 0xa1b23c4d: pc->ts_scale = 1e-9; break;
+    case 0xd4c3b2a1: pc->ts_scale = 1e-6; pc->swapped = 1; break;
+    case 0x4d3cb2a1: pc->ts_scale = 1e-9; pc->swapped = 1; break;
+    default: goto bad; // pcapng and others are not supported
+    }
+  return 0;
+
+bad:
+  fclose (pc->f);
+  pc->f = 0;
+  errno = EINVAL;
+  return -1;
+}
+
+/** @brief Next packet: arrival time relative to the first packet, original length. @return 0, or -1 at the end */
+static int
+sim_pcap_next (sim_pcap_t * pc, double *time, uint32_t * len)
+{
+  uint32_t rec[4]; // ts_sec, ts_frac, incl_len, orig_len
+  double t;
+
+  if (fread (rec, sizeof (rec), 1, pc->f) != 1)
+    return -1;
+  if (fseek (pc->f, sim_pcap_u32 (pc, rec[2]), SEEK_CUR) < 0) // Payload is not needed
+    return -1;
+
+  t = sim_pcap_u32 (pc, rec[0]) + sim_pcap_u32 (pc, rec[1]) * pc->ts_scale;
+  if (!pc->have_t0)
+    {
+      pc->t0 = t;
+      pc->have_t0 = 1;
+    }
+  *time = t - pc->t0;
+  *len = sim_pcap_u32 (pc, rec[3]);
+  return 0;
+}
+
+/* --- Simulation --- */
+
+static uint32_t
+sim_hist_bucket (double seconds)
+{
+  uint64_t ns = seconds > 0 ? (uint64_t) (seconds * 1e9) : 0;
+  uint32_t msb;
+
+  if (ns < (1 << SIM_HIST_SUB_BITS))
+    return ns;
+  msb = 63 - __builtin_clzll (ns);
+  return ((msb - SIM_HIST_SUB_BITS + 1) << SIM_HIST_SUB_BITS) +
+         ((ns >> (msb - SIM_HIST_SUB_BITS)) & ((1 << SIM_HIST_SUB_BITS) - 1));
+}
+
+/** @brief Lower bound of a histogram bucket, in seconds */
+static double
+sim_hist_value (uint32_t bucket)
+{
+  uint32_t exp = bucket >> SIM_HIST_SUB_BITS, sub = bucket & ((1 << SIM_HIST_SUB_BITS) - 1);
+
+  if (exp == 0)
+    return sub * 1e-9;
+  return (double) (((uint64_t) (1 << SIM_HIST_SUB_BITS) + sub) << (exp - 1)) * 1e-9;
+}
+
+static double
+sim_percentile (const sim_run_t * r, double pct)
+{
+  uint64_t n_sent = r->n_packets - r->n_dropped, target, seen = 0;
+  uint32_t i;
+
+  if (!n_sent)
+    return 0;
+  target = (uint64_t) (pct / 100.0 * n_sent);
+  for (i = 0; i < SIM_HIST_N_BUCKETS; i++)
+    if ((seen += r->latency_hist[i]) > target)
+      return sim_hist_value (i);
+  return r->latency_max;
+}
+
+/** @brief Charged bytes, as cbs_frame_wire_length computes them */
+static uint32_t
+sim_wire_length (uint32_t len)
+{
+  return cbs_engine_wire_length (len, sim_main.l1_accounting ? SIM_ETH_MIN_FRAME : 0,
+                                 sim_main.frame_overhead + (sim_main.l1_accounting ? SIM_L1_OVERHEAD : 0));
+}
+
+/** @brief Earliest time at or after @c now the head may leave, on the wheel's poll grid */
+static double
+sim_next_send_time (const cbs_engine_params_t * p, cbs_engine_state_t * s,
+                    const cbs_engine_queue_t * q, double port_free_time, double now)
+{
+  const cbs_engine_pkt_t *e = &q->ring[q->head];
+  double t;
+
+  cbs_engine_advance (p, s, now);
+  t = cbs_engine_next_check_time (p, s, port_free_time, e->len, e->eligible_time, now);
+  if (sim_main.poll_interval > 0) // The wheel only looks at polls
+    t = __builtin_ceil (t / sim_main.poll_interval) * sim_main.poll_interval;
+  return t;
+}
+
+/** @brief Send everything that becomes eligible before @c until */
+static void
+sim_drain (sim_run_t * r, cbs_engine_state_t * s, cbs_engine_queue_t * q,
+           double *now, double *port_free_time, double until)
+{
+  cbs_engine_pkt_t out;
+  double t;
+
+  while (q->count > 0)
+    {
+      t = sim_next_send_time (&r->p, s, q, *port_free_time, *now);
+      if (t > until)
+        break;
+      *now = t;
+      if (r->p.algo == CBS_ALGO_CBS && s->credits > r->max_credits)
+        r->max_credits = s->credits;
+      if (!cbs_engine_dequeue_eligible (&r->p, s, q, port_free_time, t, &out, 1, 0))
+        {
+          *now = t + 1e-9; // Rounding: the engine says not yet
+          continue;
+        }
+      if (s->credits < r->min_credits)
+        r->min_credits = s->credits;
+      r->n_sent_bytes += out.len;
+      r->last_tx_end = *port_free_time;
+      r->latency_sum += t - out.arrival_time;
+      if (t - out.arrival_time > r->latency_max)
+        r->latency_max = t - out.arrival_time;
+      r->latency_hist[sim_hist_bucket (t - out.arrival_time)]++;
+    }
+}
+
+static void
+sim_run (sim_run_t * r)
+{
+  cbs_engine_pkt_t pkt = { 0 };
+  cbs_engine_queue_t q = { 0 };
+  cbs_engine_state_t s;
+  sim_pcap_t pc;
+  double now = 0, port_free_time = 0, arrival;
+  uint32_t len;
+
+  r->latency_hist = calloc (SIM_HIST_N_BUCKETS, sizeof (uint64_t));
+  q.ring = calloc (r->wheel_slots, sizeof (cbs_engine_pkt_t));
+  q.size = r->wheel_slots;
+  if (!r->latency_hist || !q.ring || sim_pcap_open (&pc, sim_main.pcap_file) < 0)
+    {
+      r->error = errno ? errno : ENOMEM;
+      free (q.ring);
+      return;
+    }
+
+  cbs_engine_init (&r->p, &s, 0);
+  r->min_credits = r->max_credits = s.credits;
+  while (sim_pcap_next (&pc, &arrival, &len) == 0)
+    {
+      sim_drain (r, &s, &q, &now, &port_free_time, arrival);
+      now = arrival > now ? arrival : now;
+      r->n_packets++;
+      if (q.count >= q.size) // Wheel full: cbs_dispatch_buffer drops
+        {
+          r->n_dropped++;
+          continue;
+        }
+      pkt.len = sim_wire_length (len);
+      cbs_engine_enqueue (&r->p, &s, &q, &pkt, now); // ATS: a pcap has one flow (one rx interface)
+      if (q.count > r->max_depth)
+        r->max_depth = q.count;
+    }
+  sim_drain (r, &s, &q, &now, &port_free_time, __builtin_inf ());
+
+  fclose (pc.f);
+  free (q.ring);
+}
+
+static void *
+sim_worker (void *arg __attribute__ ((unused)))
+{
+  uint32_t i;
+
+  while ((i = __atomic_fetch_add (&sim_main.next_run, 1, __ATOMIC_RELAXED)) < sim_main.n_runs)
+    sim_run (&sim_main.runs[i]);
+  return 0;
+}
+
+/* --- Command line --- */
+
+/** @brief Parse a rate with k/M/G suffix (bits/sec) or a plain number */
+static int
+sim_parse_value (const char *s, double *v)
+{
+  char *end;
+
+  *v = strtod (s, &end);
+  if (end == s)
+    return -1;
+  switch (*end)
+    {
+    case 'k': case 'K': *v *= 1e3; end++; break;
+    case 'm': case 'M': *v *= 1e6; end++; break;
+    case 'g': case 'G': *v *= 1e9; end++; break;
+    }
+  return (*end == 0 || *end == ':') ? 0 : -1;
+}
+
+/** @brief "lo:hi:step" or a single value */
+static int
+sim_parse_range (const char *s, double *lo, double *hi, double *step)
+{
+  const char *c1 = strchr (s, ':'), *c2 = c1 ? strchr (c1 + 1, ':') : 0;
+
+  if (sim_parse_value (s, lo))
+    return -1;
+  if (!c1)
+    {
+      *hi = *lo;
+      *step = 1;
+      return 0;
+    }
+  if (!c2 || sim_parse_value (c1 + 1, hi) || sim_parse_value (c2 + 1, step) || *step <= 0 || *hi < *lo ||
+      (*hi - *lo) / *step > SIM_MAX_RANGE_STEPS)
+    return -1;
+  return 0;
+}
+
+#define foreach_sim_param                        \
+_(idleslope, CBS_ALGO_CBS, 8)                    \
+_(hicredit, CBS_ALGO_CBS, 1)                     \
+_(locredit, CBS_ALGO_CBS, 1)                     \
+_(rate, -1, 8)                                   \
+_(burst, -1, 1)                                  \
+_(wheel, -1, 1)
+
+typedef enum {
+#define _(name, algo, div) SIM_PARAM_##name,
+  foreach_sim_param
+#undef _
+  SIM_N_PARAM,
+} sim_param_t;
+
+static const char *sim_param_names[] = {
+#define _(name, algo, div) #name,
+  foreach_sim_param
+#undef _
+};
+
+/** @brief Expand one -s spec into runs (every combination of its ranges) */
+static int
+sim_add_spec (const char *spec)
+{
+  double lo[SIM_N_PARAM], hi[SIM_N_PARAM], step[SIM_N_PARAM], v[SIM_N_PARAM];
+  int set[SIM_N_PARAM] = { 0 };
+  char *copy = strdup (spec), *tok, *save = 0;
+  cbs_algo_t algo;
+  int i, rv = -1;
+
+  tok = strtok_r (copy, ",", &save);
+  if (!tok)
+    goto done;
+  if (!strcmp (tok, "cbs")) algo = CBS_ALGO_CBS;
+  else if (!strcmp (tok, "tbf")) algo = CBS_ALGO_TBF;
+  else if (!strcmp (tok, "ats")) algo = CBS_ALGO_ATS;
+  else goto done;
+
+  while ((tok = strtok_r (0, ",", &save)))
+    {
+      char *eq = strchr (tok, '=');
+      if (!eq)
+        goto done;
+      *eq = 0;
+      for (i = 0; i < SIM_N_PARAM; i++)
+        if (!strcmp (tok, sim_param_names[i]))
+          break;
+      if (i == SIM_N_PARAM || sim_parse_range (eq + 1, &lo[i], &hi[i], &step[i]))
+        goto done;
+      set[i] = 1;
+    }
+
+  if (algo == CBS_ALGO_CBS ? !set[SIM_PARAM_idleslope] : (!set[SIM_PARAM_rate] || !set[SIM_PARAM_burst]))
+    goto done;
+  for (i = 0; i < SIM_N_PARAM; i++)
+    if (!set[i])
+      lo[i] = hi[i] = 0, step[i] = 1;
+  if (!set[SIM_PARAM_wheel])
+    lo[SIM_PARAM_wheel] = hi[SIM_PARAM_wheel] = SIM_DEFAULT_WHEEL;
+
+  // Odometer over all ranges
+  memcpy (v, lo, sizeof (v));
+  while (1)
+    {
+      sim_run_t *r;
+
+      sim_main.runs = realloc (sim_main.runs, (sim_main.n_runs + 1) * sizeof (sim_run_t));
+      if (!sim_main.runs)
+        goto done;
+      r = &sim_main.runs[sim_main.n_runs++];
+      memset (r, 0, sizeof (*r));
+      r->p.algo = algo;
+      r->p.port_rate = sim_main.port_rate;
+      r->p.idleslope = v[SIM_PARAM_idleslope] / 8;
+      r->p.sendslope = r->p.idleslope - r->p.port_rate;
+      r->p.hicredit = set[SIM_PARAM_hicredit] ? v[SIM_PARAM_hicredit] : SIM_MAX_FRAME * r->p.idleslope / r->p.port_rate;
+      r->p.locredit = set[SIM_PARAM_locredit] ? v[SIM_PARAM_locredit] : SIM_MAX_FRAME * r->p.sendslope / r->p.port_rate;
+      r->p.tb_rate = v[SIM_PARAM_rate] / 8;
+      r->p.tb_burst = v[SIM_PARAM_burst];
+      r->wheel_slots = v[SIM_PARAM_wheel] >= 1 ? (uint32_t) v[SIM_PARAM_wheel] : 1;
+
+      for (i = 0; i < SIM_N_PARAM; i++)
+        {
+          if (v[i] + step[i] <= hi[i] + step[i] * 1e-9)
+            {
+              v[i] += step[i];
+              break;
+            }
+          v[i] = lo[i];
+        }
+      if (i == SIM_N_PARAM)
+        break;
+    }
+  rv = 0;
+
+done:
+  free (copy);
+  return rv;
+}
+
+static void
+sim_print (const sim_run_t * r, int csv)
+{
+  static const char *algo_names[] = { "cbs", "tbf", "ats" };
+  uint64_t n_sent = r->n_packets - r->n_dropped;
+  double duration = r->last_tx_end - r->first_arrival;
+  double rate = r->p.algo == CBS_ALGO_CBS ? r->p.idleslope : r->p.tb_rate;
+
+  if (r->error)
+    {
+      printf (csv ? "%s,%.0f,%.0f,%u,error %s\n" : "%-4s %12.0f %10.0f %8u  error: %s\n",
+              algo_names[r->p.algo], rate * 8, r->p.algo == CBS_ALGO_CBS ? r->p.hicredit : r->p.tb_burst,
+              r->wheel_slots, strerror (r->error));
+      return;
+    }
+  printf (csv ? "%s,%.0f,%.0f,%u,%lu,%lu,%.4f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%u,%.1f,%.1f\n"
+              : "%-4s %12.0f %10.0f %8u %12lu %10lu %8.4f %10.3f %10.3f %10.3f %10.3f %10.3f %10.3f %8u %10.1f %10.1f\n",
+          algo_names[r->p.algo], rate * 8, r->p.algo == CBS_ALGO_CBS ? r->p.hicredit : r->p.tb_burst, r->wheel_slots,
+          (unsigned long) r->n_packets, (unsigned long) r->n_dropped,
+          r->n_packets ? 100.0 * r->n_dropped / r->n_packets : 0.0,
+          duration > 0 ? r->n_sent_bytes * 8 / duration / 1e6 : 0.0,
+          n_sent ? r->latency_sum / n_sent * 1e6 : 0.0,
+          sim_percentile (r, 50) * 1e6, sim_percentile (r, 99) * 1e6, sim_percentile (r, 99.9) * 1e6,
+          r->latency_max * 1e6, r->max_depth, r->min_credits, r->max_credits);
+}
+
+static void
+sim_usage (const char *prog)
+{
+  fprintf (stderr,
+           "usage: %s -r <pcap> -p <port-rate> -s <spec> [-s <spec> ...]\n"
+           "          [-j <threads>] [-g <poll-interval-us>] [-l1] [-o <overhead-bytes>] [-c]\n"
+           "  spec: cbs,idleslope=<rate>[,hicredit=<b>][,locredit=<b>][,wheel=<slots>]\n"
+           "        tbf|ats,rate=<rate>,burst=<bytes>[,wheel=<slots>]\n"
+           "  any value may be a range lo:hi:step; rates take k/M/G (bits/sec)\n", prog);
+}
+
+int
+main (int argc, char **argv)
+{
+  pthread_t *threads;
+  int n_threads = 1, csv = 0, i;
+  double v;
+
+  for (i = 1; i < argc; i++)
+    {
+      const char *arg = argv[i], *val = i + 1 < argc ? argv[i + 1] : 0;
+
+      if (!strcmp (arg, "-l1")) { sim_main.l1_accounting = 1; continue; }
+      if (!strcmp (arg, "-c")) { csv = 1; continue; }
+      if (!val)
+        goto usage;
+      i++;
+      if (!strcmp (arg, "-r")) sim_main.pcap_file = val;
+      else if (!strcmp (arg, "-p") && !sim_parse_value (val, &v) && v > 0) sim_main.port_rate = v / 8;
+      else if (!strcmp (arg, "-j")) n_threads = atoi (val);
+      else if (!strcmp (arg, "-g")) sim_main.poll_interval = atof (val) * 1e-6;
+      else if (!strcmp (arg, "-o")) sim_main.frame_overhead = atoi (val);
+      else if (!strcmp (arg, "-s"))
+        {
+          if (!sim_main.port_rate)
+            {
+              fprintf (stderr, "-p must come before -s\n");
+              return 1;
+            }
+          if (sim_add_spec (val))
+            {
+              fprintf (stderr, "bad spec '%s'\n", val);
+              return 1;
+            }
+        }
+      else
+        goto usage;
+    }
+  if (!sim_main.pcap_file || !sim_main.n_runs || n_threads < 1)
+    goto usage;
+
+  threads = calloc (n_threads, sizeof (pthread_t));
+  for (i = 0; i < n_threads; i++)
+    if (pthread_create (&threads[i], 0, sim_worker, 0))
+      {
+        perror ("pthread_create");
+        return 1;
+      }
+  for (i = 0; i < n_threads; i++)
+    pthread_join (threads[i], 0);
+
+  printf (csv ? "algo,rate_bps,hicredit_or_burst,wheel,packets,dropped,drop_pct,mbps,mean_us,p50_us,p99_us,p999_us,max_us,max_depth,min_credit,max_credit\n"
+              : "%-4s %12s %10s %8s %12s %10s %8s %10s %10s %10s %10s %10s %10s %8s %10s %10s\n",
+          "algo", "rate bps", "hi/burst", "wheel", "packets", "dropped", "drop %", "Mbps",
+          "mean us", "p50 us", "p99 us", "p99.9 us", "max us", "depth", "min cred", "max cred");
+  for (i = 0; i < (int) sim_main.n_runs; i++)
+    {
+      sim_print (&sim_main.runs[i], csv);
+      free (sim_main.runs[i].latency_hist);
+    }
+  free (sim_main.runs);
+  free (threads);
+  return 0;
+
+usage:
+  sim_usage (argv[0]);
+  return 1;
+}
+
+/*
+ * fd.io coding-style-patch-verification: ON
+ *
+ * Local Variables:
+ * eval: (c-set-style "gnu")
+ * End:
+ */
@@ -0,0 +1,319 @@
+/*
+ * cbs_startup.c - VPP CBS plugin startup configuration
+ * The "cbs { }" section of startup.conf declares shapers, shaped interfaces
+ * and the threads whose wheels are preallocated. It is applied once, when
+ * the main loop starts and before the workers are released, so traffic is
+ * shaped from the first packet and no barrier is taken at runtime for the
+ * base configuration:
+ *
+ *   cbs {
+ *     arena-size 512m
+ *     wheel-idle-timeout 30
+ *     horizon 20
+ *     backpressure-backoff 50
+ *     shaper 0 { port_rate 10g idleslope 2000000 hicredit 3000 locredit -1500 threads 1-4 }
+ *     shaper 1 { port_rate 10g algorithm tbf rate 1g burst 30000 packet-size 256 }
+ *     output-feature GigabitEthernet0/8/0.100 shaper 0 tx-queue 1
+ *     output-feature GigabitEthernet0/a/0 shaper 1 arc ip
+ *     cross-connect GigabitEthernet0/8/0 GigabitEthernet0/9/0 shaper 1 lossless
+ *   }
+ *
+ * Shaper blocks take the "set cbs" parameters; horizon and backoff are in us.
+ *
+ * Copyright (c) 2024 Your Org <your.email@example.com> // Placeholder
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ */
+
+#include <vlib/vlib.h>
+#include <vnet/vnet.h>
+#include <vppinfra/error.h>
+#include <vppinfra/format.h>
+#include <vppinfra/bitmap.h>
+#include <cbs/cbs.h>
+
+/** \brief A shaped interface from the startup config */
+typedef struct
+{
+  u8 *name0;          /**< Interface name, resolved once the interfaces exist */
+  u8 *name1;          /**< Cross-connect peer (0 for the output feature) */
+  u32 shaper_index;
+  u32 tx_queue_id;    /**< CBS_TX_QUEUE_ANY unless "tx-queue <n>" was given */
+  u8 output_arcs;     /**< Output feature arcs ("arc interface|ip4|ip6|ip") */
+  u8 is_lossless;     /**< Cross-connect pauses RX instead of dropping ("lossless") */
+} cbs_startup_interface_t;
+
+/** \brief Parsed "cbs { }" section, kept until the main loop starts */
+typedef struct
+{
+  u8 is_present;
+  cbs_shaper_update_t *shapers;       /**< Installed as one bulk add */
+  uword **prealloc_threads;           /**< Per shapers entry: threads whose wheels are created up front */
+  cbs_startup_interface_t *interfaces;
+  uword arena_size;                   /**< 0 = default */
+  f64 wheel_idle_timeout;             /**< Negative = default (same for the two below) */
+  f64 horizon_max;
+  f64 tx_backoff;
+} cbs_startup_t;
+
+static cbs_startup_t cbs_startup;
+
+static clib_error_t *
+cbs_startup_shaper (cbs_startup_t * cs, u32 shaper_index, unformat_input_t * input)
+{
+  cbs_shaper_update_t *u;
+  cbs_config_args_t a;
+  uword *threads = 0;
+  u32 params_set = 0;
+  clib_error_t *error;
+
+  if (shaper_index >= CBS_MAX_SHAPERS)
+    return clib_error_return (0, "shaper %u: id must be < %u", shaper_index, CBS_MAX_SHAPERS);
+  cbs_config_args_init (&a);
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat_user (input, unformat_cbs_shaper_param, &a, &params_set));
+      else if (unformat (input, "threads %U", unformat_bitmap_list, &threads));
+      else
+        {
+          clib_bitmap_free (threads);
+          return clib_error_return (0, "shaper %u: unknown input '%U'", shaper_index, format_unformat_error, input);
+        }
+    }
+  if ((error = cbs_config_args_check (&a, params_set)))
+    {
+      clib_error_t *e = clib_error_return (0, "shaper %u: %U", shaper_index, format_clib_error, error);
+      clib_error_free (error);
+      clib_bitmap_free (threads);
+      return e;
+    }
+
+  vec_add2 (cs->shapers, u, 1);
+  u->shaper_index = shaper_index;
+  u->is_add = 1;
+  u->args = a;
+  vec_add1 (cs->prealloc_threads, threads);
+  return 0;
+}
+
+static clib_error_t *
+cbs_startup_config (vlib_main_t * vm, unformat_input_t * input)
+{
+  cbs_startup_t *cs = &cbs_startup;
+  cbs_startup_interface_t *si;
+  unformat_input_t sub_input;
+  clib_error_t *error;
+  u32 shaper_index;
+  u8 *name0, *name1;
+  f64 us;
+
+  cs->is_present = 1;
+  cs->wheel_idle_timeout = cs->horizon_max = cs->tx_backoff = -1;
+
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (input, "arena-size %U", unformat_memory_size, &cs->arena_size))
+        {
+          if (cs->arena_size == 0)
+            return clib_error_return (0, "arena-size must be > 0");
+        }
+      else if (unformat (input, "wheel-idle-timeout %f", &cs->wheel_idle_timeout))
+        {
+          if (cs->wheel_idle_timeout <= 0)
+            return clib_error_return (0, "wheel-idle-timeout must be > 0");
+        }
+      else if (unformat (input, "horizon %f", &us))
+        {
+          if (us < 0 || us * 1e-6 > CBS_MAX_HORIZON)
+            return clib_error_return (0, "horizon must be 0-%.0f us", CBS_MAX_HORIZON * 1e6);
+          cs->horizon_max = us * 1e-6;
+        }
+      else if (unformat (input, "backpressure-backoff %f", &us))
+        {
+          if (us < 0 || us * 1e-6 > CBS_TX_BACKOFF_MAX)
+            return clib_error_return (0, "backpressure-backoff must be 0-%.0f us", CBS_TX_BACKOFF_MAX * 1e6);
+          cs->tx_backoff = us * 1e-6;
+        }
+      else if (unformat (input, "shaper %u %U", &shaper_index, unformat_vlib_cli_sub_input, &sub_input))
+        {
+          error = cbs_startup_shaper (cs, shaper_index, &sub_input);
+          unformat_free (&sub_input);
+          if (error)
+            return error;
+        }
+      else if (unformat (input, "output-feature %s shaper %u", &name0, &shaper_index))
+        {
+          vec_add2 (cs->interfaces, si, 1);
+          si->name0 = name0;
+          si->shaper_index = shaper_index;
+          si->tx_queue_id = CBS_TX_QUEUE_ANY;
+          si->output_arcs = 1 << CBS_OUTPUT_ARC_INTERFACE;
+          while (1)
+            {
+              if (unformat (input, "tx-queue %u", &si->tx_queue_id))
+                {
+                  if (si->tx_queue_id >= CBS_TX_QUEUE_ANY)
+                    return clib_error_return (0, "output-feature %s: invalid tx-queue", name0);
+                }
+              else if (!unformat (input, "arc %U", unformat_cbs_output_arcs, &si->output_arcs))
+                break;
+            }
+        }
+      else if (unformat (input, "cross-connect %s %s shaper %u", &name0, &name1, &shaper_index))
+        {
+          vec_add2 (cs->interfaces, si, 1);
+          si->name0 = name0;
+          si->name1 = name1;
+          si->shaper_index = shaper_index;
+          si->tx_queue_id = CBS_TX_QUEUE_ANY;
+          si->is_lossless = unformat (input, "lossless");
+        }
+      else
+        return clib_error_return (0, "unknown input '%U'", format_unformat_error, input);
+    }
+  return 0;
+}
+
+VLIB_CONFIG_FUNCTION (cbs_startup_config, "cbs");
+
+static clib_error_t *
+cbs_startup_resolve (cbs_main_t * cbsm, u8 * name, u32 * sw_if_index)
+{
+  unformat_input_t in;
+  uword ok;
+
+  unformat_init_string (&in, (char *) name, strlen ((char *) name)); // %s names are NUL terminated
+  ok = unformat (&in, "%U", unformat_vnet_sw_interface, cbsm->vnet_main, sw_if_index);
+  unformat_free (&in);
+  return ok ? 0 : clib_error_return (0, "cbs: unknown interface '%s'", name);
+}
+
+/**
+ * @brief Create a thread's wheel for a shaper and fault its memory in on the
+ * thread's NUMA node, so the first packets neither allocate nor page fault.
+ * The barrier must be held.
+ */
+static clib_error_t *
+cbs_startup_prealloc (cbs_main_t * cbsm, u32 thread_index, u32 shaper_index)
+{
+  vlib_main_t *twm = vlib_get_main_by_index (thread_index);
+  cbs_per_thread_t *ptd = vec_elt_at_index (cbsm->per_thread, thread_index);
+  cbs_wheel_t *wp = ptd->wheel_by_shaper[shaper_index];
+  clib_error_t *numa_error;
+
+  if (!wp)
+    {
+      // Best effort: without NUMA support the pages land wherever the kernel puts them
+      numa_error = clib_mem_set_numa_affinity (twm->numa_node, 0 /* force */);
+      clib_error_free (numa_error);
+      if ((wp = cbs_wheel_create (twm, ptd, shaper_index)))
+        clib_memset (wp->entries, 0, wp->wheel_size * sizeof (wp->entries[0]));
+      numa_error = clib_mem_set_default_numa_affinity ();
+      clib_error_free (numa_error);
+    }
+  if (!wp)
+    return clib_error_return (0, "cbs: no room for shaper %u's wheel in the arena of thread %u "
+                              "(raise arena-size)", shaper_index, thread_index);
+  wp->is_pinned = 1;
+  return 0;
+}
+
+/**
+ * @brief Apply the startup config before the workers are released.
+ * A failure stops VPP, as any other invalid startup.conf section does.
+ */
+static clib_error_t *
+cbs_startup_apply (vlib_main_t * vm)
+{
+  cbs_main_t *cbsm = &cbs_main;
+  cbs_startup_t *cs = &cbs_startup;
+  cbs_startup_interface_t *si;
+  clib_error_t *error = 0;
+  u32 failed_index, i;
+  uword thread_index;
+  int rv;
+
+  if (!cs->is_present)
+    return 0;
+
+  // Globals first: the arena size is used as soon as the shapers are installed
+  if (cs->arena_size)
+    cbsm->arena_size = cs->arena_size;
+  if (cs->wheel_idle_timeout > 0)
+    cbsm->wheel_idle_timeout = cs->wheel_idle_timeout;
+  if (cs->horizon_max >= 0)
+    cbsm->horizon_max = cs->horizon_max;
+  if (cs->tx_backoff >= 0)
+    cbsm->tx_backoff = cs->tx_backoff;
+
+  if (vec_len (cs->shapers) && (rv = cbs_shaper_add_del_bulk (cbsm, cs->shapers, &failed_index)))
+    {
+      error = clib_error_return (0, "cbs: shaper %u rejected, rv %d", cs->shapers[failed_index].shaper_index, rv);
+      goto done;
+    }
+
+  vec_foreach (si, cs->interfaces)
+    {
+      u32 sw_if_index0 = ~0, sw_if_index1 = ~0;
+
+      if ((error = cbs_startup_resolve (cbsm, si->name0, &sw_if_index0)))
+        goto done;
+      if (si->name1 && (error = cbs_startup_resolve (cbsm, si->name1, &sw_if_index1)))
+        goto done;
+      rv = si->name1 ? cbs_cross_connect_enable_disable (cbsm, sw_if_index0, sw_if_index1, si->shaper_index, 1,
+                                                          si->is_lossless, CBS_DRAIN_TRANSMIT) :
+                       cbs_output_feature_enable_disable (cbsm, sw_if_index0, si->shaper_index,
+                                                          si->output_arcs, 1, CBS_DRAIN_TRANSMIT);
+      if (!rv && si->tx_queue_id != CBS_TX_QUEUE_ANY)
+        rv = cbs_interface_set_tx_queue (cbsm, sw_if_index0, si->tx_queue_id);
+      if (rv)
+        {
+          error = clib_error_return (0, "cbs: could not shape %s with shaper %u, rv %d", si->name0,
+                                     si->shaper_index, rv);
+          goto done;
+        }
+    }
+
+  // One barrier for every preallocated wheel; the workers have not forwarded yet
+  vlib_worker_thread_barrier_sync (vm);
+  vec_foreach_index (i, cs->shapers)
+    {
+      clib_bitmap_foreach (thread_index, cs->prealloc_threads[i])
+        {
+          if (thread_index >= vlib_get_n_threads ())
+            error = clib_error_return (0, "cbs: shaper %u: no thread %lu", cs->shapers[i].shaper_index, thread_index);
+          else
+            error = cbs_startup_prealloc (cbsm, thread_index, cs->shapers[i].shaper_index);
+          if (error)
+            break;
+        }
+      if (error)
+        break;
+    }
+  vlib_worker_thread_barrier_release (vm);
+
+  if (!error)
+    vlib_log_notice (cbsm->log_class, "Startup: %u shaper(s), %u interface(s) configured",
+                     vec_len (cs->shapers), vec_len (cs->interfaces));
+
+done:
+  vec_foreach (si, cs->interfaces)
+    {
+      vec_free (si->name0);
+      vec_free (si->name1);
+    }
+  vec_foreach_index (i, cs->prealloc_threads)
+    clib_bitmap_free (cs->prealloc_threads[i]);
+  vec_free (cs->prealloc_threads);
+  vec_free (cs->interfaces);
+  vec_free (cs->shapers);
+  return error;
+}
+
+VLIB_MAIN_LOOP_ENTER_FUNCTION (cbs_startup_apply);
+
+/*
+ * fd.io coding-style-patch-verification: ON
+ * Local Variables:
+ * eval: (c-set-style "gnu")
+ * End:
+ */
@@ -26,6 +26,7 @@ uword unformat_sw_if_index (unformat_input_t * input, va_list * args);
 typedef struct
 {
   u16 msg_id_base;        // Base ID for plugin's API messages
+  u32 ping_id;            // control_ping message ID, closes dumps
   vat_main_t *vat_main;   // Pointer to VAT main structure
 } cbs_test_main_t;
 
@@ -43,12 +44,14 @@ api_cbs_cross_connect_enable_disable (vat_main_t * vam)
   int enable_disable = 1; // Default to enable
   u32 sw_if_index0 = ~0, sw_if_index1 = ~0;
   u32 tmp_if_index = ~0;
+  u32 shaper_id = 0;
   vl_api_cbs_cross_connect_enable_disable_t *mp; // Pointer for API message
   int ret; // Return value from API call
 
   /* Parse CLI arguments */
   while (unformat_check_input (i) != UNFORMAT_END_OF_INPUT) {
       if (unformat (i, "disable")) enable_disable = 0;
+      else if (unformat (i, "shaper %u", &shaper_id)) ;
       // Use standard VAT unformatter for interface names/indices
       else if (unformat (i, "%U", unformat_sw_if_index, vam, &tmp_if_index)) {
           if (sw_if_index0 == ~0) sw_if_index0 = tmp_if_index;
@@ -71,6 +74,7 @@ api_cbs_cross_connect_enable_disable (vat_main_t * vam)
   M(CBS_CROSS_CONNECT_ENABLE_DISABLE, mp); // Allocate message
   mp->sw_if_index0 = clib_host_to_net_u32 (sw_if_index0); // Convert to network byte order
   mp->sw_if_index1 = clib_host_to_net_u32 (sw_if_index1);
+  mp->shaper_id = clib_host_to_net_u32 (shaper_id);
   mp->enable_disable = enable_disable;
 
   /* Send message and wait for reply */
@@ -86,11 +90,13 @@ api_cbs_output_feature_enable_disable (vat_main_t * vam)
   unformat_input_t *i = vam->input;
   int enable_disable = 1;
   u32 sw_if_index = ~0;
+  u32 shaper_id = 0;
   vl_api_cbs_output_feature_enable_disable_t *mp;
   int ret;
 
   while (unformat_check_input (i) != UNFORMAT_END_OF_INPUT) {
       if (unformat (i, "disable")) enable_disable = 0;
+      else if (unformat (i, "shaper %u", &shaper_id)) ;
       else if (unformat (i, "%U", unformat_sw_if_index, vam, &sw_if_index)) ;
       else if (unformat (i, "sw_if_index %u", &sw_if_index)) ;
       else break;
@@ -100,6 +106,7 @@ api_cbs_output_feature_enable_disable (vat_main_t * vam)
 
   M(CBS_OUTPUT_FEATURE_ENABLE_DISABLE, mp);
   mp->sw_if_index = clib_host_to_net_u32 (sw_if_index);
+  mp->shaper_id = clib_host_to_net_u32 (shaper_id);
   mp->enable_disable = enable_disable;
 
   S(mp); W(ret); return ret;
@@ -130,25 +137,49 @@ api_cbs_configure (vat_main_t * vam)
   f64 hicredit_f = 0.0, locredit_f = 0.0; // Use float for input parsing flexibility
   i32 hicredit_bytes = 0, locredit_bytes = 0; // API uses i32
   u32 packet_size = 0; // 0 means use default in plugin
+  i32 frame_overhead = 0;
+  u32 max_residence_us = 0; // 0 means no limit
+  u8 accounting_mode = 0; // CBS_API_ACCOUNTING_L2
+  u8 gso_mode = 0; // CBS_API_GSO_SEGMENTS, as the CLI
+  u8 algorithm = 0; // CBS_API_ALGO_CBS
+  u32 shaper_id = 0; // Default shaper
+  f64 rate_bps = 0.0, burst_f = 0.0;
   int ret;
   int port_rate_set = 0, idleslope_set = 0, hicredit_set = 0, locredit_set = 0; // Track mandatory params
+  int rate_set = 0, burst_set = 0;
 
   /* Parse args */
   while (unformat_check_input (i) != UNFORMAT_END_OF_INPUT) {
-      if (unformat (i, "port_rate %U", unformat_vat_cbs_rate, &port_rate_bps)) port_rate_set = 1;
+      if (unformat (i, "shaper %u", &shaper_id)) ;
+      else if (unformat (i, "port_rate %U", unformat_vat_cbs_rate, &port_rate_bps)) port_rate_set = 1;
+      else if (unformat (i, "algorithm cbs")) algorithm = 0;
+      else if (unformat (i, "algorithm tbf")) algorithm = 1;
+      else if (unformat (i, "algorithm ats")) algorithm = 2;
       else if (unformat (i, "idleslope %U", unformat_vat_cbs_slope, &idleslope_kbps)) idleslope_set = 1;
+      else if (unformat (i, "rate %U", unformat_vat_cbs_rate, &rate_bps)) rate_set = 1;
+      else if (unformat (i, "burst %f", &burst_f)) burst_set = 1;
       else if (unformat (i, "hicredit %f", &hicredit_f)) hicredit_set = 1; // Parse as float
       else if (unformat (i, "locredit %f", &locredit_f)) locredit_set = 1; // Parse as float
       else if (unformat (i, "bandwidth %U", unformat_vat_cbs_rate, &bandwidth_bps)); // Optional hint
       else if (unformat (i, "packet-size %u", &packet_size)); // Optional hint
+      else if (unformat (i, "overhead %d", &frame_overhead)); // Optional
+      else if (unformat (i, "max-residence %u", &max_residence_us)); // Optional
+      else if (unformat (i, "accounting l1")) accounting_mode = 1;
+      else if (unformat (i, "accounting l2")) accounting_mode = 0;
+      else if (unformat (i, "no-gso-segments")) gso_mode = 1;
+      else if (unformat (i, "gso-segments")) gso_mode = 0;
       else { errmsg ("unknown input '%U'", format_unformat_error, i); return -99; }
     }
 
   // Check if mandatory parameters were provided
-  if (!port_rate_set || !idleslope_set || !hicredit_set || !locredit_set) {
+  if (algorithm == 0 && (!port_rate_set || !idleslope_set || !hicredit_set || !locredit_set)) {
        errmsg ("Mandatory params missing: port_rate, idleslope, hicredit, locredit\n");
        return -99;
   }
+  if (algorithm != 0 && (!port_rate_set || !rate_set || !burst_set)) {
+       errmsg ("Mandatory params missing: port_rate, rate, burst\n");
+       return -99;
+  }
 
   // Convert float credits to integer for API message
   hicredit_bytes = (i32)hicredit_f;
@@ -156,17 +187,293 @@ api_cbs_configure (vat_main_t * vam)
 
   /* Construct API message */
   M(CBS_CONFIGURE, mp);
+  mp->shaper_id = clib_host_to_net_u32 (shaper_id);
+  mp->algorithm = algorithm;
   mp->port_rate_bps = clib_host_to_net_u64 ((u64)port_rate_bps);
+  mp->rate_bps = clib_host_to_net_u64 ((u64)rate_bps);
+  mp->burst_bytes = clib_host_to_net_u32 ((u32)burst_f);
   mp->idleslope_kbps = clib_host_to_net_u64 ((u64)idleslope_kbps);
   mp->hicredit_bytes = clib_host_to_net_u32 (hicredit_bytes); // Use u32 conversion for signed i32
   mp->locredit_bytes = clib_host_to_net_u32 (locredit_bytes); // Use u32 conversion for signed i32
   mp->average_packet_size = clib_host_to_net_u32 (packet_size);
   mp->bandwidth_in_bits_per_second = clib_host_to_net_u64 ((u64)bandwidth_bps);
+  mp->frame_overhead_bytes = clib_host_to_net_u32 (frame_overhead);
+  mp->max_residence_us = clib_host_to_net_u32 (max_residence_us);
+  mp->accounting_mode = accounting_mode;
+  mp->gso_mode = gso_mode;
 
   /* Send and wait */
   S(mp); W(ret); return ret;
 }
 
+/* VAT test function for cbs_shaper_add_del
+ * Each "shaper <id>" starts a new entry; the following parameters apply to it. */
+static int
+api_cbs_shaper_add_del (vat_main_t * vam)
+{
+  unformat_input_t *i = vam->input;
+  vl_api_cbs_shaper_add_del_t *mp;
+  vl_api_cbs_shaper_config_t *configs = 0, *c = 0;
+  f64 tmp;
+  i32 tmp_i;
+  u32 tmp_u;
+  u8 is_add = 1;
+  int ret;
+
+  while (unformat_check_input (i) != UNFORMAT_END_OF_INPUT) {
+      if (unformat (i, "del")) is_add = 0;
+      else if (unformat (i, "shaper %u", &tmp_u)) {
+          vec_add2 (configs, c, 1);
+          clib_memset (c, 0, sizeof (*c));
+          c->shaper_id = clib_host_to_net_u32 (tmp_u);
+      }
+      else if (!c) { errmsg ("parameters must follow 'shaper <id>'\n"); vec_free (configs); return -99; }
+      else if (unformat (i, "port_rate %U", unformat_vat_cbs_rate, &tmp)) c->port_rate_bps = clib_host_to_net_u64 ((u64) tmp);
+      else if (unformat (i, "algorithm cbs")) c->algorithm = 0;
+      else if (unformat (i, "algorithm tbf")) c->algorithm = 1;
+      else if (unformat (i, "algorithm ats")) c->algorithm = 2;
+      else if (unformat (i, "idleslope %U", unformat_vat_cbs_slope, &tmp)) c->idleslope_kbps = clib_host_to_net_u64 ((u64) tmp);
+      else if (unformat (i, "rate %U", unformat_vat_cbs_rate, &tmp)) c->rate_bps = clib_host_to_net_u64 ((u64) tmp);
+      else if (unformat (i, "burst %f", &tmp)) c->burst_bytes = clib_host_to_net_u32 ((u32) tmp);
+      else if (unformat (i, "hicredit %f", &tmp)) c->hicredit_bytes = clib_host_to_net_u32 ((i32) tmp);
+      else if (unformat (i, "locredit %f", &tmp)) c->locredit_bytes = clib_host_to_net_u32 ((i32) tmp);
+      else if (unformat (i, "bandwidth %U", unformat_vat_cbs_rate, &tmp)) c->bandwidth_in_bits_per_second = clib_host_to_net_u64 ((u64) tmp);
+      else if (unformat (i, "packet-size %u", &tmp_u)) c->average_packet_size = clib_host_to_net_u32 (tmp_u);
+      else if (unformat (i, "overhead %d", &tmp_i)) c->frame_overhead_bytes = clib_host_to_net_u32 (tmp_i);
+      else if (unformat (i, "max-residence %u", &tmp_u)) c->max_residence_us = clib_host_to_net_u32 (tmp_u);
+      else if (unformat (i, "accounting l1")) c->accounting_mode = 1;
+      else if (unformat (i, "accounting l2")) c->accounting_mode = 0;
+      else if (unformat (i, "no-gso-segments")) c->gso_mode = 1;
+      else if (unformat (i, "gso-segments")) c->gso_mode = 0;
+      else { errmsg ("unknown input '%U'", format_unformat_error, i); vec_free (configs); return -99; }
+    }
+
+  if (vec_len (configs) == 0) { errmsg ("missing shaper\n"); return -99; }
+
+  M2(CBS_SHAPER_ADD_DEL, mp, vec_len (configs) * sizeof (configs[0]));
+  mp->is_add = is_add;
+  mp->n_shapers = clib_host_to_net_u32 (vec_len (configs));
+  clib_memcpy (mp->shapers, configs, vec_len (configs) * sizeof (configs[0]));
+  vec_free (configs);
+
+  S(mp); W(ret); return ret;
+}
+
+static void
+vl_api_cbs_shaper_add_del_reply_t_handler (vl_api_cbs_shaper_add_del_reply_t * mp)
+{
+  vat_main_t *vam = cbs_test_main.vat_main;
+  i32 retval = clib_net_to_host_u32 (mp->retval);
+
+  if (retval)
+    errmsg ("entry %d rejected\n", (i32) clib_net_to_host_u32 (mp->failed_index));
+  vam->retval = retval;
+  vam->result_ready = 1;
+}
+
+/* VAT test function for cbs_shaper_dump */
+static int
+api_cbs_shaper_dump (vat_main_t * vam)
+{
+  unformat_input_t *i = vam->input;
+  vl_api_cbs_shaper_dump_t *mp;
+  vl_api_control_ping_t *mp_ping;
+  u32 shaper_id = ~0;
+  int ret;
+
+  while (unformat_check_input (i) != UNFORMAT_END_OF_INPUT) {
+      if (unformat (i, "shaper %u", &shaper_id)) ;
+      else break;
+    }
+
+  M(CBS_SHAPER_DUMP, mp);
+  mp->shaper_id = clib_host_to_net_u32 (shaper_id);
+  S(mp);
+
+  /* Use a control ping for synchronization */
+  PING (&cbs_test_main, mp_ping);
+  S(mp_ping);
+  W(ret); return ret;
+}
+
+static void
+vl_api_cbs_shaper_details_t_handler (vl_api_cbs_shaper_details_t * mp)
+{
+  vat_main_t *vam = cbs_test_main.vat_main;
+
+  print (vam->ofp, "shaper %u algorithm %u port_rate %lu bps depth %u enq %lu drop %lu tx %lu (%lu bytes) expired %lu",
+         clib_net_to_host_u32 (mp->config.shaper_id), mp->config.algorithm,
+         clib_net_to_host_u64 (mp->config.port_rate_bps),
+         clib_net_to_host_u32 (mp->queue_depth),
+         clib_net_to_host_u64 (mp->enqueued_packets),
+         clib_net_to_host_u64 (mp->dropped_packets),
+         clib_net_to_host_u64 (mp->transmitted_packets),
+         clib_net_to_host_u64 (mp->transmitted_bytes),
+         clib_net_to_host_u64 (mp->expired_packets));
+}
+
+/* VAT test function for cbs_interface_dump */
+static int
+api_cbs_interface_dump (vat_main_t * vam)
+{
+  unformat_input_t *i = vam->input;
+  vl_api_cbs_interface_dump_t *mp;
+  vl_api_control_ping_t *mp_ping;
+  u32 sw_if_index = ~0;
+  int ret;
+
+  while (unformat_check_input (i) != UNFORMAT_END_OF_INPUT) {
+      if (unformat (i, "%U", unformat_sw_if_index, vam, &sw_if_index)) ;
+      else if (unformat (i, "sw_if_index %u", &sw_if_index)) ;
+      else break;
+    }
+
+  M(CBS_INTERFACE_DUMP, mp);
+  mp->sw_if_index = clib_host_to_net_u32 (sw_if_index);
+  S(mp);
+
+  /* Use a control ping for synchronization */
+  PING (&cbs_test_main, mp_ping);
+  S(mp_ping);
+  W(ret); return ret;
+}
+
+static void
+vl_api_cbs_interface_details_t_handler (vl_api_cbs_interface_details_t * mp)
+{
+  vat_main_t *vam = cbs_test_main.vat_main;
+
+  print (vam->ofp, "sw_if_index %u port sw_if_index %u shaper %u%s",
+         clib_net_to_host_u32 (mp->sw_if_index),
+         clib_net_to_host_u32 (mp->port_sw_if_index),
+         clib_net_to_host_u32 (mp->shaper_id),
+         mp->is_cross_connect ? " cross-connect" : "");
+}
+
+/* VAT test function for want_cbs_events */
+static int
+api_want_cbs_events (vat_main_t * vam)
+{
+  unformat_input_t *i = vam->input;
+  vl_api_want_cbs_events_t *mp;
+  int enable_disable = 1;
+  int ret;
+
+  while (unformat_check_input (i) != UNFORMAT_END_OF_INPUT) {
+      if (unformat (i, "disable")) enable_disable = 0;
+      else break;
+    }
+
+  M(WANT_CBS_EVENTS, mp);
+  mp->enable_disable = enable_disable;
+  mp->pid = clib_host_to_net_u32 (getpid ());
+
+  S(mp); W(ret); return ret;
+}
+
+static void
+vl_api_cbs_event_t_handler (vl_api_cbs_event_t * mp)
+{
+  vat_main_t *vam = cbs_test_main.vat_main;
+
+  print (vam->ofp, "cbs event 0x%x shaper %u thread %u depth %u/%u credits %d",
+         clib_net_to_host_u32 (mp->event),
+         clib_net_to_host_u32 (mp->shaper_id),
+         clib_net_to_host_u32 (mp->thread_index),
+         clib_net_to_host_u32 (mp->queue_depth),
+         clib_net_to_host_u32 (mp->wheel_size),
+         (i32) clib_net_to_host_u32 (mp->credits_bytes));
+}
+
+/* VAT test function for cbs_event_config */
+static int
+api_cbs_event_config (vat_main_t * vam)
+{
+  unformat_input_t *i = vam->input;
+  vl_api_cbs_event_config_t *mp;
+  u32 high_pct = CBS_EVENT_DEFAULT_HIGH_PCT, low_pct = CBS_EVENT_DEFAULT_LOW_PCT;
+  u32 starvation_us = CBS_EVENT_DEFAULT_STARVATION * 1e6;
+  u32 interval_ms = CBS_EVENT_DEFAULT_MIN_INTERVAL * 1e3;
+  int ret;
+
+  while (unformat_check_input (i) != UNFORMAT_END_OF_INPUT) {
+      if (unformat (i, "disable")) high_pct = 0;
+      else if (unformat (i, "high %u", &high_pct)) ;
+      else if (unformat (i, "low %u", &low_pct)) ;
+      else if (unformat (i, "starvation %u", &starvation_us)) ;
+      else if (unformat (i, "interval %u", &interval_ms)) ;
+      else { errmsg ("unknown input '%U'", format_unformat_error, i); return -99; }
+    }
+
+  M(CBS_EVENT_CONFIG, mp);
+  mp->high_watermark_pct = high_pct;
+  mp->low_watermark_pct = low_pct;
+  mp->starvation_threshold_us = clib_host_to_net_u32 (starvation_us);
+  mp->min_interval_ms = clib_host_to_net_u32 (interval_ms);
+
+  S(mp); W(ret); return ret;
+}
+
+/* VAT test function for cbs_stream_add_del */
+static int
+api_cbs_stream_add_del (vat_main_t * vam)
+{
+  unformat_input_t *i = vam->input;
+  vl_api_cbs_stream_add_del_t *mp;
+  u32 stream_id = ~0, shaper_id = 0, max_frame_size = 0, frames = 0;
+  u8 is_add = 1;
+  int ret;
+
+  while (unformat_check_input (i) != UNFORMAT_END_OF_INPUT) {
+      if (unformat (i, "del")) is_add = 0;
+      else if (unformat (i, "stream %u", &stream_id)) ;
+      else if (unformat (i, "shaper %u", &shaper_id)) ;
+      else if (unformat (i, "frame-size %u", &max_frame_size)) ;
+      else if (unformat (i, "frames %u", &frames)) ;
+      else { errmsg ("unknown input '%U'", format_unformat_error, i); return -99; }
+    }
+  if (stream_id == ~0) { errmsg ("missing stream\n"); return -99; }
+
+  M(CBS_STREAM_ADD_DEL, mp);
+  mp->is_add = is_add;
+  mp->stream_id = clib_host_to_net_u32 (stream_id);
+  mp->shaper_id = clib_host_to_net_u32 (shaper_id);
+  mp->max_frame_size = clib_host_to_net_u32 (max_frame_size);
+  mp->frames_per_interval = clib_host_to_net_u32 (frames);
+
+  S(mp); W(ret); return ret;
+}
+
+
+/* VAT test function for cbs_stream_filter_add_del */
+static int
+api_cbs_stream_filter_add_del (vat_main_t * vam)
+{
+  unformat_input_t *i = vam->input;
+  vl_api_cbs_stream_filter_add_del_t *mp;
+  u32 stream_id = ~0, vlan_id = 0;
+  u8 dmac[6] = { 0 };
+  u8 is_add = 1, has_dmac = 0;
+  int ret;
+
+  while (unformat_check_input (i) != UNFORMAT_END_OF_INPUT) {
+      if (unformat (i, "del")) is_add = 0;
+      else if (unformat (i, "stream %u", &stream_id)) ;
+      else if (unformat (i, "dmac %U", unformat_ethernet_address, dmac)) has_dmac = 1;
+      else if (unformat (i, "vlan %u", &vlan_id)) ;
+      else { errmsg ("unknown input '%U'", format_unformat_error, i); return -99; }
+    }
+  if (stream_id == ~0) { errmsg ("missing stream\n"); return -99; }
+  if (is_add && !has_dmac) { errmsg ("missing dmac\n"); return -99; }
+
+  M(CBS_STREAM_FILTER_ADD_DEL, mp);
+  mp->is_add = is_add;
+  mp->stream_id = clib_host_to_net_u32 (stream_id);
+  clib_memcpy (mp->dst_mac, dmac, sizeof (dmac));
+  mp->vlan_id = clib_host_to_net_u16 (vlan_id);
+
+  S(mp); W(ret); return ret;
+}
 
 /* Include the auto-generated VAT test C file (defines vat_api_hookup etc.) */
 #include <cbs/cbs.api_test.c>
@@ -23,7 +23,9 @@
 _(BUFFERED, "Packets buffered to CBS wheel")            \
 _(DROPPED_WHEEL_FULL, "Packets dropped (wheel full)")    \
 _(DROPPED_LOOKUP_FAIL, "Packets dropped (fwd lookup failed)") \
-_(NO_WHEEL, "No CBS wheel configured for thread (forwarded)") \
+_(DROPPED_STREAM_SDU, "Packets dropped (stream max frame size)") \
+_(DROPPED_STREAM_METER, "Packets dropped (stream over reservation)") \
+_(NO_WHEEL, "No CBS state for thread (forwarded)") \
 _(NOT_CONFIGURED, "CBS not configured (forwarded)")
 
 typedef enum
@@ -60,100 +62,203 @@ cbs_add_trace (vlib_main_t * vm, vlib_node_runtime_t * node,
                u32 calculated_next_index);
 
 /**
- * @brief Determine the next node index *after* the CBS wheel.
- * @note This function is replaced with the logic from nsim's nsim_buffer_fwd_lookup
- * for debugging purposes, to align behavior with nsim.
+ * @brief Resolve the interface state (shaper, next node, port) for a buffer.
+ * A direct sw_if_index lookup; sub-interfaces carry their own entry that
+ * points at their parent port.
  */
-always_inline void
-cbs_buffer_fwd_lookup (cbs_main_t * cbsm, vlib_buffer_t * b,
-                       u32 * next, u8 is_cross_connect)
+always_inline cbs_interface_t *
+cbs_buffer_fwd_lookup (cbs_main_t * cbsm, vlib_buffer_t * b, u8 is_cross_connect)
 {
+  u32 tx_sw_if_index;
+
   if (is_cross_connect)
     {
       // Determine peer sw_if_index and set it in the buffer's TX field
-      u32 peer_sw_if_index = (vnet_buffer (b)->sw_if_index[VLIB_RX] == cbsm->sw_if_index0) ?
-                              cbsm->sw_if_index1 : cbsm->sw_if_index0;
-      vnet_buffer (b)->sw_if_index[VLIB_TX] = peer_sw_if_index;
+      tx_sw_if_index = (vnet_buffer (b)->sw_if_index[VLIB_RX] == cbsm->sw_if_index0) ?
+                       cbsm->sw_if_index1 : cbsm->sw_if_index0;
+      vnet_buffer (b)->sw_if_index[VLIB_TX] = tx_sw_if_index;
+    }
+  else				/* output feature */
+    tx_sw_if_index = vnet_buffer (b)->sw_if_index[VLIB_TX];
 
-      // Determine the next node index based on the *peer* interface
-      *next = (peer_sw_if_index == cbsm->sw_if_index0) ?
-              cbsm->output_next_index0 : cbsm->output_next_index1;
+  if (PREDICT_FALSE(tx_sw_if_index >= vec_len (cbsm->interface_by_sw_if_index)))
+    return 0;
+  return vec_elt_at_index (cbsm->interface_by_sw_if_index, tx_sw_if_index);
+}
 
-      // Note: nsim original code didn't have explicit drop for invalid next index (~0).
-      // If cbsm->output_next_index0/1 are not properly initialized (~0),
-      // this might lead to issues later in the packet path.
+/**
+ * @brief Stream filter key of a frame: destination MAC and outer VLAN id.
+ * Both enqueue arcs see the frame from its Ethernet header on.
+ */
+always_inline void
+cbs_buffer_stream_filter_hash (cbs_main_t * cbsm, vlib_buffer_t * b, clib_bihash_kv_8_8_t * kv, u64 * hash)
+{
+  ethernet_header_t *eh = vlib_buffer_get_current (b);
+  u16 vid = 0;
+
+  if (eh->type == clib_host_to_net_u16 (ETHERNET_TYPE_VLAN) ||
+      eh->type == clib_host_to_net_u16 (ETHERNET_TYPE_DOT1AD))
+    vid = clib_net_to_host_u16 (((ethernet_vlan_header_t *) (eh + 1))->priority_cfi_and_id) & 0xfff;
+  kv->key = cbs_stream_filter_key (eh->dst_address, vid);
+  *hash = clib_bihash_hash_8_8 (kv);
+  clib_bihash_prefetch_bucket_8_8 (&cbsm->stream_filter_table, *hash);
+}
+
+/**
+ * @brief 802.1Qci stream filter and flow meter (cbs_stream_filter_add_del).
+ * Charges the meter of a conforming frame, so only call it once nothing
+ * else can drop the frame before it is enqueued.
+ * @return 0 to enqueue, or the trace action of the drop
+ */
+always_inline cbs_trace_action_t
+cbs_stream_police (vlib_main_t * vm, cbs_main_t * cbsm, cbs_node_ctx_t * ctx, vlib_buffer_t * b,
+                   cbs_wheel_t * wp, clib_bihash_kv_8_8_t * kv, u64 hash, u32 wire_length)
+{
+  cbs_stream_meter_t *m;
+  u64 now, tat, new_tat, cost;
+
+  if (clib_bihash_search_inline_with_hash_8_8 (&cbsm->stream_filter_table, hash, kv))
+    return 0; // Not a filtered stream
+  m = vec_elt_at_index (cbsm->stream_meters, kv->value);
+  if (m->shaper_index != wp->shaper_index)
+    return 0; // Reserved in another class
+
+  // GSO super-frames are segmented later: only the rate applies to them
+  if (PREDICT_FALSE(!(b->flags & VNET_BUFFER_F_GSO) && vlib_buffer_length_in_chain (vm, b) > m->max_sdu))
+    {
+      ctx->n_sdu_drop++;
+      vlib_increment_simple_counter (&cbsm->stream_drops, ctx->thread_index, kv->value, 1);
+      return CBS_TRACE_ACTION_DROP_STREAM_SDU;
     }
-  else				/* output feature */
+  // Shared by the threads the stream arrives on: the bucket moves by compare-and-swap
+  now = (u64) (ctx->now * 1e9);
+  cost = (u64) (wire_length * m->ns_per_byte);
+  tat = clib_atomic_load_relax_n (&m->tat);
+  do
     {
-      u32 sw_if_index = vnet_buffer (b)->sw_if_index[VLIB_TX];
-
-      // Check bounds before accessing the vector, similar to nsim's implicit behavior
-      if (PREDICT_FALSE(sw_if_index >= vec_len (cbsm->output_next_index_by_sw_if_index))) {
-          // nsim doesn't explicitly handle this, likely resulting in reading potentially invalid memory
-          // or relying on vec_elt_at_index behavior. Setting to ~0 might be safer, but
-          // we align with nsim's direct lookup. Let's add a check and default to ~0 like nsim would implicitly do
-          // if the vector wasn't validated properly (though vec_validate_init_empty helps).
-          // For direct alignment, we try the lookup, which might be unsafe if vec_len is 0.
-          // A safer nsim alignment is checking vec_len.
-           if (vec_len(cbsm->output_next_index_by_sw_if_index) > sw_if_index) {
-               *next = cbsm->output_next_index_by_sw_if_index[sw_if_index];
-           } else {
-               // Index out of bounds, or vector is empty. Set to invalid.
-               *next = (u32)~0;
-           }
-      } else {
-           // Index is within bounds
-          *next = cbsm->output_next_index_by_sw_if_index[sw_if_index];
-      }
-
-      // Note: nsim original code didn't have explicit drop for invalid next index (~0).
-      // If the looked-up value in output_next_index_by_sw_if_index is ~0,
-      // it will be passed along.
+      new_tat = clib_max (tat, now) + cost;
+      if (PREDICT_FALSE(new_tat - now > m->burst_ns))
+        {
+          ctx->n_meter_drop++;
+          vlib_increment_simple_counter (&cbsm->stream_drops, ctx->thread_index, kv->value, 1);
+          return CBS_TRACE_ACTION_DROP_STREAM_METER;
+        }
     }
-    // Final safety check to prevent passing ~0 if it wasn't intended.
-    // However, aligning strictly with nsim means we don't add extra checks here.
-    // If *next remains ~0, it's passed to the next stage.
+  while (!__atomic_compare_exchange_n (&m->tat, &tat, new_tat, 1 /* weak */,
+                                       __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+  return 0;
 }
 
-/** @brief Processes a single buffer: buffer to wheel or drop. */
+/**
+ * @brief Processes a single buffer: buffer to its shaper's wheel or drop.
+ * @param kv, hash stream filter key of the buffer (kv 0 while no filter is installed)
+ */
 always_inline void
 cbs_dispatch_buffer (vlib_main_t * vm, vlib_node_runtime_t * node,
-                     cbs_main_t * cbsm, cbs_wheel_t * wp, vlib_buffer_t * b,
-                     u32 bi, cbs_node_ctx_t * ctx, u8 is_cross_connect)
+                     cbs_main_t * cbsm, vlib_buffer_t * b,
+                     u32 bi, cbs_node_ctx_t * ctx, u8 is_cross_connect,
+                     clib_bihash_kv_8_8_t * kv, u64 hash)
 {
+    cbs_interface_t *intf;
+    cbs_shaper_t *shaper;
+    cbs_wheel_t *wp = 0;
+    cbs_trace_action_t filter_action;
+    u32 wire_length, next_index;
+
+    // Determine shaper and the next node *after* the cbs-wheel node
+    intf = cbs_buffer_fwd_lookup(cbsm, b, is_cross_connect);
+
+    // Check if lookup failed (no interface state, no next node, or no wheel and none could be created)
+    if (PREDICT_FALSE(!intf || intf->output_next_index == (u32)~0 ||
+                      intf->shaper_index >= vec_len(ctx->ptd->wheel_by_shaper) ||
+                      (!(wp = ctx->ptd->wheel_by_shaper[intf->shaper_index]) &&
+                       !(wp = cbs_wheel_create(vm, ctx->ptd, intf->shaper_index))))) {
+        ctx->drop[0] = bi;
+        ctx->drop++;
+        ctx->n_lookup_drop++;
+        cbs_add_trace(vm, node, b, CBS_TRACE_ACTION_DROP_LOOKUP_FAIL, CBS_NEXT_DROP);
+        return;
+    }
+
+    // ip4/ip6-output arcs: leave through the next feature of the arc, not
+    // straight to the port, so output features after this one still apply
+    next_index = intf->output_next_index;
+    if (!is_cross_connect && PREDICT_FALSE(vnet_buffer(b)->feature_arc_index != cbsm->arc_index)) {
+        u32 feature_next;
+        vnet_feature_next(&feature_next, b);
+        if (PREDICT_FALSE(feature_next >= vec_len(cbsm->wheel_next_by_feature_next) ||
+                          (next_index = cbsm->wheel_next_by_feature_next[feature_next]) == ~0)) {
+            ctx->drop[0] = bi; // Feature added a moment ago: cbs-wheel has no next for it yet
+            ctx->drop++;
+            ctx->n_lookup_drop++;
+            cbs_add_trace(vm, node, b, CBS_TRACE_ACTION_DROP_LOOKUP_FAIL, CBS_NEXT_DROP);
+            return;
+        }
+    }
+
+    shaper = vec_elt_at_index(cbsm->shapers, wp->shaper_index);
+    wire_length = cbs_buffer_wire_length(vm, shaper, b); // Charged on dequeue (L1/L2 + GSO aware)
+
     // Check if wheel is full BEFORE trying to enqueue
     if (PREDICT_FALSE(wp->cursize >= wp->wheel_size)) {
         ctx->drop[0] = bi;
         ctx->drop++;
+        vlib_increment_combined_counter (&cbsm->counters[CBS_COUNTER_DROPPED], ctx->thread_index,
+                                         wp->shaper_index, 1, wire_length);
+        if (PREDICT_FALSE(!wp->is_dropping && wp->event_high_slots != ~0)) {
+            wp->is_dropping = 1;
+            cbs_wheel_post_event(ctx->ptd, wp, CBS_EVENT_DROPS_STARTED);
+        }
         // Use CBS_NEXT_DROP (0) as next_index for trace when dropping
         cbs_add_trace(vm, node, b, CBS_TRACE_ACTION_DROP_WHEEL_FULL, CBS_NEXT_DROP);
         return;
     }
 
-    // Proceed to enqueue
-    cbs_wheel_entry_t *e = &wp->entries[wp->tail];
-    u32 next_node_for_packet = (u32)~0; // Initialize next node index
-
-    // Determine the next node *after* the cbs-wheel node
-    cbs_buffer_fwd_lookup(cbsm, b, &next_node_for_packet, is_cross_connect);
-
-    // Check if lookup failed (returned ~0 or potentially DROP if modified)
-    if (PREDICT_FALSE(next_node_for_packet == (u32)~0 || next_node_for_packet == CBS_NEXT_DROP)) {
+    // Frames over their stream's reservation never take a slot from conforming ones;
+    // policed last, so the meter is only charged for frames that are enqueued
+    if (kv && PREDICT_FALSE((filter_action = cbs_stream_police(vm, cbsm, ctx, b, wp, kv, hash, wire_length)))) {
         ctx->drop[0] = bi;
         ctx->drop++;
-        cbs_add_trace(vm, node, b, CBS_TRACE_ACTION_DROP_LOOKUP_FAIL, CBS_NEXT_DROP);
+        vlib_increment_combined_counter (&cbsm->counters[CBS_COUNTER_DROPPED], ctx->thread_index,
+                                         wp->shaper_index, 1, wire_length);
+        cbs_add_trace(vm, node, b, filter_action, CBS_NEXT_DROP);
         return;
     }
 
     // Lookup successful, enqueue the packet info
-    e->output_next_index = next_node_for_packet; // Store the determined next node
+    cbs_wheel_entry_t *e = &wp->entries[wp->tail];
+    e->output_next_index = next_index; // Store the determined next node
+    e->hw_if_index = intf->hw_if_index;
+    e->tx_queue_id = intf->tx_queue_id;
     e->buffer_index = bi;
     e->rx_sw_if_index = vnet_buffer(b)->sw_if_index[VLIB_RX];
     e->tx_sw_if_index = vnet_buffer(b)->sw_if_index[VLIB_TX]; // TX index might have been updated by lookup
+    e->wire_length = wire_length;
+    e->enqueue_time = ctx->now;
+    if (shaper->eng.algo == CBS_ALGO_ATS)
+        e->eligible_time = cbs_engine_ats_eligibility(&shaper->eng, &wp->eng, e->rx_sw_if_index,
+                                                      e->wire_length, ctx->now);
 
     // Update wheel state
     wp->tail = (wp->tail + 1) % wp->wheel_size;
     wp->cursize++;
+    if (wp->active_index == ~0) // Was empty: cbs-wheel starts looking at it
+        cbs_active_insert(ctx->ptd, wp, ctx->now);
+    vlib_increment_combined_counter (&cbsm->counters[CBS_COUNTER_ENQUEUED], ctx->thread_index,
+                                     wp->shaper_index, 1, e->wire_length);
+
+    // Congestion events (event_high_slots is ~0 while events are off)
+    if (PREDICT_FALSE(wp->cursize >= wp->event_high_slots && !wp->is_above_high)) {
+        wp->is_above_high = 1;
+        cbs_wheel_post_event(ctx->ptd, wp, CBS_EVENT_HIGH_WATERMARK);
+    }
+    if (PREDICT_FALSE(wp->is_dropping)) {
+        wp->is_dropping = 0;
+        cbs_wheel_post_event(ctx->ptd, wp, CBS_EVENT_DROPS_STOPPED);
+    }
+    // Lossless cross-connect: stop polling this frame's RX port before the wheel can overflow
+    if (is_cross_connect && PREDICT_FALSE(cbsm->xc_lossless && wp->cursize >= wp->pause_high_slots))
+        cbs_wheel_pause_input(vm, ctx->ptd, wp, e->rx_sw_if_index);
     ctx->n_buffered++;
 
     // Add trace for buffering action
@@ -185,10 +290,11 @@ cbs_inline_fn (vlib_main_t * vm, vlib_node_runtime_t * node, vlib_frame_t * fram
 {
     cbs_main_t *cbsm = &cbs_main;
     u32 thread_index = vm->thread_index;
-    cbs_wheel_t *wp = NULL;
     u32 n_left_from, *from;
     vlib_buffer_t *bufs[VLIB_FRAME_SIZE], **b;
     u32 drops[VLIB_FRAME_SIZE];
+    clib_bihash_kv_8_8_t kv[4], *kvp;
+    u64 hash[4] = { 0 };
     cbs_node_ctx_t ctx;
 
     from = vlib_frame_vector_args (frame);
@@ -196,9 +302,9 @@ cbs_inline_fn (vlib_main_t * vm, vlib_node_runtime_t * node, vlib_frame_t * fram
     vlib_get_buffers (vm, from, bufs, n_left_from);
     b = bufs;
 
-    // Fallback: If not configured or no wheel for thread, forward directly
+    // Fallback: If not configured or no wheels for thread, forward directly
     // (Original CBS code had this fallback logic)
-    if (PREDICT_FALSE(!cbsm->is_configured || thread_index >= vec_len(cbsm->wheel_by_thread) || !(wp = cbsm->wheel_by_thread[thread_index]))) {
+    if (PREDICT_FALSE(!cbsm->is_configured || thread_index >= vec_len(cbsm->per_thread))) {
          // Try to get default next node from graph dispatch (less reliable without features)
          // Or simply drop if forwarding isn't straightforward.
          // Let's stick to the original CBS fallback logic: try to forward using graph node's default next[0]
@@ -220,6 +326,12 @@ cbs_inline_fn (vlib_main_t * vm, vlib_node_runtime_t * node, vlib_frame_t * fram
     // Initialize context for this frame
     ctx.drop = drops;
     ctx.n_buffered = 0;
+    ctx.n_lookup_drop = 0;
+    ctx.n_sdu_drop = 0;
+    ctx.n_meter_drop = 0;
+    ctx.now = vlib_time_now (vm);
+    ctx.ptd = vec_elt_at_index (cbsm->per_thread, thread_index);
+    ctx.thread_index = thread_index;
 
     // Process buffers in batches
     while (n_left_from >= 4) { // Process 4 buffers at a time
@@ -227,18 +339,33 @@ cbs_inline_fn (vlib_main_t * vm, vlib_node_runtime_t * node, vlib_frame_t * fram
         vlib_prefetch_buffer_header(b[0], STORE); vlib_prefetch_buffer_header(b[1], STORE);
         vlib_prefetch_buffer_header(b[2], STORE); vlib_prefetch_buffer_header(b[3], STORE);
 
+        // Stream filters: hash all four keys and prefetch their buckets before the first search
+        if (PREDICT_FALSE(cbsm->n_stream_filters)) {
+            cbs_buffer_stream_filter_hash (cbsm, b[0], &kv[0], &hash[0]);
+            cbs_buffer_stream_filter_hash (cbsm, b[1], &kv[1], &hash[1]);
+            cbs_buffer_stream_filter_hash (cbsm, b[2], &kv[2], &hash[2]);
+            cbs_buffer_stream_filter_hash (cbsm, b[3], &kv[3], &hash[3]);
+            kvp = kv;
+        } else
+            kvp = 0;
+
         // Dispatch each buffer
-        cbs_dispatch_buffer (vm, node, cbsm, wp, b[0], from[0], &ctx, is_cross_connect);
-        cbs_dispatch_buffer (vm, node, cbsm, wp, b[1], from[1], &ctx, is_cross_connect);
-        cbs_dispatch_buffer (vm, node, cbsm, wp, b[2], from[2], &ctx, is_cross_connect);
-        cbs_dispatch_buffer (vm, node, cbsm, wp, b[3], from[3], &ctx, is_cross_connect);
+        cbs_dispatch_buffer (vm, node, cbsm, b[0], from[0], &ctx, is_cross_connect, kvp, hash[0]);
+        cbs_dispatch_buffer (vm, node, cbsm, b[1], from[1], &ctx, is_cross_connect, kvp ? kvp + 1 : 0, hash[1]);
+        cbs_dispatch_buffer (vm, node, cbsm, b[2], from[2], &ctx, is_cross_connect, kvp ? kvp + 2 : 0, hash[2]);
+        cbs_dispatch_buffer (vm, node, cbsm, b[3], from[3], &ctx, is_cross_connect, kvp ? kvp + 3 : 0, hash[3]);
 
         // Move to next batch
         b += 4; from += 4; n_left_from -= 4;
     }
     // Process remaining buffers
     while (n_left_from > 0) {
-        cbs_dispatch_buffer (vm, node, cbsm, wp, b[0], from[0], &ctx, is_cross_connect);
+        kvp = 0;
+        if (PREDICT_FALSE(cbsm->n_stream_filters)) {
+            cbs_buffer_stream_filter_hash (cbsm, b[0], &kv[0], &hash[0]);
+            kvp = kv;
+        }
+        cbs_dispatch_buffer (vm, node, cbsm, b[0], from[0], &ctx, is_cross_connect, kvp, hash[0]);
         b += 1; from += 1; n_left_from -= 1;
     }
 
@@ -246,20 +373,17 @@ cbs_inline_fn (vlib_main_t * vm, vlib_node_runtime_t * node, vlib_frame_t * fram
     u32 n_dropped_total = ctx.drop - drops;
     if (PREDICT_FALSE(n_dropped_total > 0)) {
         vlib_buffer_free (vm, drops, n_dropped_total);
-        // Increment drop counters (distinguish wheel full vs lookup fail if needed)
-        // For simplicity now, just count total drops based on trace logic (which sets the action)
-        // This part needs refinement if precise drop reasons are counted here.
-        // Let's rely on the counters incremented within cbs_dispatch_buffer for reason.
-        // We might need separate counters if dispatch doesn't increment specific error types.
-        // Currently, dispatch trace distinguishes, but node fn only increments general drops.
-        // Let's increment based on the trace logic inside dispatch for accuracy.
-        // We need to count how many drops were wheel_full vs lookup_fail.
-        // Re-iterating drops to check trace type is inefficient.
-        // Let's increment a generic "DROP" counter here, and rely on specific counters
-        // potentially added inside cbs_dispatch_buffer if needed later.
-        // For now, just incrementing the DROPPED counter based on total drops.
-         vlib_node_increment_counter (vm, node->node_index, CBS_ERROR_DROPPED_WHEEL_FULL, n_dropped_total); // Simplified for now
-         // TODO: Refine drop counting based on reason stored during dispatch.
+        // Drop reasons are counted during dispatch: everything else hit a full wheel
+        u32 n_counted = ctx.n_lookup_drop + ctx.n_sdu_drop + ctx.n_meter_drop;
+        if (ctx.n_lookup_drop)
+            vlib_node_increment_counter (vm, node->node_index, CBS_ERROR_DROPPED_LOOKUP_FAIL, ctx.n_lookup_drop);
+        if (PREDICT_FALSE(ctx.n_sdu_drop))
+            vlib_node_increment_counter (vm, node->node_index, CBS_ERROR_DROPPED_STREAM_SDU, ctx.n_sdu_drop);
+        if (PREDICT_FALSE(ctx.n_meter_drop))
+            vlib_node_increment_counter (vm, node->node_index, CBS_ERROR_DROPPED_STREAM_METER, ctx.n_meter_drop);
+        if (n_dropped_total > n_counted)
+            vlib_node_increment_counter (vm, node->node_index, CBS_ERROR_DROPPED_WHEEL_FULL,
+                                         n_dropped_total - n_counted);
     }
 
    // Update buffered packet counter
@@ -309,6 +433,8 @@ format_cbs_trace (u8 * s, va_list * args)
       case CBS_TRACE_ACTION_BUFFER: action_str = "BUFFER"; break;
       case CBS_TRACE_ACTION_DROP_WHEEL_FULL: action_str = "DROP_WHEEL_FULL"; break;
       case CBS_TRACE_ACTION_DROP_LOOKUP_FAIL: action_str = "DROP_LOOKUP_FAIL"; break; // Added case
+      case CBS_TRACE_ACTION_DROP_STREAM_SDU: action_str = "DROP_STREAM_SDU"; break;
+      case CBS_TRACE_ACTION_DROP_STREAM_METER: action_str = "DROP_STREAM_METER"; break;
       default: break;
   }
 
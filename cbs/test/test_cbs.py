@@ -0,0 +1,281 @@
+#!/usr/bin/env python3
+"""CBS plugin end-to-end conformance and throughput tests
+
+Drives cbs-cross-connect and cbs-output-feature with pg interfaces and
+checks the shaped rate against idleslope, the burst against hicredit and
+the drops at wheel capacity, and measures forwarding Mpps. Every test
+class runs on 1 thread and again on N workers.
+
+Results are written as JSON, one file per test class, to the directory
+named by CBS_TEST_RESULTS (default: the test's temporary directory), so
+runs can be compared before an upgrade. Setting CBS_TEST_MIN_MPPS makes
+the throughput tests fail below that rate.
+"""
+
+import json
+import os
+import time
+import unittest
+
+from scapy.layers.inet import IP, UDP
+from scapy.layers.l2 import Ether
+from scapy.packet import Raw
+
+from framework import VppTestCase
+from asfframework import VppTestRunner
+
+# Mirrors cbs.h
+CBS_DEFAULT_PACKET_SIZE = 1500
+CBS_MIN_WHEEL_SLOTS = 2048
+
+RATE_TOLERANCE = 0.05  # Measured shaped rate within 5% of idleslope
+
+
+def wheel_slots(port_rate_bps, n_workers, packet_size=CBS_DEFAULT_PACKET_SIZE):
+    """Wheel slots per thread, as sized by cbs_shaper_prepare"""
+    total = max(int(port_rate_bps / 8 * 0.010), packet_size * 1024)
+    per_worker = total // n_workers if n_workers else total
+    per_worker = max(per_worker, packet_size * 256)
+    return max(per_worker // packet_size, CBS_MIN_WHEEL_SLOTS) + 1
+
+
+class TestCBS(VppTestCase):
+    """CBS shaping conformance and throughput, main thread only"""
+
+    vpp_worker_count = 0
+
+    @classmethod
+    def setUpClass(cls):
+        super(TestCBS, cls).setUpClass()
+        cls.create_pg_interfaces(range(4))
+        for i in cls.pg_interfaces:
+            i.admin_up()
+        cls.results = {"workers": cls.vpp_worker_count, "tests": {}}
+
+    @classmethod
+    def tearDownClass(cls):
+        outdir = os.getenv("CBS_TEST_RESULTS", cls.tempdir)
+        path = os.path.join(outdir, "cbs_results_%s.json" % cls.__name__)
+        with open(path, "w") as f:
+            json.dump(cls.results, f, indent=2, sort_keys=True)
+        cls.logger.info("CBS results written to %s" % path)
+        for i in cls.pg_interfaces:
+            i.admin_down()
+        super(TestCBS, cls).tearDownClass()
+
+    def record(self, name, **values):
+        self.results["tests"][name] = values
+        self.logger.info("%s: %s" % (name, json.dumps(values, sort_keys=True)))
+
+    def configure(self, port_rate, idleslope, hicredit, locredit):
+        self.vapi.cbs_configure(
+            shaper_id=0,
+            algorithm=0,  # CBS_API_ALGO_CBS
+            port_rate_bps=port_rate,
+            idleslope_kbps=idleslope // 1000,
+            hicredit_bytes=hicredit,
+            locredit_bytes=locredit,
+        )
+        # Counters survive a reconfiguration: each test starts from a new shaper.
+        # Cleanups run last in, first out, so the bindings go before this
+        # delete, which flushes whatever is still queued.
+        self.addCleanup(
+            self.vapi.cbs_shaper_add_del,
+            is_add=False,
+            n_shapers=1,
+            shapers=[{"shaper_id": 0}],
+        )
+
+    def shaper_stats(self):
+        return self.vapi.cbs_shaper_dump(shaper_id=0)[0]
+
+    def cross_connect(self):
+        self.vapi.cbs_cross_connect_enable_disable(
+            enable_disable=True,
+            sw_if_index0=self.pg0.sw_if_index,
+            sw_if_index1=self.pg1.sw_if_index,
+            shaper_id=0,
+        )
+        self.addCleanup(
+            self.vapi.cbs_cross_connect_enable_disable,
+            enable_disable=False,
+            sw_if_index0=self.pg0.sw_if_index,
+            sw_if_index1=self.pg1.sw_if_index,
+        )
+
+    def output_feature(self):
+        self.vapi.sw_interface_set_l2_xconnect(
+            self.pg2.sw_if_index, self.pg3.sw_if_index, enable=1
+        )
+        self.addCleanup(
+            self.vapi.sw_interface_set_l2_xconnect,
+            self.pg2.sw_if_index,
+            self.pg3.sw_if_index,
+            enable=0,
+        )
+        self.vapi.cbs_output_feature_enable_disable(
+            enable_disable=True, sw_if_index=self.pg3.sw_if_index, shaper_id=0
+        )
+        self.addCleanup(
+            self.vapi.cbs_output_feature_enable_disable,
+            enable_disable=False,
+            sw_if_index=self.pg3.sw_if_index,
+        )
+
+    def create_stream(self, src_if, dst_if, count, payload_len):
+        pkts = []
+        for i in range(count):
+            p = (
+                Ether(src=src_if.remote_mac, dst=dst_if.remote_mac)
+                / IP(src=src_if.remote_ip4, dst=dst_if.remote_ip4)
+                / UDP(sport=1234, dport=1234 + (i % 16))
+                / Raw(b"\xa5" * payload_len)
+            )
+            pkts.append(p)
+        return pkts
+
+    def send(self, src_if, pkts):
+        src_if.add_stream(pkts)
+        self.pg_enable_capture(self.pg_interfaces)
+        start = time.time()
+        self.pg_start()
+        return time.time() - start
+
+    @staticmethod
+    def shaped_rate(capture):
+        """Bytes/sec of a capture, the first frame starting the clock"""
+        elapsed = capture[-1].time - capture[0].time
+        return sum(len(p) for p in capture[1:]) / float(elapsed)
+
+    @staticmethod
+    def max_burst(capture, rate):
+        """Max bytes sent ahead of a line at @rate through the first frame"""
+        t0, sent, excess = capture[0].time, 0, 0.0
+        for p in capture:
+            sent += len(p)
+            excess = max(excess, sent - rate * float(p.time - t0))
+        return excess
+
+    def check_rate(self, name, src_if, dst_if):
+        port_rate, idleslope, n_pkts, payload = 1000000000, 20000000, 500, 1000
+        # 802.1Q annex L: hicredit for one interfering max size frame
+        hicredit = 1522 * idleslope // port_rate
+        locredit = -1522 * (port_rate - idleslope) // port_rate
+        self.configure(port_rate, idleslope, hicredit, locredit)
+        if src_if == self.pg0:
+            self.cross_connect()
+        else:
+            self.output_feature()
+
+        self.send(src_if, self.create_stream(src_if, dst_if, n_pkts, payload))
+        expected_duration = n_pkts * (payload + 42) * 8.0 / idleslope
+        capture = dst_if.get_capture(n_pkts, timeout=expected_duration * 2 + 5)
+
+        rate = self.shaped_rate(capture)
+        frame_len = max(len(p) for p in capture)
+        # Idle queue: credit starts at zero and can only build up to hicredit
+        burst = self.max_burst(capture, idleslope / 8.0) - frame_len
+        stats = self.shaper_stats()
+        self.record(
+            name,
+            idleslope_bps=idleslope,
+            rate_bps=rate * 8,
+            rate_error=rate * 8 / idleslope - 1,
+            burst_bytes=burst,
+            hicredit_bytes=hicredit,
+            transmitted=stats.transmitted_packets,
+        )
+        self.assertEqual(stats.dropped_packets, 0)
+        self.assertEqual(stats.transmitted_packets, n_pkts)
+        self.assertAlmostEqual(rate * 8 / idleslope, 1.0, delta=RATE_TOLERANCE)
+        self.assertLessEqual(burst, hicredit + frame_len)
+
+    def check_mpps(self, name, pairs, n_pkts):
+        port_rate = 100000000000
+        self.configure(port_rate, port_rate, 100000, -100000)
+        self.cross_connect()
+
+        for src_if, dst_if in pairs:
+            src_if.add_stream(self.create_stream(src_if, dst_if, n_pkts, 18))
+        self.pg_enable_capture(self.pg_interfaces)
+        self.pg_start()
+        captures = [dst_if.get_capture(n_pkts) for _, dst_if in pairs]
+
+        start = min(c[0].time for c in captures)
+        end = max(c[-1].time for c in captures)
+        mpps = len(pairs) * (n_pkts - 1) / float(end - start) / 1e6
+        self.record(
+            name,
+            mpps=mpps,
+            directions=len(pairs),
+            packets=len(pairs) * n_pkts,
+            mpps_per_thread=mpps / max(self.vpp_worker_count, 1),
+        )
+        self.assertEqual(self.shaper_stats().dropped_packets, 0)
+        min_mpps = float(os.getenv("CBS_TEST_MIN_MPPS", "0"))
+        self.assertGreaterEqual(mpps, min_mpps)
+
+    def test_cbs_engine(self):
+        """Engine conformance on the virtual clock"""
+        reply = self.vapi.cli("test cbs engine conformance")
+        self.logger.info(reply)
+        self.record(
+            "engine_conformance", failures=reply.count("FAIL"), output=reply
+        )
+        self.assertNotIn("FAIL", reply)
+
+    def test_cross_connect_rate(self):
+        """Cross-connect: shaped rate and burst against idleslope and hicredit"""
+        self.check_rate("cross_connect_rate", self.pg0, self.pg1)
+
+    def test_output_feature_rate(self):
+        """Output feature: shaped rate and burst against idleslope and hicredit"""
+        self.check_rate("output_feature_rate", self.pg2, self.pg3)
+
+    def test_drops_at_capacity(self):
+        """Frames beyond the wheel's capacity are dropped and counted"""
+        port_rate, idleslope, payload = 100000000, 1000000, 1000
+        slots = wheel_slots(port_rate, self.vpp_worker_count)
+        n_pkts = slots + 1000
+        self.configure(port_rate, idleslope, 1522, -1522)
+        self.cross_connect()
+
+        elapsed = self.send(
+            self.pg0, self.create_stream(self.pg0, self.pg1, n_pkts, payload)
+        )
+        stats = self.shaper_stats()
+        # Frames that left while the stream was still arriving freed slots
+        drained = int(idleslope / 8.0 * elapsed / (payload + 42)) + 1
+        self.record(
+            "drops_at_capacity",
+            wheel_slots=slots,
+            sent=n_pkts,
+            enqueued=stats.enqueued_packets,
+            dropped=stats.dropped_packets,
+            drained_bound=drained,
+        )
+        self.assertEqual(stats.enqueued_packets + stats.dropped_packets, n_pkts)
+        self.assertLessEqual(stats.enqueued_packets, slots + drained)
+        self.assertGreaterEqual(stats.dropped_packets, n_pkts - slots - drained)
+
+    def test_mpps_one_direction(self):
+        """Unthrottled forwarding rate, one direction"""
+        self.check_mpps("mpps_one_direction", [(self.pg0, self.pg1)], 10000)
+
+    def test_mpps_both_directions(self):
+        """Unthrottled forwarding rate, both directions (RX spread over the workers)"""
+        self.check_mpps(
+            "mpps_both_directions",
+            [(self.pg0, self.pg1), (self.pg1, self.pg0)],
+            10000,
+        )
+
+
+class TestCBSWorkers(TestCBS):
+    """CBS shaping conformance and throughput, 2 workers"""
+
+    vpp_worker_count = 2
+
+
+if __name__ == "__main__":
+    unittest.main(testRunner=VppTestRunner)